@@ -0,0 +1,198 @@
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include <account_table.hpp>
+#include <bank.hpp>
+#include <seqlock.hpp>
+
+using namespace banking;
+
+namespace {
+
+  const std::size_t NUM_ACCOUNTS = 10000000;
+
+  const std::size_t NUM_NAMES = 100000;
+
+  std::size_t residentBytes() {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+      if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+      fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  /**
+   * Shape of the accounts before the table: a make_shared object per account
+   * with its own name and seqlocked balance, cards holding shared pointers
+   */
+  struct PointerStore {
+    struct Balance {
+      int money_;
+      int cut_money_;
+      uint64_t epoch_;
+    };
+
+    struct Account {
+      Account(long id, const std::string &name, int amount) :
+        id_(id), name_(name), money_(Balance{amount, 0, 0}) {}
+
+      long id_;
+      std::string name_;
+      SeqLock<Balance> money_;
+    };
+
+    std::vector<std::vector<std::shared_ptr<Account>>> cards_;
+
+    void add(long card, long id, const std::string &name, int amount) {
+      if (cards_.size() <= static_cast<std::size_t>(card))
+        cards_.resize(card + 1);
+      cards_[card].push_back(std::make_shared<Account>(id, name, amount));
+    }
+
+    int64_t cardBalance(std::size_t card) const {
+      int64_t total = 0;
+      for (const auto &account : cards_[card])
+        total += account->money_.read().money_;
+      return total;
+    }
+  };
+
+  /**
+   * Structure of arrays table, cards holding inline lists of positions
+   */
+  struct TableStore {
+    AccountTable accounts_;
+    std::vector<AccountIndexList> cards_;
+
+    void add(long card, long id, const std::string &name, int amount) {
+      if (cards_.size() <= static_cast<std::size_t>(card))
+        cards_.resize(card + 1);
+      cards_[card].push_back(accounts_.create(id, name, amount));
+    }
+
+    int64_t cardBalance(std::size_t card) const {
+      int64_t total = 0;
+      for (const auto &index : cards_[card])
+        total += accounts_.balance(index);
+      return total;
+    }
+  };
+
+  /**
+   * The table in the bank's own card map, as BasicBank<MutexLockPolicy,
+   * OrderedStorage> holds it: a locked map from card number to the card and
+   * its account positions, copied out under the lock on every lookup
+   */
+  struct BankCardMapStore {
+    using card_map_t =
+      MutexLockPolicy::table_type<OrderedStorage::map_type<long, account_card_pair_t>>;
+
+    AccountTable accounts_;
+    mutable card_map_t card_map_;
+    std::vector<long> cards_;
+
+    void add(long card, long id, const std::string &name, int amount) {
+      account_card_pair_t account_card_pair;
+      bool found = card_map_.find(card, account_card_pair);
+      if (!found)
+        account_card_pair.first = std::make_shared<Card>(card);
+      account_card_pair.second.push_back(accounts_.create(id, name, amount));
+      if (found) {
+        card_map_.change(card, account_card_pair);
+      } else {
+        card_map_.add(card, account_card_pair);
+        cards_.push_back(card);
+      }
+    }
+
+    int64_t cardBalance(std::size_t card) const {
+      account_card_pair_t account_card_pair;
+      if (!card_map_.find(cards_[card], account_card_pair))
+        return 0;
+      int64_t total = 0;
+      for (const auto &index : account_card_pair.second)
+        total += accounts_.balance(index);
+      return total;
+    }
+  };
+
+  template <typename Store>
+    Store& store(std::size_t *bytes = nullptr) {
+      static std::size_t built_bytes = 0;
+      static Store *built = nullptr;
+      if (!built) {
+        std::size_t before = residentBytes();
+        built = new Store;
+        std::mt19937 mt(7);
+        std::uniform_int_distribution<int> accounts_dst(1, 9);
+        std::vector<std::string> names;
+        for (std::size_t i = 0; i < NUM_NAMES; i++)
+          names.push_back("holder " + std::to_string(i));
+        std::size_t id = 0;
+        for (long card = 0; id < NUM_ACCOUNTS; card++) {
+          for (int i = accounts_dst(mt); i > 0 && id < NUM_ACCOUNTS; i--, id++)
+            built->add(card, id, names[id % NUM_NAMES], id % 1000);
+        }
+        built_bytes = residentBytes() - before;
+      }
+      if (bytes)
+        *bytes = built_bytes;
+      return *built;
+    }
+
+  template <typename Store>
+    void BM_BuildAccounts(benchmark::State &state) {
+      std::size_t bytes = 0;
+      for (auto _ : state)
+        benchmark::DoNotOptimize(&store<Store>(&bytes));
+      state.counters["bytes_per_account"] = static_cast<double>(bytes) / NUM_ACCOUNTS;
+    }
+
+  /**
+   * Random card lookups summing the balances of its accounts, bound by the
+   * cache misses taken to reach each balance
+   */
+  template <typename Store>
+    void BM_RandomCardBalance(benchmark::State &state) {
+      const Store &accounts = store<Store>();
+      std::mt19937 mt(11);
+      std::uniform_int_distribution<std::size_t> card_dst(0, accounts.cards_.size() - 1);
+      for (auto _ : state)
+        benchmark::DoNotOptimize(accounts.cardBalance(card_dst(mt)));
+      state.SetItemsProcessed(state.iterations());
+    }
+
+  template <typename Store>
+    void BM_ScanBalances(benchmark::State &state) {
+      const Store &accounts = store<Store>();
+      for (auto _ : state) {
+        int64_t total = 0;
+        for (std::size_t card = 0; card < accounts.cards_.size(); card++)
+          total += accounts.cardBalance(card);
+        benchmark::DoNotOptimize(total);
+      }
+      state.SetItemsProcessed(state.iterations() * NUM_ACCOUNTS);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_BuildAccounts, PointerStore)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_RandomCardBalance, PointerStore);
+BENCHMARK_TEMPLATE(BM_ScanBalances, PointerStore)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_BuildAccounts, TableStore)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_RandomCardBalance, TableStore);
+BENCHMARK_TEMPLATE(BM_ScanBalances, TableStore)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_BuildAccounts, BankCardMapStore)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_RandomCardBalance, BankCardMapStore);
+BENCHMARK_TEMPLATE(BM_ScanBalances, BankCardMapStore)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+
+#include <audit_archive.hpp>
+
+using namespace banking;
+
+namespace {
+
+  const std::string ARCHIVE_PATH = "/tmp/atm_audit_bench.archive";
+  const uint64_t DAY_NS = 24ull * 3600 * 1000000000;
+  const uint64_t SPAN_NS = 30 * DAY_NS;
+  const uint64_t START_NS = 1700000000000000000ull;
+  const long ACCOUNTS = 1000000;
+  const int ATMS = 2000;
+
+  /**
+   * @brief Records to archive, ATM_AUDIT_BENCH_RECORDS overrides the 100M
+   *
+   */
+  uint64_t benchRecords() {
+    const char *records = std::getenv("ATM_AUDIT_BENCH_RECORDS");
+    return records ? std::strtoull(records, nullptr, 10) : 100000000;
+  }
+
+  /**
+   * @brief Record n of a month of traffic over ATMS atms and ACCOUNTS accounts
+   *
+   */
+  AuditRecord syntheticRecord(uint64_t n, uint64_t records, uint64_t &random) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    AuditRecord record;
+    record.time_ns_ = START_NS + n * (SPAN_NS / records) + random % 1000000;
+    record.atm_id_ = random % ATMS;
+    record.account_id_ = (random >> 16) % ACCOUNTS;
+    record.card_no_ = 100000000 + record.account_id_ / 3;
+    record.type_ = static_cast<TransactionType>((random >> 40) % 3);
+    record.amount_ = record.type_ == CHECK_BALANCE ? (random >> 8) % 100000 : ((random >> 44) % 50 + 1) * 20;
+    record.ok_ = (random >> 50) % 64;
+    return record;
+  }
+
+  /**
+   * Archive the records once, reporting the archive and the text log sizes
+   * per record. The text line is what glog would carry besides its prefix.
+   */
+  void BM_WriteArchive(benchmark::State &state) {
+    uint64_t records = benchRecords();
+    uint64_t text_bytes = 0;
+    uint64_t archive_bytes = 0;
+    for (auto _ : state) {
+      // Opening carries an existing archive on, start from nothing
+      std::remove(ARCHIVE_PATH.c_str());
+      AuditArchiveWriter writer;
+      writer.open(ARCHIVE_PATH);
+      uint64_t random = 88172645463325252ull;
+      char line[128];
+      for (uint64_t n = 0; n < records; n++) {
+        AuditRecord record = syntheticRecord(n, records, random);
+        writer.append(record);
+        if (n % 1024 == 0)
+          text_bytes += std::snprintf(line, sizeof(line), "%lu %d %ld %ld %d %d %d\n",
+              record.time_ns_, record.atm_id_, record.card_no_, record.account_id_,
+              record.type_, record.amount_, record.ok_) * 1024;
+      }
+      writer.close();
+      archive_bytes = writer.bytes();
+    }
+    state.SetItemsProcessed(state.iterations() * records);
+    state.counters["bytes_per_record"] = static_cast<double>(archive_bytes) / records;
+    state.counters["text_ratio"] = static_cast<double>(text_bytes) / archive_bytes;
+    state.counters["archive_MB"] = archive_bytes / 1e6;
+  }
+
+  void reportScan(benchmark::State &state, const AuditScanStats &stats) {
+    state.counters["blocks"] = stats.blocks_;
+    state.counters["blocks_read"] = stats.blocks_read_;
+    state.counters["MB_read"] = stats.bytes_read_ / 1e6;
+    state.counters["matched"] = stats.records_matched_;
+    state.counters["scanned"] = benchmark::Counter(stats.records_scanned_ * state.iterations(),
+        benchmark::Counter::kIsRate);
+  }
+
+  /**
+   * All withdrawals of an account over the last week of the archive
+   */
+  void BM_AccountWithdrawalsLastWeek(benchmark::State &state) {
+    AuditArchiveReader reader;
+    if (!reader.open(ARCHIVE_PATH)) {
+      state.SkipWithError("No archive");
+      return;
+    }
+    AuditQuery query;
+    query.account_id_ = 4242;
+    query.type_ = WITHDRAW;
+    query.from_ns_ = START_NS + SPAN_NS - 7 * DAY_NS;
+    AuditScanStats stats;
+    int64_t withdrawn = 0;
+    for (auto _ : state) {
+      stats = reader.scan(query, [&withdrawn](const AuditRecord &record) { withdrawn += record.amount_; });
+      benchmark::DoNotOptimize(withdrawn);
+    }
+    reportScan(state, stats);
+  }
+
+  /**
+   * Deposit and withdraw totals per atm over the whole archive, run for a
+   * fixed count as it removes the archive
+   */
+  void BM_TotalsByAtm(benchmark::State &state) {
+    AuditArchiveReader reader;
+    if (!reader.open(ARCHIVE_PATH)) {
+      state.SkipWithError("No archive");
+      return;
+    }
+    AuditScanStats stats;
+    for (auto _ : state) {
+      std::map<int, ActivityTotals> totals;
+      stats = reader.totalsByAtm(AuditQuery(), totals);
+      benchmark::DoNotOptimize(totals);
+    }
+    reportScan(state, stats);
+    std::remove(ARCHIVE_PATH.c_str());
+  }
+}
+
+BENCHMARK(BM_WriteArchive)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AccountWithdrawalsLastWeek)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_TotalsByAtm)->Iterations(3)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,97 @@
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+
+using namespace banking;
+
+namespace {
+
+  /**
+   * @brief Card and account used by one benchmark thread, created once per bank
+   *
+   * @return false with error set if the bank refused to open it
+   */
+  template <typename BankT>
+    bool threadAccount(int thread_index, std::pair<long, long> &account, std::string &error) {
+      static std::mutex mtx;
+      static std::map<int, std::pair<long, long>> accounts;
+      std::lock_guard<std::mutex> lck(mtx);
+      auto it = accounts.find(thread_index);
+      if (it != accounts.end()) {
+        account = it->second;
+        return true;
+      }
+
+      BankT *bank = BankT::getBank();
+      try {
+        long card_no = bank->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000);
+        std::vector<long> account_no;
+        if (card_no < 0 || !bank->listAccounts(card_no, account_no) || account_no.empty()) {
+          error = "no account for thread " + std::to_string(thread_index);
+          return false;
+        }
+        account = accounts[thread_index] = std::make_pair(card_no, account_no[0]);
+        return true;
+      } catch (std::exception &e) {
+        error = e.what();
+        return false;
+      }
+    }
+
+  /**
+   * Full customer sessions, nine balance checks for every deposit
+   *
+   * Only the table and id pool locks differ between the policies, the account
+   * table, read path, holds, admission and snapshot epoch are the same
+   * synchronized components in every bank, so there is no single threaded
+   * case here: NoLockPolicy would only show the table locks it leaves out.
+   */
+  template <typename BankT>
+    void BM_Session(benchmark::State &state) {
+      BankT *bank = BankT::getBank();
+      std::pair<long, long> account;
+      std::string error;
+      if (!threadAccount<BankT>(state.thread_index(), account, error)) {
+        state.SkipWithError(error.c_str());
+        return;
+      }
+      atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+      int64_t sessions = 0;
+
+      for (auto _ : state) {
+        try {
+          int token = bank->verifyAndCreateTransaction(account.first, 8888);
+          if (token < 0) {
+            state.SkipWithError("wrong pin");
+            break;
+          }
+          bank->acknowledgeTransaction(token, atm_cb);
+          bank->selectAccount(token, account.second);
+          TransactionType trans_type = (sessions % 10) ? CHECK_BALANCE : DEPOSIT;
+          bank->performTransaction(token, trans_type, 1);
+        } catch (std::exception &e) {
+          state.SkipWithError(e.what());
+          break;
+        }
+        sessions++;
+      }
+      state.SetItemsProcessed(sessions);
+    }
+
+  using MutexOrdered = BasicBank<MutexLockPolicy, OrderedStorage>;
+  using MutexFlatHash = BasicBank<MutexLockPolicy, FlatHashStorage>;
+  using ShardedOrdered = BasicBank<ShardedLockPolicy<BANK_SHARDS>, OrderedStorage>;
+  using ShardedFlatHash = BasicBank<ShardedLockPolicy<BANK_SHARDS>, FlatHashStorage>;
+}
+
+BENCHMARK_TEMPLATE(BM_Session, MutexOrdered)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Session, MutexFlatHash)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Session, ShardedOrdered)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Session, ShardedFlatHash)->ThreadRange(1, 32)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <batch_job.hpp>
+
+using namespace banking;
+
+namespace {
+
+  // Leaves account ids over for the benchmark threads
+  const int BATCH_ACCOUNTS = ACCOUNTS_CARDS_UL - 100;
+
+  /**
+   * @brief Card and account used by one benchmark thread, created once per bank
+   *
+   */
+  std::pair<long, long> threadAccount(int thread_index) {
+    static std::mutex mtx;
+    static std::map<int, std::pair<long, long>> accounts;
+    std::lock_guard<std::mutex> lck(mtx);
+    auto it = accounts.find(thread_index);
+    if (it != accounts.end())
+      return it->second;
+
+    Bank *bank = Bank::getBank();
+    long card_no = -1;
+    while (card_no < 0) {
+      try {
+        card_no = bank->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000000);
+      } catch (std::exception&) {
+      }
+    }
+    std::vector<long> account_no;
+    bank->listAccounts(card_no, account_no);
+    accounts[thread_index] = std::make_pair(card_no, account_no[0]);
+    return accounts[thread_index];
+  }
+
+  /**
+   * @brief Fill the bank with accounts for the batch jobs to go over
+   *
+   */
+  void fillBank() {
+    static std::once_flag filled;
+    std::call_once(filled, []() {
+      Bank *bank = Bank::getBank();
+      long card_no = bank->createAndLinkAccount("batch", 1000000);
+      for (int i = 1; i < BATCH_ACCOUNTS; i++)
+        bank->createAndLinkAccount("batch", 1000000, card_no);
+    });
+  }
+
+  /**
+   * Deposit sessions while batch jobs pass over every account back to back:
+   * no job (range 0), jobs as fast as they go (range 1), and jobs held to a
+   * transaction p99 budget of the second range in microseconds (range 2).
+   */
+  void BM_SessionsUnderBatchJob(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    fillBank();
+    std::pair<long, long> account = threadAccount(state.thread_index());
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+
+    static std::atomic<bool> jobs_running;
+    static std::atomic<uint64_t> adjusted, throttled;
+    static std::thread driver;
+    static uint64_t next_job_id = 1;
+    if (state.thread_index() == 0 && state.range(0)) {
+      adjusted = 0;
+      throttled = 0;
+      jobs_running = true;
+      BatchJobConfig config;
+      config.threads_ = 2;
+      config.chunk_size_ = 64;
+      if (state.range(0) == 2)
+        config.latency_budget_ = std::chrono::microseconds(state.range(1));
+      driver = std::thread([bank, config]() mutable {
+        while (jobs_running.load()) {
+          config.job_id_ = next_job_id++;
+          std::unique_ptr<BatchJob> job = bank->startBatchJob(config, [](long, int) { return 1; });
+          while (!job->wait(std::chrono::milliseconds(10)) && jobs_running.load())
+            ;
+          job->stop();
+          adjusted += job->progress().applied_;
+          throttled += job->progress().throttled_;
+        }
+      });
+    }
+
+    std::vector<int64_t> latencies;
+    latencies.reserve(1 << 16);
+    for (auto _ : state) {
+      auto begin = std::chrono::steady_clock::now();
+      try {
+        TransactionType trans_type = DEPOSIT;
+        int token = bank->verifyAndCreateTransaction(account.first, 8888);
+        bank->acknowledgeTransaction(token, atm_cb);
+        bank->selectAccount(token, account.second);
+        bank->performTransaction(token, trans_type, 1);
+      } catch (std::exception&) {
+      }
+      latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    if (!latencies.empty()) {
+      std::size_t rank = latencies.size() * 99 / 100;
+      std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+      state.counters["p99_us"] = latencies[rank] / 1000.0;
+    }
+    if (state.thread_index() == 0 && state.range(0)) {
+      jobs_running = false;
+      driver.join();
+      state.counters["adjusted"] = benchmark::Counter(adjusted.load(), benchmark::Counter::kIsRate);
+      state.counters["throttled"] = throttled.load();
+    }
+  }
+}
+
+BENCHMARK(BM_SessionsUnderBatchJob)->Args({0, 0})->Args({1, 0})->Args({2, 20})->Args({2, 1})->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,146 @@
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <partitioned_bank.hpp>
+
+using namespace banking;
+
+namespace {
+
+  const TransactionType MIX[] = {CHECK_BALANCE, DEPOSIT, CHECK_BALANCE, WITHDRAW};
+
+  /**
+   * @brief Card and account of the shared lock bank used by one benchmark
+   *        thread, created once per bank
+   *
+   */
+  std::pair<long, long> threadAccount(int thread_index) {
+    static std::mutex mtx;
+    static std::map<int, std::pair<long, long>> accounts;
+    std::lock_guard<std::mutex> lck(mtx);
+    auto it = accounts.find(thread_index);
+    if (it != accounts.end())
+      return it->second;
+
+    Bank *bank = Bank::getBank();
+    long card_no = -1;
+    while (card_no < 0) {
+      try {
+        card_no = bank->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000000);
+      } catch (std::exception&) {
+      }
+    }
+    std::vector<long> account_no;
+    bank->listAccounts(card_no, account_no);
+    accounts[thread_index] = std::make_pair(card_no, account_no[0]);
+    return accounts[thread_index];
+  }
+
+  /**
+   * struct ThreadPort - Port, card and account of the partitioned bank used
+   *                     by one benchmark thread
+   */
+  struct ThreadPort {
+    AtmPort *port_;
+    long card_no_;
+    long account_no_;
+  };
+
+  /**
+   * @brief Port of a benchmark thread on a partitioned bank with one worker
+   *        per benchmark thread, the bank is replaced when the thread count
+   *        changes
+   *
+   */
+  ThreadPort threadPort(int threads, int thread_index) {
+    static std::mutex mtx;
+    static std::unique_ptr<PartitionedBank> bank;
+    static std::vector<std::unique_ptr<AtmPort>> ports;
+    static std::map<int, ThreadPort> thread_ports;
+    std::lock_guard<std::mutex> lck(mtx);
+    if (!bank || bank->workers() != static_cast<std::size_t>(threads)) {
+      thread_ports.clear();
+      ports.clear();
+      bank.reset();
+      bank.reset(new PartitionedBank(threads, threads));
+    }
+    auto it = thread_ports.find(thread_index);
+    if (it != thread_ports.end())
+      return it->second;
+
+    ports.push_back(bank->connect());
+    ThreadPort port{ports.back().get(), -1, -1};
+    port.card_no_ = port.port_->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000000);
+    std::vector<long> account_no;
+    port.port_->listAccounts(port.card_no_, account_no);
+    port.account_no_ = account_no[0];
+    thread_ports[thread_index] = port;
+    return port;
+  }
+
+  /**
+   * Balance, deposit, balance, withdraw sessions on the bank every atm
+   * shares through its mutexes
+   */
+  void BM_SharedLockBank(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::pair<long, long> account = threadAccount(state.thread_index());
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    int64_t failed = 0;
+    unsigned n = 0;
+
+    for (auto _ : state) {
+      try {
+        TransactionType trans_type = MIX[n++ % 4];
+        int token = bank->verifyAndCreateTransaction(account.first, 8888);
+        bank->acknowledgeTransaction(token, atm_cb);
+        bank->selectAccount(token, account.second);
+        bank->performTransaction(token, trans_type, 1);
+      } catch (std::exception&) {
+        failed++;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["failed"] = failed;
+  }
+
+  /**
+   * The same sessions on a partitioned bank with a core pinned worker per
+   * benchmark thread. Only the settles and session ends are pipelined, the
+   * other calls are round trips, so this tells whether the partitioning pays
+   * off on the machine at hand rather than assuming it does
+   */
+  void BM_PartitionedBank(benchmark::State &state) {
+    ThreadPort port = threadPort(state.threads(), state.thread_index());
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    int64_t failed = 0;
+    unsigned n = 0;
+
+    for (auto _ : state) {
+      try {
+        TransactionType trans_type = MIX[n++ % 4];
+        int token = port.port_->verifyAndCreateTransaction(port.card_no_, 8888);
+        port.port_->acknowledgeTransaction(token, atm_cb);
+        port.port_->selectAccount(token, port.account_no_);
+        port.port_->performTransaction(token, trans_type, 1);
+      } catch (std::exception&) {
+        failed++;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["failed"] = failed;
+  }
+
+  int cores() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+BENCHMARK(BM_SharedLockBank)->DenseThreadRange(1, cores())->UseRealTime();
+BENCHMARK(BM_PartitionedBank)->DenseThreadRange(1, cores())->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,243 @@
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <rcu.hpp>
+#include <seqlock.hpp>
+
+using namespace banking;
+
+namespace {
+
+  const int NUM_ACCOUNTS = 64;
+
+  const int READ_PERCENT = 90;
+
+  /**
+   * Shape of the original CHECK_BALANCE path: a locked map lookup followed by
+   * reading a balance that writers modify under the same kind of lock
+   */
+  struct LockedStore {
+    std::mutex map_mutex_;
+    std::map<long, std::shared_ptr<std::pair<std::mutex, int>>> balances_;
+
+    LockedStore() {
+      for (long id = 0; id < NUM_ACCOUNTS; id++)
+        balances_[id] = std::make_shared<std::pair<std::mutex, int>>();
+    }
+
+    int read(long id) {
+      std::shared_ptr<std::pair<std::mutex, int>> balance;
+      {
+        std::lock_guard<std::mutex> lck(map_mutex_);
+        balance = balances_.find(id)->second;
+      }
+      std::lock_guard<std::mutex> lck(balance->first);
+      return balance->second;
+    }
+
+    void deposit(long id, int amount) {
+      std::shared_ptr<std::pair<std::mutex, int>> balance;
+      {
+        std::lock_guard<std::mutex> lck(map_mutex_);
+        balance = balances_.find(id)->second;
+      }
+      std::lock_guard<std::mutex> lck(balance->first);
+      balance->second += amount;
+    }
+  };
+
+  /**
+   * Read optimized path: RCU lookup of the account and a seqlock balance read
+   */
+  struct VersionedStore {
+    struct AccountView {
+      std::shared_ptr<SeqLock<int>> balance_;
+    };
+
+    RcuTable<AccountView> accounts_;
+
+    VersionedStore() : accounts_(NUM_ACCOUNTS) {
+      for (long id = 0; id < NUM_ACCOUNTS; id++) {
+        accounts_.publish(id, std::unique_ptr<const AccountView>(
+              new AccountView{std::make_shared<SeqLock<int>>(0)}));
+      }
+    }
+
+    int read(long id) {
+      RcuTable<AccountView>::ReadGuard guard(accounts_);
+      return guard.get(id)->balance_->read();
+    }
+
+    void deposit(long id, int amount) {
+      RcuTable<AccountView>::ReadGuard guard(accounts_);
+      guard.get(id)->balance_->write([amount](int &money) {
+        money += amount;
+        return true;
+      });
+    }
+  };
+
+  template <typename Store>
+    void BM_ReadWriteMix(benchmark::State &state) {
+      static Store store;
+      std::mt19937 mt(state.thread_index());
+      std::uniform_int_distribution<long> account_dst(0, NUM_ACCOUNTS - 1);
+      std::uniform_int_distribution<int> op_dst(0, 99);
+
+      for (auto _ : state) {
+        long id = account_dst(mt);
+        if (op_dst(mt) < READ_PERCENT)
+          benchmark::DoNotOptimize(store.read(id));
+        else
+          store.deposit(id, 1);
+      }
+      state.SetItemsProcessed(state.iterations());
+    }
+
+  /**
+   * struct ThreadCards - Card read by one benchmark thread and card it
+   *                      deposits on, with their accounts
+   */
+  struct ThreadCards {
+    long read_card_, read_account_;
+    long write_card_, write_account_;
+  };
+
+  /**
+   * @brief Cards of a benchmark thread on the Bank, created once
+   *
+   */
+  ThreadCards threadCards(int thread_index) {
+    static std::mutex mtx;
+    static std::map<int, ThreadCards> cards;
+    std::lock_guard<std::mutex> lck(mtx);
+    auto it = cards.find(thread_index);
+    if (it != cards.end())
+      return it->second;
+
+    Bank *bank = Bank::getBank();
+    ThreadCards thread_cards;
+    std::vector<long> account_no;
+    thread_cards.read_card_ = bank->createAndLinkAccount("reader" + std::to_string(thread_index), 1000);
+    bank->listAccounts(thread_cards.read_card_, account_no);
+    thread_cards.read_account_ = account_no.back();
+    thread_cards.write_card_ = bank->createAndLinkAccount("writer" + std::to_string(thread_index), 1000);
+    bank->listAccounts(thread_cards.write_card_, account_no);
+    thread_cards.write_account_ = account_no.back();
+    cards[thread_index] = thread_cards;
+    return thread_cards;
+  }
+
+  /**
+   * @brief Open a session on a card with its account selected
+   *
+   */
+  int openSession(Bank *bank, long card_no, long account_no) {
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    int token = bank->verifyAndCreateTransaction(card_no, 8888);
+    bank->acknowledgeTransaction(token, atm_cb);
+    bank->selectAccount(token, account_no);
+    return token;
+  }
+
+  /**
+   * Balance of an open session, the lock free read path of the Bank. Mixed,
+   * READ_PERCENT of the calls are reads and the rest deposit sessions on
+   * another card of the thread
+   */
+  template <bool Mixed>
+    void BM_BankCheckBalance(benchmark::State &state) {
+      Bank *bank = Bank::getBank();
+      ThreadCards cards;
+      int token;
+      try {
+        cards = threadCards(state.thread_index());
+        token = openSession(bank, cards.read_card_, cards.read_account_);
+      } catch (std::exception &ex) {
+        state.SkipWithError(ex.what());
+        return;
+      }
+      std::mt19937 mt(state.thread_index());
+      std::uniform_int_distribution<int> op_dst(0, 99);
+
+      try {
+        for (auto _ : state) {
+          int amount;
+          if (Mixed && op_dst(mt) >= READ_PERCENT) {
+            TransactionType trans_type = DEPOSIT;
+            bank->performTransaction(openSession(bank, cards.write_card_, cards.write_account_),
+                trans_type, 1);
+          } else if (!bank->checkBalance(token, amount)) {
+            state.SkipWithError("Session lost its account");
+            break;
+          }
+        }
+      } catch (std::exception &ex) {
+        state.SkipWithError(ex.what());
+      }
+      TransactionType trans_type = CHECK_BALANCE;
+      bank->performTransaction(token, trans_type, 0);
+      state.SetItemsProcessed(state.iterations());
+    }
+
+  /**
+   * Accounts of a card, read from its snapshot
+   */
+  void BM_BankListAccounts(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    ThreadCards cards;
+    try {
+      cards = threadCards(state.thread_index());
+    } catch (std::exception &ex) {
+      state.SkipWithError(ex.what());
+      return;
+    }
+    std::vector<long> account_no;
+    for (auto _ : state) {
+      account_no.clear();
+      if (!bank->listAccounts(cards.read_card_, account_no)) {
+        state.SkipWithError("Card lost");
+        break;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  /**
+   * A whole balance session, through the locked session and card tables the
+   * lock free calls above skip
+   */
+  void BM_BankBalanceSession(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    ThreadCards cards;
+    try {
+      cards = threadCards(state.thread_index());
+    } catch (std::exception &ex) {
+      state.SkipWithError(ex.what());
+      return;
+    }
+    try {
+      for (auto _ : state) {
+        TransactionType trans_type = CHECK_BALANCE;
+        bank->performTransaction(openSession(bank, cards.read_card_, cards.read_account_), trans_type, 0);
+      }
+    } catch (std::exception &ex) {
+      state.SkipWithError(ex.what());
+    }
+    state.SetItemsProcessed(state.iterations());
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_ReadWriteMix, LockedStore)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadWriteMix, VersionedStore)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BankCheckBalance, false)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BankCheckBalance, true)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_BankListAccounts)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_BankBalanceSession)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,209 @@
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <cache_line.hpp>
+#include <reconciliation.hpp>
+
+using namespace banking;
+
+namespace {
+
+  const std::size_t NUM_ACCOUNTS = 10000000;
+
+  const std::size_t NUM_ATMS = 1000;
+
+  /**
+   * End of day sized snapshot: 10M accounts spread one to nine per card
+   */
+  const BalanceSnapshot& largeSnapshot() {
+    static BalanceSnapshot snapshot;
+    if (!snapshot.balances_.empty())
+      return snapshot;
+
+    std::mt19937 mt(7);
+    std::uniform_int_distribution<int> accounts_dst(1, 9);
+    std::uniform_int_distribution<int64_t> balance_dst(-1000, 1000000);
+    snapshot.balances_.reserve(NUM_ACCOUNTS);
+    snapshot.account_ids_.reserve(NUM_ACCOUNTS);
+    snapshot.card_offsets_.push_back(0);
+    while (snapshot.balances_.size() < NUM_ACCOUNTS) {
+      int accounts = accounts_dst(mt);
+      for (int i = 0; i < accounts && snapshot.balances_.size() < NUM_ACCOUNTS; i++) {
+        snapshot.account_ids_.push_back(snapshot.balances_.size());
+        snapshot.balances_.push_back(balance_dst(mt));
+      }
+      ActivityTotals activity;
+      activity.deposits_ = accounts * 100;
+      activity.deposit_count_ = accounts;
+      snapshot.card_nos_.push_back(snapshot.card_nos_.size());
+      snapshot.card_offsets_.push_back(snapshot.balances_.size());
+      snapshot.card_activity_.push_back(activity);
+    }
+    snapshot.atm_activity_.resize(NUM_ATMS);
+    for (std::size_t atm_id = 0; atm_id < NUM_ATMS; atm_id += 3)
+      snapshot.atm_activity_[atm_id].deposit_count_ = atm_id;
+    return snapshot;
+  }
+
+  /**
+   * @brief Fill the bank up to its account limit, one to nine accounts a card
+   *
+   * @return false with error set if the bank refused an account
+   */
+  bool populateBank(Bank *bank, std::string &error) {
+    std::mt19937 mt(7);
+    std::uniform_int_distribution<int> accounts_dst(1, 9);
+    int accounts = 0;
+    try {
+      while (accounts < ACCOUNTS_CARDS_UL) {
+        long card_no = bank->createAndLinkAccount("holder", 1000);
+        accounts++;
+        for (int i = accounts_dst(mt); i > 1 && accounts < ACCOUNTS_CARDS_UL; i--, accounts++)
+          bank->createAndLinkAccount("holder", 1000, card_no);
+      }
+    } catch (std::exception &e) {
+      error = std::string("account ") + std::to_string(accounts) + ": " + e.what();
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * reconcile() alone over a synthetic 10M account snapshot
+   */
+  void BM_Reconcile(benchmark::State &state) {
+    const BalanceSnapshot &snapshot = largeSnapshot();
+    for (auto _ : state)
+      benchmark::DoNotOptimize(reconcile(snapshot, state.range(0)).total_balance_);
+    state.SetItemsProcessed(state.iterations() * snapshot.balances_.size());
+    state.counters["cards"] = snapshot.card_nos_.size();
+  }
+
+  /**
+   * End to end report on a bank filled to ACCOUNTS_CARDS_UL accounts: the
+   * snapshot copy, then reconcile() over it
+   */
+  void BM_SnapshotAndReconcile(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::string error;
+    if (!populateBank(bank, error)) {
+      state.SkipWithError(error.c_str());
+      bank->deleteBank();
+      return;
+    }
+
+    std::size_t accounts = 0;
+    for (auto _ : state) {
+      BalanceSnapshot snapshot = bank->snapshotBalances();
+      benchmark::DoNotOptimize(reconcile(snapshot, state.range(0)).total_balance_);
+      accounts = snapshot.balances_.size();
+    }
+    state.SetItemsProcessed(state.iterations() * accounts);
+    state.counters["accounts"] = accounts;
+    bank->deleteBank();
+  }
+
+  /**
+   * Deposit sessions on a live bank with and without a thread snapshotting and
+   * reconciling it back to back. Given a spare core for the reconciler,
+   * sessions per second should barely move.
+   */
+  void BM_SessionsDuringReconcile(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::string error;
+    long card_no = -1;
+    std::vector<long> account_no;
+    try {
+      card_no = bank->createAndLinkAccount("someone", 1000);
+      bank->listAccounts(card_no, account_no);
+      for (int i = 0; i < ACCOUNTS_CARDS_UL / 2; i++)
+        bank->createAndLinkAccount("other", i);
+    } catch (std::exception &e) {
+      error = e.what();
+    }
+    if (account_no.empty() || !error.empty()) {
+      state.SkipWithError(error.empty() ? "no account" : error.c_str());
+      bank->deleteBank();
+      return;
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int64_t> reports(0);
+    std::thread reconciler;
+    if (state.range(0)) {
+      reconciler = std::thread([&]() {
+        while (!done.load(std::memory_order_relaxed)) {
+          benchmark::DoNotOptimize(reconcile(bank->snapshotBalances(), 2).total_balance_);
+          reports.fetch_add(1, std::memory_order_relaxed);
+        }
+      });
+    }
+
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    for (auto _ : state) {
+      try {
+        int token = bank->verifyAndCreateTransaction(card_no, 8888, 1);
+        if (token < 0) {
+          state.SkipWithError("wrong pin");
+          break;
+        }
+        bank->acknowledgeTransaction(token, atm_cb);
+        bank->selectAccount(token, account_no[0]);
+        TransactionType trans_type = DEPOSIT;
+        bank->performTransaction(token, trans_type, 10);
+      } catch (std::exception &e) {
+        state.SkipWithError(e.what());
+        break;
+      }
+    }
+
+    done.store(true);
+    if (reconciler.joinable())
+      reconciler.join();
+    state.SetItemsProcessed(state.iterations());
+    state.counters["reports"] = reports.load();
+    bank->deleteBank();
+  }
+
+  /**
+   * struct WriterSlot - Value written by one benchmark thread, alone on its line
+   */
+  struct alignas(CACHE_LINE_BYTES) WriterSlot {
+    std::atomic<uint64_t> value_;
+  };
+
+  /**
+   * What every deposit, withdraw and account creation pays for the snapshot
+   * cut: entering and leaving a SnapshotEpoch, a seq_cst add and a release
+   * sub on one counter all writers share. Each thread writes its own cache
+   * line, so without the guard nothing is shared and the gap is the guard.
+   */
+  template <bool guarded>
+    void BM_WriteEpoch(benchmark::State &state) {
+      static SnapshotEpoch epoch;
+      static WriterSlot written[64];
+      std::atomic<uint64_t> &slot = written[state.thread_index() % 64].value_;
+      for (auto _ : state) {
+        if (guarded) {
+          SnapshotEpoch::Guard guard(epoch);
+          slot.store(slot.load(std::memory_order_relaxed) + guard.epoch(), std::memory_order_relaxed);
+        } else {
+          slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+      }
+      state.SetItemsProcessed(state.iterations());
+    }
+}
+
+BENCHMARK(BM_Reconcile)->RangeMultiplier(2)->Range(1, 16)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_SnapshotAndReconcile)->RangeMultiplier(2)->Range(1, 4)->Unit(benchmark::kMicrosecond)->UseRealTime();
+BENCHMARK(BM_SessionsDuringReconcile)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_WriteEpoch, false)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_WriteEpoch, true)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
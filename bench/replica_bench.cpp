@@ -0,0 +1,91 @@
+#include <map>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <replica.hpp>
+
+using namespace banking;
+
+namespace {
+
+  ChangeJournal journal(1 << 14);
+  BankReplica replica(journal);
+
+  /**
+   * @brief Card and account used by one benchmark thread, created once per bank
+   *
+   */
+  std::pair<long, long> threadAccount(int thread_index) {
+    static std::mutex mtx;
+    static std::map<int, std::pair<long, long>> accounts;
+    std::lock_guard<std::mutex> lck(mtx);
+    auto it = accounts.find(thread_index);
+    if (it != accounts.end())
+      return it->second;
+
+    Bank *bank = Bank::getBank();
+    long card_no = -1;
+    while (card_no < 0) {
+      try {
+        card_no = bank->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000000);
+      } catch (std::exception&) {
+      }
+    }
+    std::vector<long> account_no;
+    bank->listAccounts(card_no, account_no);
+    accounts[thread_index] = std::make_pair(card_no, account_no[0]);
+    return accounts[thread_index];
+  }
+
+  /**
+   * 90/10 balance inquiry/withdraw mix with the primary journaling to a
+   * replica, inquiries served by the primary (range 0) or by the replica
+   * (range 1). Withdrawals always run on the primary.
+   */
+  void BM_InquiryWithdrawMix(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::pair<long, long> account = threadAccount(state.thread_index());
+    if (state.thread_index() == 0) {
+      bank->attachJournal(&journal);
+      replica.start();
+    }
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    bool on_replica = state.range(0);
+    int64_t withdrawals = 0, failed = 0;
+    unsigned n = 0;
+
+    for (auto _ : state) {
+      try {
+        if (++n % 10 && on_replica) {
+          int amount;
+          if (!replica.checkBalance(account.first, 8888, account.second, amount))
+            failed++;
+          benchmark::DoNotOptimize(amount);
+          continue;
+        }
+        TransactionType trans_type = n % 10 ? CHECK_BALANCE : WITHDRAW;
+        int token = bank->verifyAndCreateTransaction(account.first, 8888);
+        bank->acknowledgeTransaction(token, atm_cb);
+        bank->selectAccount(token, account.second);
+        bank->performTransaction(token, trans_type, 1);
+        withdrawals += trans_type == WITHDRAW;
+      } catch (std::exception&) {
+        failed++;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["withdrawals"] = benchmark::Counter(withdrawals, benchmark::Counter::kIsRate);
+    state.counters["failed"] = failed;
+    if (state.thread_index() == 0) {
+      ReplicaMetrics metrics = replica.metrics();
+      state.counters["lag_records"] = metrics.lag_records_;
+      state.counters["max_lag_us"] = metrics.max_lag_ns_ / 1000;
+    }
+  }
+}
+
+BENCHMARK(BM_InquiryWithdrawMix)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
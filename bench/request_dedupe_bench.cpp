@@ -0,0 +1,42 @@
+#include <atomic>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <request_dedupe.hpp>
+
+using namespace banking;
+
+namespace {
+
+  /**
+   * New requests with one retry in ten, against the bank's dedupe sizing. The
+   * memory counter stays flat however many ids go through.
+   */
+  void BM_DedupeRequests(benchmark::State &state) {
+    static RequestDedupe<TransactionOutcome, std::mutex> dedupe(DEDUPE_CAPACITY, DEDUPE_WINDOW);
+    static std::atomic<uint64_t> next_id(1);
+    TransactionOutcome outcome;
+    uint64_t last_id = 0;
+    int64_t duplicates = 0;
+
+    for (auto _ : state) {
+      uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+      if (last_id && id % 10 == 0)
+        id = last_id;
+      if (dedupe.begin(state.thread_index(), id, outcome) == DEDUPE_NEW)
+        dedupe.complete(state.thread_index(), id, outcome);
+      else
+        duplicates++;
+      last_id = id;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["duplicates"] = duplicates;
+    state.counters["memory_bytes"] = benchmark::Counter(dedupe.memoryBytes(), benchmark::Counter::kAvgThreads);
+  }
+}
+
+BENCHMARK(BM_DedupeRequests)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,93 @@
+#include <map>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+
+using namespace banking;
+
+namespace {
+
+  /**
+   * @brief Card and account used by one benchmark thread, created once per bank
+   *
+   */
+  std::pair<long, long> threadAccount(int thread_index) {
+    static std::mutex mtx;
+    static std::map<int, std::pair<long, long>> accounts;
+    std::lock_guard<std::mutex> lck(mtx);
+    auto it = accounts.find(thread_index);
+    if (it != accounts.end())
+      return it->second;
+
+    Bank *bank = Bank::getBank();
+    long card_no = -1;
+    while (card_no < 0) {
+      try {
+        card_no = bank->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000000);
+      } catch (std::exception&) {
+      }
+    }
+    std::vector<long> account_no;
+    bank->listAccounts(card_no, account_no);
+    accounts[thread_index] = std::make_pair(card_no, account_no[0]);
+    return accounts[thread_index];
+  }
+
+  /**
+   * Balance check then withdraw as two sessions, each with its own card
+   * verification, account selection and locked lookups
+   */
+  void BM_BalanceThenWithdrawSessions(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::pair<long, long> account = threadAccount(state.thread_index());
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    int64_t failed = 0;
+
+    for (auto _ : state) {
+      try {
+        for (TransactionType trans_type : {CHECK_BALANCE, WITHDRAW}) {
+          int token = bank->verifyAndCreateTransaction(account.first, 8888);
+          bank->acknowledgeTransaction(token, atm_cb);
+          bank->selectAccount(token, account.second);
+          bank->performTransaction(token, trans_type, 1);
+        }
+      } catch (std::exception&) {
+        failed++;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["failed"] = failed;
+  }
+
+  /**
+   * Balance check then withdraw as one optimistic session
+   */
+  void BM_BalanceThenWithdrawOptimistic(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::pair<long, long> account = threadAccount(state.thread_index());
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    std::vector<SessionOperation> operations = {{SESSION_CHECK_BALANCE, account.second, 0, -1},
+      {SESSION_WITHDRAW, account.second, 1, -1}};
+    int64_t failed = 0;
+
+    for (auto _ : state) {
+      try {
+        int token = bank->verifyAndCreateTransaction(account.first, 8888);
+        bank->acknowledgeTransaction(token, atm_cb);
+        if (!bank->performSession(token, operations))
+          failed++;
+      } catch (std::exception&) {
+        failed++;
+      }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["failed"] = failed;
+  }
+}
+
+BENCHMARK(BM_BalanceThenWithdrawSessions)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_BalanceThenWithdrawOptimistic)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
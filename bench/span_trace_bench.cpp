@@ -0,0 +1,73 @@
+#include <map>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include <bank.hpp>
+#include <span_trace.hpp>
+
+using namespace banking;
+
+namespace {
+
+  /**
+   * @brief Card and account used by one benchmark thread, created once per bank
+   *
+   */
+  std::pair<long, long> threadAccount(int thread_index) {
+    static std::mutex mtx;
+    static std::map<int, std::pair<long, long>> accounts;
+    std::lock_guard<std::mutex> lck(mtx);
+    auto it = accounts.find(thread_index);
+    if (it != accounts.end())
+      return it->second;
+
+    Bank *bank = Bank::getBank();
+    long card_no = -1;
+    while (card_no < 0) {
+      try {
+        card_no = bank->createAndLinkAccount("bench" + std::to_string(thread_index), 1000000000);
+      } catch (std::exception&) {
+      }
+    }
+    std::vector<long> account_no;
+    bank->listAccounts(card_no, account_no);
+    accounts[thread_index] = std::make_pair(card_no, account_no[0]);
+    return accounts[thread_index];
+  }
+
+  /**
+   * Withdraw sessions with span tracing off (range 0) or sampling one session
+   * in every range(0)
+   */
+  void BM_TracedSessions(benchmark::State &state) {
+    Bank *bank = Bank::getBank();
+    std::pair<long, long> account = threadAccount(state.thread_index());
+    atm_cb_t atm_cb = [](AtmOperationType, int, std::string&&) { return true; };
+    if (state.thread_index() == 0 && state.range(0))
+      SpanTracer::getTracer()->start("", state.range(0));
+    int64_t failed = 0;
+
+    for (auto _ : state) {
+      try {
+        int token = bank->verifyAndCreateTransaction(account.first, 8888);
+        bank->acknowledgeTransaction(token, atm_cb);
+        bank->selectAccount(token, account.second);
+        TransactionType trans_type = WITHDRAW;
+        bank->performTransaction(token, trans_type, 1);
+      } catch (std::exception&) {
+        failed++;
+      }
+    }
+    if (state.thread_index() == 0) {
+      state.counters["dropped"] = SpanTracer::getTracer()->dropped();
+      SpanTracer::getTracer()->stop();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["failed"] = failed;
+  }
+}
+
+BENCHMARK(BM_TracedSessions)->Arg(0)->Arg(100)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
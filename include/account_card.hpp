@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <string>
 
 namespace banking {
 
@@ -18,44 +20,76 @@ namespace banking {
     CHECK_BALANCE
   };
 
-  using acc_cb_t = std::function<bool(const TransactionType&, int&)>;
+  using acc_cb_t = std::function<bool(const TransactionType&, int&, uint64_t)>;
 
+  using account_index_t = uint32_t;
+
+  class AccountTable;
+
+  /**
+   * Account - Handle to an account stored in an AccountTable, which must outlive it
+   */
   class Account {
     public:
+      Account() : table_(nullptr), index_(0) {}
+
       /**
        * @brief Constructor
        *
-       * @param account_id
-       * @param holder_name
-       * @param amount
+       * @param table
+       * @param index position of the account in the table
        */
-      Account (long account_id, const std::string &holder_name, int amount);
+      Account (AccountTable &table, account_index_t index) : table_(&table), index_(index) {}
 
       /**
        * @brief Getter function for account name
        *
        */
-      std::string get_name() { return name_; }
+      const std::string& get_name() const;
 
       /**
        * @brief Getter function for id
        *
        */
-      long get_id() { return id_; }
+      long get_id() const;
+
+      /**
+       * @brief Position of the account in its table
+       *
+       */
+      account_index_t get_index() const { return index_; }
+
+      /**
+       * @brief Lock free balance read, never blocks a concurrent transaction
+       *
+       * @param version if not null, populated with the balance version
+       * @return balance
+       */
+      int get_balance(uint64_t *version = nullptr) const;
+
+      /**
+       * @brief Balance as of a snapshot cut, never blocks a concurrent transaction
+       *
+       * @param epoch epoch started by the cut, every write tagged below it is
+       *        complete
+       * @return balance
+       */
+      int get_snapshot_balance(uint64_t epoch) const;
 
       /**
        * @brief Perfrom the secified transaction type
        *
        * @param trans_type
        * @param amount
+       * @param epoch snapshot epoch the transaction runs in, 0 if none
        * @return true/false
        */
-      bool performTransaction(const TransactionType &trans_type, int &amount);
+      bool performTransaction(const TransactionType &trans_type, int &amount,
+          uint64_t epoch = 0);
 
     private:
-      long id_;
-      std::string name_;
-      int money_;
+      AccountTable *table_;
+      account_index_t index_;
   };
 
   class Card {
@@ -100,9 +134,10 @@ namespace banking {
        *
        * @param trans_type
        * @param amount
+       * @param epoch snapshot epoch the transaction runs in, 0 if none
        * @return true/false
        */
-      bool callAccountCallback(TransactionType &trans_type, int amount);
+      bool callAccountCallback(TransactionType &trans_type, int amount, uint64_t epoch = 0);
 
     private:
       long number_;
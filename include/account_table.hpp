@@ -0,0 +1,440 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <account_card.hpp>
+#include <flat_hash_map.hpp>
+
+namespace banking {
+
+  /**
+   * ChunkedArray - Growable array carved out of fixed size chunks
+   *
+   * Chunks are never moved once allocated, so elements below size() can be
+   * read while a single writer grows the array.
+   */
+  template <typename T>
+    class ChunkedArray {
+      public:
+        static const std::size_t CHUNK_BITS = 14;
+        static const std::size_t CHUNK_SIZE = std::size_t(1) << CHUNK_BITS;
+        static const std::size_t MAX_CHUNKS = 4096;
+
+        ChunkedArray() {
+          for (auto &chunk : chunks_)
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+
+        ~ChunkedArray() {
+          for (auto &chunk : chunks_)
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+
+        ChunkedArray(const ChunkedArray&) = delete;
+        ChunkedArray& operator=(const ChunkedArray&) = delete;
+
+        T& operator[](std::size_t index) {
+          return chunks_[index >> CHUNK_BITS].load(std::memory_order_acquire)[index & (CHUNK_SIZE - 1)];
+        }
+
+        const T& operator[](std::size_t index) const {
+          return chunks_[index >> CHUNK_BITS].load(std::memory_order_acquire)[index & (CHUNK_SIZE - 1)];
+        }
+
+        /**
+         * @brief Make room for elements up to index, callers serialize growth
+         *
+         * @param index
+         * @return false if index is beyond the largest supported size
+         */
+        bool reserve(std::size_t index) {
+          std::size_t chunk = index >> CHUNK_BITS;
+          if (chunk >= MAX_CHUNKS)
+            return false;
+          if (!chunks_[chunk].load(std::memory_order_relaxed))
+            chunks_[chunk].store(new T[CHUNK_SIZE](), std::memory_order_release);
+          return true;
+        }
+
+        /**
+         * @brief Bytes held by the allocated chunks
+         *
+         */
+        std::size_t memoryBytes() const {
+          std::size_t bytes = 0;
+          for (const auto &chunk : chunks_) {
+            if (chunk.load(std::memory_order_relaxed))
+              bytes += CHUNK_SIZE * sizeof(T);
+          }
+          return bytes;
+        }
+
+      private:
+        std::atomic<T*> chunks_[MAX_CHUNKS];
+    };
+
+  /**
+   * InlineList - List keeping its first N elements inline, for the handful of
+   *              accounts a card links to
+   */
+  template <typename T, std::size_t N>
+    class InlineList {
+      public:
+        class const_iterator {
+          public:
+            const_iterator(const InlineList *list, std::size_t index) : list_(list), index_(index) {}
+
+            const T& operator*() const { return (*list_)[index_]; }
+
+            const_iterator& operator++() {
+              index_++;
+              return *this;
+            }
+
+            bool operator==(const const_iterator &other) const { return index_ == other.index_; }
+            bool operator!=(const const_iterator &other) const { return index_ != other.index_; }
+
+          private:
+            const InlineList *list_;
+            std::size_t index_;
+        };
+
+        InlineList() : size_(0) {}
+
+        void push_back(const T &value) {
+          if (size_ < N)
+            inline_[size_] = value;
+          else
+            overflow_.push_back(value);
+          size_++;
+        }
+
+        const T& operator[](std::size_t index) const {
+          return index < N ? inline_[index] : overflow_[index - N];
+        }
+
+        std::size_t size() const { return size_; }
+        bool empty() const { return !size_; }
+        const T& back() const { return (*this)[size_ - 1]; }
+
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, size_); }
+
+      private:
+        std::array<T, N> inline_;
+        uint32_t size_;
+        std::vector<T> overflow_;
+    };
+
+  using AccountIndexList = InlineList<account_index_t, 3>;
+
+  /**
+   * NameInterner - Stores each distinct holder name once and hands out dense ids
+   */
+  class NameInterner {
+    public:
+      /**
+       * @brief Id of a name, adding it if it is new
+       *
+       * @param name
+       * @return id
+       */
+      uint32_t intern(const std::string &name);
+
+      /**
+       * @brief Id of a name without adding it
+       *
+       * @param name
+       * @param id populated with the id if found
+       * @return true if found else false
+       */
+      bool find(const std::string &name, uint32_t &id);
+
+      /**
+       * @brief Lock free lookup of an id handed out before
+       *
+       */
+      const std::string& name(uint32_t id) const { return names_[id]; }
+
+      std::size_t memoryBytes() const;
+
+    private:
+      std::mutex mutex_;
+      FlatHashMap<std::string, uint32_t> ids_;
+      ChunkedArray<std::string> names_;
+      std::size_t bytes_ = 0;
+  };
+
+  /**
+   * AccountTable - Accounts stored as parallel dense arrays indexed by position
+   *
+   * Ids, interned name ids and balances each live in their own chunked array,
+   * so scanning one field touches only that field. Every account carries a
+   * sequence word that is both the version seen by readers and the lock taken
+   * by writers: odd while a write is in progress. Funds on hold are kept apart
+   * from the balance and only writers taking money out look at them. Accounts
+   * are only ever added. The last batch job applied to every account is kept
+   * so a job run again does not apply twice.
+   */
+  class AccountTable {
+    friend class AccountTransaction;
+
+    public:
+      AccountTable() : size_(0) {}
+
+      AccountTable(const AccountTable&) = delete;
+      AccountTable& operator=(const AccountTable&) = delete;
+
+      /**
+       * @brief Add an account
+       *
+       * @param account_id
+       * @param holder_name
+       * @param amount
+       * @param epoch snapshot epoch the account is created in
+       * @return index of the account
+       */
+      account_index_t create(long account_id, const std::string &holder_name, int amount,
+          uint64_t epoch = 0);
+
+      long id(account_index_t index) const { return ids_[index]; }
+      uint32_t nameId(account_index_t index) const { return name_ids_[index]; }
+      const std::string& name(account_index_t index) const { return names_.name(name_ids_[index]); }
+
+      /**
+       * @brief Lock free balance read, never blocks a concurrent transaction
+       *
+       * @param index
+       * @param version if not null, populated with the balance version
+       * @return balance
+       */
+      int balance(account_index_t index, uint64_t *version = nullptr) const;
+
+      /**
+       * @brief Balance as of a snapshot cut, see Account::get_snapshot_balance
+       *
+       */
+      int snapshotBalance(account_index_t index, uint64_t epoch) const;
+
+      /**
+       * @brief Perform a transaction on an account, see Account::performTransaction
+       *
+       */
+      bool performTransaction(account_index_t index, const TransactionType &trans_type,
+          int &amount, uint64_t epoch = 0);
+
+      /**
+       * @brief Overwrite the balance of an account, unchecked and unlogged,
+       *        for copies of another table such as a replica
+       *
+       * @param index
+       * @param balance
+       * @param epoch snapshot epoch the write lands in, 0 if none
+       */
+      void set(account_index_t index, int balance, uint64_t epoch = 0);
+
+      /**
+       * @brief Lock free hold on available funds, see HoldTable
+       *
+       * @param index
+       * @param amount
+       * @return false if the balance less what is already held is short
+       */
+      bool reserve(account_index_t index, int amount);
+
+      /**
+       * @brief Drop a hold placed by reserve
+       *
+       */
+      void unreserve(account_index_t index, int amount) {
+        held_[index].fetch_sub(amount, std::memory_order_seq_cst);
+      }
+
+      /**
+       * @brief Turn a hold placed by reserve into a withdraw
+       *
+       * @param index
+       * @param amount
+       * @param epoch snapshot epoch the withdraw lands in, 0 if none
+       */
+      void settle(account_index_t index, int amount, uint64_t epoch = 0);
+
+      /**
+       * @brief Funds on hold
+       *
+       */
+      int held(account_index_t index) const { return held_[index].load(std::memory_order_seq_cst); }
+
+      /**
+       * @brief Apply the adjustment of a batch job to an account at most once,
+       *        under the account's write lock so it lands strictly before or
+       *        after every other write
+       *
+       * @param index
+       * @param job_id nonzero, an account skips every job not newer than the
+       *        last one applied to it
+       * @param adjustment amount to add given the account id and its balance,
+       *        a debit is cut down to the funds not on hold
+       * @param amount populated with the amount added
+       * @param epoch snapshot epoch the change lands in, 0 if none
+       * @return false if the job was already applied to the account
+       */
+      bool adjust(account_index_t index, uint64_t job_id,
+          const std::function<int(long, int)> &adjustment, int &amount, uint64_t epoch = 0);
+
+      /**
+       * @brief Last batch job applied to an account, 0 if none
+       *
+       */
+      uint64_t lastJob(account_index_t index) const { return jobs_[index].load(std::memory_order_acquire); }
+
+      /**
+       * @brief Id of a holder name if any account was created with it
+       *
+       */
+      bool findName(const std::string &holder_name, uint32_t &name_id) {
+        return names_.find(holder_name, name_id);
+      }
+
+      std::size_t size() const { return size_.load(std::memory_order_acquire); }
+
+      /**
+       * @brief Bytes held by the arrays and the interned names
+       *
+       */
+      std::size_t memoryBytes() const;
+
+    private:
+      /**
+       * @brief Apply a change to an account while holding its sequence odd
+       *
+       * @tparam F callable of signature bool(int available), given the balance
+       *         less the funds on hold, false keeps the balance
+       */
+      template <typename F>
+        bool write(account_index_t index, int amount, uint64_t epoch, F &&check);
+
+      /**
+       * @brief Take the write lock of an account if it is still at a version
+       *
+       * @param index
+       * @param version even sequence the caller read the account at
+       * @return false if the account was written or is being written since
+       */
+      bool tryLock(account_index_t index, uint64_t version);
+
+      /**
+       * @brief Wait for and take the write lock of an account
+       *
+       * @return version the account was locked at
+       */
+      uint64_t lock(account_index_t index);
+
+      /**
+       * @brief Add to the balance of an account locked at a version and
+       *        release it, see write
+       *
+       */
+      void apply(account_index_t index, uint64_t version, int amount, uint64_t epoch);
+
+      std::mutex create_mutex_;
+      std::atomic<std::size_t> size_;
+      NameInterner names_;
+      ChunkedArray<long> ids_;
+      ChunkedArray<uint32_t> name_ids_;
+      ChunkedArray<std::atomic<uint64_t>> seqs_;
+      ChunkedArray<std::atomic<int>> money_, cut_money_;
+      ChunkedArray<std::atomic<uint64_t>> epochs_;
+      ChunkedArray<std::atomic<int>> held_;
+      ChunkedArray<std::atomic<uint64_t>> jobs_;
+  };
+
+  /**
+   * AccountTransaction - Optimistic transaction over accounts of an AccountTable
+   *
+   * Reads record the version of every account they see and writes are only
+   * buffered, so nothing is locked while the transaction is built. commit()
+   * locks the written accounts in index order, checks that no account read
+   * has changed since and applies every write at once, or applies nothing.
+   */
+  class AccountTransaction {
+    public:
+      explicit AccountTransaction(AccountTable &table) : table_(table) {}
+
+      /**
+       * @brief Versioned balance read
+       *
+       * @param index
+       * @return balance including the writes and holds buffered by this
+       *         transaction
+       */
+      int read(account_index_t index);
+
+      /**
+       * @brief Versioned balance read less the funds on hold
+       *
+       */
+      int available(account_index_t index) {
+        return read(index) - table_.held(index);
+      }
+
+      /**
+       * @brief Buffer a change to the balance of an account, reading it first
+       *        if it was not read yet
+       *
+       * @param index
+       * @param amount added to the balance, negative to take money out
+       */
+      void add(account_index_t index, int amount);
+
+      /**
+       * @brief Buffer a hold on funds of an account, placed at commit the way
+       *        AccountTable::reserve places one
+       *
+       * @param index
+       * @param amount
+       */
+      void hold(account_index_t index, int amount);
+
+      /**
+       * @brief Validate the reads and apply the writes atomically
+       *
+       * @param epoch snapshot epoch the writes land in, 0 if none
+       * @return false if an account read has changed or a debited or held
+       *         account would dip into funds on hold, nothing is applied and the
+       *         transaction can be cleared and run again
+       */
+      bool commit(uint64_t epoch = 0);
+
+      /**
+       * @brief Forget every read and buffered write
+       *
+       */
+      void clear() { entries_.clear(); }
+
+    private:
+      /**
+       * struct Entry - An account read by the transaction
+       */
+      struct Entry {
+        account_index_t index_;
+        uint64_t version_;
+        int money_;
+        int amount_;
+        int held_;
+        bool written_;
+      };
+
+      Entry& entry(account_index_t index);
+
+      AccountTable &table_;
+      std::vector<Entry> entries_;
+  };
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace banking {
+
+  /**
+   * struct AdmissionMetrics - Counters of an AdmissionController
+   */
+  struct AdmissionMetrics {
+    std::size_t budget_ = 0;
+    std::size_t active_ = 0;
+    std::size_t queue_depth_ = 0;
+    std::size_t max_queue_depth_ = 0;
+    uint64_t admitted_ = 0;
+    uint64_t waited_ = 0;
+    uint64_t shed_ = 0;
+    uint64_t timed_out_ = 0;
+
+    /**
+     * @brief Fraction of admission requests turned away
+     *
+     */
+    double shedRate() const {
+      uint64_t requests = admitted_ + shed_ + timed_out_;
+      return requests ? static_cast<double>(shed_ + timed_out_) / requests : 0.0;
+    }
+  };
+
+  /**
+   * AdmissionController - Bounds the number of concurrent sessions
+   *
+   * Requests beyond the budget wait in a bounded FIFO queue of their atm and
+   * freed slots go round robin over the atms with someone waiting, so a busy
+   * site can not starve the others. A request is shed right away when its atm
+   * queue is full, or once its deadline passes without a slot.
+   */
+  class AdmissionController {
+    public:
+      using clock_t = std::chrono::steady_clock;
+
+      /**
+       * @brief Constructor
+       *
+       * @param budget concurrent sessions allowed
+       * @param queue_per_atm waiting requests allowed per atm
+       * @param max_wait longest a request waits for a slot
+       */
+      AdmissionController(std::size_t budget, std::size_t queue_per_atm,
+          clock_t::duration max_wait);
+
+      /**
+       * @brief Take a session slot, waiting up to the configured max wait
+       *
+       * @param atm_id atm asking, -1 if unknown
+       * @return true if admitted, false if shed
+       */
+      bool admit(int atm_id);
+
+      /**
+       * @brief Take a session slot, waiting until a deadline
+       *
+       * @param atm_id atm asking, -1 if unknown
+       * @param deadline
+       * @return true if admitted, false if shed
+       */
+      bool admit(int atm_id, clock_t::time_point deadline);
+
+      /**
+       * @brief Give back a slot taken by admit
+       *
+       */
+      void release();
+
+      /**
+       * @brief Change the limits, waiting requests are granted if the budget grew
+       *
+       */
+      void configure(std::size_t budget, std::size_t queue_per_atm, clock_t::duration max_wait);
+
+      AdmissionMetrics metrics();
+
+    private:
+      /**
+       * struct Waiter - A request queued for a slot
+       */
+      struct Waiter {
+        bool granted_ = false;
+        std::condition_variable cv_;
+      };
+
+      /**
+       * @brief Hand free slots to waiters round robin over the atms, mutex_
+       *        must be held
+       *
+       */
+      void grantWaiters();
+
+      /**
+       * @brief Take a waiter that gave up out of its queue, mutex_ must be held
+       *
+       */
+      void removeWaiter(int atm_id, Waiter *waiter);
+
+      std::mutex mutex_;
+      std::size_t budget_, queue_per_atm_;
+      clock_t::duration max_wait_;
+      std::map<int, std::deque<Waiter*>> queues_;
+      std::deque<int> turns_;
+      AdmissionMetrics metrics_;
+  };
+}
@@ -22,6 +22,12 @@ namespace banking {
        */
       AtmController();
 
+      /**
+       * @brief Destructor, gives the atm id back to the bank that handed it out
+       *
+       */
+      virtual ~AtmController();
+
       /**
        * @brief API to call when card is inserted
        *
@@ -37,7 +43,16 @@ namespace banking {
        */
       void selectAccount(long account_no);
 
-      void performTransaction(TransactionType trans_type, int amount = 0);
+      /**
+       * @brief Perform a transaction on the selected account
+       *
+       * @param trans_type
+       * @param amount
+       * @param request_id id identifying this request across retries, 0 if
+       *        retries should not be detected
+       */
+      void performTransaction(TransactionType trans_type, int amount = 0,
+          uint64_t request_id = 0);
 
       /**
        * @brief Callback function that bank calls
@@ -53,6 +68,7 @@ namespace banking {
 
     private:
       int atm_id_;
+      uint64_t bank_generation_;
       Transaction transaction_;
   };
 }
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <account_card.hpp>
+#include <reconciliation.hpp>
+
+namespace banking {
+
+  const std::size_t AUDIT_BLOCK_RECORDS = 1 << 16;
+
+  /**
+   * struct AuditRecord - One completed transaction
+   *
+   * time_ns_ is wall clock nanoseconds since the epoch, atm_id_ -1 if the
+   * session did not name its atm, ok_ whether the money moved.
+   */
+  struct AuditRecord {
+    uint64_t time_ns_;
+    int atm_id_;
+    long card_no_;
+    long account_id_;
+    TransactionType type_;
+    int amount_;
+    bool ok_;
+  };
+
+  enum AuditColumn {
+    AUDIT_TIME,
+    AUDIT_ATM,
+    AUDIT_CARD,
+    AUDIT_ACCOUNT,
+    AUDIT_TYPE,
+    AUDIT_AMOUNT,
+    AUDIT_COLUMNS
+  };
+
+  /**
+   * struct AuditBlockIndex - Where the columns of a block of records are and
+   *                          the range of every column in it, as stored in
+   *                          the block's header
+   */
+  struct AuditBlockIndex {
+    uint64_t offset_;
+    uint32_t count_;
+    std::array<uint32_t, AUDIT_COLUMNS> column_bytes_;
+    uint64_t min_time_, max_time_;
+    long min_atm_, max_atm_;
+    long min_card_, max_card_;
+    long min_account_, max_account_;
+    uint32_t types_;
+  };
+
+  /**
+   * struct AuditQuery - Records to select, -1 for any
+   *
+   * Times are wall clock nanoseconds, from_ns_ included and to_ns_ excluded.
+   * result_ is 1 for transactions that went through and 0 for refused ones.
+   */
+  struct AuditQuery {
+    uint64_t from_ns_ = 0;
+    uint64_t to_ns_ = UINT64_MAX;
+    long account_id_ = -1;
+    long card_no_ = -1;
+    long atm_id_ = -1;
+    int type_ = -1;
+    int result_ = -1;
+  };
+
+  /**
+   * struct AuditScanStats - Work done answering a query
+   */
+  struct AuditScanStats {
+    uint64_t blocks_ = 0;
+    uint64_t blocks_read_ = 0;
+    uint64_t bytes_read_ = 0;
+    uint64_t records_scanned_ = 0;
+    uint64_t records_matched_ = 0;
+  };
+
+  /**
+   * AuditArchiveWriter - Appends completed transactions to a columnar archive
+   *
+   * Records are gathered into blocks, sorted by time and written column
+   * after column: times as deltas from the first, atm, card and account as
+   * offsets from the block minimum and amounts zig-zagged, all as varints.
+   * Every block starts with a header holding its record count, column sizes
+   * and the range of each column, so an archive is readable from the front
+   * whether or not it was ever closed. A full block is encoded off the lock
+   * taken by append, so concurrent sessions only ever wait for a push.
+   */
+  class AuditArchiveWriter {
+    public:
+      /**
+       * @brief Constructor
+       *
+       * @param block_records records per block
+       */
+      explicit AuditArchiveWriter(std::size_t block_records = AUDIT_BLOCK_RECORDS);
+
+      /**
+       * @brief Destructor, closes the archive
+       *
+       */
+      ~AuditArchiveWriter();
+
+      AuditArchiveWriter(const AuditArchiveWriter&) = delete;
+      AuditArchiveWriter& operator=(const AuditArchiveWriter&) = delete;
+
+      /**
+       * @brief Start or carry on an archive, a block left torn at the end of
+       *        an existing one is cut off first
+       *
+       * @param path
+       * @return false if already open, the file is not an archive or it can
+       *         not be written
+       */
+      bool open(const std::string &path);
+
+      /**
+       * @brief Add a record
+       *
+       * @param record
+       */
+      void append(const AuditRecord &record);
+
+      /**
+       * @brief Write the last block
+       *
+       * @return false if the archive was not open or a write failed
+       */
+      bool close();
+
+      /**
+       * @{name} records appended since open and size of the archive
+       */
+      uint64_t records() const;
+      uint64_t bytes() const;
+
+      /**
+       * @brief Wall clock nanoseconds records are stamped with
+       *
+       */
+      static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+      }
+
+    private:
+      /**
+       * @brief Encode and write a block, with write_mutex_ held
+       *
+       */
+      void writeBlock(std::vector<AuditRecord> &records);
+
+      const std::size_t block_records_;
+
+      /**
+       * @{name} block being filled, records appended while closed are dropped
+       */
+      mutable std::mutex mutex_;
+      bool open_;
+      std::vector<AuditRecord> pending_;
+      uint64_t records_;
+
+      /**
+       * @{name} file, its size and whether a write failed
+       */
+      mutable std::mutex write_mutex_;
+      std::ofstream file_;
+      uint64_t offset_;
+      bool failed_;
+  };
+
+  /**
+   * AuditArchiveReader - Answers queries over an archive, reading only the
+   *                      blocks whose ranges overlap the query and only the
+   *                      columns the query looks at
+   */
+  class AuditArchiveReader {
+    public:
+      /**
+       * @brief Load the block headers of an archive, a block still being
+       *        written or left torn at the end is skipped
+       *
+       * @param path
+       * @return false if the file is not an archive
+       */
+      bool open(const std::string &path);
+
+      std::size_t blocks() const { return index_.size(); }
+      uint64_t records() const;
+
+      /**
+       * @brief Visit the records matching a query, in time order within a block
+       *
+       * @param query
+       * @param visit
+       * @return stats
+       */
+      AuditScanStats scan(const AuditQuery &query, const std::function<void(const AuditRecord&)> &visit);
+
+      /**
+       * @brief Deposit and withdraw totals per atm of the matching records
+       *        that went through, only the atm, type and amount columns are
+       *        read besides those the query filters on
+       *
+       * @param query
+       * @param totals populated with the totals keyed by atm id
+       * @return stats
+       */
+      AuditScanStats totalsByAtm(const AuditQuery &query, std::map<int, ActivityTotals> &totals);
+
+    private:
+      /**
+       * struct Columns - Decoded columns of a block, the ones not read are empty
+       */
+      struct Columns {
+        std::vector<uint64_t> time_;
+        std::vector<long> atm_, card_, account_;
+        std::vector<uint8_t> type_;
+        std::vector<int> amount_;
+      };
+
+      /**
+       * @brief Whether a block may hold records matching a query
+       *
+       */
+      static bool overlaps(const AuditBlockIndex &block, const AuditQuery &query);
+
+      /**
+       * @brief Read and decode some columns of a block
+       *
+       * @param block
+       * @param columns bit mask of AuditColumn
+       * @param out
+       * @return bytes read, 0 if the read failed
+       */
+      uint64_t readColumns(const AuditBlockIndex &block, uint32_t columns, Columns &out);
+
+      /**
+       * @brief Run over the matching rows of every overlapping block
+       *
+       * @param query
+       * @param columns columns needed besides the ones filtered on
+       * @param visit given the decoded block and the row
+       * @return stats
+       */
+      AuditScanStats run(const AuditQuery &query, uint32_t columns,
+          const std::function<void(const Columns&, std::size_t)> &visit);
+
+      std::ifstream file_;
+      std::vector<AuditBlockIndex> index_;
+  };
+}
@@ -3,6 +3,7 @@
 #include <chrono>
 #include <functional>
 #include <map>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <random>
@@ -11,6 +12,19 @@
 #include <glog/logging.h>
 
 #include <account_card.hpp>
+#include <account_table.hpp>
+#include <admission.hpp>
+#include <audit_archive.hpp>
+#include <bank_policies.hpp>
+#include <batch_job.hpp>
+#include <holds.hpp>
+#include <journal.hpp>
+#include <rcu.hpp>
+#include <reconciliation.hpp>
+#include <request_dedupe.hpp>
+#include <snapshot_epoch.hpp>
+#include <span_trace.hpp>
+#include <trace.hpp>
 
 namespace banking {
 
@@ -18,12 +32,106 @@ namespace banking {
 
   const int HIDDEN_PASSCODE = 12345;
 
-  using AccountPtr = std::shared_ptr<Account>;
+  const std::size_t BANK_SHARDS = 16;
+
+  const std::chrono::minutes DEDUPE_WINDOW(5);
+
+  /**
+   * Deposits and withdraws carrying a request id the bank remembers for the
+   * whole window at up to this rate, past it the oldest ids are forgotten
+   * early, after DEDUPE_CAPACITY / rate seconds
+   */
+  const std::size_t DEDUPE_PEAK_RATE = 1000;
+
+  const std::size_t DEDUPE_CAPACITY =
+    DEDUPE_PEAK_RATE * std::chrono::duration_cast<std::chrono::seconds>(DEDUPE_WINDOW).count();
+
+  const std::size_t ADMISSION_QUEUE_PER_ATM = 8;
+
+  const std::chrono::seconds ADMISSION_MAX_WAIT(2);
+
+  const int SESSION_MAX_ATTEMPTS = 8;
+
+  /**
+   * A session with no call for this long is taken to be abandoned by its atm,
+   * it is ended and its token and admission slot reclaimed
+   */
+  const std::chrono::minutes SESSION_IDLE_TIMEOUT(2);
+
+  const std::chrono::seconds SESSION_REAP_INTERVAL(1);
+
+  const std::chrono::seconds HOLD_TTL(30);
+
   using CardPtr = std::shared_ptr<Card>;
-  using account_card_pair_t = std::pair<CardPtr, std::vector<AccountPtr>>;
+  using account_card_pair_t = std::pair<CardPtr, AccountIndexList>;
   using atm_cb_t = std::function<bool(AtmOperationType, int, std::string&&)>;
 
-  class Bank {
+  /**
+   * struct CardView - Immutable snapshot of the accounts linked to a card,
+   *                   as positions in the bank's account table
+   */
+  struct CardView {
+    long card_no_;
+    uint64_t version_;
+    AccountIndexList accounts_;
+  };
+
+  /**
+   * struct TransactionOutcome - What a request asked for, the last thing the
+   *                             atm was told for it and whether it carried it
+   *                             out, reported to retries
+   */
+  struct TransactionOutcome {
+    TransactionOutcome() : TransactionOutcome(CHECK_BALANCE, 0) {}
+    TransactionOutcome(TransactionType trans_type, int requested) :
+      trans_type_(trans_type), requested_(requested), atm_op_(SHOW_ERROR), amount_(-1),
+      done_(false) {}
+
+    TransactionType trans_type_;
+    int requested_;
+    AtmOperationType atm_op_;
+    int amount_;
+    bool done_;
+  };
+
+  /**
+   * struct SessionView - Immutable snapshot of a session with a selected account
+   */
+  struct SessionView {
+    long card_no_;
+    Account account_;
+    atm_cb_t atm_cb_;
+  };
+
+  enum SessionOperationType {
+    SESSION_CHECK_BALANCE,
+    SESSION_DEPOSIT,
+    SESSION_WITHDRAW,
+    SESSION_TRANSFER
+  };
+
+  /**
+   * struct SessionOperation - One step of a multi operation session
+   *
+   * to_account_no_ is the account credited by a transfer, both accounts have
+   * to be linked to the card of the session.
+   */
+  struct SessionOperation {
+    SessionOperationType type_;
+    long account_no_;
+    int amount_;
+    long to_account_no_;
+  };
+
+  /**
+   * BasicBank - The bank, with its synchronization and table storage chosen at
+   *             compile time
+   *
+   * @tparam LockPolicy NoLockPolicy, MutexLockPolicy or ShardedLockPolicy<N>
+   * @tparam StoragePolicy OrderedStorage or FlatHashStorage
+   */
+  template <typename LockPolicy, typename StoragePolicy>
+  class BasicBank {
     public:
 
       /**
@@ -32,18 +140,21 @@ namespace banking {
        * @param holder_name
        * @param amount
        * @param card_no
+       * @return card number the account is linked to
        */
-      void createAndLinkAccount(const std::string &holder_name,
+      long createAndLinkAccount(const std::string &holder_name,
           int amount, long card_no = -1);
 
       /**
-       * @brief verify card pin and generate a transaction token
+       * @brief verify card pin and generate a transaction token, waiting for a
+       *        session slot when the bank is at its session budget
        *
        * @param card_no
        * @param card_pin
-       * @return transaction token
+       * @param atm_id atm the session runs on, -1 if unknown
+       * @return transaction token, throws if no slot freed up in time
        */
-      int verifyAndCreateTransaction(long card_no, int card_pin);
+      int verifyAndCreateTransaction(long card_no, int card_pin, int atm_id = -1);
 
       /**
        * @brief Select a particular account
@@ -54,21 +165,166 @@ namespace banking {
       void selectAccount(int transaction_token, long account_no);
 
       /**
-       * @brief handle the transaction after doing it with the account
+       * @brief handle the transaction after doing it with the account,
+       *        withdrawals only take the money once the atm dispensed it
        *
        * @param transaction_token
        * @param trans_type
        * @param amount
+       * @param request_id client supplied id, a deposit or withdraw repeating an
+       *        id the card used recently is not applied again, the retrying
+       *        session is shown the original outcome without moving cash and
+       *        ended, or an error if the retry asks for another transaction or
+       *        amount. 0 disables the check.
+       */
+      void performTransaction(int transaction_token, TransactionType &trans_type, int amount,
+          uint64_t request_id = 0);
+
+      /**
+       * @brief Run several operations on the accounts of a session's card as
+       *        one optimistic transaction and end the session
+       *
+       * Balances are read without locks and checked again when the
+       * operations are applied together, the whole session is run again if an
+       * account changed in between. Withdrawals put their funds on pinned
+       * holds, settled once the atm dispensed the cash. Deposits are taken
+       * first and credited only once taken, cash taken for a session that is
+       * then refused is handed back. The atm is told the outcome of the other
+       * operations only once they are all applied, an undispensed withdraw
+       * releases its hold. A throwing atm callback ends the session and
+       * releases its holds. Selecting an account first is not needed.
+       *
+       * @param transaction_token
+       * @param operations
+       * @return true if applied, false if refused or still conflicting after
+       *         SESSION_MAX_ATTEMPTS runs
+       */
+      bool performSession(int transaction_token, const std::vector<SessionOperation> &operations);
+
+      /**
+       * @brief Lock free balance of the account selected in a session
+       *
+       * @param transaction_token
+       * @param amount populated with the balance
+       * @return true if the session has a selected account
+       */
+      bool checkBalance(int transaction_token, int &amount);
+
+      /**
+       * @brief Lock free listing of the accounts linked to a card
+       *
+       * @param card_no
+       * @param account_no populated with the account ids
+       * @return true if the card is present
+       */
+      bool listAccounts(long card_no, std::vector<long> &account_no);
+
+      /**
+       * @brief Consistent copy of every balance and of the per card and per atm
+       *        activity, taken without blocking sessions
+       *
+       * Every deposit or withdraw is either fully in the copy or fully out of
+       * it. Only transactions already in flight when the copy starts are
+       * waited for.
+       *
+       * @return snapshot
+       */
+      BalanceSnapshot snapshotBalances();
+
+      /**
+       * @brief Change the session admission limits
+       *
+       * @param budget concurrent sessions, capped at the transaction token pool
+       * @param queue_per_atm session requests allowed to wait per atm
+       * @param max_wait longest a session request waits for a slot
+       * @param idle_timeout how long a session goes without a call before it
+       *        is ended and its slot reclaimed
+       */
+      void configureAdmission(std::size_t budget, std::size_t queue_per_atm,
+          AdmissionController::clock_t::duration max_wait,
+          std::chrono::steady_clock::duration idle_timeout = SESSION_IDLE_TIMEOUT);
+
+      /**
+       * @brief Session budget, queue depth and shed counters
+       *
+       */
+      AdmissionMetrics admissionMetrics() { return admission_.metrics(); }
+
+      /**
+       * @brief Drop withdraw holds past their time to live, also done on
+       *        every withdraw
+       *
+       * @return holds dropped
+       */
+      std::size_t expireHolds() { return holds_.expire(); }
+
+      /**
+       * @brief Open withdraw holds and how they were closed
+       *
+       */
+      HoldMetrics holdMetrics() const { return holds_.metrics(); }
+
+      /**
+       * @brief Publish every account link and balance change to a journal
+       *        feeding a replica, see BankReplica. The journal is first
+       *        given a link of every account already present, so attaching
+       *        it again resyncs a replica after ChangeJournal::takeResync.
+       *
+       * @param journal nullptr to stop publishing
+       */
+      void attachJournal(ChangeJournal *journal);
+
+      /**
+       * @brief Start a job adjusting every account present, such as interest
+       *        or a fee, alongside the atms and without stopping them, see
+       *        BatchJob. The latency budget of the job is held against
+       *        performTransaction and performSession.
+       *
+       * @param config
+       * @param adjustment amount to add given an account id and its balance
+       * @return the running job, to be stopped before the bank is deleted
+       */
+      std::unique_ptr<BatchJob> startBatchJob(const BatchJobConfig &config,
+          batch_adjustment_t adjustment);
+
+      /**
+       * @brief Append every deposit, withdraw and balance check, and whether
+       *        it went through, to an audit archive. Also done with
+       *        ATM_AUDIT_ARCHIVE=<file> set when the bank is created.
+       *
+       * @param archive open archive, nullptr to stop appending
+       */
+      void attachAuditArchive(AuditArchiveWriter *archive) {
+        audit_.store(archive, std::memory_order_release);
+      }
+
+      /**
+       * @brief Add an account under the id and card number it had on another
+       *        bank, for promoting a replica
+       *
+       * @param card_no card to link the account to, created if not present
+       * @param account_id
+       * @param holder_name
+       * @param amount
        */
-      void performTransaction(int transaction_token, TransactionType &trans_type, int amount);
+      void restoreAccount(long card_no, long account_id, const std::string &holder_name, int amount);
 
       /**
        * @brief Generate atm id for new atms
        *
-       * @return atm if
+       * @return atm id, unique among the atms of this bank until returned,
+       *         throws if every id is taken
        */
       int get_atm_id();
 
+      /**
+       * @brief Give back the id of an atm going away, ids this bank does not
+       *        have out are ignored
+       *
+       * @param atm_id
+       */
+      void returnAtmId(int atm_id);
+
       /**
        * @brief [Needs to deleted] Get account and card number for a specific
        *         holder name
@@ -100,7 +356,7 @@ namespace banking {
        * @brief destructor
        *
        */
-      ~Bank();
+      ~BasicBank();
 
     private:
 
@@ -108,129 +364,259 @@ namespace banking {
        * @brief Constructor
        *
        */
-      Bank() {}
+      BasicBank() :
+        card_views_(ACCOUNTS_CARDS_UL),
+        session_views_(ACCOUNTS_CARDS_UL),
+        dedupe_(DEDUPE_CAPACITY, DEDUPE_WINDOW),
+        admission_(ACCOUNTS_CARDS_UL, ADMISSION_QUEUE_PER_ATM, ADMISSION_MAX_WAIT),
+        holds_(accounts_, ACCOUNTS_CARDS_UL, HOLD_TTL),
+        journal_(nullptr),
+        audit_(nullptr),
+        token_atm_ids_(ACCOUNTS_CARDS_UL),
+        card_activity_(ACCOUNTS_CARDS_UL),
+        atm_activity_(ACCOUNTS_CARDS_UL),
+        token_seen_(ACCOUNTS_CARDS_UL),
+        next_reap_(0),
+        idle_timeout_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              SESSION_IDLE_TIMEOUT).count()) {
+          for (auto &atm_id : token_atm_ids_)
+            atm_id.store(-1, std::memory_order_relaxed);
+          for (auto &seen : token_seen_)
+            seen.store(0, std::memory_order_relaxed);
+        }
+
+      using mutex_t = typename LockPolicy::mutex_type;
+
+      template <typename K, typename V>
+        using table_t = typename LockPolicy::template table_type<
+          typename StoragePolicy::template map_type<K, V>>;
 
       std::vector<long> available_account_ids_, available_card_ids_;
       std::vector<int> available_transaction_tokens_, available_atm_ids_;
 
-      std::mutex account_id_mutex_, card_id_mutex_, t_token_mutex_, atm_id_mutex_;
+      mutex_t account_id_mutex_, card_id_mutex_, t_token_mutex_, atm_id_mutex_;
+
+      AccountTable accounts_;
+      table_t<long, account_card_pair_t> account_cards_map_;
+      table_t<int, long> transaction_map_;
+      table_t<int, atm_cb_t> atm_cb_map_;
 
-      std::map<long, account_card_pair_t> account_cards_map_;
-      std::map<int, long> transaction_map_;
-      std::map<int, atm_cb_t> atm_cb_map_;
+      /**
+       * @{name} read side copies of the maps above, indexed by card number and
+       *         transaction token respectively
+       */
+      RcuTable<CardView> card_views_;
+      RcuTable<SessionView> session_views_;
 
-      std::mutex account_cards_mutex_, transaction_map_mutex_, atm_cb_mutex_;
+      /**
+       * @{name} recently seen request ids and their outcomes
+       */
+      RequestDedupe<TransactionOutcome, mutex_t> dedupe_;
+
+      /**
+       * @{name} bounds the sessions holding a transaction token
+       */
+      AdmissionController admission_;
+
+      /**
+       * @{name} funds held by withdrawals waiting on the atm to dispense
+       */
+      HoldTable holds_;
+
+      /**
+       * @{name} change stream to a replica, if any
+       */
+      std::atomic<ChangeJournal*> journal_;
+
+      /**
+       * @{name} archive of completed transactions, if any, and the one opened
+       *         from the environment
+       */
+      std::atomic<AuditArchiveWriter*> audit_;
+      std::unique_ptr<AuditArchiveWriter> env_audit_;
+
+      /**
+       * @{name} latency of transactions, recorded while a batch job runs
+       */
+      LatencyWindow transaction_latency_;
+
+      /**
+       * @{name} snapshot cut, atm of every session and lock free activity
+       *         counters, indexed by transaction token, card number and atm id
+       */
+      SnapshotEpoch snapshot_epoch_;
+      mutex_t snapshot_mutex_;
+      std::vector<std::atomic<int>> token_atm_ids_;
+      ActivityLedger card_activity_, atm_activity_;
+
+      /**
+       * @{name} steady clock time of the last call on every session, 0 for
+       *         free tokens, when idle sessions are next looked for and how
+       *         long one may idle, in steady clock ticks
+       */
+      std::vector<std::atomic<int64_t>> token_seen_;
+      std::atomic<int64_t> next_reap_, idle_timeout_;
 
       /**
        * @{name} instance of the bank
        */
-      static Bank *bank_;
+      static BasicBank *bank_;
+      static uint64_t generation_;
 
       /**
-       * @brief generate a random number from a set of values
+       * @brief Take a random id out of a pool until it is given back
        *
-       * @tparam T type of the random number to be returned
+       * @tparam T type of the id
        * @param mtx
        * @param available_ids
-       * @return random number
+       * @return id, throws if the pool is empty
        */
       template <typename T>
-        T getRandomId(std::mutex &mtx,
-                      std::vector<T> available_ids) {
-          std::lock_guard<std::mutex> lck(mtx);
-          std::mt19937 mt(std::chrono::high_resolution_clock::now().time_since_epoch().count());
-          std::uniform_int_distribution<int> dst(0, available_ids.size() - 1);
-          int index = dst(mt);
+        T takeRandomId(mutex_t &mtx, std::vector<T> &available_ids) {
+          std::lock_guard<mutex_t> lck(mtx);
+          if (available_ids.empty())
+            throw std::runtime_error("No ids available");
+          thread_local std::mt19937 mt(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+          std::uniform_int_distribution<std::size_t> dst(0, available_ids.size() - 1);
+          std::size_t index = dst(mt);
           T id = available_ids[index];
-          available_ids.erase(available_ids.begin() + index);
+          available_ids[index] = available_ids.back();
+          available_ids.pop_back();
           return id;
         }
 
       /**
-       * @brief find an element in map
-       *
-       * @tparam T typename of key
-       * @tparam U typename of value
-       * @param map_mutex
-       * @param search_map
-       * @param key
-       * @param mit iterator corresponding to the found element
-       * @return true if found in map else false
-       */
-      template <typename T, typename U>
-        bool findInMap(std::mutex &map_mutex,
-            const std::map<T, U> &search_map,
-            const T &key,
-            U &mit) {
-          std::lock_guard<std::mutex> lck(map_mutex);
-          typename std::map<T, U>::const_iterator it = search_map.find(key);
-          if (it != search_map.end()) {
-            mit = it->second;
-            return true;
-          }
-          return false;
+       * @brief Give back an id taken by takeRandomId
+       *
+       */
+      template <typename T>
+        void returnId(mutex_t &mtx, std::vector<T> &available_ids, T id) {
+          std::lock_guard<mutex_t> lck(mtx);
+          available_ids.push_back(id);
         }
 
       /**
-       * @brief Change the value of the element specified by the key
-       *
-       * @tparam T typename of key
-       * @tparam U typename of value
-       * @param map_mutex
-       * @param search_map
-       * @param key
-       * @param value
-       * @return true if key found and value changed, else false
-       */
-      template <typename T, typename U>
-        bool changeValueInMap(std::mutex &map_mutex,
-            std::map<T, U> &search_map,
-            const T &key,
-            U &value) {
-          std::lock_guard<std::mutex> lck(map_mutex);
-          typename std::map<T, U>::iterator it = search_map.find(key);
-          if (it != search_map.end()) {
-            it->second = value;
-            return true;
-          }
-          return false;
-        }
+       * @brief Publish a new snapshot of the accounts linked to a card
+       *
+       * @param card_no
+       * @param accounts
+       */
+      void publishCardView(long card_no, const AccountIndexList &accounts);
 
       /**
-       * @brief Add a key-value pair to map
+       * @brief Read the accounts linked to a card from its snapshot
        *
-       * @tparam T type name of key
-       * @tparam U type name of value
-       * @param mtx mutex corresponding the map
-       * @param key to be added
-       * @param value
+       * @param card_no
+       * @param account_no populated with the account ids
+       * @return true if the card is present
        */
-      template <typename T, typename U>
-        void addToMap(std::mutex &mtx,
-            std::map<T, U> &add_map,
-            T &key, U &value) {
-          std::lock_guard<std::mutex> lck(mtx);
-          std::pair<typename std::map<T, U>::iterator, bool> ret;
-          ret = add_map.insert(std::pair<T, U>(key, value));
-          if (!ret.second)
-            throw std::runtime_error("Unable to add to map");
-        }
+      bool readCardAccounts(long card_no, std::vector<long> &account_no);
 
       /**
-       * @brief Delete an element from map
+       * @brief Carry out a transaction of a session and end it
        *
-       * @tparam T typename of key
-       * @tparam U typename of value
-       * @param mtx
-       * @param delete_map
-       * @param key
-       */
-      template <typename T, typename U>
-        void deleteFromMap(std::mutex &mtx,
-            std::map<T, U> &delete_map, T &key) {
-          std::lock_guard<std::mutex> lck(mtx);
-          delete_map.erase(key);
-        }
+       * @param transaction_token
+       * @param trans_type
+       * @param amount
+       */
+      void applyTransaction(int transaction_token, TransactionType &trans_type, int amount);
+
+      /**
+       * @brief Apply a deposit or withdraw at most once per request id of the
+       *        card, once the session has a selected account
+       *
+       * @param transaction_token
+       * @param trans_type
+       * @param amount
+       * @param request_id
+       */
+      void performIdempotentTransaction(int transaction_token, TransactionType &trans_type,
+          int amount, uint64_t request_id);
+
+      /**
+       * @brief Withdraw from the selected account of a session in two phases:
+       *        hold the funds, have the atm dispense, then settle the hold, or
+       *        release it if the atm could not dispense
+       *
+       * @param transaction_token
+       * @param amount
+       */
+      void performWithdraw(int transaction_token, int amount);
+
+      /**
+       * @brief Deposit to the selected account of a session in two phases:
+       *        have the atm take the cash, then credit the account, so a
+       *        refused take has nothing to undo
+       *
+       * @param transaction_token
+       * @param amount
+       */
+      void performDeposit(int transaction_token, int amount);
+
+      /**
+       * @brief Body of performSession, which ends the session if it throws
+       *
+       * @param transaction_token
+       * @param operations
+       * @param trace receives the session's results
+       */
+      bool runSession(int transaction_token, const std::vector<SessionOperation> &operations,
+          TraceScope &trace);
+
+      /**
+       * @brief Run the operations of a session into a transaction
+       *
+       * @param txn
+       * @param operations
+       * @param accounts table position of every operation's account and
+       *        transfer target
+       * @param shown populated with the amount shown for every operation
+       * @return false if a withdraw or transfer is short of money
+       */
+      bool buildSession(AccountTransaction &txn, const std::vector<SessionOperation> &operations,
+          const std::vector<std::pair<account_index_t, account_index_t>> &accounts,
+          std::vector<int> &shown);
+
+      /**
+       * @brief Publish the link of an account to a card to the journal, if any
+       *
+       * @param card_no
+       * @param index
+       */
+      void journalLink(long card_no, account_index_t index);
+
+      /**
+       * @brief Publish the current balance of an account to the journal, if any
+       *
+       * @param index
+       */
+      void journalBalance(account_index_t index);
+
+      /**
+       * @brief Append a completed transaction to the audit archive, if any
+       *
+       * @param transaction_token
+       * @param card_no
+       * @param index account the transaction ran on
+       * @param trans_type
+       * @param amount
+       * @param ok whether it went through
+       */
+      void audit(int transaction_token, long card_no, account_index_t index,
+          TransactionType trans_type, int amount, bool ok);
+
+      /**
+       * @brief Count a deposit or withdraw against the card and atm of a session
+       *
+       * @param epoch
+       * @param transaction_token
+       * @param card_no
+       * @param trans_type
+       * @param amount
+       * @param count 1 to count the transaction, -1 to undo it
+       */
+      void recordActivity(uint64_t epoch, int transaction_token, long card_no,
+          TransactionType trans_type, int amount, int count);
 
       /**
        * @brief Cleanup after an error condition
@@ -239,20 +625,47 @@ namespace banking {
        */
       void throwSession(int token, bool throw_it = true);
 
+      /**
+       * @brief Note a call on a session, keeping it from being taken as
+       *        abandoned
+       *
+       * @param token
+       */
+      void touchSession(int token);
+
+      /**
+       * @brief End the sessions idle for longer than the idle timeout, at
+       *        most once every SESSION_REAP_INTERVAL or idle timeout if
+       *        shorter. Their atms are shown an error.
+       *
+       */
+      void reapIdleSessions();
+
     public:
       /**
        * @brief Get the single instance of bank
        *
        * @return instance
        */
-      static Bank* getBank() {
+      static BasicBank* getBank() {
         if (!bank_) {
-          bank_ = new Bank;
+          bank_ = new BasicBank;
           bank_->init();
+          generation_++;
         }
         return bank_;
       }
 
+      /**
+       * @brief Count of instances created, tells whether the instance is
+       *        still the one something was handed ids by
+       *
+       * @return generation of the current instance, 0 if none was created
+       */
+      static uint64_t generation() {
+        return bank_ ? generation_ : 0;
+      }
+
       /**
        * @brief calls destructor and reinitializes instance
        *
@@ -261,5 +674,35 @@ namespace banking {
         delete bank_;
         bank_ = nullptr;
       }
+
+      /**
+       * @brief Put a new, empty bank in place of the instance. The current
+       *        one has to be quiescent: no session open on it and no caller
+       *        inside it or still holding it.
+       *
+       * @return the new instance
+       * @throws std::runtime_error if a session is open, the current bank
+       *         then stays in place
+       */
+      static BasicBank* replaceBank() {
+        if (bank_ && bank_->admission_.metrics().active_)
+          throw std::runtime_error("Bank still has open sessions");
+        delete bank_;
+        bank_ = nullptr;
+        return getBank();
+      }
   };
+
+  extern template class BasicBank<NoLockPolicy, OrderedStorage>;
+  extern template class BasicBank<NoLockPolicy, FlatHashStorage>;
+  extern template class BasicBank<MutexLockPolicy, OrderedStorage>;
+  extern template class BasicBank<MutexLockPolicy, FlatHashStorage>;
+  extern template class BasicBank<ShardedLockPolicy<BANK_SHARDS>, OrderedStorage>;
+  extern template class BasicBank<ShardedLockPolicy<BANK_SHARDS>, FlatHashStorage>;
+
+#ifdef ATM_SINGLE_THREADED
+  using Bank = BasicBank<NoLockPolicy, OrderedStorage>;
+#else
+  using Bank = BasicBank<MutexLockPolicy, OrderedStorage>;
+#endif
 }
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include <flat_hash_map.hpp>
+#include <span_trace.hpp>
+
+namespace banking {
+
+  /**
+   * NullMutex - Lockable that does nothing, for single threaded builds
+   */
+  struct NullMutex {
+    void lock() {}
+    void unlock() {}
+    bool try_lock() { return true; }
+  };
+
+  /**
+   * SpanMutex - Mutex whose waits show up in the span of a sampled session
+   *
+   * Only a lock that is already held pays for the span check.
+   */
+  template <typename Mutex>
+    struct SpanMutex {
+      void lock() {
+        if (mutex_.try_lock())
+          return;
+        SpanScope span("mutex wait");
+        mutex_.lock();
+      }
+
+      void unlock() { mutex_.unlock(); }
+      bool try_lock() { return mutex_.try_lock(); }
+
+      Mutex mutex_;
+    };
+
+  /**
+   * LockedTable - A map guarded by a single mutex
+   *
+   * Every operation copies values in or out under the lock so callers never
+   * hold references into the map.
+   */
+  template <typename Map, typename Mutex>
+    class LockedTable {
+      public:
+        using key_type = typename Map::key_type;
+        using mapped_type = typename Map::mapped_type;
+
+        /**
+         * @brief find an element in the table
+         *
+         * @param key
+         * @param value populated with the value if found
+         * @return true if found else false
+         */
+        bool find(const key_type &key, mapped_type &value) {
+          std::lock_guard<Mutex> lck(mutex_);
+          typename Map::iterator it = map_.find(key);
+          if (it != map_.end()) {
+            value = it->second;
+            return true;
+          }
+          return false;
+        }
+
+        /**
+         * @brief Change the value of the element specified by the key
+         *
+         * @param key
+         * @param value
+         * @return true if key found and value changed, else false
+         */
+        bool change(const key_type &key, const mapped_type &value) {
+          std::lock_guard<Mutex> lck(mutex_);
+          typename Map::iterator it = map_.find(key);
+          if (it != map_.end()) {
+            it->second = value;
+            return true;
+          }
+          return false;
+        }
+
+        /**
+         * @brief Add a key-value pair, throws if the key is already present
+         *
+         * @param key
+         * @param value
+         */
+        void add(const key_type &key, const mapped_type &value) {
+          std::lock_guard<Mutex> lck(mutex_);
+          if (!map_.insert(typename Map::value_type(key, value)).second)
+            throw std::runtime_error("Unable to add to map");
+        }
+
+        /**
+         * @brief Delete an element
+         *
+         * @param key
+         */
+        void erase(const key_type &key) {
+          std::lock_guard<Mutex> lck(mutex_);
+          map_.erase(key);
+        }
+
+        /**
+         * @brief Delete an element and hand back its value
+         *
+         * @param key
+         * @param value populated with the value if found
+         * @return true if this call deleted it, false if it was not present
+         */
+        bool remove(const key_type &key, mapped_type &value) {
+          std::lock_guard<Mutex> lck(mutex_);
+          typename Map::iterator it = map_.find(key);
+          if (it == map_.end())
+            return false;
+          value = it->second;
+          map_.erase(key);
+          return true;
+        }
+
+        void clear() {
+          std::lock_guard<Mutex> lck(mutex_);
+          map_.clear();
+        }
+
+        /**
+         * @brief Find the first element matching a predicate, in map order
+         *
+         * @tparam F callable of signature bool(const key_type&, const mapped_type&)
+         * @param pred
+         * @param key populated with the key if found
+         * @param value populated with the value if found
+         * @return true if found else false
+         */
+        template <typename F>
+          bool findIf(F &&pred, key_type &key, mapped_type &value) {
+            std::lock_guard<Mutex> lck(mutex_);
+            for (const auto &element : map_) {
+              if (pred(element.first, element.second)) {
+                key = element.first;
+                value = element.second;
+                return true;
+              }
+            }
+            return false;
+          }
+
+      private:
+        Mutex mutex_;
+        Map map_;
+    };
+
+  /**
+   * ShardedTable - A map split by key hash over shards with their own mutex
+   */
+  template <typename Map, typename Mutex, std::size_t N>
+    class ShardedTable {
+      public:
+        using key_type = typename LockedTable<Map, Mutex>::key_type;
+        using mapped_type = typename LockedTable<Map, Mutex>::mapped_type;
+
+        bool find(const key_type &key, mapped_type &value) {
+          return shard(key).find(key, value);
+        }
+
+        bool change(const key_type &key, const mapped_type &value) {
+          return shard(key).change(key, value);
+        }
+
+        void add(const key_type &key, const mapped_type &value) {
+          shard(key).add(key, value);
+        }
+
+        void erase(const key_type &key) {
+          shard(key).erase(key);
+        }
+
+        bool remove(const key_type &key, mapped_type &value) {
+          return shard(key).remove(key, value);
+        }
+
+        void clear() {
+          for (auto &shard : shards_)
+            shard.clear();
+        }
+
+        template <typename F>
+          bool findIf(F &&pred, key_type &key, mapped_type &value) {
+            for (auto &shard : shards_) {
+              if (shard.findIf(pred, key, value))
+                return true;
+            }
+            return false;
+          }
+
+      private:
+        LockedTable<Map, Mutex>& shard(const key_type &key) {
+          return shards_[std::hash<key_type>()(key) % N];
+        }
+
+        std::array<LockedTable<Map, Mutex>, N> shards_;
+    };
+
+  /**
+   * Lock policies - How the bank synchronizes its tables and id pools
+   *
+   * Only those. The lock free read path, the account table, admission,
+   * holds and the snapshot epoch keep their atomics and mutexes under every
+   * policy, NoLockPolicy drops the table and pool locks and nothing else.
+   */
+  struct NoLockPolicy {
+    using mutex_type = NullMutex;
+    template <typename Map>
+      using table_type = LockedTable<Map, NullMutex>;
+  };
+
+  struct MutexLockPolicy {
+    using mutex_type = SpanMutex<std::mutex>;
+    template <typename Map>
+      using table_type = LockedTable<Map, mutex_type>;
+  };
+
+  template <std::size_t N>
+    struct ShardedLockPolicy {
+      using mutex_type = SpanMutex<std::mutex>;
+      template <typename Map>
+        using table_type = ShardedTable<Map, mutex_type, N>;
+    };
+
+  /**
+   * Storage policies - Which map the bank tables are built on
+   */
+  struct OrderedStorage {
+    template <typename K, typename V>
+      using map_type = std::map<K, V>;
+  };
+
+  struct FlatHashStorage {
+    template <typename K, typename V>
+      using map_type = FlatHashMap<K, V>;
+  };
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <account_table.hpp>
+#include <snapshot_epoch.hpp>
+
+namespace banking {
+
+  /**
+   * LatencyWindow - Latencies of the most recent atm calls, recorded only
+   *                 while someone watches them
+   *
+   * Every sample is one word holding the millisecond it was taken at and the
+   * latency, written into a ring without a lock, so recording costs a clock
+   * read and a store. Readers skip samples older than the age they ask for.
+   */
+  class LatencyWindow {
+    public:
+      using clock_t = std::chrono::steady_clock;
+
+      /**
+       * Scope - Records the time from its construction to its destruction
+       */
+      class Scope {
+        public:
+          explicit Scope(LatencyWindow &window) :
+            window_(window.active() ? &window : nullptr),
+            begin_(window_ ? clock_t::now() : clock_t::time_point()) {}
+
+          ~Scope() {
+            if (window_)
+              window_->record(clock_t::now() - begin_);
+          }
+
+          Scope(const Scope&) = delete;
+          Scope& operator=(const Scope&) = delete;
+
+        private:
+          LatencyWindow *window_;
+          clock_t::time_point begin_;
+      };
+
+      /**
+       * @brief Constructor
+       *
+       * @param capacity samples kept, rounded up to a power of two
+       */
+      explicit LatencyWindow(std::size_t capacity = 1024);
+
+      LatencyWindow(const LatencyWindow&) = delete;
+      LatencyWindow& operator=(const LatencyWindow&) = delete;
+
+      /**
+       * @{name} start and stop recording, watchers nest
+       */
+      void watch() { watchers_.fetch_add(1, std::memory_order_relaxed); }
+      void unwatch() { watchers_.fetch_sub(1, std::memory_order_relaxed); }
+      bool active() const { return watchers_.load(std::memory_order_relaxed) > 0; }
+
+      /**
+       * @brief Add a sample
+       *
+       * @param latency
+       */
+      void record(clock_t::duration latency);
+
+      /**
+       * @brief Latency below which a share of the recent samples fall
+       *
+       * @param quantile between 0 and 1
+       * @param max_age samples older than this are left out
+       * @param min_samples
+       * @return latency, zero if fewer than min_samples are recent enough
+       */
+      clock_t::duration percentile(double quantile, clock_t::duration max_age,
+          std::size_t min_samples = 1) const;
+
+    private:
+      uint32_t millis(clock_t::time_point time) const {
+        return static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(time - origin_).count());
+      }
+
+      const clock_t::time_point origin_;
+      const std::size_t mask_;
+      std::vector<std::atomic<uint64_t>> samples_;
+      std::atomic<std::size_t> next_;
+      std::atomic<int> watchers_;
+  };
+
+  using batch_adjustment_t = std::function<int(long, int)>;
+
+  /**
+   * struct BatchJobConfig - What a batch job applies and how hard it may push
+   */
+  struct BatchJobConfig {
+    /**
+     * @{name} nonzero id, a newer job must have a higher one, see
+     *         AccountTable::adjust
+     */
+    uint64_t job_id_ = 1;
+
+    /**
+     * @{name} threads working on chunks and accounts per chunk, an account
+     *         lock is held only for its own adjustment
+     */
+    std::size_t threads_ = 1;
+    std::size_t chunk_size_ = 256;
+
+    /**
+     * @{name} pause of a thread after every chunk, grown up to max_pause_
+     *         while the p99 of the atm calls watched is over latency_budget_
+     *         and shrunk back once it is under, zero budget to not adapt
+     */
+    std::chrono::microseconds pause_ = std::chrono::microseconds(0);
+    std::chrono::microseconds max_pause_ = std::chrono::milliseconds(50);
+    std::chrono::microseconds latency_budget_ = std::chrono::microseconds(0);
+
+    /**
+     * @{name} file the progress is saved to after every chunk and resumed
+     *         from, empty to not save it
+     */
+    std::string checkpoint_path_;
+  };
+
+  /**
+   * struct BatchProgress - Where a batch job is at
+   */
+  struct BatchProgress {
+    uint64_t job_id_ = 0;
+    std::size_t next_index_ = 0;
+    std::size_t accounts_ = 0;
+    uint64_t applied_ = 0;
+    uint64_t skipped_ = 0;
+    int64_t amount_ = 0;
+    uint64_t throttled_ = 0;
+    std::chrono::microseconds pause_ = std::chrono::microseconds(0);
+    bool done_ = false;
+  };
+
+  /**
+   * BatchJob - Applies an adjustment, such as interest or a fee, to every
+   *            account of a table while atms keep running
+   *
+   * Accounts present when the job starts are cut into chunks that threads
+   * claim one at a time, every account is changed on its own through
+   * AccountTable::adjust, in the snapshot epoch current at that moment, so
+   * a deposit or withdraw runs either before or after the adjustment of its
+   * account and no account waits on another. Every account done stays
+   * marked with the job id, so the chunks past the checkpoint that were
+   * already worked on when the job stopped are skipped when it resumes. The
+   * checkpoint only moves past a chunk once every chunk below it is done.
+   */
+  class BatchJob {
+    public:
+      /**
+       * @brief Constructor
+       *
+       * @param accounts
+       * @param epoch snapshot epoch of the writers of accounts
+       * @param latency atm calls to keep within the budget, or nullptr
+       * @param on_adjusted called with every account changed, or empty
+       * @param config
+       * @param adjustment amount to add given an account id and its balance
+       */
+      BatchJob(AccountTable &accounts, SnapshotEpoch &epoch, LatencyWindow *latency,
+          std::function<void(account_index_t)> on_adjusted, const BatchJobConfig &config,
+          batch_adjustment_t adjustment);
+
+      /**
+       * @brief Destructor, stops the job
+       *
+       */
+      ~BatchJob();
+
+      BatchJob(const BatchJob&) = delete;
+      BatchJob& operator=(const BatchJob&) = delete;
+
+      /**
+       * @brief Start the threads, from the checkpoint if it is of this job,
+       *        or go on from where a stopped run left off
+       *
+       */
+      void start();
+
+      /**
+       * @brief Wait for the job to finish or be stopped
+       *
+       * @param timeout
+       * @return true if finished
+       */
+      bool wait(std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+      /**
+       * @brief Stop once the chunks being worked on are done, the checkpoint
+       *        is kept for resuming
+       *
+       */
+      void stop();
+
+      BatchProgress progress() const;
+
+      /**
+       * @brief Read a checkpoint
+       *
+       * @param path
+       * @param job_id populated with the job saved
+       * @param next_index populated with the first account not known done
+       * @param done populated with whether the job finished
+       * @return false if there is no readable checkpoint
+       */
+      static bool readCheckpoint(const std::string &path, uint64_t &job_id,
+          std::size_t &next_index, bool &done);
+
+    private:
+      /**
+       * @brief Work on chunks until none is left or the job is stopped
+       *
+       */
+      void run();
+
+      /**
+       * @brief Apply the job to a chunk
+       *
+       */
+      void process(std::size_t begin, std::size_t end);
+
+      /**
+       * @brief Mark a chunk done and move the checkpoint past every done chunk
+       *        at its head
+       *
+       */
+      void complete(std::size_t chunk);
+
+      /**
+       * @brief Grow or shrink the pause after a chunk by the latency watched
+       *
+       * @return pause to take
+       */
+      std::chrono::microseconds throttle();
+
+      /**
+       * @brief Save the progress, with mutex_ held
+       *
+       */
+      void saveCheckpoint();
+
+      AccountTable &accounts_;
+      SnapshotEpoch &epoch_;
+      LatencyWindow *latency_;
+      std::function<void(account_index_t)> on_adjusted_;
+      const BatchJobConfig config_;
+      const batch_adjustment_t adjustment_;
+
+      /**
+       * @{name} accounts covered, set by the first start, chunk to hand out
+       *         next, and the chunks done past the checkpoint, under mutex_
+       */
+      bool started_;
+      std::size_t accounts_count_, chunks_;
+      std::atomic<std::size_t> next_chunk_;
+      mutable std::mutex mutex_;
+      std::condition_variable finished_;
+      std::size_t checkpoint_chunk_, running_threads_;
+      std::set<std::size_t> done_chunks_;
+
+      std::atomic<bool> stopping_;
+      std::vector<std::thread> threads_;
+
+      std::atomic<uint64_t> applied_, skipped_, throttled_;
+      std::atomic<int64_t> amount_;
+      std::atomic<int64_t> pause_us_;
+  };
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+namespace banking {
+
+  /**
+   * @{name} bytes two counters written by different threads have to be apart
+   *         so they never share a cache line
+   */
+  const std::size_t CACHE_LINE_BYTES = 64;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace banking {
+
+  /**
+   * CuckooFilter - Approximate set of 64 bit keys supporting deletion
+   *
+   * Buckets of four 16 bit fingerprints; a key lives in one of two buckets
+   * derived from its hash and fingerprint. A fingerprint that can not be
+   * placed after the kicks is kept aside so nothing inserted is ever lost.
+   * False positives are possible, false negatives are not as long as only
+   * inserted keys are erased. Not thread safe, callers guard it.
+   */
+  class CuckooFilter {
+    public:
+      /**
+       * @brief Constructor
+       *
+       * @param capacity number of keys the filter should hold comfortably
+       */
+      explicit CuckooFilter(std::size_t capacity) :
+        has_victim_(false), victim_fp_(0), victim_index_(0), mt_(capacity) {
+        std::size_t bucket_count = 1;
+        while (bucket_count * SLOTS < capacity * 2)
+          bucket_count <<= 1;
+        fingerprints_.assign(bucket_count * SLOTS, 0);
+      }
+
+      /**
+       * @brief Add a key
+       *
+       * @param key
+       * @return false if the filter is too full to place it
+       */
+      bool insert(uint64_t key) {
+        if (has_victim_)
+          return false;
+        uint16_t fp = fingerprint(key);
+        std::size_t i1 = bucket(key);
+        std::size_t i2 = altBucket(i1, fp);
+        if (place(i1, fp) || place(i2, fp))
+          return true;
+
+        std::size_t index = (mt_() & 1) ? i1 : i2;
+        for (int kick = 0; kick < MAX_KICKS; kick++) {
+          uint16_t &victim = fingerprints_[index * SLOTS + mt_() % SLOTS];
+          std::swap(fp, victim);
+          index = altBucket(index, fp);
+          if (place(index, fp))
+            return true;
+        }
+        has_victim_ = true;
+        victim_fp_ = fp;
+        victim_index_ = index;
+        return true;
+      }
+
+      /**
+       * @brief Whether the key may have been inserted
+       *
+       * @param key
+       * @return false if it definitely was not
+       */
+      bool contains(uint64_t key) const {
+        uint16_t fp = fingerprint(key);
+        std::size_t i1 = bucket(key);
+        std::size_t i2 = altBucket(i1, fp);
+        return find(i1, fp) || find(i2, fp) || isVictim(i1, i2, fp);
+      }
+
+      /**
+       * @brief Remove a previously inserted key
+       *
+       * @param key
+       * @return false if no matching fingerprint was found
+       */
+      bool erase(uint64_t key) {
+        uint16_t fp = fingerprint(key);
+        std::size_t i1 = bucket(key);
+        std::size_t i2 = altBucket(i1, fp);
+        if (isVictim(i1, i2, fp)) {
+          has_victim_ = false;
+          return true;
+        }
+        if (!remove(i1, fp) && !remove(i2, fp))
+          return false;
+        if (has_victim_ && place(victim_index_, victim_fp_))
+          has_victim_ = false;
+        return true;
+      }
+
+      std::size_t memoryBytes() const { return fingerprints_.size() * sizeof(uint16_t); }
+
+    private:
+      static const std::size_t SLOTS = 4;
+      static const int MAX_KICKS = 500;
+
+      static uint64_t mix(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+      }
+
+      std::size_t buckets() const { return fingerprints_.size() / SLOTS; }
+
+      uint16_t fingerprint(uint64_t key) const {
+        uint16_t fp = static_cast<uint16_t>(mix(key) >> 48);
+        return fp ? fp : 1;
+      }
+
+      std::size_t bucket(uint64_t key) const {
+        return mix(key) & (buckets() - 1);
+      }
+
+      std::size_t altBucket(std::size_t index, uint16_t fp) const {
+        return (index ^ mix(fp)) & (buckets() - 1);
+      }
+
+      bool isVictim(std::size_t i1, std::size_t i2, uint16_t fp) const {
+        return has_victim_ && victim_fp_ == fp && (victim_index_ == i1 || victim_index_ == i2);
+      }
+
+      bool place(std::size_t index, uint16_t fp) {
+        for (std::size_t slot = 0; slot < SLOTS; slot++) {
+          if (!fingerprints_[index * SLOTS + slot]) {
+            fingerprints_[index * SLOTS + slot] = fp;
+            return true;
+          }
+        }
+        return false;
+      }
+
+      bool find(std::size_t index, uint16_t fp) const {
+        for (std::size_t slot = 0; slot < SLOTS; slot++) {
+          if (fingerprints_[index * SLOTS + slot] == fp)
+            return true;
+        }
+        return false;
+      }
+
+      bool remove(std::size_t index, uint16_t fp) {
+        for (std::size_t slot = 0; slot < SLOTS; slot++) {
+          if (fingerprints_[index * SLOTS + slot] == fp) {
+            fingerprints_[index * SLOTS + slot] = 0;
+            return true;
+          }
+        }
+        return false;
+      }
+
+      std::vector<uint16_t> fingerprints_;
+      bool has_victim_;
+      uint16_t victim_fp_;
+      std::size_t victim_index_;
+      std::minstd_rand mt_;
+  };
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace banking {
+
+  /**
+   * FlatHashMap - Open addressing hash map with all entries in one array
+   *
+   * Linear probing with backward shift deletion, kept at most half full. Only
+   * the subset of the std::map interface the bank tables need is provided.
+   */
+  template <typename K, typename V, typename Hash = std::hash<K>>
+    class FlatHashMap {
+      public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<K, V>;
+
+        template <typename Map, typename Value>
+          class Iterator {
+            public:
+              Iterator(Map *map, std::size_t index) : map_(map), index_(index) { skip(); }
+
+              Value& operator*() const { return map_->slots_[index_]; }
+              Value* operator->() const { return &map_->slots_[index_]; }
+
+              Iterator& operator++() {
+                index_++;
+                skip();
+                return *this;
+              }
+
+              bool operator==(const Iterator &other) const { return index_ == other.index_; }
+              bool operator!=(const Iterator &other) const { return index_ != other.index_; }
+
+            private:
+              void skip() {
+                while (index_ < map_->used_.size() && !map_->used_[index_])
+                  index_++;
+              }
+
+              Map *map_;
+              std::size_t index_;
+          };
+
+        using iterator = Iterator<FlatHashMap, value_type>;
+        using const_iterator = Iterator<const FlatHashMap, const value_type>;
+
+        FlatHashMap() : size_(0) { rehash(16); }
+
+        iterator begin() { return iterator(this, 0); }
+        iterator end() { return iterator(this, slots_.size()); }
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, slots_.size()); }
+
+        std::size_t size() const { return size_; }
+
+        iterator find(const K &key) {
+          return iterator(this, lookup(key));
+        }
+
+        const_iterator find(const K &key) const {
+          return const_iterator(this, lookup(key));
+        }
+
+        std::pair<iterator, bool> insert(const value_type &value) {
+          std::size_t index = lookup(value.first);
+          if (index != slots_.size())
+            return std::make_pair(iterator(this, index), false);
+
+          if ((size_ + 1) * 2 > slots_.size())
+            rehash(slots_.size() * 2);
+          index = place(value);
+          size_++;
+          return std::make_pair(iterator(this, index), true);
+        }
+
+        std::size_t erase(const K &key) {
+          std::size_t index = lookup(key);
+          if (index == slots_.size())
+            return 0;
+
+          std::size_t mask = slots_.size() - 1;
+          std::size_t hole = index;
+          for (std::size_t next = (hole + 1) & mask; used_[next]; next = (next + 1) & mask) {
+            std::size_t home = bucket(slots_[next].first);
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+              slots_[hole] = std::move(slots_[next]);
+              hole = next;
+            }
+          }
+          slots_[hole] = value_type();
+          used_[hole] = false;
+          size_--;
+          return 1;
+        }
+
+        void clear() {
+          slots_.clear();
+          used_.clear();
+          size_ = 0;
+          rehash(16);
+        }
+
+      private:
+        std::size_t bucket(const K &key) const {
+          uint64_t hash = static_cast<uint64_t>(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+          return static_cast<std::size_t>(hash >> 32) & (slots_.size() - 1);
+        }
+
+        /**
+         * @brief Slot index of key, slots_.size() if absent
+         *
+         */
+        std::size_t lookup(const K &key) const {
+          std::size_t mask = slots_.size() - 1;
+          for (std::size_t index = bucket(key); used_[index]; index = (index + 1) & mask) {
+            if (slots_[index].first == key)
+              return index;
+          }
+          return slots_.size();
+        }
+
+        std::size_t place(const value_type &value) {
+          std::size_t mask = slots_.size() - 1;
+          std::size_t index = bucket(value.first);
+          while (used_[index])
+            index = (index + 1) & mask;
+          slots_[index] = value;
+          used_[index] = true;
+          return index;
+        }
+
+        void rehash(std::size_t capacity) {
+          std::vector<value_type> slots(capacity);
+          std::vector<bool> used(capacity, false);
+          slots.swap(slots_);
+          used.swap(used_);
+          for (std::size_t i = 0; i < slots.size(); i++) {
+            if (used[i])
+              place(slots[i]);
+          }
+        }
+
+        std::vector<value_type> slots_;
+        std::vector<bool> used_;
+        std::size_t size_;
+    };
+}
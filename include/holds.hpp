@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <account_table.hpp>
+
+namespace banking {
+
+  /**
+   * struct HoldMetrics - Counters of a HoldTable
+   */
+  struct HoldMetrics {
+    std::size_t active_ = 0;
+    uint64_t authorized_ = 0;
+    uint64_t declined_ = 0;
+    uint64_t settled_ = 0;
+    uint64_t released_ = 0;
+    uint64_t expired_ = 0;
+  };
+
+  /**
+   * HoldTable - Holds on account funds between authorizing a withdraw and
+   *             settling it
+   *
+   * authorize() reserves the funds without locking the account, settle()
+   * turns the hold into the withdraw and release() drops it. A hold neither
+   * settled nor released within the time to live is dropped by expire(),
+   * which authorize() also runs, so funds held by a session that went away
+   * come back on their own. Exactly one of settle, release and expire wins
+   * a hold. A pinned hold is left out of expire(), its owner settles or
+   * releases it, so settling it after dispensing can not fail.
+   */
+  class HoldTable {
+    public:
+      using clock_t = std::chrono::steady_clock;
+
+      /**
+       * @brief Constructor
+       *
+       * @param accounts table the held accounts live in
+       * @param capacity holds open at once
+       * @param ttl time a hold lives unless settled or released
+       */
+      HoldTable(AccountTable &accounts, std::size_t capacity, clock_t::duration ttl);
+
+      HoldTable(const HoldTable&) = delete;
+      HoldTable& operator=(const HoldTable&) = delete;
+
+      /**
+       * @brief Hold funds of an account
+       *
+       * @param index
+       * @param amount
+       * @param hold_id populated with the id of the hold
+       * @param pinned true if the hold never expires
+       * @return false if the available funds are short or no hold is free
+       */
+      bool authorize(account_index_t index, int amount, uint64_t &hold_id, bool pinned = false);
+
+      /**
+       * @brief Add funds already put on hold in the account table, by a
+       *        committed AccountTransaction, to a pinned hold
+       *
+       * @param hold_id
+       * @param amount
+       * @return false if the hold is not open
+       */
+      bool adopt(uint64_t hold_id, int amount);
+
+      /**
+       * @brief Withdraw the held funds
+       *
+       * @param hold_id
+       * @param epoch snapshot epoch the withdraw lands in, 0 if none
+       * @return false if the hold expired or was already closed
+       */
+      bool settle(uint64_t hold_id, uint64_t epoch = 0);
+
+      /**
+       * @brief Give the held funds back
+       *
+       * @param hold_id
+       * @return false if the hold expired or was already closed
+       */
+      bool release(uint64_t hold_id);
+
+      /**
+       * @brief Drop every hold past its time to live
+       *
+       * @param now
+       * @return holds dropped
+       */
+      std::size_t expire(clock_t::time_point now = clock_t::now());
+
+      HoldMetrics metrics() const;
+
+    private:
+      /**
+       * struct Slot - A hold, open while hold_id_ carries the id handed out
+       */
+      struct Slot {
+        std::atomic<uint64_t> hold_id_;
+        uint32_t generation_;
+        account_index_t index_;
+        int amount_;
+      };
+
+      /**
+       * @brief Take a hold away from whoever else may be closing it
+       *
+       * @param hold_id
+       * @return slot of the hold if this caller closed it, else nullptr
+       */
+      Slot* close(uint64_t hold_id);
+
+      /**
+       * @brief Put the slot of a closed hold back on the free list
+       *
+       */
+      void recycle(Slot *slot);
+
+      AccountTable &accounts_;
+      std::size_t capacity_;
+      clock_t::duration ttl_;
+      std::unique_ptr<Slot[]> slots_;
+
+      std::mutex mutex_;
+      std::vector<uint32_t> free_;
+      std::deque<std::pair<clock_t::time_point, uint64_t>> expiries_;
+
+      std::atomic<std::size_t> active_;
+      std::atomic<uint64_t> authorized_, declined_, settled_, released_, expired_;
+  };
+
+  /**
+   * HoldScope - Pinned holds taken by one call, released when it returns or
+   *             throws without having settled or released them, so an atm
+   *             callback throwing can not keep funds held for good
+   */
+  class HoldScope {
+    public:
+      HoldScope(HoldTable &holds, std::size_t count) : holds_(holds), hold_ids_(count, 0) {}
+
+      ~HoldScope() { releaseAll(); }
+
+      HoldScope(const HoldScope&) = delete;
+      HoldScope& operator=(const HoldScope&) = delete;
+
+      /**
+       * @brief Id of the i-th hold, 0 while none is taken
+       *
+       */
+      uint64_t& operator[](std::size_t i) { return hold_ids_[i]; }
+
+      /**
+       * @brief Settle the i-th hold, it is no longer released on the way out
+       *
+       */
+      bool settle(std::size_t i, uint64_t epoch = 0) {
+        uint64_t hold_id = hold_ids_[i];
+        hold_ids_[i] = 0;
+        return hold_id && holds_.settle(hold_id, epoch);
+      }
+
+      /**
+       * @brief Release the i-th hold now
+       *
+       */
+      bool release(std::size_t i) {
+        uint64_t hold_id = hold_ids_[i];
+        hold_ids_[i] = 0;
+        return hold_id && holds_.release(hold_id);
+      }
+
+      void releaseAll() {
+        for (std::size_t i = 0; i < hold_ids_.size(); i++)
+          release(i);
+      }
+
+    private:
+      HoldTable &holds_;
+      std::vector<uint64_t> hold_ids_;
+  };
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace banking {
+
+  enum JournalOp {
+    JOURNAL_LINK_ACCOUNT,
+    JOURNAL_BALANCE
+  };
+
+  /**
+   * struct JournalRecord - One change made on the primary bank
+   *
+   * Accounts are told apart by account_index_, their position in the
+   * primary's account table, as account ids may repeat. A link record adds
+   * an account to a card, creating the card if it is new. A balance record
+   * carries the balance of an account as of version_, the account's sequence
+   * on the primary; a replica keeps the highest version it saw, so records
+   * of one account may arrive in any order.
+   */
+  struct JournalRecord {
+    uint64_t seq_;
+    uint64_t time_ns_;
+    JournalOp op_;
+    long card_no_;
+    long account_id_;
+    uint32_t account_index_;
+    uint64_t version_;
+    int balance_;
+    std::string holder_name_;
+  };
+
+  /**
+   * @brief Append the binary encoding of a record to a buffer
+   *
+   * @param record
+   * @param out
+   */
+  void encodeJournalRecord(const JournalRecord &record, std::string &out);
+
+  /**
+   * @brief Decode one record from a buffer
+   *
+   * @param in
+   * @param pos offset to decode from, advanced past the record
+   * @param record
+   * @return false if the buffer ends before a complete record
+   */
+  bool decodeJournalRecord(const std::string &in, std::size_t &pos, JournalRecord &record);
+
+  /**
+   * ChangeJournal - Bounded in process stream of changes from a primary bank
+   *                 to its replicas
+   *
+   * The primary never waits on a slow replica for longer than max_wait: a
+   * record that still finds the journal full is dropped and the journal is
+   * marked for resync, attaching it to the bank again republishes every
+   * account with its current balance. Relayed records wait for room instead,
+   * holding back the sender. A single consumer reads.
+   */
+  class ChangeJournal {
+    public:
+      using clock_t = std::chrono::steady_clock;
+
+      /**
+       * @brief Constructor
+       *
+       * @param capacity records buffered before the primary waits
+       * @param max_wait longest the primary waits for room before dropping
+       */
+      explicit ChangeJournal(std::size_t capacity, clock_t::duration max_wait = clock_t::duration::zero());
+
+      ChangeJournal(const ChangeJournal&) = delete;
+      ChangeJournal& operator=(const ChangeJournal&) = delete;
+
+      /**
+       * @brief Stamp a record with the next sequence number and the time, and
+       *        append it
+       *
+       * @param record
+       * @return false if the journal was closed, or full and the record
+       *         dropped
+       */
+      bool publish(JournalRecord &record);
+
+      /**
+       * @brief Append a record stamped by another journal, for relaying
+       *
+       * @param record
+       * @return false if the journal was closed
+       */
+      bool push(const JournalRecord &record);
+
+      /**
+       * @brief Take the records appended so far
+       *
+       * @param records populated with up to max records, oldest first
+       * @param max
+       * @param timeout longest to wait for a first record
+       * @return false once the journal is closed and drained
+       */
+      bool consume(std::vector<JournalRecord> &records, std::size_t max,
+          clock_t::duration timeout);
+
+      /**
+       * @brief Refuse further records and wake the consumer
+       *
+       */
+      void close();
+
+      /**
+       * @brief Sequence number of the last record appended
+       *
+       */
+      uint64_t head() const;
+
+      /**
+       * @brief Records dropped because the journal was full
+       *
+       */
+      uint64_t dropped() const;
+
+      /**
+       * @brief Clear the resync mark
+       *
+       * @return true if records were dropped since the last call, the
+       *         replica misses changes until the journal is attached again
+       */
+      bool takeResync();
+
+      /**
+       * @brief Nanoseconds on the clock records are stamped with
+       *
+       */
+      static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_t::now().time_since_epoch()).count();
+      }
+
+    private:
+      std::size_t capacity_;
+      clock_t::duration max_wait_;
+      mutable std::mutex mutex_;
+      std::condition_variable not_full_, not_empty_;
+      std::deque<JournalRecord> records_;
+      uint64_t head_;
+      uint64_t dropped_;
+      bool resync_;
+      bool closed_;
+  };
+
+  /**
+   * @brief Stream the records of a journal over a file descriptor, such as a
+   *        local socket, until the journal is closed or the write fails
+   *
+   * @param journal
+   * @param fd
+   * @return records sent
+   */
+  uint64_t sendJournal(ChangeJournal &journal, int fd);
+
+  /**
+   * @brief Push the records read off a file descriptor into a journal until
+   *        the other end closes it, then close the journal
+   *
+   * @param fd
+   * @param journal
+   * @return records received
+   */
+  uint64_t receiveJournal(int fd, ChangeJournal &journal);
+}
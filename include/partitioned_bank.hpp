@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bank.hpp>
+#include <flat_hash_map.hpp>
+#include <spsc_ring.hpp>
+
+namespace banking {
+
+  enum PartitionOp {
+    PARTITION_CREATE_ACCOUNT,
+    PARTITION_VERIFY,
+    PARTITION_LIST_ACCOUNTS,
+    PARTITION_SELECT_ACCOUNT,
+    PARTITION_CHECK_BALANCE,
+    PARTITION_DEPOSIT,
+    PARTITION_REVERSE_DEPOSIT,
+    PARTITION_HOLD,
+    PARTITION_SETTLE,
+    PARTITION_RELEASE,
+    PARTITION_END_SESSION
+  };
+
+  /**
+   * struct PartitionRequest - A call from an atm to the worker owning a card
+   *                           or session
+   */
+  struct PartitionRequest {
+    PartitionOp op_;
+    long card_no_;
+    int card_pin_;
+    int token_;
+    long account_no_;
+    int amount_;
+    std::string holder_name_;
+  };
+
+  /**
+   * struct PartitionReply - Answer of a worker, value_ is the card number,
+   *                         token or balance asked for
+   */
+  struct PartitionReply {
+    bool ok_;
+    long value_;
+    InlineList<long, 3> accounts_;
+  };
+
+  class AtmPort;
+
+  /**
+   * PartitionedBank - The bank as shared nothing workers, each pinned to a
+   *                   core and owning a partition of the cards
+   *
+   * A card, its accounts and the sessions opened with it belong to worker
+   * card_no % workers, and so do account ids and transaction tokens, so a
+   * request goes straight to its owner and no bank state is ever touched by
+   * two threads. Atms talk to the workers through an AtmPort, over one pair
+   * of single producer single consumer rings per atm and worker. Withdrawals
+   * hold the funds until the atm reports back, like BasicBank. An atm posts
+   * the requests it needs no answer to and goes on, up to RING_CAPACITY per
+   * worker.
+   */
+  class PartitionedBank {
+    public:
+      /**
+       * @brief Constructor, starts the workers
+       *
+       * @param workers
+       * @param max_atms ports that can be connected
+       * @param pin_cores pin worker i to core i modulo the cores present
+       */
+      PartitionedBank(std::size_t workers, std::size_t max_atms, bool pin_cores = true);
+
+      /**
+       * @brief Destructor, stops the workers, every port must be idle
+       *
+       */
+      ~PartitionedBank();
+
+      PartitionedBank(const PartitionedBank&) = delete;
+      PartitionedBank& operator=(const PartitionedBank&) = delete;
+
+      /**
+       * @brief Port for one atm, used by a single thread at a time
+       *
+       * @return port, throws once max_atms ports are connected
+       */
+      std::unique_ptr<AtmPort> connect();
+
+      std::size_t workers() const { return workers_.size(); }
+
+      static const std::size_t RING_CAPACITY = 64;
+
+    private:
+      friend class AtmPort;
+
+      struct Partition;
+
+      /**
+       * struct Channel - Rings between one atm and one worker
+       */
+      struct Channel {
+        Channel() : requests_(RING_CAPACITY), replies_(RING_CAPACITY) {}
+
+        /**
+         * @{name} keep the cache line alignment of the rings, which the
+         *         global operator new does not before C++17
+         */
+        static void* operator new(std::size_t size);
+        static void operator delete(void *channel);
+
+        SpscRing<PartitionRequest> requests_;
+        SpscRing<PartitionReply> replies_;
+      };
+
+      /**
+       * struct Worker - A worker thread, its partition and its channels
+       */
+      struct Worker {
+        std::unique_ptr<Partition> partition_;
+        std::vector<std::unique_ptr<Channel>> channels_;
+        std::thread thread_;
+      };
+
+      /**
+       * @brief Serve the channels of a worker until stopped
+       *
+       */
+      void run(std::size_t worker, bool pin_core);
+
+      std::vector<std::unique_ptr<Worker>> workers_;
+      std::size_t max_atms_;
+      std::atomic<std::size_t> ports_;
+      std::atomic<bool> running_;
+  };
+
+  /**
+   * AtmPort - An atm's connection to a PartitionedBank, with the calls of
+   *           BasicBank
+   *
+   * The atm callbacks run on the atm's own thread, never on a worker.
+   */
+  class AtmPort {
+    public:
+      AtmPort(PartitionedBank &bank, std::size_t port) :
+        bank_(bank), port_(port), next_worker_(port), unanswered_(bank.workers(), 0) {}
+
+      /**
+       * @brief Destructor, waits for the replies to posted requests
+       *
+       */
+      ~AtmPort();
+
+      AtmPort(const AtmPort&) = delete;
+      AtmPort& operator=(const AtmPort&) = delete;
+
+      /**
+       * @brief See BasicBank::createAndLinkAccount, a new card goes to the
+       *        next worker in turn
+       *
+       */
+      long createAndLinkAccount(const std::string &holder_name, int amount, long card_no = -1);
+
+      /**
+       * @brief See BasicBank::verifyAndCreateTransaction
+       *
+       */
+      int verifyAndCreateTransaction(long card_no, int card_pin);
+
+      /**
+       * @brief See BasicBank::acknowledgeTransaction
+       *
+       */
+      void acknowledgeTransaction(int transaction_token, atm_cb_t atm_cb);
+
+      /**
+       * @brief See BasicBank::selectAccount
+       *
+       */
+      void selectAccount(int transaction_token, long account_no);
+
+      /**
+       * @brief See BasicBank::performTransaction, ends the session
+       *
+       */
+      void performTransaction(int transaction_token, TransactionType trans_type, int amount);
+
+      /**
+       * @brief See BasicBank::listAccounts
+       *
+       */
+      bool listAccounts(long card_no, std::vector<long> &account_no);
+
+    private:
+      /**
+       * @brief Send a request to a worker and wait for its reply
+       *
+       */
+      PartitionReply call(std::size_t worker, PartitionRequest &request);
+
+      /**
+       * @brief Send a request to a worker without waiting, its reply is
+       *        skipped by a later call
+       *
+       */
+      void post(std::size_t worker, PartitionRequest &request);
+
+      /**
+       * @brief Wait for the oldest reply of a worker not taken yet
+       *
+       */
+      PartitionReply receive(std::size_t worker);
+
+      std::size_t owner(long id) const { return static_cast<std::size_t>(id) % bank_.workers(); }
+
+      /**
+       * @brief End a session on its worker and forget its callback
+       *
+       */
+      void endSession(int transaction_token, bool show_error);
+
+      PartitionedBank &bank_;
+      std::size_t port_, next_worker_;
+      std::vector<std::size_t> unanswered_;
+      FlatHashMap<int, atm_cb_t> atm_cbs_;
+  };
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cache_line.hpp>
+
+namespace banking {
+
+  const std::size_t RCU_READER_SHARDS = 16;
+
+  /**
+   * RcuTable - Fixed size table of immutable snapshots with lock free readers
+   *
+   * Readers pin the current epoch with a counter, load the slot pointer and use
+   * the snapshot until the guard goes out of scope. Writers swap in a new
+   * snapshot and retire the old one; retired snapshots are freed once every
+   * reader of the epoch they were unlinked in has left. Writers never wait for
+   * readers, reclamation is simply deferred to a later publish. The reader
+   * counters are spread over RCU_READER_SHARDS cache lines, a thread always
+   * counting on the same one, so readers on different cores rarely share a
+   * line and a writer sums the shards.
+   */
+  template <typename V>
+    class RcuTable {
+      public:
+        /**
+         * ReadGuard - Keeps the snapshots read through it alive
+         */
+        class ReadGuard {
+          public:
+            explicit ReadGuard(const RcuTable &table) :
+              table_(table), readers_(table.readers_[readerShard()]) {
+              for (;;) {
+                epoch_ = table_.epoch_.load(std::memory_order_acquire);
+                readers_.active_[epoch_ & 1].fetch_add(1, std::memory_order_seq_cst);
+                if (table_.epoch_.load(std::memory_order_seq_cst) == epoch_)
+                  break;
+                readers_.active_[epoch_ & 1].fetch_sub(1, std::memory_order_release);
+              }
+            }
+
+            ~ReadGuard() {
+              readers_.active_[epoch_ & 1].fetch_sub(1, std::memory_order_release);
+            }
+
+            ReadGuard(const ReadGuard&) = delete;
+            ReadGuard& operator=(const ReadGuard&) = delete;
+
+            /**
+             * @brief Snapshot stored at key
+             *
+             * @param key
+             * @return snapshot or nullptr if the slot is empty
+             */
+            const V* get(std::size_t key) const {
+              if (key >= table_.slots_.size())
+                return nullptr;
+              return table_.slots_[key].load(std::memory_order_acquire);
+            }
+
+          private:
+            const RcuTable &table_;
+            typename RcuTable::Readers &readers_;
+            uint64_t epoch_;
+        };
+
+        /**
+         * @brief Constructor
+         *
+         * @param size number of slots
+         */
+        explicit RcuTable(std::size_t size) : slots_(size), epoch_(0) {
+          for (auto &slot : slots_)
+            slot.store(nullptr, std::memory_order_relaxed);
+          for (auto &readers : readers_) {
+            readers.active_[0].store(0);
+            readers.active_[1].store(0);
+          }
+        }
+
+        ~RcuTable() {
+          for (auto &slot : slots_)
+            delete slot.load(std::memory_order_relaxed);
+        }
+
+        RcuTable(const RcuTable&) = delete;
+        RcuTable& operator=(const RcuTable&) = delete;
+
+        /**
+         * @brief Replace the snapshot at key
+         *
+         * @param key
+         * @param value new snapshot, nullptr to empty the slot
+         * @return false if key is out of range
+         */
+        bool publish(std::size_t key, std::unique_ptr<const V> value) {
+          if (key >= slots_.size())
+            return false;
+          const V *old = slots_[key].exchange(value.release(), std::memory_order_acq_rel);
+          std::lock_guard<std::mutex> lck(retire_mutex_);
+          if (old)
+            retired_current_.emplace_back(old);
+          reclaim();
+          return true;
+        }
+
+        /**
+         * @brief Empty the slot at key
+         *
+         * @param key
+         */
+        void remove(std::size_t key) {
+          publish(key, nullptr);
+        }
+
+      private:
+        /**
+         * struct Readers - Readers of each epoch parity counted on one shard,
+         *                  padded so two shards are a cache line apart
+         */
+        struct Readers {
+          std::atomic<long> active_[2];
+          char pad_[CACHE_LINE_BYTES - sizeof(std::atomic<long>[2])];
+        };
+
+        /**
+         * @brief Shard the calling thread counts itself on, handed out in turn
+         *
+         */
+        static std::size_t readerShard() {
+          static std::atomic<std::size_t> next_shard(0);
+          thread_local std::size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % RCU_READER_SHARDS;
+          return shard;
+        }
+
+        /**
+         * @brief Free snapshots whose grace period has elapsed and open a new epoch
+         *
+         * Must be called with retire_mutex_ held. A reader counted after its
+         * shard was summed sees the new epoch when it checks again and backs
+         * off, as with a single counter.
+         */
+        void reclaim() {
+          uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+          for (const auto &readers : readers_) {
+            if (readers.active_[(epoch + 1) & 1].load(std::memory_order_seq_cst) != 0)
+              return;
+          }
+          retired_previous_.clear();
+          if (retired_current_.empty())
+            return;
+          retired_previous_.swap(retired_current_);
+          epoch_.store(epoch + 1, std::memory_order_seq_cst);
+        }
+
+        std::vector<std::atomic<const V*>> slots_;
+
+        mutable std::atomic<uint64_t> epoch_;
+        mutable Readers readers_[RCU_READER_SHARDS];
+
+        std::mutex retire_mutex_;
+        std::vector<std::unique_ptr<const V>> retired_current_, retired_previous_;
+    };
+}
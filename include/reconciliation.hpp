@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <account_card.hpp>
+
+namespace banking {
+
+  /**
+   * struct ActivityTotals - Money moved by deposits and withdrawals
+   */
+  struct ActivityTotals {
+    int64_t deposits_ = 0;
+    int64_t withdrawals_ = 0;
+    int64_t deposit_count_ = 0;
+    int64_t withdraw_count_ = 0;
+
+    ActivityTotals& operator+=(const ActivityTotals &other) {
+      deposits_ += other.deposits_;
+      withdrawals_ += other.withdrawals_;
+      deposit_count_ += other.deposit_count_;
+      withdraw_count_ += other.withdraw_count_;
+      return *this;
+    }
+
+    bool empty() const { return !deposit_count_ && !withdraw_count_; }
+  };
+
+  /**
+   * ActivityLedger - Lock free activity counters for a fixed range of keys
+   *
+   * Counters are kept per parity of the snapshot epoch they are recorded in, so
+   * a closed epoch can be folded into the running totals while writers of the
+   * current one keep counting on the other side.
+   */
+  class ActivityLedger {
+    public:
+      /**
+       * @brief Constructor
+       *
+       * @param keys number of keys, keys are 0 to keys - 1
+       */
+      explicit ActivityLedger(std::size_t keys);
+
+      /**
+       * @brief Count a deposit or withdraw, a negative count undoes one
+       *
+       * @param epoch snapshot epoch the transaction runs in
+       * @param key
+       * @param trans_type
+       * @param amount
+       * @param count
+       */
+      void record(uint64_t epoch, std::size_t key, TransactionType trans_type,
+          int64_t amount, int64_t count = 1);
+
+      /**
+       * @brief Fold a closed epoch into the totals, no writer may still be in it
+       *        and callers must serialize among themselves
+       *
+       * @param epoch closed epoch
+       * @param totals populated with the totals of every epoch up to it
+       */
+      void fold(uint64_t epoch, std::vector<ActivityTotals> &totals);
+
+    private:
+      /**
+       * struct Counters - ActivityTotals updated without a lock
+       */
+      struct Counters {
+        std::atomic<int64_t> deposits_;
+        std::atomic<int64_t> withdrawals_;
+        std::atomic<int64_t> deposit_count_;
+        std::atomic<int64_t> withdraw_count_;
+      };
+
+      std::vector<Counters> pending_[2];
+      std::vector<ActivityTotals> totals_;
+  };
+
+  /**
+   * struct BalanceSnapshot - Balances and activity as of one snapshot cut
+   *
+   * Balances sit in one contiguous array grouped by card, the accounts of the
+   * i-th card being [card_offsets_[i], card_offsets_[i + 1]).
+   */
+  struct BalanceSnapshot {
+    uint64_t epoch_ = 0;
+    std::vector<long> card_nos_;
+    std::vector<std::size_t> card_offsets_;
+    std::vector<long> account_ids_;
+    std::vector<int64_t> balances_;
+    std::vector<ActivityTotals> card_activity_;
+    std::vector<ActivityTotals> atm_activity_;
+  };
+
+  /**
+   * struct AtmReport - Totals of the transactions done at an atm
+   */
+  struct AtmReport {
+    int atm_id_;
+    ActivityTotals activity_;
+  };
+
+  /**
+   * struct ReconciliationReport - Global, per card and per atm totals, card
+   *                               balances are in the order of the snapshot's
+   *                               card_nos_
+   */
+  struct ReconciliationReport {
+    uint64_t epoch_ = 0;
+    std::size_t accounts_ = 0;
+    int64_t total_balance_ = 0;
+    int64_t min_balance_ = 0;
+    int64_t max_balance_ = 0;
+    std::size_t negative_balances_ = 0;
+    ActivityTotals activity_;
+    std::vector<int64_t> card_balances_;
+    std::vector<AtmReport> atms_;
+  };
+
+  /**
+   * @brief Reduce a snapshot into its report, cards are split into ranges of
+   *        about equal account count scanned by their own thread
+   *
+   * @param snapshot
+   * @param threads number of threads scanning, at least 1
+   * @return report, atms without activity are left out
+   */
+  ReconciliationReport reconcile(const BalanceSnapshot &snapshot, unsigned threads);
+}
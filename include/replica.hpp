@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bank.hpp>
+#include <flat_hash_map.hpp>
+#include <journal.hpp>
+
+namespace banking {
+
+  /**
+   * struct ReplicaMetrics - How far a replica is behind its primary
+   */
+  struct ReplicaMetrics {
+    uint64_t applied_ = 0;
+    uint64_t applied_seq_ = 0;
+    uint64_t head_seq_ = 0;
+    uint64_t lag_records_ = 0;
+    uint64_t last_lag_ns_ = 0;
+    uint64_t max_lag_ns_ = 0;
+    uint64_t stale_ = 0;
+    uint64_t dropped_ = 0;
+  };
+
+  /**
+   * BankReplica - Hot standby copy of the bank's cards and balances, fed by
+   *               the journal of the primary
+   *
+   * Serves balance inquiries, account listings and the back office lookup
+   * without touching the primary, lock free like the primary's read path.
+   * Records are applied by one applier at a time, either the thread started
+   * by start() or callers of poll(). Lag is the time from the primary
+   * publishing a record to the replica applying it. Records the primary
+   * dropped on a full journal are made up by attaching the journal again,
+   * links of accounts already known then refresh their balance.
+   */
+  class BankReplica {
+    public:
+      /**
+       * @brief Constructor
+       *
+       * @param journal journal the primary publishes to, directly or relayed
+       *        over a local socket with receiveJournal
+       */
+      explicit BankReplica(ChangeJournal &journal);
+
+      ~BankReplica();
+
+      BankReplica(const BankReplica&) = delete;
+      BankReplica& operator=(const BankReplica&) = delete;
+
+      /**
+       * @brief Apply the journal on a background thread
+       *
+       */
+      void start();
+
+      /**
+       * @brief Stop the background applier, records not yet applied stay in
+       *        the journal
+       *
+       */
+      void stop();
+
+      /**
+       * @brief Apply the records in the journal
+       *
+       * @param timeout longest to wait for a first record
+       * @return records applied
+       */
+      std::size_t poll(ChangeJournal::clock_t::duration timeout = ChangeJournal::clock_t::duration::zero());
+
+      /**
+       * @brief Wait until every record up to a sequence number is applied
+       *
+       * @param seq
+       * @param timeout
+       * @return false if the replica is still behind
+       */
+      bool catchUp(uint64_t seq, ChangeJournal::clock_t::duration timeout);
+
+      /**
+       * @brief Balance of an account of a card, as of the records applied
+       *
+       * @param card_no
+       * @param card_pin
+       * @param account_no
+       * @param amount populated with the balance
+       * @return false if the card does not verify or the account is not
+       *         linked to it
+       */
+      bool checkBalance(long card_no, int card_pin, long account_no, int &amount);
+
+      /**
+       * @brief See BasicBank::listAccounts
+       *
+       */
+      bool listAccounts(long card_no, std::vector<long> &account_no);
+
+      /**
+       * @brief See BasicBank::privilegedOperation
+       *
+       */
+      bool privilegedOperation(const int &passcode, const std::string &holder_name,
+          std::vector<long> &account_no, long &card_no);
+
+      ReplicaMetrics metrics() const;
+
+      /**
+       * @brief Fail over to the replica: apply what is left of the journal,
+       *        close it so the old primary can not feed it any more, and
+       *        replace the bank with one holding the replica's cards and
+       *        balances. Reads on the replica fail from then on.
+       *
+       * The bank in place has to be quiescent, see Bank::replaceBank.
+       *
+       * @return the promoted bank
+       * @throws std::runtime_error if the bank in place has a session open,
+       *         nothing is changed then
+       */
+      Bank* promote();
+
+    private:
+      /**
+       * struct ReplicaCard - Immutable snapshot of a card and its accounts
+       */
+      struct ReplicaCard {
+        CardPtr card_;
+        AccountIndexList accounts_;
+      };
+
+      /**
+       * @brief Apply one record, with apply_mutex_ held
+       *
+       */
+      void apply(const JournalRecord &record);
+
+      /**
+       * @brief Set the balance of an account if the version is newer than
+       *        the one applied
+       *
+       */
+      void applyBalance(account_index_t index, uint64_t version, int balance);
+
+      ChangeJournal &journal_;
+      AccountTable accounts_;
+      RcuTable<ReplicaCard> cards_;
+
+      /**
+       * @{name} applier state, keyed by position on the primary: account
+       *         positions on the replica, primary versions and balances of
+       *         accounts whose link has not arrived yet
+       */
+      std::mutex apply_mutex_;
+      FlatHashMap<account_index_t, account_index_t> indexes_;
+      std::vector<uint64_t> versions_;
+      FlatHashMap<account_index_t, std::pair<uint64_t, int>> pending_;
+
+      std::atomic<bool> running_, promoted_;
+      std::thread applier_;
+
+      std::atomic<uint64_t> applied_, applied_seq_, last_lag_ns_, max_lag_ns_, stale_;
+  };
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cuckoo_filter.hpp>
+#include <flat_hash_map.hpp>
+
+namespace banking {
+
+  enum DedupeStatus {
+    DEDUPE_NEW,
+    DEDUPE_DUPLICATE,
+    DEDUPE_IN_FLIGHT
+  };
+
+  /**
+   * RequestDedupe - Bounded memory record of recently seen request ids
+   *
+   * A request is named by its id within a scope, the same id from two scopes
+   * is two requests. Ids are spread over shards, each with a cuckoo filter answering the common
+   * "never seen" case and a fixed ring of exact entries holding the recorded
+   * result. Entries leave when they are older than the window or when their
+   * ring slot is reused, so memory stays at what the constructor allocates no
+   * matter the request rate; a retry arriving after that is treated as new.
+   * Once more than capacity requests arrive within the window the ring, not
+   * the window, bounds how long a request is remembered.
+   *
+   * A filter refusing an id is rebuilt from the ring, if that fails as well
+   * the shard looks every id up in the exact index until a later rebuild
+   * succeeds, the filter never hides an id that is remembered.
+   *
+   * @tparam Value result recorded for a request
+   * @tparam Mutex lockable guarding a shard
+   * @tparam Filter approximate membership of the ids of a shard
+   */
+  template <typename Value, typename Mutex, typename Filter = CuckooFilter>
+    class RequestDedupe {
+      public:
+        using clock_t = std::chrono::steady_clock;
+
+        /**
+         * @brief Constructor
+         *
+         * @param capacity total number of requests remembered
+         * @param window how long a request is remembered
+         * @param shards number of independently locked shards
+         */
+        RequestDedupe(std::size_t capacity, clock_t::duration window, std::size_t shards = 16) :
+          window_(window) {
+            for (std::size_t i = 0; i < shards; i++)
+              shards_.emplace_back(new Shard((capacity + shards - 1) / shards));
+          }
+
+        /**
+         * @brief Look up a request and reserve it if it was not seen
+         *
+         * @param scope who sent the request, a card or an atm
+         * @param request_id
+         * @param value recorded with a new request, replaced by what was
+         *        recorded for a request seen before
+         * @return DEDUPE_NEW if reserved, DEDUPE_DUPLICATE if completed before,
+         *         DEDUPE_IN_FLIGHT if reserved and not yet completed
+         */
+        DedupeStatus begin(uint64_t scope, uint64_t request_id, Value &value) {
+          uint64_t key = keyOf(scope, request_id);
+          Shard &shard = shardOf(key);
+          clock_t::time_point now = clock_t::now();
+          std::lock_guard<Mutex> lck(shard.mutex_);
+
+          if (!shard.filtered_ || shard.filter_.contains(key)) {
+            typename FlatHashMap<uint64_t, std::size_t>::iterator it = shard.index_.find(key);
+            if (it != shard.index_.end()) {
+              Entry &entry = shard.ring_[it->second];
+              // Two requests mixing to one key, the older one is forgotten
+              if (entry.scope_ == scope && entry.request_id_ == request_id &&
+                  now - entry.time_ <= window_) {
+                value = entry.value_;
+                return entry.completed_ ? DEDUPE_DUPLICATE : DEDUPE_IN_FLIGHT;
+              }
+              evict(shard, it->second);
+            }
+          }
+
+          std::size_t slot = shard.next_;
+          shard.next_ = (shard.next_ + 1) % shard.ring_.size();
+          evict(shard, slot);
+
+          Entry &entry = shard.ring_[slot];
+          entry.key_ = key;
+          entry.scope_ = scope;
+          entry.request_id_ = request_id;
+          entry.time_ = now;
+          entry.used_ = true;
+          entry.completed_ = false;
+          entry.value_ = value;
+          shard.index_.insert(std::make_pair(key, slot));
+          if (shard.filtered_ ? !shard.filter_.insert(key) : shard.next_ == 0)
+            rebuildFilter(shard);
+          return DEDUPE_NEW;
+        }
+
+        /**
+         * @brief Record the result of a request reserved by begin
+         *
+         * @param scope
+         * @param request_id
+         * @param value
+         */
+        void complete(uint64_t scope, uint64_t request_id, const Value &value) {
+          uint64_t key = keyOf(scope, request_id);
+          Shard &shard = shardOf(key);
+          std::lock_guard<Mutex> lck(shard.mutex_);
+          typename FlatHashMap<uint64_t, std::size_t>::iterator it = shard.index_.find(key);
+          if (it == shard.index_.end())
+            return;
+          Entry &entry = shard.ring_[it->second];
+          if (entry.scope_ != scope || entry.request_id_ != request_id)
+            return;
+          entry.value_ = value;
+          entry.completed_ = true;
+        }
+
+        /**
+         * @brief Upper bound of the bytes held by the filters, indexes and rings
+         *
+         */
+        std::size_t memoryBytes() const {
+          std::size_t bytes = 0;
+          for (const auto &shard : shards_) {
+            bytes += sizeof(Shard) + shard->filter_.memoryBytes() +
+              shard->ring_.size() * (sizeof(Entry) + 4 * sizeof(std::pair<uint64_t, std::size_t>));
+          }
+          return bytes;
+        }
+
+      private:
+        /**
+         * struct Entry - One remembered request
+         */
+        struct Entry {
+          uint64_t key_;
+          uint64_t scope_;
+          uint64_t request_id_;
+          clock_t::time_point time_;
+          bool used_ = false;
+          bool completed_ = false;
+          Value value_;
+        };
+
+        /**
+         * struct Shard - Filter, exact index and ring for a slice of the ids
+         */
+        struct Shard {
+          explicit Shard(std::size_t capacity) :
+            capacity_(capacity), filter_(capacity), filtered_(true),
+            ring_(capacity ? capacity : 1), next_(0) {}
+
+          Mutex mutex_;
+          std::size_t capacity_;
+          Filter filter_;
+          bool filtered_;
+          FlatHashMap<uint64_t, std::size_t> index_;
+          std::vector<Entry> ring_;
+          std::size_t next_;
+        };
+
+        /**
+         * @brief Key of a request in the filters and indexes, the entry keeps
+         *        the scope and id to tell apart requests sharing a key
+         *
+         */
+        static uint64_t keyOf(uint64_t scope, uint64_t request_id) {
+          return request_id ^ ((scope + 1) * 0xC2B2AE3D27D4EB4Full);
+        }
+
+        Shard& shardOf(uint64_t key) {
+          return *shards_[(key * 0x9E3779B97F4A7C15ull >> 56) % shards_.size()];
+        }
+
+        /**
+         * @brief Forget the request held in a ring slot, shard mutex must be held
+         *
+         */
+        void evict(Shard &shard, std::size_t slot) {
+          Entry &entry = shard.ring_[slot];
+          if (!entry.used_)
+            return;
+          shard.index_.erase(entry.key_);
+          if (shard.filtered_)
+            shard.filter_.erase(entry.key_);
+          entry.used_ = false;
+          entry.value_ = Value();
+        }
+
+        /**
+         * @brief Refill the filter of a shard with the ids of its ring, shard
+         *        mutex must be held
+         *
+         * Leaves the shard unfiltered if an id can not be placed, the caller
+         * retries once the ring wrapped around.
+         */
+        void rebuildFilter(Shard &shard) {
+          shard.filter_ = Filter(shard.capacity_);
+          shard.filtered_ = true;
+          for (const Entry &entry : shard.ring_) {
+            if (entry.used_ && !shard.filter_.insert(entry.key_)) {
+              shard.filtered_ = false;
+              return;
+            }
+          }
+        }
+
+        clock_t::duration window_;
+        std::vector<std::unique_ptr<Shard>> shards_;
+    };
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+namespace banking {
+
+  /**
+   * SeqLock - Versioned value whose readers never take a lock
+   *
+   * Writers serialize among themselves and bump the sequence to an odd value
+   * while they modify the value. Readers retry until they observe the same even
+   * sequence before and after the load, so they never block a writer. The
+   * value is kept in atomic words so values wider than a lock free atomic
+   * can be versioned too.
+   */
+  template <typename T>
+    class SeqLock {
+      static_assert(std::is_trivially_copyable<T>::value,
+          "SeqLock value must be trivially copyable");
+
+      public:
+        /**
+         * @brief Constructor
+         *
+         * @param value initial value
+         */
+        explicit SeqLock(const T &value) : seq_(0) { store(value); }
+
+        /**
+         * @brief Read a consistent value
+         *
+         * @param version if not null, populated with the version of the value read
+         * @return value
+         */
+        T read(uint64_t *version = nullptr) const {
+          uint64_t seq_begin, seq_end;
+          T value;
+          do {
+            seq_begin = seq_.load(std::memory_order_acquire);
+            value = load();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq_end = seq_.load(std::memory_order_relaxed);
+          } while ((seq_begin & 1) || seq_begin != seq_end);
+
+          if (version)
+            *version = seq_begin;
+          return value;
+        }
+
+        /**
+         * @brief Modify the value under the writer lock
+         *
+         * @tparam F callable of signature bool(T&)
+         * @param f modifier, the new value is kept only when it returns true
+         * @return result of f
+         */
+        template <typename F>
+          bool write(F &&f) {
+            std::lock_guard<std::mutex> lck(write_mutex_);
+            T value = load();
+            if (!f(value))
+              return false;
+
+            uint64_t seq = seq_.load(std::memory_order_relaxed);
+            seq_.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            store(value);
+            seq_.store(seq + 2, std::memory_order_release);
+            return true;
+          }
+
+        /**
+         * @brief Current version, always even outside a write
+         *
+         */
+        uint64_t version() const { return seq_.load(std::memory_order_acquire); }
+
+      private:
+        static const std::size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        T load() const {
+          uint64_t words[WORDS];
+          for (std::size_t i = 0; i < WORDS; i++)
+            words[i] = words_[i].load(std::memory_order_relaxed);
+          T value;
+          std::memcpy(&value, words, sizeof(T));
+          return value;
+        }
+
+        void store(const T &value) {
+          uint64_t words[WORDS] = {};
+          std::memcpy(words, &value, sizeof(T));
+          for (std::size_t i = 0; i < WORDS; i++)
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        std::atomic<uint64_t> seq_;
+        std::atomic<uint64_t> words_[WORDS];
+        std::mutex write_mutex_;
+    };
+}
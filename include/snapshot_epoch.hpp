@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace banking {
+
+  /**
+   * SnapshotEpoch - Cut point separating writes before and after a snapshot
+   *
+   * Writers tag everything they change with the epoch they entered in. Taking a
+   * snapshot advances the epoch and waits only for the writers still inside the
+   * previous one; writers entering afterwards carry on untouched, keeping the
+   * value as of the cut next to the new one so the snapshot can still read it.
+   * Epoch 0 is never current, it marks values written outside of any epoch.
+   */
+  class SnapshotEpoch {
+    public:
+      /**
+       * Guard - Keeps the epoch entered in open until it goes out of scope
+       */
+      class Guard {
+        public:
+          explicit Guard(SnapshotEpoch &source) : source_(source) {
+            for (;;) {
+              epoch_ = source_.epoch_.load(std::memory_order_acquire);
+              source_.active_[epoch_ & 1].fetch_add(1, std::memory_order_seq_cst);
+              if (source_.epoch_.load(std::memory_order_seq_cst) == epoch_)
+                break;
+              source_.active_[epoch_ & 1].fetch_sub(1, std::memory_order_release);
+            }
+          }
+
+          ~Guard() {
+            source_.active_[epoch_ & 1].fetch_sub(1, std::memory_order_release);
+          }
+
+          Guard(const Guard&) = delete;
+          Guard& operator=(const Guard&) = delete;
+
+          uint64_t epoch() const { return epoch_; }
+
+        private:
+          SnapshotEpoch &source_;
+          uint64_t epoch_;
+      };
+
+      SnapshotEpoch() : epoch_(1) {
+        active_[0].store(0);
+        active_[1].store(0);
+      }
+
+      SnapshotEpoch(const SnapshotEpoch&) = delete;
+      SnapshotEpoch& operator=(const SnapshotEpoch&) = delete;
+
+      uint64_t current() const { return epoch_.load(std::memory_order_acquire); }
+
+      /**
+       * @brief Start a new epoch once every writer of the current one has left,
+       *        callers taking snapshots must serialize among themselves
+       *
+       * @return the new epoch, everything tagged below it is complete
+       */
+      uint64_t advance() {
+        uint64_t closed = epoch_.fetch_add(1, std::memory_order_seq_cst);
+        while (active_[closed & 1].load(std::memory_order_acquire))
+          std::this_thread::yield();
+        return closed + 1;
+      }
+
+    private:
+      std::atomic<uint64_t> epoch_;
+      std::atomic<uint64_t> active_[2];
+  };
+}
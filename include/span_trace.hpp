@@ -0,0 +1,223 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <thread_buffers.hpp>
+
+namespace banking {
+
+  /**
+   * struct SpanEvent - Time spent in one stage of a session
+   *
+   * name_ points to a string literal, session_ is the sampled session the
+   * stage ran for and thread_ the thread it ran on.
+   */
+  struct SpanEvent {
+    const char *name_;
+    uint64_t session_;
+    long token_;
+    uint32_t thread_;
+    uint64_t start_ns_;
+    uint64_t duration_ns_;
+  };
+
+  /**
+   * SpanTracer - Samples customer sessions and times their stages
+   *
+   * A sampled session gets an id when verifyAndCreateTransaction starts and
+   * keeps it through its transaction token until the session ends. Spans of
+   * the session land in the buffer of the thread that ran them and are
+   * written out as Chrome trace-event JSON, one row per session.
+   */
+  class SpanTracer {
+    public:
+      /**
+       * @brief Start tracing sessions
+       *
+       * @param path file the Chrome trace is written to on stop, empty to
+       *        only export on demand
+       * @param sample_every trace one session out of every sample_every
+       * @return false if already tracing
+       */
+      bool start(const std::string &path, uint32_t sample_every = 1);
+
+      /**
+       * @brief Stop tracing and write the spans out to the path given to
+       *        start. Spans racing with stop may be dropped.
+       *
+       */
+      void stop();
+
+      /**
+       * @brief Whether sessions are being traced, the only cost paid when not.
+       *        A plain static so no lazy initialization check comes with it.
+       *
+       */
+      static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+      /**
+       * @brief Write every span buffered so far as Chrome trace-event JSON
+       *
+       * @param out
+       * @return spans written
+       */
+      std::size_t exportChrome(std::ostream &out);
+
+      /**
+       * @brief Spans not buffered because a thread's buffer was full
+       *
+       */
+      uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+      /**
+       * @brief Start a session, picking whether it is sampled
+       *
+       * @return session id, 0 if not sampled
+       */
+      uint64_t newSession();
+
+      /**
+       * @brief Tie a session to the transaction token it runs under
+       *
+       */
+      void bindSession(long token, uint64_t session) { slot(token).store(session, std::memory_order_relaxed); }
+
+      /**
+       * @brief Forget the session of a token once the session is over
+       *
+       */
+      void endSession(long token) { slot(token).store(0, std::memory_order_relaxed); }
+
+      /**
+       * @brief Session running under a token, 0 if none is sampled
+       *
+       */
+      uint64_t session(long token) { return slot(token).load(std::memory_order_relaxed); }
+
+      /**
+       * @brief Nanoseconds since tracing started
+       *
+       */
+      uint64_t now() const;
+
+      /**
+       * @brief Buffer a span in the calling thread's buffer
+       *
+       * @param event
+       */
+      void record(const SpanEvent &event);
+
+      /**
+       * @brief Get the single instance of the tracer
+       *
+       * @return instance
+       */
+      static SpanTracer* getTracer() {
+        static SpanTracer tracer;
+        return &tracer;
+      }
+
+      static const std::size_t SESSION_SLOTS = 1 << 12;
+      static const std::size_t BUFFER_SPANS = 1 << 16;
+
+    private:
+      /**
+       * struct Buffer - Per thread span buffer
+       */
+      struct Buffer {
+        std::mutex mutex_;
+        std::vector<SpanEvent> spans_;
+        uint32_t thread_;
+      };
+
+      SpanTracer();
+
+      std::atomic<uint64_t>& slot(long token) {
+        return sessions_[static_cast<std::size_t>(token) & (SESSION_SLOTS - 1)];
+      }
+
+      static std::atomic<bool> enabled_;
+      std::atomic<uint64_t> next_session_, dropped_;
+      std::atomic<uint32_t> sample_every_, next_thread_;
+      std::chrono::steady_clock::time_point start_;
+      std::string path_;
+
+      std::mutex state_mutex_;
+      ThreadBuffers<Buffer> buffers_;
+      std::unique_ptr<std::atomic<uint64_t>[]> sessions_;
+  };
+
+  /**
+   * @{name} tag to have a SpanScope start a new session
+   */
+  enum SpanNewSession { SPAN_NEW_SESSION };
+
+  /**
+   * SpanScope - Times a stage of a session until it goes out of scope
+   *
+   * Stages nested on the same thread without a token of their own, such as
+   * lock waits, belong to the session of the enclosing stage. When tracing is
+   * disabled it does nothing past a single branch.
+   */
+  class SpanScope {
+    public:
+      /**
+       * @brief Stage of the session running under a token
+       *
+       * @param name string literal
+       * @param token transaction token, -1 for the session of the enclosing
+       *        stage
+       */
+      SpanScope(const char *name, long token = -1) : session_(0) {
+        if (SpanTracer::enabled())
+          begin(name, token);
+      }
+
+      /**
+       * @brief First stage of a session that has no token yet, see bind
+       *
+       */
+      SpanScope(const char *name, SpanNewSession) : session_(0) {
+        if (SpanTracer::enabled())
+          beginSession(name);
+      }
+
+      ~SpanScope() {
+        if (session_)
+          end();
+      }
+
+      SpanScope(const SpanScope&) = delete;
+      SpanScope& operator=(const SpanScope&) = delete;
+
+      /**
+       * @brief Whether the stage is part of a sampled session
+       *
+       */
+      bool active() const { return session_ != 0; }
+
+      /**
+       * @brief Tie the session started by this scope to its token
+       *
+       * @param token
+       */
+      void bind(long token);
+
+    private:
+      void begin(const char *name, long token);
+      void beginSession(const char *name);
+      void end();
+
+      uint64_t session_;
+      uint64_t parent_session_;
+      long parent_token_;
+      SpanEvent event_;
+  };
+}
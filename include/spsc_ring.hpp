@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include <cache_line.hpp>
+
+namespace banking {
+
+  /**
+   * SpscRing - Bounded queue between exactly one producer and one consumer
+   *
+   * The producer only writes tail_ and the consumer only writes head_, each
+   * on its own cache line, and every side keeps a copy of the other's index
+   * so it only reads the shared one when the ring looks full or empty.
+   * Nothing is locked and nothing is allocated past construction.
+   */
+  template <typename T>
+    class SpscRing {
+      public:
+        /**
+         * @brief Constructor
+         *
+         * @param capacity rounded up to a power of two
+         */
+        explicit SpscRing(std::size_t capacity) :
+          mask_(roundUp(capacity) - 1),
+          slots_(new T[mask_ + 1]),
+          head_(0),
+          cached_tail_(0),
+          tail_(0),
+          cached_head_(0) {}
+
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        /**
+         * @brief Enqueue, producer side only
+         *
+         * @param value moved from if enqueued
+         * @return false if the ring is full
+         */
+        bool tryPush(T &value) {
+          std::size_t tail = tail_.load(std::memory_order_relaxed);
+          if (tail - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > mask_)
+              return false;
+          }
+          slots_[tail & mask_] = std::move(value);
+          tail_.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+
+        /**
+         * @brief Dequeue, consumer side only
+         *
+         * @param value populated with the oldest element
+         * @return false if the ring is empty
+         */
+        bool tryPop(T &value) {
+          std::size_t head = head_.load(std::memory_order_relaxed);
+          if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_)
+              return false;
+          }
+          value = std::move(slots_[head & mask_]);
+          head_.store(head + 1, std::memory_order_release);
+          return true;
+        }
+
+        std::size_t capacity() const { return mask_ + 1; }
+
+      private:
+        static std::size_t roundUp(std::size_t capacity) {
+          std::size_t size = 1;
+          while (size < capacity)
+            size <<= 1;
+          return size;
+        }
+
+        const std::size_t mask_;
+        std::unique_ptr<T[]> slots_;
+
+        alignas(CACHE_LINE_BYTES) std::atomic<std::size_t> head_;
+        std::size_t cached_tail_;
+        alignas(CACHE_LINE_BYTES) std::atomic<std::size_t> tail_;
+        std::size_t cached_head_;
+    };
+}
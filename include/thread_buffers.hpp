@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace banking {
+
+  /**
+   * ThreadBuffers - A buffer per thread for each recording run
+   *
+   * A thread reaches its own buffer without locking once it has one for the
+   * current run. Starting a new run hands back the buffers of the last one
+   * and every thread takes a fresh buffer on its next use. Meant for single
+   * instance owners, a thread alternating between two owners of the same
+   * buffer type takes a new buffer on every switch.
+   *
+   * @tparam Buffer default constructible buffer
+   */
+  template <typename Buffer>
+    class ThreadBuffers {
+      public:
+        ThreadBuffers() : generation_(0) {}
+
+        ThreadBuffers(const ThreadBuffers&) = delete;
+        ThreadBuffers& operator=(const ThreadBuffers&) = delete;
+
+        /**
+         * @brief Buffer of the calling thread for the current run
+         *
+         * @param init called with a new buffer before it is handed out
+         * @return buffer
+         */
+        template <typename Init>
+          std::shared_ptr<Buffer> local(Init init) {
+            Local &local = threadLocal();
+            if (local.buffer_ && local.owner_ == this &&
+                local.generation_ == generation_.load(std::memory_order_acquire))
+              return local.buffer_;
+
+            std::shared_ptr<Buffer> buffer = std::make_shared<Buffer>();
+            init(*buffer);
+            std::lock_guard<std::mutex> lck(mutex_);
+            local.buffer_ = buffer;
+            local.owner_ = this;
+            local.generation_ = generation_.load(std::memory_order_relaxed);
+            buffers_.push_back(buffer);
+            return buffer;
+          }
+
+        /**
+         * @brief Buffers taken so far in the current run
+         *
+         */
+        std::vector<std::shared_ptr<Buffer>> buffers() {
+          std::lock_guard<std::mutex> lck(mutex_);
+          return buffers_;
+        }
+
+        /**
+         * @brief Start a new run
+         *
+         * @return buffers of the run that ended
+         */
+        std::vector<std::shared_ptr<Buffer>> rotate() {
+          std::vector<std::shared_ptr<Buffer>> buffers;
+          std::lock_guard<std::mutex> lck(mutex_);
+          buffers.swap(buffers_);
+          generation_.fetch_add(1, std::memory_order_release);
+          return buffers;
+        }
+
+      private:
+        /**
+         * struct Local - Buffer a thread holds and the run it belongs to
+         */
+        struct Local {
+          std::shared_ptr<Buffer> buffer_;
+          const ThreadBuffers *owner_ = nullptr;
+          uint64_t generation_ = 0;
+        };
+
+        static Local& threadLocal() {
+          thread_local Local local;
+          return local;
+        }
+
+        std::atomic<uint64_t> generation_;
+        std::mutex mutex_;
+        std::vector<std::shared_ptr<Buffer>> buffers_;
+    };
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <thread_buffers.hpp>
+
+namespace banking {
+
+  enum TraceOp {
+    TRACE_CREATE_AND_LINK_ACCOUNT,
+    TRACE_VERIFY_AND_CREATE_TRANSACTION,
+    TRACE_ACKNOWLEDGE_TRANSACTION,
+    TRACE_SELECT_ACCOUNT,
+    TRACE_PERFORM_TRANSACTION,
+    TRACE_CHECK_BALANCE,
+    TRACE_LIST_ACCOUNTS,
+    TRACE_GET_ATM_ID,
+    TRACE_PRIVILEGED_OPERATION,
+    TRACE_ATM_CALLBACK,
+    TRACE_PERFORM_SESSION,
+    TRACE_RETURN_ATM_ID
+  };
+
+  /**
+   * struct TraceEvent - One recorded Bank call or atm callback
+   *
+   * token_ is the transaction token the call was made with, -1 for calls that
+   * are not part of a session. args_ and results_ are op specific, see the
+   * recording sites in bank.cpp.
+   */
+  struct TraceEvent {
+    uint64_t seq_;
+    uint64_t time_ns_;
+    TraceOp op_;
+    long token_;
+    std::string text_;
+    std::vector<long> args_;
+    std::vector<long> results_;
+  };
+
+  /**
+   * @brief Append the binary encoding of an event to a buffer
+   *
+   * @param event
+   * @param out
+   */
+  void encodeTraceEvent(const TraceEvent &event, std::string &out);
+
+  /**
+   * @brief Decode one event from a buffer
+   *
+   * @param in
+   * @param pos offset to decode from, advanced past the event
+   * @param event
+   * @return false if the buffer ends before a complete event, or the event
+   *         is not one of the known ops with the args and results it is
+   *         recorded with
+   */
+  bool decodeTraceEvent(const std::string &in, std::size_t &pos, TraceEvent &event);
+
+  /**
+   * @brief Read all the events of a trace file ordered by sequence number
+   *
+   * @param path
+   * @param events
+   * @return false if the file can not be opened, is not a trace or holds an
+   *         event that can not be decoded
+   */
+  bool readTrace(const std::string &path, std::vector<TraceEvent> &events);
+
+  class TraceRecorder {
+    public:
+      /**
+       * @brief Start writing events to a trace file
+       *
+       * @param path
+       * @return false if already recording or the file can not be opened
+       */
+      bool start(const std::string &path);
+
+      /**
+       * @brief Flush every thread's buffer and close the trace file. Events
+       *        racing with stop may be dropped.
+       *
+       */
+      void stop();
+
+      /**
+       * @brief Whether calls should be recorded, the only cost paid when disabled
+       *
+       */
+      bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+      /**
+       * @brief Next global sequence number
+       *
+       */
+      uint64_t nextSeq() { return seq_.fetch_add(1, std::memory_order_relaxed); }
+
+      /**
+       * @brief Nanoseconds since the recording started
+       *
+       */
+      uint64_t now() const;
+
+      /**
+       * @brief Buffer an event in the calling thread's buffer
+       *
+       * @param event
+       */
+      void record(const TraceEvent &event);
+
+      /**
+       * @brief Get the single instance of the recorder
+       *
+       * @return instance
+       */
+      static TraceRecorder* getRecorder() {
+        static TraceRecorder recorder;
+        return &recorder;
+      }
+
+    private:
+      /**
+       * struct Buffer - Per thread event buffer
+       */
+      struct Buffer {
+        std::mutex mutex_;
+        std::string bytes_;
+      };
+
+      TraceRecorder() : enabled_(false), seq_(0) {}
+
+      /**
+       * @brief Write a buffer out to the file, buffer mutex must be held
+       *
+       * @param buffer
+       */
+      void flush(Buffer &buffer);
+
+      std::atomic<bool> enabled_;
+      std::atomic<uint64_t> seq_;
+      std::chrono::steady_clock::time_point start_;
+
+      std::mutex file_mutex_;
+      std::ofstream file_;
+      ThreadBuffers<Buffer> buffers_;
+  };
+
+  /**
+   * TraceScope - Records a Bank call when it goes out of scope
+   *
+   * Constructed at the start of a call; when recording is disabled nothing
+   * is built past a single relaxed load, the event only exists while
+   * recording. Results default to the failure values passed in so calls that
+   * throw are recorded as failed.
+   */
+  class TraceScope {
+    public:
+      TraceScope(TraceOp op, long token, std::initializer_list<long> args,
+          std::initializer_list<long> results = {}, const std::string *text = nullptr) {
+        TraceRecorder *recorder = TraceRecorder::getRecorder();
+        if (!recorder->enabled())
+          return;
+        event_.reset(new TraceEvent);
+        event_->seq_ = recorder->nextSeq();
+        event_->time_ns_ = recorder->now();
+        event_->op_ = op;
+        event_->token_ = token;
+        if (text)
+          event_->text_ = *text;
+        event_->args_ = args;
+        event_->results_ = results;
+      }
+
+      ~TraceScope() {
+        if (event_)
+          TraceRecorder::getRecorder()->record(*event_);
+      }
+
+      TraceScope(const TraceScope&) = delete;
+      TraceScope& operator=(const TraceScope&) = delete;
+
+      bool active() const { return static_cast<bool>(event_); }
+
+      /**
+       * @brief Set the recorded arguments of the call, for arguments that are
+       *        only worth flattening while recording
+       *
+       * @param args
+       */
+      void set_args(std::vector<long> args) {
+        if (event_)
+          event_->args_ = std::move(args);
+      }
+
+      /**
+       * @brief Set the recorded results of the call
+       *
+       * @param results
+       */
+      void set_results(std::vector<long> results) {
+        if (event_)
+          event_->results_ = std::move(results);
+      }
+
+    private:
+      std::unique_ptr<TraceEvent> event_;
+  };
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <bank.hpp>
+#include <trace.hpp>
+
+namespace banking {
+
+  /**
+   * struct ReplayOptions - How a trace is replayed
+   *
+   * With a parallelism of 1 every call is replayed in the recorded global
+   * order. With more, sessions are spread over that many threads, all sessions
+   * of a card on the same thread so balance dependent results stay
+   * deterministic. Calls outside sessions run alone between sessions.
+   */
+  struct ReplayOptions {
+    ReplayOptions() : original_timing_(false), parallelism_(1) {}
+
+    bool original_timing_;
+    int parallelism_;
+  };
+
+  /**
+   * struct ReplayReport - Outcome of a replay
+   */
+  struct ReplayReport {
+    uint64_t calls_;
+    uint64_t sessions_;
+    uint64_t mismatches_;
+    double elapsed_ms_;
+  };
+
+  class TraceReplayer {
+    public:
+      /**
+       * @brief Constructor
+       *
+       * @param events recorded events ordered by sequence number, as read
+       *        by readTrace, which rejects events it could not replay
+       * @param options
+       */
+      TraceReplayer(const std::vector<TraceEvent> &events, const ReplayOptions &options);
+
+      /**
+       * @brief Replay the trace against a fresh bank and verify the results
+       *
+       * @return report
+       */
+      ReplayReport run();
+
+    private:
+      /**
+       * struct Session - Calls made with one transaction token
+       */
+      struct Session {
+        long card_no_;
+        long token_;
+        std::vector<const TraceEvent*> calls_;
+        std::deque<const TraceEvent*> callbacks_;
+      };
+
+      /**
+       * @brief Group calls by session and callbacks with their session
+       *
+       */
+      void buildSessions();
+
+      /**
+       * @brief Replay a single call and compare its results with the recorded ones
+       *
+       * @param event
+       * @param session nullptr for calls outside a session
+       */
+      void replayCall(const TraceEvent &event, Session *session);
+
+      /**
+       * @brief Replay every call of a session
+       *
+       * @param session
+       */
+      void replaySession(Session &session);
+
+      /**
+       * @brief Sleep until the recorded time of an event when replaying at
+       *        original timing
+       *
+       * @param event
+       */
+      void waitForEvent(const TraceEvent &event);
+
+      /**
+       * @brief Callback handed to the bank in place of the recorded atm
+       *
+       * @param session
+       * @return callback
+       */
+      atm_cb_t sessionCallback(Session &session);
+
+      /**
+       * @brief Translate a recorded account, card or atm id to the replayed one.
+       *        Unknown ids become invalid negative ids.
+       *
+       * @param ids
+       * @param id
+       * @return translated id
+       */
+      long mapId(const std::map<long, long> &ids, long id) const;
+
+      void mismatch(const TraceEvent &event, const std::string &what);
+
+      ReplayOptions options_;
+      const std::vector<TraceEvent> &events_;
+
+      std::vector<Session> sessions_;
+      std::vector<long> event_sessions_;
+      std::map<long, long> card_ids_, account_ids_, atm_ids_;
+
+      std::chrono::steady_clock::time_point start_;
+      uint64_t first_time_ns_;
+
+      std::atomic<uint64_t> calls_, mismatches_;
+  };
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace banking {
+
+  /**
+   * @brief Append value as a little endian base 128 varint, 7 bits a byte
+   *
+   */
+  inline void putVarint(uint64_t value, std::string &out) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  /**
+   * @brief Append a zigzag encoded varint, so small negatives stay short
+   *
+   */
+  inline void putSigned(long value, std::string &out) {
+    putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63), out);
+  }
+
+  /**
+   * @brief Read a varint at pos and move pos past it
+   *
+   * @return false if in ends first or the varint is longer than 64 bits
+   */
+  inline bool getVarint(const std::string &in, std::size_t &pos, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(in[pos++]);
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Read a zigzag encoded varint, see getVarint
+   *
+   */
+  inline bool getSigned(const std::string &in, std::size_t &pos, long &value) {
+    uint64_t raw;
+    if (!getVarint(in, pos, raw))
+      return false;
+    value = static_cast<long>((raw >> 1) ^ (~(raw & 1) + 1));
+    return true;
+  }
+}
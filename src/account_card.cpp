@@ -1,35 +1,29 @@
 #include <glog/logging.h>
 
 #include <account_card.hpp>
+#include <account_table.hpp>
 
 namespace banking {
 
-  Account::Account(long account_id,
-      const std::string &holder_name,
-      int amount) :
-    id_(account_id),
-    name_(holder_name),
-    money_(amount) {
-      DLOG(INFO) << "Created account: " << id_ << " " << name_ << " " << money_;
-    }
+  const std::string& Account::get_name() const {
+    return table_->name(index_);
+  }
 
-  bool Account::performTransaction(const TransactionType &trans_type, int &amount) {
-    switch (trans_type) {
-      case DEPOSIT: money_ += amount;
-                    LOG(INFO) << "Good deposit";
-                    return true;
-      case WITHDRAW: if (money_ >= amount) {
-                       money_ -= amount;
-                       LOG(INFO) << "Good withdraw";
-                       return true;
-                     }
-                     LOG(WARNING) << "Bad withdraw";
-                     return false;
-      case CHECK_BALANCE: amount = money_;
-                          LOG(INFO) << "Good check";
-                          return true;
-    }
-    return false;
+  long Account::get_id() const {
+    return table_->id(index_);
+  }
+
+  int Account::get_balance(uint64_t *version) const {
+    return table_->balance(index_, version);
+  }
+
+  int Account::get_snapshot_balance(uint64_t epoch) const {
+    return table_->snapshotBalance(index_, epoch);
+  }
+
+  bool Account::performTransaction(const TransactionType &trans_type, int &amount,
+      uint64_t epoch) {
+    return table_->performTransaction(index_, trans_type, amount, epoch);
   }
 
   Card::Card(long card_no) : number_(card_no), pin_(8888) {
@@ -52,10 +46,10 @@ namespace banking {
     return true;
   }
 
-  bool Card::callAccountCallback(TransactionType &trans_type, int amount) {
+  bool Card::callAccountCallback(TransactionType &trans_type, int amount, uint64_t epoch) {
     if (acc_cb_ == nullptr)
       return false;
 
-    return acc_cb_(trans_type, amount);
+    return acc_cb_(trans_type, amount, epoch);
   }
 }
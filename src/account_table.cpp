@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <account_table.hpp>
+
+namespace banking {
+
+  uint32_t NameInterner::intern(const std::string &name) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    FlatHashMap<std::string, uint32_t>::iterator it = ids_.find(name);
+    if (it != ids_.end())
+      return it->second;
+
+    uint32_t id = ids_.size();
+    if (!names_.reserve(id))
+      throw std::runtime_error("Too many holder names");
+    names_[id] = name;
+    ids_.insert(std::make_pair(name, id));
+    bytes_ += name.capacity() > 15 ? name.capacity() + 1 : 0;
+    return id;
+  }
+
+  bool NameInterner::find(const std::string &name, uint32_t &id) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    FlatHashMap<std::string, uint32_t>::iterator it = ids_.find(name);
+    if (it == ids_.end())
+      return false;
+    id = it->second;
+    return true;
+  }
+
+  std::size_t NameInterner::memoryBytes() const {
+    return names_.memoryBytes() + bytes_ +
+      ids_.size() * 2 * (sizeof(std::pair<std::string, uint32_t>) + sizeof(bool));
+  }
+
+  account_index_t AccountTable::create(long account_id, const std::string &holder_name,
+      int amount, uint64_t epoch) {
+    std::lock_guard<std::mutex> lck(create_mutex_);
+    std::size_t index = size_.load(std::memory_order_relaxed);
+    if (index > UINT32_MAX || !ids_.reserve(index) || !name_ids_.reserve(index) ||
+        !seqs_.reserve(index) || !money_.reserve(index) || !cut_money_.reserve(index) ||
+        !epochs_.reserve(index) || !held_.reserve(index) || !jobs_.reserve(index))
+      throw std::runtime_error("Account table is full");
+
+    ids_[index] = account_id;
+    name_ids_[index] = names_.intern(holder_name);
+    seqs_[index].store(0, std::memory_order_relaxed);
+    money_[index].store(amount, std::memory_order_relaxed);
+    cut_money_[index].store(0, std::memory_order_relaxed);
+    epochs_[index].store(epoch, std::memory_order_relaxed);
+    held_[index].store(0, std::memory_order_relaxed);
+    jobs_[index].store(0, std::memory_order_relaxed);
+    size_.store(index + 1, std::memory_order_release);
+    return static_cast<account_index_t>(index);
+  }
+
+  int AccountTable::balance(account_index_t index, uint64_t *version) const {
+    const std::atomic<uint64_t> &seq = seqs_[index];
+    uint64_t seq_begin, seq_end;
+    int money;
+    do {
+      seq_begin = seq.load(std::memory_order_acquire);
+      money = money_[index].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq_end = seq.load(std::memory_order_relaxed);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+
+    if (version)
+      *version = seq_begin;
+    return money;
+  }
+
+  int AccountTable::snapshotBalance(account_index_t index, uint64_t epoch) const {
+    const std::atomic<uint64_t> &seq = seqs_[index];
+    uint64_t seq_begin, seq_end;
+    int money;
+    do {
+      seq_begin = seq.load(std::memory_order_acquire);
+      money = epochs_[index].load(std::memory_order_relaxed) >= epoch ?
+        cut_money_[index].load(std::memory_order_relaxed) :
+        money_[index].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq_end = seq.load(std::memory_order_relaxed);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+    return money;
+  }
+
+  uint64_t AccountTable::lock(account_index_t index) {
+    std::atomic<uint64_t> &seq = seqs_[index];
+    uint64_t current = seq.load(std::memory_order_relaxed);
+    for (;;) {
+      if (current & 1) {
+        std::this_thread::yield();
+        current = seq.load(std::memory_order_relaxed);
+      } else if (seq.compare_exchange_weak(current, current + 1, std::memory_order_seq_cst)) {
+        break;
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    return current;
+  }
+
+  template <typename F>
+    bool AccountTable::write(account_index_t index, int amount, uint64_t epoch, F &&check) {
+      uint64_t current = lock(index);
+      int money = money_[index].load(std::memory_order_relaxed);
+      if (!check(money - held(index))) {
+        seqs_[index].store(current, std::memory_order_release);
+        return false;
+      }
+
+      apply(index, current, amount, epoch);
+      return true;
+    }
+
+  bool AccountTable::tryLock(account_index_t index, uint64_t version) {
+    if (!seqs_[index].compare_exchange_strong(version, version + 1, std::memory_order_seq_cst))
+      return false;
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+  }
+
+  void AccountTable::apply(account_index_t index, uint64_t version, int amount, uint64_t epoch) {
+    int money = money_[index].load(std::memory_order_relaxed);
+
+    // Keep the value at the cut the write lands after, see SnapshotEpoch
+    uint64_t account_epoch = epochs_[index].load(std::memory_order_relaxed);
+    if (epoch > account_epoch) {
+      cut_money_[index].store(money, std::memory_order_relaxed);
+      epochs_[index].store(epoch, std::memory_order_relaxed);
+    } else if (epoch && epoch < account_epoch) {
+      cut_money_[index].store(cut_money_[index].load(std::memory_order_relaxed) + amount,
+          std::memory_order_relaxed);
+    }
+    money_[index].store(money + amount, std::memory_order_relaxed);
+    seqs_[index].store(version + 2, std::memory_order_release);
+  }
+
+  void AccountTable::set(account_index_t index, int balance, uint64_t epoch) {
+    uint64_t current = lock(index);
+    apply(index, current, balance - money_[index].load(std::memory_order_relaxed), epoch);
+  }
+
+  bool AccountTable::reserve(account_index_t index, int amount) {
+    std::atomic<int> &held = held_[index];
+    for (;;) {
+      uint64_t version;
+      int money = balance(index, &version);
+      int current = held.load(std::memory_order_seq_cst);
+      if (money - current < amount)
+        return false;
+      if (!held.compare_exchange_weak(current, current + amount, std::memory_order_seq_cst))
+        continue;
+
+      // Writers read the holds after taking the lock, so either a writer
+      // that debited the balance meanwhile shows up here or it saw this hold
+      if (seqs_[index].load(std::memory_order_seq_cst) == version)
+        return true;
+      held.fetch_sub(amount, std::memory_order_seq_cst);
+    }
+  }
+
+  void AccountTable::settle(account_index_t index, int amount, uint64_t epoch) {
+    uint64_t current = lock(index);
+    held_[index].fetch_sub(amount, std::memory_order_seq_cst);
+    apply(index, current, -amount, epoch);
+  }
+
+  bool AccountTable::adjust(account_index_t index, uint64_t job_id,
+      const std::function<int(long, int)> &adjustment, int &amount, uint64_t epoch) {
+    amount = 0;
+    if (jobs_[index].load(std::memory_order_acquire) >= job_id)
+      return false;
+
+    uint64_t current = lock(index);
+    if (jobs_[index].load(std::memory_order_relaxed) >= job_id) {
+      seqs_[index].store(current, std::memory_order_release);
+      return false;
+    }
+    int money = money_[index].load(std::memory_order_relaxed);
+    amount = std::max(adjustment(ids_[index], money), std::min(0, held(index) - money));
+    jobs_[index].store(job_id, std::memory_order_release);
+    apply(index, current, amount, epoch);
+    return true;
+  }
+
+  bool AccountTable::performTransaction(account_index_t index, const TransactionType &trans_type,
+      int &amount, uint64_t epoch) {
+    switch (trans_type) {
+      case DEPOSIT: write(index, amount, epoch, [](int) { return true; });
+                    LOG(INFO) << "Good deposit";
+                    return true;
+      case WITHDRAW: if (write(index, -amount, epoch, [amount](int available) { return available >= amount; })) {
+                       LOG(INFO) << "Good withdraw";
+                       return true;
+                     }
+                     LOG(WARNING) << "Bad withdraw";
+                     return false;
+      case CHECK_BALANCE: amount = balance(index);
+                          LOG(INFO) << "Good check";
+                          return true;
+    }
+    return false;
+  }
+
+  std::size_t AccountTable::memoryBytes() const {
+    return sizeof(*this) + names_.memoryBytes() + ids_.memoryBytes() + name_ids_.memoryBytes() +
+      seqs_.memoryBytes() + money_.memoryBytes() + cut_money_.memoryBytes() + epochs_.memoryBytes() +
+      held_.memoryBytes() + jobs_.memoryBytes();
+  }
+
+  AccountTransaction::Entry& AccountTransaction::entry(account_index_t index) {
+    for (auto &entry : entries_) {
+      if (entry.index_ == index)
+        return entry;
+    }
+    Entry entry{index, 0, 0, 0, 0, false};
+    entry.money_ = table_.balance(index, &entry.version_);
+    entries_.push_back(entry);
+    return entries_.back();
+  }
+
+  int AccountTransaction::read(account_index_t index) {
+    Entry &account = entry(index);
+    return account.money_ + account.amount_ - account.held_;
+  }
+
+  void AccountTransaction::add(account_index_t index, int amount) {
+    Entry &account = entry(index);
+    account.amount_ += amount;
+    account.written_ = true;
+  }
+
+  void AccountTransaction::hold(account_index_t index, int amount) {
+    Entry &account = entry(index);
+    account.held_ += amount;
+    account.written_ = true;
+  }
+
+  bool AccountTransaction::commit(uint64_t epoch) {
+    // A single global lock order keeps two committing transactions from
+    // each holding an account the other needs
+    std::sort(entries_.begin(), entries_.end(), [](const Entry &lhs, const Entry &rhs) {
+      return lhs.index_ < rhs.index_;
+    });
+
+    std::size_t locked = 0;
+    bool valid = true;
+    for (; locked < entries_.size() && valid; locked++) {
+      const Entry &account = entries_[locked];
+      if (account.written_)
+        valid = table_.tryLock(account.index_, account.version_);
+    }
+    if (!valid)
+      locked--;
+
+    for (std::size_t i = 0; i < entries_.size() && valid; i++) {
+      const Entry &account = entries_[i];
+      if (!account.written_)
+        valid = table_.seqs_[account.index_].load(std::memory_order_acquire) == account.version_;
+      else if (account.amount_ < 0 || account.held_ > 0)
+        valid = account.money_ + account.amount_ - account.held_ >= table_.held(account.index_);
+    }
+
+    for (std::size_t i = 0; i < locked; i++) {
+      const Entry &account = entries_[i];
+      if (!account.written_)
+        continue;
+      if (valid) {
+        // Placed before the version moves on, see AccountTable::reserve
+        if (account.held_)
+          table_.held_[account.index_].fetch_add(account.held_, std::memory_order_seq_cst);
+        table_.apply(account.index_, account.version_, account.amount_, epoch);
+      }
+      else
+        table_.seqs_[account.index_].store(account.version_, std::memory_order_release);
+    }
+    return valid;
+  }
+}
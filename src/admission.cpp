@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include <admission.hpp>
+
+namespace banking {
+
+  AdmissionController::AdmissionController(std::size_t budget, std::size_t queue_per_atm,
+      clock_t::duration max_wait) :
+    budget_(budget),
+    queue_per_atm_(queue_per_atm),
+    max_wait_(max_wait) {}
+
+  bool AdmissionController::admit(int atm_id) {
+    clock_t::duration max_wait;
+    {
+      std::lock_guard<std::mutex> lck(mutex_);
+      max_wait = max_wait_;
+    }
+    return admit(atm_id, clock_t::now() + max_wait);
+  }
+
+  bool AdmissionController::admit(int atm_id, clock_t::time_point deadline) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    if (metrics_.active_ < budget_ && turns_.empty()) {
+      metrics_.active_++;
+      metrics_.admitted_++;
+      return true;
+    }
+
+    std::deque<Waiter*> &queue = queues_[atm_id];
+    if (queue.size() >= queue_per_atm_) {
+      if (queue.empty())
+        queues_.erase(atm_id);
+      metrics_.shed_++;
+      LOG(WARNING) << "Shedding session request from atm " << atm_id;
+      return false;
+    }
+
+    Waiter waiter;
+    if (queue.empty())
+      turns_.push_back(atm_id);
+    queue.push_back(&waiter);
+    metrics_.queue_depth_++;
+    metrics_.max_queue_depth_ = std::max(metrics_.max_queue_depth_, metrics_.queue_depth_);
+    metrics_.waited_++;
+
+    if (!waiter.cv_.wait_until(lck, deadline, [&waiter]() { return waiter.granted_; })) {
+      removeWaiter(atm_id, &waiter);
+      metrics_.timed_out_++;
+      LOG(WARNING) << "Session request from atm " << atm_id << " timed out";
+      return false;
+    }
+    return true;
+  }
+
+  void AdmissionController::release() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (metrics_.active_)
+      metrics_.active_--;
+    grantWaiters();
+  }
+
+  void AdmissionController::configure(std::size_t budget, std::size_t queue_per_atm,
+      clock_t::duration max_wait) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    budget_ = budget;
+    queue_per_atm_ = queue_per_atm;
+    max_wait_ = max_wait;
+    grantWaiters();
+  }
+
+  AdmissionMetrics AdmissionController::metrics() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    AdmissionMetrics metrics = metrics_;
+    metrics.budget_ = budget_;
+    return metrics;
+  }
+
+  void AdmissionController::grantWaiters() {
+    while (metrics_.active_ < budget_ && !turns_.empty()) {
+      int atm_id = turns_.front();
+      turns_.pop_front();
+      std::deque<Waiter*> &queue = queues_[atm_id];
+      Waiter *waiter = queue.front();
+      queue.pop_front();
+      if (queue.empty())
+        queues_.erase(atm_id);
+      else
+        turns_.push_back(atm_id);
+
+      metrics_.queue_depth_--;
+      metrics_.active_++;
+      metrics_.admitted_++;
+      waiter->granted_ = true;
+      waiter->cv_.notify_one();
+    }
+  }
+
+  void AdmissionController::removeWaiter(int atm_id, Waiter *waiter) {
+    std::deque<Waiter*> &queue = queues_[atm_id];
+    queue.erase(std::remove(queue.begin(), queue.end(), waiter), queue.end());
+    metrics_.queue_depth_--;
+    if (queue.empty()) {
+      queues_.erase(atm_id);
+      turns_.erase(std::remove(turns_.begin(), turns_.end(), atm_id), turns_.end());
+    }
+  }
+}
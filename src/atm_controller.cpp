@@ -6,6 +6,13 @@ namespace banking {
 
   AtmController::AtmController() : transaction_() {
     atm_id_ = Bank::getBank()->get_atm_id();
+    bank_generation_ = Bank::generation();
+  }
+
+  AtmController::~AtmController() {
+    // A bank replaced since then never handed this id out
+    if (Bank::generation() == bank_generation_)
+      Bank::getBank()->returnAtmId(atm_id_);
   }
 
   void AtmController::insertCard(long card_no, int card_pin) {
@@ -18,7 +25,7 @@ namespace banking {
     int transaction_token;
     try {
       transaction_token = Bank::getBank()->verifyAndCreateTransaction(card_no,
-          card_pin);
+          card_pin, atm_id_);
     } catch (std::exception &ex) {
       controllerDisplay(SHOW_ERROR, -1, ex.what());
       return;
@@ -42,8 +49,9 @@ namespace banking {
     Bank::getBank()->selectAccount(transaction_.token_, account_no);
   }
 
-  void AtmController::performTransaction(TransactionType trans_type, int amount) {
-    Bank::getBank()->performTransaction(transaction_.token_, trans_type, amount);
+  void AtmController::performTransaction(TransactionType trans_type, int amount,
+      uint64_t request_id) {
+    Bank::getBank()->performTransaction(transaction_.token_, trans_type, amount, request_id);
   }
 
   bool AtmController::controllerDisplay(AtmOperationType atm_op,
@@ -0,0 +1,484 @@
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include <audit_archive.hpp>
+#include <varint.hpp>
+
+namespace banking {
+
+  namespace {
+    const char AUDIT_MAGIC[8] = {'A', 'T', 'M', 'A', 'U', 'D', 'T', '2'};
+    const char AUDIT_BLOCK_MAGIC[4] = {'B', 'L', 'C', 'K'};
+    // Block magic and the size of the header after it
+    const std::size_t AUDIT_BLOCK_PREFIX_BYTES = sizeof(AUDIT_BLOCK_MAGIC) + 4;
+    const long AUDIT_DENSE_ATMS = 1 << 16;
+
+    /**
+     * @brief Type and result of a record in one small code, also the bit of
+     *        the block's type mask
+     *
+     */
+    uint8_t typeCode(TransactionType type, bool ok) {
+      return static_cast<uint8_t>(type) | (ok ? 4 : 0);
+    }
+
+    bool typeMatches(uint8_t code, const AuditQuery &query) {
+      return (query.type_ < 0 || (code & 3) == query.type_) &&
+        (query.result_ < 0 || (code >> 2) == query.result_);
+    }
+
+    /**
+     * @brief Block magic, header size and header of a block, offset_ is not
+     *        stored as it is where the header ends
+     *
+     */
+    void putBlockHeader(const AuditBlockIndex &block, std::string &out) {
+      std::string header;
+      putVarint(block.count_, header);
+      for (auto bytes : block.column_bytes_)
+        putVarint(bytes, header);
+      putVarint(block.min_time_, header);
+      putVarint(block.max_time_ - block.min_time_, header);
+      putSigned(block.min_atm_, header);
+      putVarint(block.max_atm_ - block.min_atm_, header);
+      putSigned(block.min_card_, header);
+      putVarint(block.max_card_ - block.min_card_, header);
+      putSigned(block.min_account_, header);
+      putVarint(block.max_account_ - block.min_account_, header);
+      putVarint(block.types_, header);
+
+      out.append(AUDIT_BLOCK_MAGIC, sizeof(AUDIT_BLOCK_MAGIC));
+      for (int i = 0; i < 4; i++)
+        out.push_back(static_cast<char>((header.size() >> (8 * i)) & 0xff));
+      out += header;
+    }
+
+    bool getBlockHeader(const std::string &header, AuditBlockIndex &block) {
+      std::size_t pos = 0;
+      uint64_t count, value, time_range, atm_range, card_range, account_range, types;
+      if (!getVarint(header, pos, count))
+        return false;
+      block.count_ = count;
+      for (auto &bytes : block.column_bytes_) {
+        if (!getVarint(header, pos, value))
+          return false;
+        bytes = value;
+      }
+      if (!getVarint(header, pos, block.min_time_) || !getVarint(header, pos, time_range) ||
+          !getSigned(header, pos, block.min_atm_) || !getVarint(header, pos, atm_range) ||
+          !getSigned(header, pos, block.min_card_) || !getVarint(header, pos, card_range) ||
+          !getSigned(header, pos, block.min_account_) || !getVarint(header, pos, account_range) ||
+          !getVarint(header, pos, types) || pos != header.size())
+        return false;
+      block.max_time_ = block.min_time_ + time_range;
+      block.max_atm_ = block.min_atm_ + atm_range;
+      block.max_card_ = block.min_card_ + card_range;
+      block.max_account_ = block.min_account_ + account_range;
+      block.types_ = types;
+      return true;
+    }
+
+    /**
+     * @brief Walk the block headers of an archive from the front
+     *
+     * @param in archive, past its magic
+     * @param size of the archive
+     * @param index populated with the complete blocks
+     * @param torn set if the walk stopped at a block running past the end
+     * @return end of the last complete block
+     */
+    uint64_t readBlockHeaders(std::istream &in, uint64_t size, std::vector<AuditBlockIndex> &index,
+        bool &torn) {
+      uint64_t offset = sizeof(AUDIT_MAGIC);
+      char prefix[AUDIT_BLOCK_PREFIX_BYTES];
+      std::string header;
+      torn = false;
+      while (offset < size) {
+        torn = offset + sizeof(prefix) > size;
+        in.clear();
+        in.seekg(offset);
+        if (torn || !in.read(prefix, sizeof(prefix)) ||
+            std::memcmp(prefix, AUDIT_BLOCK_MAGIC, sizeof(AUDIT_BLOCK_MAGIC)))
+          break;
+        const char *size_bytes = prefix + sizeof(AUDIT_BLOCK_MAGIC);
+        uint64_t header_bytes = 0;
+        for (int i = 0; i < 4; i++)
+          header_bytes |= static_cast<uint64_t>(static_cast<uint8_t>(size_bytes[i])) << (8 * i);
+        AuditBlockIndex block;
+        block.offset_ = offset + sizeof(prefix) + header_bytes;
+        if ((torn = block.offset_ > size))
+          break;
+        header.resize(header_bytes);
+        if (!in.read(&header[0], header_bytes) || !getBlockHeader(header, block))
+          break;
+        uint64_t end = block.offset_;
+        for (auto bytes : block.column_bytes_)
+          end += bytes;
+        if ((torn = end > size))
+          break;
+        index.push_back(block);
+        offset = end;
+      }
+      return offset;
+    }
+  }
+
+  AuditArchiveWriter::AuditArchiveWriter(std::size_t block_records) :
+    block_records_(std::max<std::size_t>(1, block_records)),
+    open_(false),
+    records_(0),
+    offset_(0),
+    failed_(false) {}
+
+  AuditArchiveWriter::~AuditArchiveWriter() {
+    close();
+  }
+
+  bool AuditArchiveWriter::open(const std::string &path) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    std::lock_guard<std::mutex> write_lck(write_mutex_);
+    if (open_)
+      return false;
+
+    // An existing archive is carried on from its last complete block
+    uint64_t end = 0;
+    std::ifstream existing(path, std::ios::binary | std::ios::ate);
+    if (existing && existing.tellg() > 0) {
+      uint64_t size = existing.tellg();
+      char magic[sizeof(AUDIT_MAGIC)];
+      existing.seekg(0);
+      if (!existing.read(magic, sizeof(magic)) || std::memcmp(magic, AUDIT_MAGIC, sizeof(magic))) {
+        LOG(ERROR) << "Not an audit archive " << path;
+        return false;
+      }
+      std::vector<AuditBlockIndex> blocks;
+      bool torn;
+      end = readBlockHeaders(existing, size, blocks, torn);
+      if (end < size && !torn) {
+        LOG(ERROR) << "Corrupted audit block at " << end << " in " << path;
+        return false;
+      }
+      if (end < size && truncate(path.c_str(), end)) {
+        LOG(ERROR) << "Unable to cut the torn audit block off " << path;
+        return false;
+      }
+    }
+    existing.close();
+
+    file_.open(path, std::ios::binary | std::ios::app);
+    if (!file_) {
+      LOG(ERROR) << "Unable to open audit archive " << path;
+      return false;
+    }
+    if (!end) {
+      file_.write(AUDIT_MAGIC, sizeof(AUDIT_MAGIC));
+      end = sizeof(AUDIT_MAGIC);
+    }
+    offset_ = end;
+    records_ = 0;
+    failed_ = false;
+    pending_.clear();
+    pending_.reserve(block_records_);
+    open_ = true;
+    return true;
+  }
+
+  void AuditArchiveWriter::append(const AuditRecord &record) {
+    std::vector<AuditRecord> full;
+    std::unique_lock<std::mutex> write_lck;
+    {
+      std::lock_guard<std::mutex> lck(mutex_);
+      if (!open_)
+        return;
+      pending_.push_back(record);
+      records_++;
+      if (pending_.size() < block_records_)
+        return;
+      full.swap(pending_);
+      pending_.reserve(block_records_);
+      // Taken before letting go, close can not write the index under the block
+      write_lck = std::unique_lock<std::mutex>(write_mutex_);
+    }
+    writeBlock(full);
+  }
+
+  bool AuditArchiveWriter::close() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    std::lock_guard<std::mutex> write_lck(write_mutex_);
+    if (!open_)
+      return false;
+    open_ = false;
+    if (!pending_.empty())
+      writeBlock(pending_);
+    pending_.clear();
+    file_.close();
+    bool ok = !failed_ && !file_.fail();
+    if (!ok)
+      LOG(ERROR) << "Audit archive incomplete";
+    return ok;
+  }
+
+  uint64_t AuditArchiveWriter::records() const {
+    std::lock_guard<std::mutex> lck(mutex_);
+    return records_;
+  }
+
+  uint64_t AuditArchiveWriter::bytes() const {
+    std::lock_guard<std::mutex> write_lck(write_mutex_);
+    return offset_;
+  }
+
+  void AuditArchiveWriter::writeBlock(std::vector<AuditRecord> &records) {
+    if (!file_.is_open() || records.empty())
+      return;
+    std::stable_sort(records.begin(), records.end(), [](const AuditRecord &lhs, const AuditRecord &rhs) {
+      return lhs.time_ns_ < rhs.time_ns_;
+    });
+
+    AuditBlockIndex block;
+    block.count_ = records.size();
+    block.min_time_ = records.front().time_ns_;
+    block.max_time_ = records.back().time_ns_;
+    block.min_atm_ = block.max_atm_ = records.front().atm_id_;
+    block.min_card_ = block.max_card_ = records.front().card_no_;
+    block.min_account_ = block.max_account_ = records.front().account_id_;
+    block.types_ = 0;
+    for (const auto &record : records) {
+      block.min_atm_ = std::min<long>(block.min_atm_, record.atm_id_);
+      block.max_atm_ = std::max<long>(block.max_atm_, record.atm_id_);
+      block.min_card_ = std::min(block.min_card_, record.card_no_);
+      block.max_card_ = std::max(block.max_card_, record.card_no_);
+      block.min_account_ = std::min(block.min_account_, record.account_id_);
+      block.max_account_ = std::max(block.max_account_, record.account_id_);
+      block.types_ |= 1u << typeCode(record.type_, record.ok_);
+    }
+
+    std::array<std::string, AUDIT_COLUMNS> columns;
+    uint64_t previous = block.min_time_;
+    for (const auto &record : records) {
+      putVarint(record.time_ns_ - previous, columns[AUDIT_TIME]);
+      previous = record.time_ns_;
+      putVarint(record.atm_id_ - block.min_atm_, columns[AUDIT_ATM]);
+      putVarint(record.card_no_ - block.min_card_, columns[AUDIT_CARD]);
+      putVarint(record.account_id_ - block.min_account_, columns[AUDIT_ACCOUNT]);
+      columns[AUDIT_TYPE].push_back(static_cast<char>(typeCode(record.type_, record.ok_)));
+      putSigned(record.amount_, columns[AUDIT_AMOUNT]);
+    }
+    for (int column = 0; column < AUDIT_COLUMNS; column++)
+      block.column_bytes_[column] = columns[column].size();
+    std::string header;
+    putBlockHeader(block, header);
+    file_.write(header.data(), header.size());
+    offset_ += header.size();
+    for (const auto &column : columns) {
+      file_.write(column.data(), column.size());
+      offset_ += column.size();
+    }
+    // Readers see every block once it is written out whole
+    if (!file_.flush()) {
+      LOG(ERROR) << "Unable to write audit block";
+      failed_ = true;
+    }
+  }
+
+  bool AuditArchiveReader::open(const std::string &path) {
+    file_.close();
+    file_.clear();
+    index_.clear();
+    file_.open(path, std::ios::binary);
+    char magic[sizeof(AUDIT_MAGIC)];
+    if (!file_ || !file_.read(magic, sizeof(magic)) || std::memcmp(magic, AUDIT_MAGIC, sizeof(magic)))
+      return false;
+
+    file_.seekg(0, std::ios::end);
+    uint64_t size = file_.tellg();
+    bool torn;
+    uint64_t end = readBlockHeaders(file_, size, index_, torn);
+    // A torn block is one still being written or cut short by a crash
+    if (end < size && !torn)
+      LOG(WARNING) << "Skipping corrupted audit blocks from " << end;
+    return true;
+  }
+
+  uint64_t AuditArchiveReader::records() const {
+    uint64_t records = 0;
+    for (const auto &block : index_)
+      records += block.count_;
+    return records;
+  }
+
+  bool AuditArchiveReader::overlaps(const AuditBlockIndex &block, const AuditQuery &query) {
+    if (block.max_time_ < query.from_ns_ || block.min_time_ >= query.to_ns_)
+      return false;
+    if (query.account_id_ >= 0 &&
+        (query.account_id_ < block.min_account_ || query.account_id_ > block.max_account_))
+      return false;
+    if (query.card_no_ >= 0 && (query.card_no_ < block.min_card_ || query.card_no_ > block.max_card_))
+      return false;
+    if (query.atm_id_ >= 0 && (query.atm_id_ < block.min_atm_ || query.atm_id_ > block.max_atm_))
+      return false;
+    for (uint8_t code = 0; code < 8; code++) {
+      if ((block.types_ & (1u << code)) && typeMatches(code, query))
+        return true;
+    }
+    return false;
+  }
+
+  uint64_t AuditArchiveReader::readColumns(const AuditBlockIndex &block, uint32_t columns, Columns &out) {
+    uint64_t offset = block.offset_, bytes_read = 0;
+    std::string bytes;
+    for (int column = 0; column < AUDIT_COLUMNS; column++) {
+      uint32_t size = block.column_bytes_[column];
+      if (!(columns & (1u << column))) {
+        offset += size;
+        continue;
+      }
+      bytes.resize(size);
+      file_.clear();
+      file_.seekg(offset);
+      if (!file_.read(&bytes[0], size))
+        return 0;
+      offset += size;
+      bytes_read += size;
+
+      std::size_t pos = 0;
+      uint64_t value;
+      uint64_t previous = block.min_time_;
+      switch (column) {
+        case AUDIT_TIME: out.time_.resize(block.count_);
+                         for (auto &time : out.time_) {
+                           if (!getVarint(bytes, pos, value))
+                             return 0;
+                           time = previous += value;
+                         }
+                         break;
+        case AUDIT_ATM:
+        case AUDIT_CARD:
+        case AUDIT_ACCOUNT: {
+          std::vector<long> &values = column == AUDIT_ATM ? out.atm_ :
+            column == AUDIT_CARD ? out.card_ : out.account_;
+          long base = column == AUDIT_ATM ? block.min_atm_ :
+            column == AUDIT_CARD ? block.min_card_ : block.min_account_;
+          values.resize(block.count_);
+          for (auto &id : values) {
+            if (!getVarint(bytes, pos, value))
+              return 0;
+            id = base + static_cast<long>(value);
+          }
+          break;
+        }
+        case AUDIT_TYPE: if (bytes.size() != block.count_)
+                           return 0;
+                         out.type_.assign(bytes.begin(), bytes.end());
+                         break;
+        case AUDIT_AMOUNT: out.amount_.resize(block.count_);
+                           for (auto &amount : out.amount_) {
+                             long signed_value;
+                             if (!getSigned(bytes, pos, signed_value))
+                               return 0;
+                             amount = static_cast<int>(signed_value);
+                           }
+                           break;
+      }
+    }
+    return bytes_read;
+  }
+
+  AuditScanStats AuditArchiveReader::run(const AuditQuery &query, uint32_t columns,
+      const std::function<void(const Columns&, std::size_t)> &visit) {
+    AuditScanStats stats;
+    stats.blocks_ = index_.size();
+    if (query.account_id_ >= 0)
+      columns |= 1u << AUDIT_ACCOUNT;
+    if (query.card_no_ >= 0)
+      columns |= 1u << AUDIT_CARD;
+    if (query.atm_id_ >= 0)
+      columns |= 1u << AUDIT_ATM;
+    if (query.type_ >= 0 || query.result_ >= 0)
+      columns |= 1u << AUDIT_TYPE;
+
+    Columns block_columns;
+    for (const auto &block : index_) {
+      if (!overlaps(block, query))
+        continue;
+      // Times only need decoding where the block straddles the query's range
+      bool inside = block.min_time_ >= query.from_ns_ && block.max_time_ < query.to_ns_;
+      uint32_t block_mask = columns | (inside ? 0 : 1u << AUDIT_TIME);
+      uint64_t bytes = readColumns(block, block_mask, block_columns);
+      if (!bytes) {
+        LOG(ERROR) << "Corrupted audit block at " << block.offset_;
+        continue;
+      }
+      stats.blocks_read_++;
+      stats.bytes_read_ += bytes;
+      stats.records_scanned_ += block.count_;
+
+      for (std::size_t row = 0; row < block.count_; row++) {
+        if (!inside && (block_columns.time_[row] < query.from_ns_ || block_columns.time_[row] >= query.to_ns_))
+          continue;
+        if (query.account_id_ >= 0 && block_columns.account_[row] != query.account_id_)
+          continue;
+        if (query.card_no_ >= 0 && block_columns.card_[row] != query.card_no_)
+          continue;
+        if (query.atm_id_ >= 0 && block_columns.atm_[row] != query.atm_id_)
+          continue;
+        if ((query.type_ >= 0 || query.result_ >= 0) && !typeMatches(block_columns.type_[row], query))
+          continue;
+        stats.records_matched_++;
+        visit(block_columns, row);
+      }
+    }
+    return stats;
+  }
+
+  AuditScanStats AuditArchiveReader::scan(const AuditQuery &query,
+      const std::function<void(const AuditRecord&)> &visit) {
+    return run(query, (1u << AUDIT_COLUMNS) - 1, [&visit](const Columns &columns, std::size_t row) {
+      AuditRecord record;
+      record.time_ns_ = columns.time_[row];
+      record.atm_id_ = static_cast<int>(columns.atm_[row]);
+      record.card_no_ = columns.card_[row];
+      record.account_id_ = columns.account_[row];
+      record.type_ = static_cast<TransactionType>(columns.type_[row] & 3);
+      record.amount_ = columns.amount_[row];
+      record.ok_ = columns.type_[row] >> 2;
+      visit(record);
+    });
+  }
+
+  AuditScanStats AuditArchiveReader::totalsByAtm(const AuditQuery &query,
+      std::map<int, ActivityTotals> &totals) {
+    AuditQuery moved = query;
+    moved.result_ = 1;
+    uint32_t columns = (1u << AUDIT_ATM) | (1u << AUDIT_TYPE) | (1u << AUDIT_AMOUNT);
+    // Atm ids are small, summed by position and only folded into the map once
+    std::vector<ActivityTotals> by_id;
+    AuditScanStats stats = run(moved, columns, [&](const Columns &columns, std::size_t row) {
+      long atm_id = columns.atm_[row];
+      ActivityTotals *atm;
+      if (atm_id >= -1 && atm_id < AUDIT_DENSE_ATMS) {
+        if (static_cast<std::size_t>(atm_id + 1) >= by_id.size())
+          by_id.resize(atm_id + 2);
+        atm = &by_id[atm_id + 1];
+      } else {
+        atm = &totals[static_cast<int>(atm_id)];
+      }
+      switch (columns.type_[row] & 3) {
+        case DEPOSIT: atm->deposits_ += columns.amount_[row];
+                      atm->deposit_count_++;
+                      break;
+        case WITHDRAW: atm->withdrawals_ += columns.amount_[row];
+                       atm->withdraw_count_++;
+                       break;
+      }
+    });
+    for (std::size_t i = 0; i < by_id.size(); i++) {
+      if (by_id[i].deposit_count_ || by_id[i].withdraw_count_)
+        totals[static_cast<int>(i) - 1] += by_id[i];
+    }
+    return stats;
+  }
+}
@@ -2,96 +2,147 @@
 #include <glog/logging.h>
 
 #include <bank.hpp>
+#include <algorithm>
+#include <cstdlib>
 #include <stdexcept>
 #include <string>
 
 namespace banking {
-  Bank *Bank::bank_;
+  template <typename LockPolicy, typename StoragePolicy>
+  BasicBank<LockPolicy, StoragePolicy> *BasicBank<LockPolicy, StoragePolicy>::bank_;
 
-  void Bank::init() {
+  template <typename LockPolicy, typename StoragePolicy>
+  uint64_t BasicBank<LockPolicy, StoragePolicy>::generation_;
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::init() {
     LOG(INFO) << "Initializing bank!";
-    std::lock_guard<std::mutex> lck1(account_id_mutex_);
+    std::lock_guard<mutex_t> lck1(account_id_mutex_);
     available_account_ids_.resize(ACCOUNTS_CARDS_UL);
     std::iota(available_account_ids_.begin(), available_account_ids_.end(), 0);
 
-    std::lock_guard<std::mutex> lck2(card_id_mutex_);
+    std::lock_guard<mutex_t> lck2(card_id_mutex_);
     available_card_ids_.resize(ACCOUNTS_CARDS_UL);
     std::iota(available_card_ids_.begin(), available_card_ids_.end(), 0);
 
-    std::lock_guard<std::mutex> lck3(t_token_mutex_);
+    std::lock_guard<mutex_t> lck3(t_token_mutex_);
     available_transaction_tokens_.resize(ACCOUNTS_CARDS_UL);
     std::iota(available_transaction_tokens_.begin(), available_transaction_tokens_.end(), 0);
 
-    std::lock_guard<std::mutex> lck4(atm_id_mutex_);
+    std::lock_guard<mutex_t> lck4(atm_id_mutex_);
     available_atm_ids_.resize(ACCOUNTS_CARDS_UL);
     std::iota(available_atm_ids_.begin(), available_atm_ids_.end(), 0);
+
+    const char *trace_path = std::getenv("ATM_BANK_TRACE");
+    if (trace_path)
+      TraceRecorder::getRecorder()->start(trace_path);
+
+    const char *span_path = std::getenv("ATM_SPAN_TRACE");
+    if (span_path) {
+      const char *sample_every = std::getenv("ATM_SPAN_SAMPLE");
+      SpanTracer::getTracer()->start(span_path, sample_every ? std::atoi(sample_every) : 1);
+    }
+
+    const char *audit_path = std::getenv("ATM_AUDIT_ARCHIVE");
+    if (audit_path) {
+      env_audit_.reset(new AuditArchiveWriter);
+      if (env_audit_->open(audit_path))
+        attachAuditArchive(env_audit_.get());
+    }
   }
 
-  Bank::~Bank() {
-    std::lock_guard<std::mutex> lck1(account_id_mutex_);
+  template <typename LockPolicy, typename StoragePolicy>
+  BasicBank<LockPolicy, StoragePolicy>::~BasicBank() {
+    TraceRecorder::getRecorder()->stop();
+    SpanTracer::getTracer()->stop();
+    if (env_audit_)
+      env_audit_->close();
+
+    std::lock_guard<mutex_t> lck1(account_id_mutex_);
     available_account_ids_.clear();
 
-    std::lock_guard<std::mutex> lck2(card_id_mutex_);
+    std::lock_guard<mutex_t> lck2(card_id_mutex_);
     available_card_ids_.clear();
 
-    std::lock_guard<std::mutex> lck3(t_token_mutex_);
+    std::lock_guard<mutex_t> lck3(t_token_mutex_);
     available_transaction_tokens_.clear();
 
-    std::lock_guard<std::mutex> lck4(atm_id_mutex_);
+    std::lock_guard<mutex_t> lck4(atm_id_mutex_);
     available_atm_ids_.clear();
 
-    std::lock_guard<std::mutex> lc5(account_cards_mutex_);
     account_cards_map_.clear();
-
-    std::lock_guard<std::mutex> lc6(transaction_map_mutex_);
     transaction_map_.clear();
-
-    std::lock_guard<std::mutex> lc7(atm_cb_mutex_);
     atm_cb_map_.clear();
   }
 
-  void Bank::createAndLinkAccount(const std::string &holder_name, int amount, long card_no) {
-    AccountPtr account = std::make_shared<Account>(getRandomId<long>(account_id_mutex_, available_account_ids_),
-        holder_name, amount);
-    LOG(INFO) << "Creating card and account for " << holder_name << " " << amount;
+  template <typename LockPolicy, typename StoragePolicy>
+  long BasicBank<LockPolicy, StoragePolicy>::createAndLinkAccount(const std::string &holder_name, int amount, long card_no) {
+    TraceScope trace(TRACE_CREATE_AND_LINK_ACCOUNT, -1, {amount, card_no}, {0}, &holder_name);
+    // Ids are taken out of their pools and the card checked before the
+    // account row is created, so a refused call leaves nothing behind
+    long account_id = takeRandomId<long>(account_id_mutex_, available_account_ids_);
     account_card_pair_t account_card_pair;
     if (card_no >= 0) {
-      if(findInMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_,
-            card_no, account_card_pair)) {
+      if(!account_cards_map_.find(card_no, account_card_pair)) {
         LOG(ERROR) << "Card number is not present";
+        returnId<long>(account_id_mutex_, available_account_ids_, account_id);
         throw std::runtime_error("Illegal card access");
       }
-      account_card_pair.second.push_back(account);
-      if (!changeValueInMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_,
-            card_no, account_card_pair))
+    } else {
+      try {
+        account_card_pair.first = std::make_shared<Card>(takeRandomId<long>(card_id_mutex_, available_card_ids_));
+      } catch (std::exception &ex) {
+        LOG(ERROR) << "Unable to create an entry for account and card for user: " << holder_name;
+        returnId<long>(account_id_mutex_, available_account_ids_, account_id);
+        throw;
+      }
+    }
+
+    SnapshotEpoch::Guard epoch(snapshot_epoch_);
+    account_index_t account = accounts_.create(account_id, holder_name, amount, epoch.epoch());
+    LOG(INFO) << "Creating card and account for " << holder_name << " " << amount;
+    account_card_pair.second.push_back(account);
+    if (card_no >= 0) {
+      if (!account_cards_map_.change(card_no, account_card_pair))
       {
         LOG(ERROR) << "Unable to update the link";
         throw std::runtime_error("Corrupted card access");
       }
-      return;
+    } else {
+      card_no = account_card_pair.first->get_number();
+      account_cards_map_.add(card_no, account_card_pair);
     }
+    publishCardView(card_no, account_card_pair.second);
+    journalLink(card_no, account);
+    trace.set_results({1, account_id, card_no});
+    return card_no;
+  }
 
-    try {
-      CardPtr card = std::make_shared<Card>(getRandomId<long>(card_id_mutex_, available_card_ids_));
-      std::vector<AccountPtr> cur_card_accounts;
-      cur_card_accounts.push_back(account);
-      account_card_pair_t account_card_pair = std::pair<CardPtr, std::vector<AccountPtr>>(card, cur_card_accounts);
-      addToMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_,
-          card->get_number(), account_card_pair);
-    } catch (std::exception &ex) {
-      LOG(ERROR) << "Unable to create an entry for account and card for user: " << holder_name;
-      throw ex;
-    }
+  template <typename LockPolicy, typename StoragePolicy>
+  int BasicBank<LockPolicy, StoragePolicy>::get_atm_id() {
+    TraceScope trace(TRACE_GET_ATM_ID, -1, {});
+    int atm_id = takeRandomId<int>(atm_id_mutex_, available_atm_ids_);
+    trace.set_results({atm_id});
+    return atm_id;
   }
 
-  int Bank::get_atm_id() {
-    return getRandomId<int>(atm_id_mutex_, available_atm_ids_);
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::returnAtmId(int atm_id) {
+    TraceScope trace(TRACE_RETURN_ATM_ID, -1, {atm_id});
+    if (atm_id < 0 || atm_id >= ACCOUNTS_CARDS_UL)
+      return;
+    std::lock_guard<mutex_t> lck(atm_id_mutex_);
+    if (std::find(available_atm_ids_.begin(), available_atm_ids_.end(), atm_id) == available_atm_ids_.end())
+      available_atm_ids_.push_back(atm_id);
   }
 
-  int Bank::verifyAndCreateTransaction(long card_no, int card_pin) {
+  template <typename LockPolicy, typename StoragePolicy>
+  int BasicBank<LockPolicy, StoragePolicy>::verifyAndCreateTransaction(long card_no, int card_pin, int atm_id) {
+    TraceScope trace(TRACE_VERIFY_AND_CREATE_TRANSACTION, -1, {card_no, card_pin, atm_id}, {-1});
+    SpanScope span("verifyAndCreateTransaction", SPAN_NEW_SESSION);
     account_card_pair_t acit;
     DLOG(INFO) << "Current card transaction: " << card_no << " " << card_pin;
-    if (!findInMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_, card_no, acit)) {
+    if (!account_cards_map_.find(card_no, acit)) {
       LOG(ERROR) << "Unable to find card number!";
       throw std::runtime_error("Illegal card access");
     }
@@ -101,47 +152,91 @@ namespace banking {
       throw std::runtime_error("Illegal card access");
     }
 
-    int transaction_token = getRandomId<int>(t_token_mutex_, available_transaction_tokens_);
+    reapIdleSessions();
+    {
+      SpanScope wait("admission");
+      if (!admission_.admit(atm_id)) {
+        LOG(ERROR) << "Session budget exhausted";
+        throw std::runtime_error("Bank busy, please try again");
+      }
+    }
 
+    int transaction_token = -1;
     try {
-      addToMap<int, long>(transaction_map_mutex_, transaction_map_,
-          transaction_token, card_no);
+      transaction_token = takeRandomId<int>(t_token_mutex_, available_transaction_tokens_);
+      transaction_map_.add(transaction_token, card_no);
     } catch (std::exception &ex) {
       LOG(ERROR) << "Unable to initialize a transaction";
+      if (transaction_token >= 0)
+        returnId<int>(t_token_mutex_, available_transaction_tokens_, transaction_token);
+      admission_.release();
       throw std::runtime_error("Transaction initialization error");
     }
+    token_atm_ids_[transaction_token].store(atm_id, std::memory_order_relaxed);
+    token_seen_[transaction_token].store(
+        std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_release);
+    span.bind(transaction_token);
+    trace.set_results({transaction_token});
     return transaction_token;
   }
 
-  void Bank::acknowledgeTransaction(int transaction_token, atm_cb_t atm_cb) {
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::acknowledgeTransaction(int transaction_token, atm_cb_t atm_cb) {
+    TraceScope trace(TRACE_ACKNOWLEDGE_TRANSACTION, transaction_token, {}, {0});
+    SpanScope span("acknowledgeTransaction", transaction_token);
+    if (trace.active()) {
+      atm_cb_t recorded_cb = atm_cb;
+      atm_cb = [transaction_token, recorded_cb](AtmOperationType atm_op, int info,
+          std::string &&display_msg) {
+        TraceScope cb_trace(TRACE_ATM_CALLBACK, transaction_token, {atm_op, info}, {0});
+        bool ret = recorded_cb(atm_op, info, std::move(display_msg));
+        cb_trace.set_results({ret});
+        return ret;
+      };
+    }
+    if (span.active()) {
+      atm_cb_t display_cb = atm_cb;
+      atm_cb = [transaction_token, display_cb](AtmOperationType atm_op, int info,
+          std::string &&display_msg) {
+        SpanScope cb_span("controllerDisplay", transaction_token);
+        return display_cb(atm_op, info, std::move(display_msg));
+      };
+    }
+
     long card_no;
-    if (findInMap<int, long>(transaction_map_mutex_, transaction_map_, transaction_token, card_no)) {
-      try{
-        addToMap<int, atm_cb_t>(atm_cb_mutex_, atm_cb_map_, transaction_token, atm_cb);
-      } catch (std::exception &ex) {
-        throw ex;
-      }
-    } else {
+    if (!transaction_map_.find(transaction_token, card_no))
       throw std::runtime_error("Unable to find transaction");
-    }
+    touchSession(transaction_token);
 
-    std::string accounts = "";
-    account_card_pair_t account_card_pair;
-    if (findInMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_, card_no, account_card_pair)) {
-      for (const auto &acc : account_card_pair.second) {
-        accounts = accounts + std::to_string(acc->get_id()) + std::string(" ");
+    try {
+      atm_cb_map_.add(transaction_token, atm_cb);
+      std::string accounts = "";
+      std::vector<long> account_no;
+      if (readCardAccounts(card_no, account_no)) {
+        for (const auto &acc : account_no) {
+          accounts = accounts + std::to_string(acc) + std::string(" ");
+        }
+        atm_cb(SHOW_INPUT, (int)account_no.size(), std::string(accounts));
+      } else {
+        atm_cb(SHOW_ERROR, -1, "Unable to find accounts");
       }
-      atm_cb(SHOW_INPUT, (int)account_card_pair.second.size(), std::string(accounts));
-    } else {
-      atm_cb(SHOW_ERROR, -1, "Unable to find accounts");
+    } catch (...) {
+      // The atm is left without the token, nothing else would end the session
+      throwSession(transaction_token, false);
+      throw;
     }
+    trace.set_results({1});
   }
 
-  void Bank::selectAccount(int transaction_token, long account_no) {
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::selectAccount(int transaction_token, long account_no) {
+    TraceScope trace(TRACE_SELECT_ACCOUNT, transaction_token, {account_no});
+    SpanScope span("selectAccount", transaction_token);
+    touchSession(transaction_token);
     LOG(INFO) << "Selected account: " << transaction_token << " " << account_no;
     long card_no;
     atm_cb_t atm_cb;
-    if (!findInMap<int, long>(transaction_map_mutex_, transaction_map_, transaction_token, card_no)) {
+    if (!transaction_map_.find(transaction_token, card_no)) {
       LOG(ERROR) << "Not found!!!!";
       throwSession(transaction_token);
       return;
@@ -149,20 +244,18 @@ namespace banking {
 
     account_card_pair_t account_card_pair;
 
-    if (!findInMap<long, account_card_pair_t>(account_cards_mutex_,
-          account_cards_map_, card_no,
-          account_card_pair)) {
+    if (!account_cards_map_.find(card_no, account_card_pair)) {
       LOG(ERROR) << "Not found!!!!";
       throwSession(transaction_token);
       return;
     }
 
-    AccountPtr account;
+    Account account;
     bool found = false;
-    for (auto &acc : account_card_pair.second) {
-      if (acc->get_id() == account_no) {
+    for (const auto &index : account_card_pair.second) {
+      if (accounts_.id(index) == account_no) {
         found = true;
-        account = acc;
+        account = Account(accounts_, index);
         break;
       }
     }
@@ -174,115 +267,809 @@ namespace banking {
 
     acc_cb_t f = std::bind(&Account::performTransaction, account,
         std::placeholders::_1,
-        std::placeholders::_2);
-    account_card_pair.first->set_account_callback(f);
+        std::placeholders::_2,
+        std::placeholders::_3);
+    bool linked = account_card_pair.first->set_account_callback(f);
     LOG(INFO) << "Calling input";
 
-    if (findInMap<int, atm_cb_t>(atm_cb_mutex_, atm_cb_map_, transaction_token, atm_cb))
+    if (atm_cb_map_.find(transaction_token, atm_cb)) {
+      if (linked) {
+        session_views_.publish(transaction_token,
+            std::unique_ptr<const SessionView>(new SessionView{card_no, account, atm_cb}));
+      }
       atm_cb(SHOW_INPUT, 1, "Select transaction type");
+    } else {
+      throwSession(transaction_token);
+    }
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::performTransaction(int transaction_token, TransactionType &trans_type, int amount,
+      uint64_t request_id) {
+    // Opened before the dispatch, so retries are recorded along with their id
+    TraceScope trace(TRACE_PERFORM_TRANSACTION, transaction_token,
+        {trans_type, amount, static_cast<long>(request_id)});
+    SpanScope span("performTransaction", transaction_token);
+    LatencyWindow::Scope latency(transaction_latency_);
+    touchSession(transaction_token);
+    try {
+      if (request_id && trans_type != CHECK_BALANCE)
+        performIdempotentTransaction(transaction_token, trans_type, amount, request_id);
+      else
+        applyTransaction(transaction_token, trans_type, amount);
+    } catch (...) {
+      // An atm callback threw, the atm is not coming back for this session
+      throwSession(transaction_token, false);
+      throw;
+    }
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::applyTransaction(int transaction_token,
+      TransactionType &trans_type, int amount) {
+    LOG(INFO) << transaction_token << " " << trans_type << " " << amount;
+    if (trans_type == CHECK_BALANCE) {
+      long card_no = -1;
+      atm_cb_t atm_cb;
+      account_index_t account = 0;
+      {
+        RcuTable<SessionView>::ReadGuard guard(session_views_);
+        const SessionView *session = guard.get(transaction_token);
+        if (session) {
+          amount = session->account_.get_balance();
+          atm_cb = session->atm_cb_;
+          card_no = session->card_no_;
+          account = session->account_.get_index();
+        }
+      }
+      if (atm_cb) {
+        atm_cb(SHOW, amount, "Show me the money!");
+        audit(transaction_token, card_no, account, CHECK_BALANCE, amount, true);
+        throwSession(transaction_token, false);
+        return;
+      }
+      LOG(ERROR) << "no selected account";
+      throwSession(transaction_token);
+      return;
+    }
+
+    if (trans_type == WITHDRAW)
+      performWithdraw(transaction_token, amount);
     else
+      performDeposit(transaction_token, amount);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::performDeposit(int transaction_token, int amount) {
+    long card_no;
+    atm_cb_t atm_cb;
+    account_index_t account = 0;
+    bool selected = false;
+    {
+      RcuTable<SessionView>::ReadGuard guard(session_views_);
+      const SessionView *session = guard.get(transaction_token);
+      if (session) {
+        account = session->account_.get_index();
+        selected = true;
+      }
+    }
+    if (!selected || !transaction_map_.find(transaction_token, card_no) ||
+        !atm_cb_map_.find(transaction_token, atm_cb)) {
+      LOG(ERROR) << "no selected account";
       throwSession(transaction_token);
+      return;
+    }
+
+    // Two phase: the account is credited only once the atm has the cash, a
+    // refused take leaves nothing to undo. Audited done only when credited.
+    bool taken;
+    try {
+      taken = atm_cb(TAKE, amount, "Give me the money");
+    } catch (...) {
+      audit(transaction_token, card_no, account, DEPOSIT, amount, false);
+      throw;
+    }
+    if (taken) {
+      SnapshotEpoch::Guard epoch(snapshot_epoch_);
+      TransactionType trans_type = DEPOSIT;
+      int credited = amount;
+      accounts_.performTransaction(account, trans_type, credited, epoch.epoch());
+      recordActivity(epoch.epoch(), transaction_token, card_no, DEPOSIT, amount, 1);
+    }
+    if (taken)
+      journalBalance(account);
+    audit(transaction_token, card_no, account, DEPOSIT, amount, taken);
+    throwSession(transaction_token, false);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::performIdempotentTransaction(int transaction_token,
+      TransactionType &trans_type, int amount, uint64_t request_id) {
+    long card_no = -1;
+    {
+      RcuTable<SessionView>::ReadGuard guard(session_views_);
+      const SessionView *session = guard.get(transaction_token);
+      if (session)
+        card_no = session->card_no_;
+    }
+    atm_cb_t atm_cb;
+    bool has_atm = atm_cb_map_.find(transaction_token, atm_cb);
+    // Nothing is reserved for a session that could not carry the request out,
+    // its retry on a working session must not be answered as a duplicate
+    if (card_no < 0 || !has_atm) {
+      LOG(ERROR) << "no selected account";
+      throwSession(transaction_token);
+      return;
+    }
+
+    std::shared_ptr<TransactionOutcome> outcome =
+      std::make_shared<TransactionOutcome>(trans_type, amount);
+    DedupeStatus status = dedupe_.begin(card_no, request_id, *outcome);
+    if (status != DEDUPE_NEW) {
+      // Answered on the retrying session only, cash never moves twice
+      if (outcome->trans_type_ != trans_type || outcome->requested_ != amount) {
+        LOG(WARNING) << "Request " << request_id << " of card " << card_no
+          << " reused for another transaction";
+        atm_cb(SHOW_ERROR, -1, "Request id already used");
+      } else if (status == DEDUPE_IN_FLIGHT) {
+        LOG(WARNING) << "Request " << request_id << " is already being processed";
+        atm_cb(SHOW_ERROR, -1, "Request already being processed");
+      } else {
+        LOG(WARNING) << "Repeated request " << request_id << ", not applied again";
+        if (outcome->done_ && (outcome->atm_op_ == GIVE || outcome->atm_op_ == TAKE))
+          atm_cb(SHOW, outcome->amount_, "Request already carried out");
+        else
+          atm_cb(SHOW_ERROR, -1, "Request already refused");
+      }
+      throwSession(transaction_token, false);
+      return;
+    }
+
+    atm_cb_t recording_cb = [outcome, atm_cb](AtmOperationType atm_op, int info,
+        std::string &&display_msg) {
+      bool done = atm_cb(atm_op, info, std::move(display_msg));
+      outcome->atm_op_ = atm_op;
+      outcome->amount_ = info;
+      outcome->done_ = done;
+      return done;
+    };
+    atm_cb_map_.change(transaction_token, recording_cb);
+
+    try {
+      applyTransaction(transaction_token, trans_type, amount);
+    } catch (...) {
+      dedupe_.complete(card_no, request_id, *outcome);
+      throw;
+    }
+    dedupe_.complete(card_no, request_id, *outcome);
   }
 
-  void Bank::performTransaction(int transaction_token, TransactionType &trans_type, int amount) {
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::performWithdraw(int transaction_token, int amount) {
     long card_no;
-    LOG(INFO) << transaction_token << " " << trans_type << " " << amount;
-    if (!findInMap<int, long>(transaction_map_mutex_, transaction_map_, transaction_token, card_no)) {
-      LOG(ERROR) << "no transaction";
+    atm_cb_t atm_cb;
+    account_index_t account = 0;
+    bool selected = false;
+    {
+      RcuTable<SessionView>::ReadGuard guard(session_views_);
+      const SessionView *session = guard.get(transaction_token);
+      if (session) {
+        account = session->account_.get_index();
+        selected = true;
+      }
+    }
+    if (!selected || !transaction_map_.find(transaction_token, card_no) ||
+        !atm_cb_map_.find(transaction_token, atm_cb)) {
+      LOG(ERROR) << "no selected account";
       throwSession(transaction_token);
       return;
     }
 
-    account_card_pair_t account_card_pair;
-    if (!findInMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_, card_no, account_card_pair)) {
-      LOG(ERROR) << "no account";
+    // Pinned, only this call closes the hold so settling it can not fail
+    // once the cash is out. The scope releases it if the atm throws.
+    HoldScope hold(holds_, 1);
+    bool authorized;
+    {
+      SpanScope hold_span("authorizeHold");
+      authorized = holds_.authorize(account, amount, hold[0], true);
+    }
+    if (!authorized) {
+      LOG(WARNING) << "Bad withdraw";
+      audit(transaction_token, card_no, account, WITHDRAW, amount, false);
       throwSession(transaction_token);
       return;
     }
 
-    if (account_card_pair.first->callAccountCallback(trans_type, amount)) {
-      atm_cb_t atm_cb;
-      if (findInMap<int, atm_cb_t>(atm_cb_mutex_, atm_cb_map_, transaction_token, atm_cb)) {
-        std::string display_msg;
-        AtmOperationType atm_op;
-        switch (trans_type) {
-          case DEPOSIT: atm_op = TAKE;
-                        display_msg = std::string("Give me the money");
-                        break;
-          case WITHDRAW: atm_op = GIVE;
-                         display_msg = std::string("Take your money");
-                         break;
-          case CHECK_BALANCE: atm_op = SHOW;
-                              display_msg = std::string("Show me the money!");
-                              break;
-        }
-        if (!atm_cb(atm_op, amount, std::string(display_msg))) {
-          TransactionType reverse_trans_type;
-          switch (trans_type) {
-            case DEPOSIT: reverse_trans_type = WITHDRAW;
-                          break;
-            case WITHDRAW: reverse_trans_type = DEPOSIT;
-                           break;
+    bool given;
+    try {
+      given = atm_cb(GIVE, amount, "Take your money");
+    } catch (...) {
+      audit(transaction_token, card_no, account, WITHDRAW, amount, false);
+      throw;
+    }
+    if (!given) {
+      hold.release(0);
+      audit(transaction_token, card_no, account, WITHDRAW, amount, false);
+      throwSession(transaction_token, false);
+      return;
+    }
+
+    {
+      SnapshotEpoch::Guard epoch(snapshot_epoch_);
+      hold.settle(0, epoch.epoch());
+      recordActivity(epoch.epoch(), transaction_token, card_no, WITHDRAW, amount, 1);
+    }
+    journalBalance(account);
+    audit(transaction_token, card_no, account, WITHDRAW, amount, true);
+    throwSession(transaction_token, false);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::performSession(int transaction_token,
+      const std::vector<SessionOperation> &operations) {
+    TraceScope trace(TRACE_PERFORM_SESSION, transaction_token, {}, {0});
+    SpanScope span("performSession", transaction_token);
+    LatencyWindow::Scope latency(transaction_latency_);
+    touchSession(transaction_token);
+    if (trace.active()) {
+      std::vector<long> args;
+      for (const auto &operation : operations) {
+        args.insert(args.end(), {operation.type_, operation.account_no_, operation.amount_,
+            operation.to_account_no_});
+      }
+      trace.set_args(args);
+    }
+
+    try {
+      return runSession(transaction_token, operations, trace);
+    } catch (...) {
+      // An atm callback threw, the atm is not coming back for this session
+      throwSession(transaction_token, false);
+      throw;
+    }
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::runSession(int transaction_token,
+      const std::vector<SessionOperation> &operations, TraceScope &trace) {
+    long card_no;
+    atm_cb_t atm_cb;
+    if (!transaction_map_.find(transaction_token, card_no) ||
+        !atm_cb_map_.find(transaction_token, atm_cb)) {
+      LOG(ERROR) << "no transaction";
+      throwSession(transaction_token);
+      return false;
+    }
+
+    // Resolve every account once from the card snapshot, retries reuse them
+    std::vector<std::pair<account_index_t, account_index_t>> accounts;
+    {
+      RcuTable<CardView>::ReadGuard guard(card_views_);
+      const CardView *card = guard.get(card_no);
+      auto find = [this, card](long account_no, account_index_t &index) {
+        if (!card)
+          return false;
+        for (const auto &linked : card->accounts_) {
+          if (accounts_.id(linked) == account_no) {
+            index = linked;
+            return true;
           }
-          account_card_pair.first->callAccountCallback(reverse_trans_type, amount);
         }
+        return false;
+      };
+      for (const auto &operation : operations) {
+        std::pair<account_index_t, account_index_t> indexes(0, 0);
+        if (operation.amount_ < 0 || !find(operation.account_no_, indexes.first) ||
+            (operation.type_ == SESSION_TRANSFER && !find(operation.to_account_no_, indexes.second)))
+          break;
+        accounts.push_back(indexes);
+      }
+    }
+    if (accounts.size() != operations.size()) {
+      LOG(ERROR) << "no account";
+      throwSession(transaction_token);
+      return false;
+    }
+
+    // Every withdraw gets a pinned hold up front, its funds are held by the
+    // commit and settled only once the atm dispensed them. The scope releases
+    // whatever is still held when the session leaves early.
+    HoldScope holds(holds_, operations.size());
+    for (std::size_t i = 0; i < operations.size(); i++) {
+      if (operations[i].type_ == SESSION_WITHDRAW && !holds_.authorize(accounts[i].first, 0, holds[i], true)) {
+        LOG(ERROR) << "No free hold for session " << transaction_token;
+        holds.releaseAll();
+        atm_cb(SHOW_ERROR, -1, "Accounts busy, please try again");
         throwSession(transaction_token, false);
+        return false;
       }
+    }
+
+    // Refused as asked before the atm takes any cash
+    std::vector<int> shown;
+    {
+      AccountTransaction dry_run(accounts_);
+      if (!buildSession(dry_run, operations, accounts, shown)) {
+        LOG(WARNING) << "Bad session " << transaction_token;
+        holds.releaseAll();
+        atm_cb(SHOW_ERROR, -1, "Insufficient funds");
+        throwSession(transaction_token, false);
+        return false;
+      }
+    }
+
+    // Deposits are two phase as in performDeposit: the atm takes the cash
+    // first and only what it took is credited, by the commit below
+    std::vector<SessionOperation> applied(operations);
+    std::vector<bool> taken(operations.size(), false);
+    auto fail_deposits = [&](const char *what) {
+      for (std::size_t i = 0; i < operations.size(); i++) {
+        if (!taken[i])
+          continue;
+        LOG(ERROR) << "Deposit of " << operations[i].amount_ << " in session " << transaction_token
+          << " " << what;
+        audit(transaction_token, card_no, accounts[i].first, DEPOSIT, operations[i].amount_, false);
+      }
+    };
+    try {
+      for (std::size_t i = 0; i < operations.size(); i++) {
+        if (operations[i].type_ != SESSION_DEPOSIT)
+          continue;
+        taken[i] = atm_cb(TAKE, operations[i].amount_, "Give me the money");
+        if (!taken[i]) {
+          applied[i].amount_ = 0;
+          audit(transaction_token, card_no, accounts[i].first, DEPOSIT, operations[i].amount_, false);
+        }
+      }
+    } catch (...) {
+      fail_deposits("taken by an atm that failed, not credited");
+      throw;
+    }
+    // Cash taken for a session that can not be applied goes back to the customer
+    auto give_back_deposits = [&]() {
+      for (std::size_t i = 0; i < operations.size(); i++) {
+        if (taken[i] && !atm_cb(GIVE, operations[i].amount_, "Take back your money")) {
+          LOG(ERROR) << "Deposit of " << operations[i].amount_ << " in session " << transaction_token
+            << " kept by the atm, not credited";
+        }
+      }
+      fail_deposits("not credited");
+    };
+
+    AccountTransaction txn(accounts_);
+    for (int attempt = 1; attempt <= SESSION_MAX_ATTEMPTS; attempt++) {
+      bool built;
+      bool committed;
+      {
+        SnapshotEpoch::Guard epoch(snapshot_epoch_);
+        txn.clear();
+        built = buildSession(txn, applied, accounts, shown);
+        committed = built && txn.commit(epoch.epoch());
+        for (std::size_t i = 0; committed && i < operations.size(); i++) {
+          if (taken[i])
+            recordActivity(epoch.epoch(), transaction_token, card_no, DEPOSIT, operations[i].amount_, 1);
+        }
+      }
+      if (!built) {
+        // A deposit the atm refused was needed by a later operation
+        LOG(WARNING) << "Bad session " << transaction_token;
+        holds.releaseAll();
+        give_back_deposits();
+        atm_cb(SHOW_ERROR, -1, "Insufficient funds");
+        throwSession(transaction_token, false);
+        return false;
+      }
+      if (!committed) {
+        LOG(WARNING) << "Session " << transaction_token << " conflicted on attempt " << attempt;
+        continue;
+      }
+      for (std::size_t i = 0; i < operations.size(); i++) {
+        if (holds[i])
+          holds_.adopt(holds[i], operations[i].amount_);
+      }
+
+      // Committed, the atm is driven outside of the epoch and the writes
+      // following what it did enter a new one
+      auto settle_withdraw = [&](std::size_t i, int amount) {
+        SnapshotEpoch::Guard epoch(snapshot_epoch_);
+        holds.settle(i, epoch.epoch());
+        recordActivity(epoch.epoch(), transaction_token, card_no, WITHDRAW, amount, 1);
+      };
+      for (std::size_t i = 0; i < operations.size(); i++) {
+        const SessionOperation &operation = operations[i];
+        int amount = operation.amount_;
+        bool done;
+        switch (operation.type_) {
+          case SESSION_CHECK_BALANCE: atm_cb(SHOW, shown[i], "Show me the money!");
+                                      audit(transaction_token, card_no, accounts[i].first, CHECK_BALANCE, shown[i], true);
+                                      break;
+          case SESSION_TRANSFER: atm_cb(SHOW, shown[i], "Show me the money!");
+                                 audit(transaction_token, card_no, accounts[i].first, WITHDRAW, amount, true);
+                                 audit(transaction_token, card_no, accounts[i].second, DEPOSIT, amount, true);
+                                 break;
+          case SESSION_DEPOSIT: if (taken[i])
+                                  audit(transaction_token, card_no, accounts[i].first, DEPOSIT, amount, true);
+                                break;
+          case SESSION_WITHDRAW: try {
+                                   done = atm_cb(GIVE, amount, "Take your money");
+                                 } catch (...) {
+                                   audit(transaction_token, card_no, accounts[i].first, WITHDRAW, amount, false);
+                                   throw;
+                                 }
+                                 if (done)
+                                   settle_withdraw(i, amount);
+                                 else
+                                   holds.release(i);
+                                 audit(transaction_token, card_no, accounts[i].first, WITHDRAW, amount, done);
+                                 break;
+        }
+      }
+      for (std::size_t i = 0; i < operations.size(); i++) {
+        if (operations[i].type_ == SESSION_CHECK_BALANCE)
+          continue;
+        journalBalance(accounts[i].first);
+        if (operations[i].type_ == SESSION_TRANSFER)
+          journalBalance(accounts[i].second);
+      }
+      if (trace.active()) {
+        std::vector<long> results(1, 1);
+        results.insert(results.end(), shown.begin(), shown.end());
+        trace.set_results(results);
+      }
+      throwSession(transaction_token, false);
+      return true;
+    }
+
+    LOG(ERROR) << "Session " << transaction_token << " kept conflicting";
+    holds.releaseAll();
+    give_back_deposits();
+    atm_cb(SHOW_ERROR, -1, "Accounts busy, please try again");
+    throwSession(transaction_token, false);
+    return false;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::buildSession(AccountTransaction &txn,
+      const std::vector<SessionOperation> &operations,
+      const std::vector<std::pair<account_index_t, account_index_t>> &accounts,
+      std::vector<int> &shown) {
+    shown.clear();
+    for (std::size_t i = 0; i < operations.size(); i++) {
+      const SessionOperation &operation = operations[i];
+      account_index_t index = accounts[i].first;
+      switch (operation.type_) {
+        case SESSION_CHECK_BALANCE: shown.push_back(txn.read(index));
+                                    break;
+        case SESSION_DEPOSIT: txn.add(index, operation.amount_);
+                              shown.push_back(operation.amount_);
+                              break;
+        case SESSION_WITHDRAW: if (txn.available(index) < operation.amount_)
+                                 return false;
+                               txn.hold(index, operation.amount_);
+                               shown.push_back(operation.amount_);
+                               break;
+        case SESSION_TRANSFER: if (txn.available(index) < operation.amount_)
+                                 return false;
+                               txn.add(index, -operation.amount_);
+                               txn.add(accounts[i].second, operation.amount_);
+                               shown.push_back(txn.read(index));
+                               break;
+      }
+    }
+    return true;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::configureAdmission(std::size_t budget,
+      std::size_t queue_per_atm, AdmissionController::clock_t::duration max_wait,
+      std::chrono::steady_clock::duration idle_timeout) {
+    admission_.configure(std::min<std::size_t>(budget, ACCOUNTS_CARDS_UL), queue_per_atm, max_wait);
+    idle_timeout_.store(idle_timeout.count(), std::memory_order_relaxed);
+    next_reap_.store(0, std::memory_order_relaxed);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  std::unique_ptr<BatchJob> BasicBank<LockPolicy, StoragePolicy>::startBatchJob(
+      const BatchJobConfig &config, batch_adjustment_t adjustment) {
+    std::unique_ptr<BatchJob> job(new BatchJob(accounts_, snapshot_epoch_, &transaction_latency_,
+          [this](account_index_t index) { journalBalance(index); }, config, std::move(adjustment)));
+    job->start();
+    return job;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::restoreAccount(long card_no, long account_id,
+      const std::string &holder_name, int amount) {
+    auto take = [](mutex_t &mtx, std::vector<long> &available_ids, long id) {
+      std::lock_guard<mutex_t> lck(mtx);
+      auto it = std::find(available_ids.begin(), available_ids.end(), id);
+      if (it != available_ids.end()) {
+        *it = available_ids.back();
+        available_ids.pop_back();
+      }
+    };
+    take(account_id_mutex_, available_account_ids_, account_id);
+    take(card_id_mutex_, available_card_ids_, card_no);
+
+    SnapshotEpoch::Guard epoch(snapshot_epoch_);
+    account_index_t account = accounts_.create(account_id, holder_name, amount, epoch.epoch());
+    account_card_pair_t account_card_pair;
+    if (account_cards_map_.find(card_no, account_card_pair)) {
+      account_card_pair.second.push_back(account);
+      account_cards_map_.change(card_no, account_card_pair);
     } else {
-      throwSession(transaction_token);
+      account_card_pair.first = std::make_shared<Card>(card_no);
+      account_card_pair.second.push_back(account);
+      account_cards_map_.add(card_no, account_card_pair);
+    }
+    publishCardView(card_no, account_card_pair.second);
+    journalLink(card_no, account);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::attachJournal(ChangeJournal *journal) {
+    journal_.store(journal, std::memory_order_release);
+    if (!journal)
+      return;
+    // Changes racing with the seeding either carry a newer version than the
+    // link or are already part of it
+    RcuTable<CardView>::ReadGuard guard(card_views_);
+    for (long card_no = 0; card_no < ACCOUNTS_CARDS_UL; card_no++) {
+      const CardView *card = guard.get(card_no);
+      if (!card)
+        continue;
+      for (const auto &index : card->accounts_)
+        journalLink(card_no, index);
+    }
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::journalLink(long card_no, account_index_t index) {
+    ChangeJournal *journal = journal_.load(std::memory_order_acquire);
+    if (!journal)
+      return;
+    JournalRecord record;
+    record.op_ = JOURNAL_LINK_ACCOUNT;
+    record.card_no_ = card_no;
+    record.account_id_ = accounts_.id(index);
+    record.account_index_ = index;
+    record.balance_ = accounts_.balance(index, &record.version_);
+    record.holder_name_ = accounts_.name(index);
+    journal->publish(record);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::journalBalance(account_index_t index) {
+    ChangeJournal *journal = journal_.load(std::memory_order_acquire);
+    if (!journal)
+      return;
+    // Read after the change, so the last record of an account always carries
+    // its latest version whichever writer publishes first
+    JournalRecord record;
+    record.op_ = JOURNAL_BALANCE;
+    record.card_no_ = -1;
+    record.account_id_ = accounts_.id(index);
+    record.account_index_ = index;
+    record.balance_ = accounts_.balance(index, &record.version_);
+    journal->publish(record);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::audit(int transaction_token, long card_no,
+      account_index_t index, TransactionType trans_type, int amount, bool ok) {
+    AuditArchiveWriter *archive = audit_.load(std::memory_order_acquire);
+    if (!archive)
+      return;
+    AuditRecord record;
+    record.time_ns_ = AuditArchiveWriter::now();
+    record.atm_id_ = token_atm_ids_[transaction_token].load(std::memory_order_relaxed);
+    record.card_no_ = card_no;
+    record.account_id_ = accounts_.id(index);
+    record.type_ = trans_type;
+    record.amount_ = amount;
+    record.ok_ = ok;
+    archive->append(record);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::recordActivity(uint64_t epoch, int transaction_token,
+      long card_no, TransactionType trans_type, int amount, int count) {
+    card_activity_.record(epoch, card_no, trans_type, amount, count);
+    int atm_id = token_atm_ids_[transaction_token].load(std::memory_order_relaxed);
+    if (atm_id >= 0)
+      atm_activity_.record(epoch, atm_id, trans_type, amount, count);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  BalanceSnapshot BasicBank<LockPolicy, StoragePolicy>::snapshotBalances() {
+    std::lock_guard<mutex_t> lck(snapshot_mutex_);
+    BalanceSnapshot snapshot;
+    snapshot.epoch_ = snapshot_epoch_.advance();
+
+    std::vector<ActivityTotals> card_activity;
+    card_activity_.fold(snapshot.epoch_ - 1, card_activity);
+    atm_activity_.fold(snapshot.epoch_ - 1, snapshot.atm_activity_);
+
+    snapshot.card_offsets_.push_back(0);
+    RcuTable<CardView>::ReadGuard guard(card_views_);
+    for (long card_no = 0; card_no < ACCOUNTS_CARDS_UL; card_no++) {
+      const CardView *card = guard.get(card_no);
+      if (!card)
+        continue;
+      for (const auto &index : card->accounts_) {
+        snapshot.account_ids_.push_back(accounts_.id(index));
+        snapshot.balances_.push_back(accounts_.snapshotBalance(index, snapshot.epoch_));
+      }
+      snapshot.card_nos_.push_back(card_no);
+      snapshot.card_offsets_.push_back(snapshot.balances_.size());
+      snapshot.card_activity_.push_back(card_activity[card_no]);
+    }
+    return snapshot;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::checkBalance(int transaction_token, int &amount) {
+    TraceScope trace(TRACE_CHECK_BALANCE, transaction_token, {}, {0});
+    SpanScope span("checkBalance", transaction_token);
+    RcuTable<SessionView>::ReadGuard guard(session_views_);
+    const SessionView *session = guard.get(transaction_token);
+    if (!session)
+      return false;
+    amount = session->account_.get_balance();
+    trace.set_results({1, amount});
+    return true;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::listAccounts(long card_no, std::vector<long> &account_no) {
+    TraceScope trace(TRACE_LIST_ACCOUNTS, -1, {card_no}, {0});
+    if (!readCardAccounts(card_no, account_no))
+      return false;
+    if (trace.active()) {
+      std::vector<long> results(1, 1);
+      results.insert(results.end(), account_no.begin(), account_no.end());
+      trace.set_results(results);
+    }
+    return true;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::readCardAccounts(long card_no, std::vector<long> &account_no) {
+    RcuTable<CardView>::ReadGuard guard(card_views_);
+    const CardView *card = guard.get(card_no);
+    if (!card)
+      return false;
+    for (const auto &index : card->accounts_)
+      account_no.push_back(accounts_.id(index));
+    return true;
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::publishCardView(long card_no, const AccountIndexList &accounts) {
+    uint64_t version = 0;
+    {
+      RcuTable<CardView>::ReadGuard guard(card_views_);
+      const CardView *card = guard.get(card_no);
+      if (card)
+        version = card->version_ + 1;
     }
+    card_views_.publish(card_no,
+        std::unique_ptr<const CardView>(new CardView{card_no, version, accounts}));
   }
 
-  void Bank::throwSession(int token, bool throw_it) {
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::throwSession(int token, bool throw_it) {
+    session_views_.remove(token);
     long card_no;
-    if (findInMap<int, long>(transaction_map_mutex_, transaction_map_, token, card_no)) {
+    // Only the call removing the token releases it, the session may be ended
+    // by its own call and by the reaper at once
+    bool active = transaction_map_.remove(token, card_no);
+    if (active) {
       account_card_pair_t account_card_pair;
-      if (findInMap<long, account_card_pair_t>(account_cards_mutex_, account_cards_map_,
-            card_no, account_card_pair)) {
+      if (account_cards_map_.find(card_no, account_card_pair)) {
         account_card_pair.first->reset_account_callback();
       }
     }
-    deleteFromMap<int, long>(transaction_map_mutex_, transaction_map_, token);
-
     atm_cb_t atm_cb;
-    bool found = findInMap<int, atm_cb_t>(atm_cb_mutex_, atm_cb_map_, token, atm_cb);
+    bool found = atm_cb_map_.remove(token, atm_cb);
 
-    deleteFromMap<int, atm_cb_t>(atm_cb_mutex_, atm_cb_map_, token);
+    // Only hand the token out again once nothing refers to it
+    if (active) {
+      if (SpanTracer::enabled())
+        SpanTracer::getTracer()->endSession(token);
+      token_atm_ids_[token].store(-1, std::memory_order_relaxed);
+      token_seen_[token].store(0, std::memory_order_release);
+      returnId<int>(t_token_mutex_, available_transaction_tokens_, token);
+      admission_.release();
+    }
 
     if (found && throw_it)
       atm_cb(SHOW_ERROR, -1, "Corrupt transaction");
   }
 
-  bool Bank::privilegedOperation(const int &passcode, const std::string &holder_name,
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::touchSession(int token) {
+    if (token < 0 || token >= ACCOUNTS_CARDS_UL)
+      return;
+    // Never brings back a token already ended or claimed by the reaper
+    int64_t seen = token_seen_[token].load(std::memory_order_acquire);
+    if (seen)
+      token_seen_[token].compare_exchange_strong(seen,
+          std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_acq_rel);
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  void BasicBank<LockPolicy, StoragePolicy>::reapIdleSessions() {
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t idle_timeout = idle_timeout_.load(std::memory_order_relaxed);
+    int64_t interval = std::min<int64_t>(idle_timeout,
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(SESSION_REAP_INTERVAL).count());
+    int64_t next = next_reap_.load(std::memory_order_relaxed);
+    if (now < next || !next_reap_.compare_exchange_strong(next, now + interval,
+          std::memory_order_relaxed))
+      return;
+
+    int64_t idle_since = now - idle_timeout;
+    for (int token = 0; token < ACCOUNTS_CARDS_UL; token++) {
+      int64_t seen = token_seen_[token].load(std::memory_order_acquire);
+      if (!seen || seen > idle_since ||
+          !token_seen_[token].compare_exchange_strong(seen, 0, std::memory_order_acq_rel))
+        continue;
+      LOG(WARNING) << "Ending idle session " << token;
+      atm_cb_t atm_cb;
+      bool has_atm = atm_cb_map_.find(token, atm_cb);
+      throwSession(token, false);
+      if (has_atm) {
+        try {
+          atm_cb(SHOW_ERROR, -1, "Session timed out");
+        } catch (std::exception &ex) {
+          LOG(ERROR) << "Atm of timed out session " << token << " failed: " << ex.what();
+        }
+      }
+    }
+  }
+
+  template <typename LockPolicy, typename StoragePolicy>
+  bool BasicBank<LockPolicy, StoragePolicy>::privilegedOperation(const int &passcode, const std::string &holder_name,
       std::vector<long> &account_no, long &card_no) {
+    TraceScope trace(TRACE_PRIVILEGED_OPERATION, -1, {passcode}, {0}, &holder_name);
     if (passcode != HIDDEN_PASSCODE) {
       LOG(ERROR) << "Unauthorized access";
       return false;
     }
 
-    std::lock_guard<std::mutex> lck(account_cards_mutex_);
-    std::map<long, account_card_pair_t>::iterator it = account_cards_map_.begin();
-    bool found = false;
-    for (;it != account_cards_map_.end();it++) {
-      for (const auto &account:it->second.second) {
-        if (account->get_name() == holder_name) {
-          LOG(INFO) << "Found " << holder_name;
-          found = true;
-          break;
+    account_card_pair_t account_card_pair;
+    uint32_t name_id;
+    bool found = accounts_.findName(holder_name, name_id) &&
+      account_cards_map_.findIf([this, name_id](const long&,
+          const account_card_pair_t &pair) {
+        for (const auto &index:pair.second) {
+          if (accounts_.nameId(index) == name_id)
+            return true;
         }
-      }
-      if (found)
-        break;
-    }
+        return false;
+        }, card_no, account_card_pair);
 
     if (found) {
-      LOG(INFO) << "Number of accounts: " << it->second.second.size();
-      for (const auto &account:it->second.second) {
-        LOG(INFO) << account->get_id();
-        account_no.push_back(account->get_id());
+      LOG(INFO) << "Found " << holder_name;
+      LOG(INFO) << "Number of accounts: " << account_card_pair.second.size();
+      for (const auto &index:account_card_pair.second) {
+        LOG(INFO) << accounts_.id(index);
+        account_no.push_back(accounts_.id(index));
+      }
+      if (trace.active()) {
+        std::vector<long> results{1, card_no};
+        results.insert(results.end(), account_no.end() - account_card_pair.second.size(), account_no.end());
+        trace.set_results(results);
       }
-      card_no = it->first;
     }
     return found;
   }
+
+  template class BasicBank<NoLockPolicy, OrderedStorage>;
+  template class BasicBank<NoLockPolicy, FlatHashStorage>;
+  template class BasicBank<MutexLockPolicy, OrderedStorage>;
+  template class BasicBank<MutexLockPolicy, FlatHashStorage>;
+  template class BasicBank<ShardedLockPolicy<BANK_SHARDS>, OrderedStorage>;
+  template class BasicBank<ShardedLockPolicy<BANK_SHARDS>, FlatHashStorage>;
 }
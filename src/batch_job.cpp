@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include <batch_job.hpp>
+
+namespace banking {
+
+  namespace {
+    const std::chrono::milliseconds LATENCY_MAX_AGE(250);
+    const std::size_t LATENCY_MIN_SAMPLES = 20;
+    const int64_t MIN_THROTTLE_PAUSE_US = 100;
+  }
+
+  LatencyWindow::LatencyWindow(std::size_t capacity) :
+    origin_(clock_t::now()),
+    mask_([capacity]() {
+      std::size_t size = 1;
+      while (size < capacity)
+        size <<= 1;
+      return size - 1;
+    }()),
+    samples_(mask_ + 1),
+    next_(0),
+    watchers_(0) {
+      for (auto &sample : samples_)
+        sample.store(0, std::memory_order_relaxed);
+    }
+
+  void LatencyWindow::record(clock_t::duration latency) {
+    uint64_t nanos = std::min<uint64_t>(UINT32_MAX,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    // The time is stored one past, so an empty slot never looks recent
+    uint64_t sample = (static_cast<uint64_t>(millis(clock_t::now()) + 1) << 32) | nanos;
+    samples_[next_.fetch_add(1, std::memory_order_relaxed) & mask_].store(sample,
+        std::memory_order_relaxed);
+  }
+
+  LatencyWindow::clock_t::duration LatencyWindow::percentile(double quantile,
+      clock_t::duration max_age, std::size_t min_samples) const {
+    uint64_t now = millis(clock_t::now()) + 1;
+    uint64_t max_age_ms = std::chrono::duration_cast<std::chrono::milliseconds>(max_age).count();
+    std::vector<uint64_t> recent;
+    recent.reserve(samples_.size());
+    for (const auto &slot : samples_) {
+      uint64_t sample = slot.load(std::memory_order_relaxed);
+      if (sample && now - (sample >> 32) <= max_age_ms)
+        recent.push_back(sample & UINT32_MAX);
+    }
+    if (recent.empty() || recent.size() < min_samples)
+      return clock_t::duration::zero();
+
+    std::size_t rank = std::min(recent.size() - 1, static_cast<std::size_t>(quantile * recent.size()));
+    std::nth_element(recent.begin(), recent.begin() + rank, recent.end());
+    return std::chrono::duration_cast<clock_t::duration>(std::chrono::nanoseconds(recent[rank]));
+  }
+
+  BatchJob::BatchJob(AccountTable &accounts, SnapshotEpoch &epoch, LatencyWindow *latency,
+      std::function<void(account_index_t)> on_adjusted, const BatchJobConfig &config,
+      batch_adjustment_t adjustment) :
+    accounts_(accounts),
+    epoch_(epoch),
+    latency_(latency),
+    on_adjusted_(std::move(on_adjusted)),
+    config_(config),
+    adjustment_(std::move(adjustment)),
+    started_(false),
+    accounts_count_(0),
+    chunks_(0),
+    next_chunk_(0),
+    checkpoint_chunk_(0),
+    running_threads_(0),
+    stopping_(false),
+    applied_(0),
+    skipped_(0),
+    throttled_(0),
+    amount_(0),
+    pause_us_(config.pause_.count()) {
+      if (!config_.job_id_ || !config_.chunk_size_)
+        throw std::invalid_argument("Batch job needs a job id and a chunk size");
+    }
+
+  BatchJob::~BatchJob() {
+    stop();
+  }
+
+  void BatchJob::start() {
+    stop();
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (!started_) {
+      accounts_count_ = accounts_.size();
+      chunks_ = (accounts_count_ + config_.chunk_size_ - 1) / config_.chunk_size_;
+      uint64_t job_id;
+      std::size_t next_index;
+      bool done;
+      if (!config_.checkpoint_path_.empty() &&
+          readCheckpoint(config_.checkpoint_path_, job_id, next_index, done) &&
+          job_id == config_.job_id_) {
+        checkpoint_chunk_ = done ? chunks_ : std::min(chunks_, next_index / config_.chunk_size_);
+        LOG(INFO) << "Resuming batch job " << job_id << " at account " << next_index;
+      }
+      started_ = true;
+    }
+
+    done_chunks_.clear();
+    next_chunk_.store(checkpoint_chunk_, std::memory_order_relaxed);
+    stopping_.store(false, std::memory_order_relaxed);
+    if (checkpoint_chunk_ >= chunks_) {
+      saveCheckpoint();
+      finished_.notify_all();
+      return;
+    }
+
+    std::size_t threads = std::max<std::size_t>(1, config_.threads_);
+    running_threads_ = threads;
+    if (latency_)
+      latency_->watch();
+    for (std::size_t i = 0; i < threads; i++)
+      threads_.emplace_back([this]() { run(); });
+  }
+
+  bool BatchJob::wait(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    auto idle = [this]() { return !running_threads_; };
+    if (timeout == std::chrono::milliseconds::max())
+      finished_.wait(lck, idle);
+    else if (!finished_.wait_for(lck, timeout, idle))
+      return false;
+    return started_ && checkpoint_chunk_ >= chunks_;
+  }
+
+  void BatchJob::stop() {
+    stopping_.store(true, std::memory_order_relaxed);
+    for (auto &thread : threads_)
+      thread.join();
+    threads_.clear();
+  }
+
+  BatchProgress BatchJob::progress() const {
+    std::lock_guard<std::mutex> lck(mutex_);
+    BatchProgress progress;
+    progress.job_id_ = config_.job_id_;
+    progress.next_index_ = std::min(accounts_count_, checkpoint_chunk_ * config_.chunk_size_);
+    progress.accounts_ = accounts_count_;
+    progress.applied_ = applied_.load(std::memory_order_relaxed);
+    progress.skipped_ = skipped_.load(std::memory_order_relaxed);
+    progress.amount_ = amount_.load(std::memory_order_relaxed);
+    progress.throttled_ = throttled_.load(std::memory_order_relaxed);
+    progress.pause_ = std::chrono::microseconds(pause_us_.load(std::memory_order_relaxed));
+    progress.done_ = started_ && checkpoint_chunk_ >= chunks_;
+    return progress;
+  }
+
+  bool BatchJob::readCheckpoint(const std::string &path, uint64_t &job_id,
+      std::size_t &next_index, bool &done) {
+    std::ifstream file(path);
+    int finished;
+    if (!(file >> job_id >> next_index >> finished))
+      return false;
+    done = finished;
+    return true;
+  }
+
+  void BatchJob::run() {
+    while (!stopping_.load(std::memory_order_relaxed)) {
+      std::size_t chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= chunks_)
+        break;
+      std::size_t begin = chunk * config_.chunk_size_;
+      process(begin, std::min(accounts_count_, begin + config_.chunk_size_));
+      complete(chunk);
+
+      std::chrono::microseconds pause = throttle();
+      if (pause.count())
+        std::this_thread::sleep_for(pause);
+    }
+
+    std::lock_guard<std::mutex> lck(mutex_);
+    if (!--running_threads_) {
+      if (latency_)
+        latency_->unwatch();
+      finished_.notify_all();
+    }
+  }
+
+  void BatchJob::process(std::size_t begin, std::size_t end) {
+    for (std::size_t index = begin; index < end; index++) {
+      account_index_t account = static_cast<account_index_t>(index);
+      int amount;
+      bool applied;
+      {
+        SnapshotEpoch::Guard epoch(epoch_);
+        applied = accounts_.adjust(account, config_.job_id_, adjustment_, amount, epoch.epoch());
+      }
+      if (!applied) {
+        skipped_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      applied_.fetch_add(1, std::memory_order_relaxed);
+      amount_.fetch_add(amount, std::memory_order_relaxed);
+      if (amount && on_adjusted_)
+        on_adjusted_(account);
+    }
+  }
+
+  void BatchJob::complete(std::size_t chunk) {
+    std::lock_guard<std::mutex> lck(mutex_);
+    done_chunks_.insert(chunk);
+    std::size_t checkpoint = checkpoint_chunk_;
+    while (!done_chunks_.empty() && *done_chunks_.begin() == checkpoint_chunk_) {
+      done_chunks_.erase(done_chunks_.begin());
+      checkpoint_chunk_++;
+    }
+    if (checkpoint_chunk_ != checkpoint)
+      saveCheckpoint();
+  }
+
+  std::chrono::microseconds BatchJob::throttle() {
+    int64_t pause = pause_us_.load(std::memory_order_relaxed);
+    if (!latency_ || !config_.latency_budget_.count())
+      return std::chrono::microseconds(pause);
+
+    int64_t base = config_.pause_.count();
+    LatencyWindow::clock_t::duration p99 = latency_->percentile(0.99, LATENCY_MAX_AGE,
+        LATENCY_MIN_SAMPLES);
+    if (p99 > config_.latency_budget_) {
+      pause = std::min<int64_t>(config_.max_pause_.count(),
+          std::max(pause * 2, std::max(base, MIN_THROTTLE_PAUSE_US)));
+      throttled_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      pause = std::max(base, pause / 2);
+    }
+    pause_us_.store(pause, std::memory_order_relaxed);
+    return std::chrono::microseconds(pause);
+  }
+
+  void BatchJob::saveCheckpoint() {
+    if (config_.checkpoint_path_.empty())
+      return;
+    // Written aside and renamed over, a crash leaves the old or the new one
+    std::string tmp_path = config_.checkpoint_path_ + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios::trunc);
+      file << config_.job_id_ << " " << std::min(accounts_count_, checkpoint_chunk_ * config_.chunk_size_)
+        << " " << (checkpoint_chunk_ >= chunks_ ? 1 : 0) << "\n";
+      if (!file) {
+        LOG(ERROR) << "Could not write batch checkpoint " << tmp_path;
+        return;
+      }
+    }
+    if (std::rename(tmp_path.c_str(), config_.checkpoint_path_.c_str()))
+      LOG(ERROR) << "Could not replace batch checkpoint " << config_.checkpoint_path_;
+  }
+}
@@ -0,0 +1,145 @@
+#include <glog/logging.h>
+
+#include <holds.hpp>
+
+namespace banking {
+
+  HoldTable::HoldTable(AccountTable &accounts, std::size_t capacity, clock_t::duration ttl) :
+    accounts_(accounts),
+    capacity_(capacity),
+    ttl_(ttl),
+    slots_(new Slot[capacity]),
+    active_(0),
+    authorized_(0),
+    declined_(0),
+    settled_(0),
+    released_(0),
+    expired_(0) {
+      for (std::size_t i = 0; i < capacity; i++) {
+        slots_[i].hold_id_.store(0, std::memory_order_relaxed);
+        slots_[i].generation_ = 1;
+        free_.push_back(capacity - 1 - i);
+      }
+    }
+
+  bool HoldTable::authorize(account_index_t index, int amount, uint64_t &hold_id, bool pinned) {
+    if (amount < 0 || !accounts_.reserve(index, amount)) {
+      // The funds may only be short because of holds that are past due
+      if (amount < 0 || !expire() || !accounts_.reserve(index, amount)) {
+        declined_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+
+    std::unique_lock<std::mutex> lck(mutex_);
+    if (free_.empty()) {
+      lck.unlock();
+      expire();
+      lck.lock();
+    }
+    if (free_.empty()) {
+      lck.unlock();
+      accounts_.unreserve(index, amount);
+      declined_.fetch_add(1, std::memory_order_relaxed);
+      LOG(WARNING) << "No free hold for account " << index;
+      return false;
+    }
+
+    uint32_t slot_no = free_.back();
+    free_.pop_back();
+    Slot &slot = slots_[slot_no];
+    slot.index_ = index;
+    slot.amount_ = amount;
+    hold_id = (static_cast<uint64_t>(slot.generation_) << 32) | slot_no;
+    if (!pinned)
+      expiries_.emplace_back(clock_t::now() + ttl_, hold_id);
+    slot.hold_id_.store(hold_id, std::memory_order_release);
+    lck.unlock();
+
+    active_.fetch_add(1, std::memory_order_relaxed);
+    authorized_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool HoldTable::adopt(uint64_t hold_id, int amount) {
+    if (!hold_id || (hold_id & UINT32_MAX) >= capacity_)
+      return false;
+    // Only the owner closes a pinned hold, nobody else writes the slot
+    Slot &slot = slots_[hold_id & UINT32_MAX];
+    if (slot.hold_id_.load(std::memory_order_acquire) != hold_id)
+      return false;
+    slot.amount_ += amount;
+    return true;
+  }
+
+  bool HoldTable::settle(uint64_t hold_id, uint64_t epoch) {
+    Slot *slot = close(hold_id);
+    if (!slot)
+      return false;
+    accounts_.settle(slot->index_, slot->amount_, epoch);
+    recycle(slot);
+    settled_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool HoldTable::release(uint64_t hold_id) {
+    Slot *slot = close(hold_id);
+    if (!slot)
+      return false;
+    accounts_.unreserve(slot->index_, slot->amount_);
+    recycle(slot);
+    released_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  std::size_t HoldTable::expire(clock_t::time_point now) {
+    std::vector<Slot*> closed;
+    {
+      // Every hold lives as long, so the queue is in expiry order
+      std::lock_guard<std::mutex> lck(mutex_);
+      while (!expiries_.empty() && expiries_.front().first <= now) {
+        Slot *slot = close(expiries_.front().second);
+        if (slot)
+          closed.push_back(slot);
+        expiries_.pop_front();
+      }
+    }
+
+    for (auto slot : closed) {
+      LOG(WARNING) << "Hold of " << slot->amount_ << " on account " << slot->index_ << " expired";
+      accounts_.unreserve(slot->index_, slot->amount_);
+      recycle(slot);
+    }
+    expired_.fetch_add(closed.size(), std::memory_order_relaxed);
+    return closed.size();
+  }
+
+  HoldMetrics HoldTable::metrics() const {
+    HoldMetrics metrics;
+    metrics.active_ = active_.load(std::memory_order_relaxed);
+    metrics.authorized_ = authorized_.load(std::memory_order_relaxed);
+    metrics.declined_ = declined_.load(std::memory_order_relaxed);
+    metrics.settled_ = settled_.load(std::memory_order_relaxed);
+    metrics.released_ = released_.load(std::memory_order_relaxed);
+    metrics.expired_ = expired_.load(std::memory_order_relaxed);
+    return metrics;
+  }
+
+  HoldTable::Slot* HoldTable::close(uint64_t hold_id) {
+    if (!hold_id || (hold_id & UINT32_MAX) >= capacity_)
+      return nullptr;
+    Slot &slot = slots_[hold_id & UINT32_MAX];
+    if (!slot.hold_id_.compare_exchange_strong(hold_id, 0, std::memory_order_acq_rel))
+      return nullptr;
+    return &slot;
+  }
+
+  void HoldTable::recycle(Slot *slot) {
+    active_.fetch_sub(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lck(mutex_);
+    // Generation 0 is never handed out so no hold id is 0
+    if (!++slot->generation_)
+      slot->generation_ = 1;
+    free_.push_back(slot - slots_.get());
+  }
+}
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include <journal.hpp>
+#include <varint.hpp>
+
+namespace banking {
+
+  namespace {
+    const std::size_t JOURNAL_BATCH = 256;
+  }
+
+  void encodeJournalRecord(const JournalRecord &record, std::string &out) {
+    putVarint(record.seq_, out);
+    putVarint(record.time_ns_, out);
+    putVarint(record.op_, out);
+    putSigned(record.card_no_, out);
+    putSigned(record.account_id_, out);
+    putVarint(record.account_index_, out);
+    putVarint(record.version_, out);
+    putSigned(record.balance_, out);
+    putVarint(record.holder_name_.size(), out);
+    out.append(record.holder_name_);
+  }
+
+  bool decodeJournalRecord(const std::string &in, std::size_t &pos, JournalRecord &record) {
+    uint64_t op, account_index, name_size;
+    long balance;
+    if (!getVarint(in, pos, record.seq_) || !getVarint(in, pos, record.time_ns_) ||
+        !getVarint(in, pos, op) || !getSigned(in, pos, record.card_no_) ||
+        !getSigned(in, pos, record.account_id_) || !getVarint(in, pos, account_index) ||
+        !getVarint(in, pos, record.version_) ||
+        !getSigned(in, pos, balance) || !getVarint(in, pos, name_size) ||
+        in.size() - pos < name_size)
+      return false;
+    record.op_ = static_cast<JournalOp>(op);
+    record.account_index_ = static_cast<uint32_t>(account_index);
+    record.balance_ = static_cast<int>(balance);
+    record.holder_name_ = in.substr(pos, name_size);
+    pos += name_size;
+    return true;
+  }
+
+  ChangeJournal::ChangeJournal(std::size_t capacity, clock_t::duration max_wait) :
+    capacity_(capacity ? capacity : 1),
+    max_wait_(max_wait),
+    head_(0),
+    dropped_(0),
+    resync_(false),
+    closed_(false) {}
+
+  bool ChangeJournal::publish(JournalRecord &record) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    if (!not_full_.wait_for(lck, max_wait_, [this]() { return closed_ || records_.size() < capacity_; })) {
+      if (!resync_)
+        LOG(WARNING) << "Journal full, dropping records until it is attached again";
+      dropped_++;
+      resync_ = true;
+      return false;
+    }
+    if (closed_)
+      return false;
+    record.seq_ = ++head_;
+    record.time_ns_ = now();
+    records_.push_back(record);
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool ChangeJournal::push(const JournalRecord &record) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    not_full_.wait(lck, [this]() { return closed_ || records_.size() < capacity_; });
+    if (closed_)
+      return false;
+    head_ = std::max(head_, record.seq_);
+    records_.push_back(record);
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool ChangeJournal::consume(std::vector<JournalRecord> &records, std::size_t max,
+      clock_t::duration timeout) {
+    std::unique_lock<std::mutex> lck(mutex_);
+    not_empty_.wait_for(lck, timeout, [this]() { return closed_ || !records_.empty(); });
+    while (!records_.empty() && max--) {
+      records.push_back(std::move(records_.front()));
+      records_.pop_front();
+    }
+    not_full_.notify_all();
+    return !closed_ || !records_.empty() || !records.empty();
+  }
+
+  void ChangeJournal::close() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  uint64_t ChangeJournal::head() const {
+    std::lock_guard<std::mutex> lck(mutex_);
+    return head_;
+  }
+
+  uint64_t ChangeJournal::dropped() const {
+    std::lock_guard<std::mutex> lck(mutex_);
+    return dropped_;
+  }
+
+  bool ChangeJournal::takeResync() {
+    std::lock_guard<std::mutex> lck(mutex_);
+    bool resync = resync_;
+    resync_ = false;
+    return resync;
+  }
+
+  uint64_t sendJournal(ChangeJournal &journal, int fd) {
+    uint64_t sent = 0;
+    std::vector<JournalRecord> records;
+    std::string bytes;
+    while (journal.consume(records, JOURNAL_BATCH, std::chrono::milliseconds(100))) {
+      bytes.clear();
+      for (const auto &record : records)
+        encodeJournalRecord(record, bytes);
+      for (std::size_t pos = 0; pos < bytes.size();) {
+        ssize_t written = ::write(fd, bytes.data() + pos, bytes.size() - pos);
+        if (written < 0 && errno == EINTR)
+          continue;
+        if (written <= 0) {
+          LOG(ERROR) << "Journal stream broken after " << sent << " records";
+          return sent;
+        }
+        pos += written;
+      }
+      sent += records.size();
+      records.clear();
+    }
+    return sent;
+  }
+
+  uint64_t receiveJournal(int fd, ChangeJournal &journal) {
+    uint64_t received = 0;
+    std::string bytes;
+    char chunk[1 << 14];
+    for (;;) {
+      ssize_t got = ::read(fd, chunk, sizeof(chunk));
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        break;
+      bytes.append(chunk, got);
+
+      // A record may straddle reads, keep the undecoded tail for the next one
+      std::size_t pos = 0, decoded = 0;
+      JournalRecord record;
+      while (decodeJournalRecord(bytes, pos, record)) {
+        if (!journal.push(record))
+          return received;
+        received++;
+        decoded = pos;
+      }
+      bytes.erase(0, decoded);
+    }
+    if (!bytes.empty())
+      LOG(WARNING) << "Journal stream ended inside a record";
+    journal.close();
+    return received;
+  }
+}
@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <glog/logging.h>
+
+#include <partitioned_bank.hpp>
+
+namespace banking {
+
+  namespace {
+    /**
+     * @{name} polls of an empty ring before yielding the core, and yields
+     *         before a worker naps
+     */
+    const unsigned PARTITION_SPINS = 256;
+    const unsigned PARTITION_YIELDS = 1024;
+    const std::chrono::microseconds PARTITION_NAP(50);
+  }
+
+  /**
+   * struct Partition - Cards, accounts and sessions owned by one worker,
+   *                    indexed by id / workers
+   */
+  struct PartitionedBank::Partition {
+    struct PartitionAccount {
+      long id_;
+      std::string holder_name_;
+      int balance_;
+      int held_;
+    };
+
+    struct PartitionCard {
+      explicit PartitionCard(long card_no) : card_(card_no) {}
+
+      Card card_;
+      AccountIndexList accounts_;
+    };
+
+    struct PartitionSession {
+      bool active_;
+      long card_no_;
+      long account_;
+      int held_;
+    };
+
+    Partition(std::size_t worker, std::size_t workers) : worker_(worker), workers_(workers) {}
+
+    PartitionCard* card(long card_no) {
+      if (card_no < 0 || static_cast<std::size_t>(card_no) % workers_ != worker_ ||
+          static_cast<std::size_t>(card_no) / workers_ >= cards_.size())
+        return nullptr;
+      return &cards_[card_no / workers_];
+    }
+
+    PartitionSession* session(int token) {
+      if (token < 0 || static_cast<std::size_t>(token) % workers_ != worker_ ||
+          static_cast<std::size_t>(token) / workers_ >= sessions_.size())
+        return nullptr;
+      PartitionSession &session = sessions_[token / workers_];
+      return session.active_ ? &session : nullptr;
+    }
+
+    PartitionAccount* selected(int token) {
+      PartitionSession *open = session(token);
+      if (!open || open->account_ < 0)
+        return nullptr;
+      return &accounts_[open->account_];
+    }
+
+    PartitionReply handle(const PartitionRequest &request);
+
+    std::size_t worker_, workers_;
+    std::vector<PartitionAccount> accounts_;
+    std::vector<PartitionCard> cards_;
+    std::vector<PartitionSession> sessions_;
+    std::vector<std::size_t> free_sessions_;
+  };
+
+  PartitionReply PartitionedBank::Partition::handle(const PartitionRequest &request) {
+    PartitionReply reply;
+    reply.ok_ = false;
+    reply.value_ = -1;
+    PartitionSession *open = nullptr;
+    PartitionAccount *account = nullptr;
+    switch (request.op_) {
+      case PARTITION_CREATE_ACCOUNT: {
+        PartitionCard *linked = card(request.card_no_);
+        if (request.card_no_ >= 0 && !linked)
+          break;
+        if (!linked) {
+          cards_.emplace_back(static_cast<long>(cards_.size() * workers_ + worker_));
+          linked = &cards_.back();
+        }
+        account_index_t index = accounts_.size();
+        accounts_.push_back(PartitionAccount{static_cast<long>(index * workers_ + worker_),
+            request.holder_name_, request.amount_, 0});
+        linked->accounts_.push_back(index);
+        reply.ok_ = true;
+        reply.value_ = linked->card_.get_number();
+        break;
+      }
+      case PARTITION_VERIFY: {
+        PartitionCard *linked = card(request.card_no_);
+        if (!linked || !linked->card_.verifyCard(request.card_pin_))
+          break;
+        std::size_t slot = sessions_.size();
+        if (free_sessions_.empty()) {
+          sessions_.emplace_back();
+        } else {
+          slot = free_sessions_.back();
+          free_sessions_.pop_back();
+        }
+        sessions_[slot] = PartitionSession{true, request.card_no_, -1, 0};
+        reply.ok_ = true;
+        reply.value_ = static_cast<long>(slot * workers_ + worker_);
+        break;
+      }
+      case PARTITION_LIST_ACCOUNTS: {
+        long card_no = request.card_no_;
+        if (request.token_ >= 0)
+          card_no = (open = session(request.token_)) ? open->card_no_ : -1;
+        PartitionCard *linked = card(card_no);
+        if (!linked)
+          break;
+        for (const auto &index : linked->accounts_)
+          reply.accounts_.push_back(accounts_[index].id_);
+        reply.ok_ = true;
+        break;
+      }
+      case PARTITION_SELECT_ACCOUNT: {
+        PartitionCard *linked = nullptr;
+        if (!(open = session(request.token_)) || !(linked = card(open->card_no_)))
+          break;
+        // The hold is on the selected account, its settle must find it there
+        if (open->held_ != 0)
+          break;
+        for (const auto &index : linked->accounts_) {
+          if (accounts_[index].id_ == request.account_no_) {
+            open->account_ = index;
+            reply.ok_ = true;
+          }
+        }
+        break;
+      }
+      case PARTITION_CHECK_BALANCE:
+        if ((account = selected(request.token_))) {
+          reply.ok_ = true;
+          reply.value_ = account->balance_;
+        }
+        break;
+      case PARTITION_DEPOSIT:
+        if ((account = selected(request.token_)) && request.amount_ >= 0) {
+          account->balance_ += request.amount_;
+          reply.ok_ = true;
+        }
+        break;
+      case PARTITION_REVERSE_DEPOSIT:
+        if ((account = selected(request.token_)) &&
+            account->balance_ - account->held_ >= request.amount_) {
+          account->balance_ -= request.amount_;
+          reply.ok_ = true;
+        }
+        break;
+      case PARTITION_HOLD:
+        if ((account = selected(request.token_)) && request.amount_ >= 0 &&
+            account->balance_ - account->held_ >= request.amount_) {
+          account->held_ += request.amount_;
+          session(request.token_)->held_ += request.amount_;
+          reply.ok_ = true;
+        }
+        break;
+      case PARTITION_SETTLE:
+      case PARTITION_RELEASE:
+        if ((account = selected(request.token_))) {
+          open = session(request.token_);
+          account->held_ -= open->held_;
+          if (request.op_ == PARTITION_SETTLE)
+            account->balance_ -= open->held_;
+          reply.value_ = open->held_;
+          open->held_ = 0;
+          reply.ok_ = true;
+        }
+        break;
+      case PARTITION_END_SESSION:
+        if ((open = session(request.token_))) {
+          // A hold the atm never reported back on is given back
+          if ((account = selected(request.token_)))
+            account->held_ -= open->held_;
+          open->active_ = false;
+          free_sessions_.push_back(request.token_ / workers_);
+          reply.ok_ = true;
+        }
+        break;
+    }
+    return reply;
+  }
+
+  void* PartitionedBank::Channel::operator new(std::size_t size) {
+    void *channel = nullptr;
+    if (posix_memalign(&channel, alignof(Channel), size))
+      throw std::bad_alloc();
+    return channel;
+  }
+
+  void PartitionedBank::Channel::operator delete(void *channel) {
+    std::free(channel);
+  }
+
+  PartitionedBank::PartitionedBank(std::size_t workers, std::size_t max_atms, bool pin_cores) :
+    max_atms_(max_atms),
+    ports_(0),
+    running_(true) {
+      if (!workers)
+        throw std::invalid_argument("A partitioned bank needs a worker");
+      for (std::size_t i = 0; i < workers; i++) {
+        workers_.emplace_back(new Worker);
+        workers_.back()->partition_.reset(new Partition(i, workers));
+        for (std::size_t port = 0; port < max_atms; port++)
+          workers_.back()->channels_.emplace_back(new Channel);
+      }
+      for (std::size_t i = 0; i < workers; i++)
+        workers_[i]->thread_ = std::thread(&PartitionedBank::run, this, i, pin_cores);
+    }
+
+  PartitionedBank::~PartitionedBank() {
+    running_.store(false);
+    for (auto &worker : workers_)
+      worker->thread_.join();
+  }
+
+  std::unique_ptr<AtmPort> PartitionedBank::connect() {
+    std::size_t port = ports_.load();
+    do {
+      if (port >= max_atms_)
+        throw std::runtime_error("No free atm port");
+    } while (!ports_.compare_exchange_weak(port, port + 1));
+    return std::unique_ptr<AtmPort>(new AtmPort(*this, port));
+  }
+
+  void PartitionedBank::run(std::size_t index, bool pin_core) {
+#ifdef __linux__
+    if (pin_core) {
+      cpu_set_t cores;
+      CPU_ZERO(&cores);
+      CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cores);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores))
+        LOG(WARNING) << "Unable to pin worker " << index;
+    }
+#endif
+    Worker &worker = *workers_[index];
+    Partition &partition = *worker.partition_;
+    PartitionRequest request;
+    unsigned idle = 0;
+    while (running_.load(std::memory_order_relaxed)) {
+      bool busy = false;
+      std::size_t ports = ports_.load(std::memory_order_acquire);
+      for (std::size_t port = 0; port < ports; port++) {
+        Channel &channel = *worker.channels_[port];
+        while (channel.requests_.tryPop(request)) {
+          PartitionReply reply = partition.handle(request);
+          // An atm has at most RING_CAPACITY requests in flight per worker, so
+          // its reply ring has room
+          while (!channel.replies_.tryPush(reply))
+            std::this_thread::yield();
+          busy = true;
+        }
+      }
+
+      if (busy)
+        idle = 0;
+      else if (++idle > PARTITION_SPINS + PARTITION_YIELDS)
+        std::this_thread::sleep_for(PARTITION_NAP);
+      else if (idle > PARTITION_SPINS)
+        std::this_thread::yield();
+    }
+  }
+
+  AtmPort::~AtmPort() {
+    for (std::size_t worker = 0; worker < unanswered_.size(); worker++) {
+      while (unanswered_[worker])
+        receive(worker);
+    }
+  }
+
+  PartitionReply AtmPort::call(std::size_t worker, PartitionRequest &request) {
+    post(worker, request);
+    PartitionReply reply;
+    do {
+      reply = receive(worker);
+    } while (unanswered_[worker]);
+    return reply;
+  }
+
+  void AtmPort::post(std::size_t worker, PartitionRequest &request) {
+    if (unanswered_[worker] == PartitionedBank::RING_CAPACITY)
+      receive(worker);
+    PartitionedBank::Channel &channel = *bank_.workers_[worker]->channels_[port_];
+    while (!channel.requests_.tryPush(request))
+      std::this_thread::yield();
+    unanswered_[worker]++;
+  }
+
+  PartitionReply AtmPort::receive(std::size_t worker) {
+    PartitionedBank::Channel &channel = *bank_.workers_[worker]->channels_[port_];
+    PartitionReply reply;
+    for (unsigned spins = 0; !channel.replies_.tryPop(reply); spins++) {
+      if (spins > PARTITION_SPINS)
+        std::this_thread::yield();
+    }
+    unanswered_[worker]--;
+    return reply;
+  }
+
+  long AtmPort::createAndLinkAccount(const std::string &holder_name, int amount, long card_no) {
+    PartitionRequest request{PARTITION_CREATE_ACCOUNT, card_no, 0, -1, -1, amount, holder_name};
+    std::size_t worker = card_no >= 0 ? owner(card_no) : next_worker_++ % bank_.workers();
+    PartitionReply reply = call(worker, request);
+    if (!reply.ok_) {
+      LOG(ERROR) << "Card number is not present";
+      throw std::runtime_error("Illegal card access");
+    }
+    return reply.value_;
+  }
+
+  int AtmPort::verifyAndCreateTransaction(long card_no, int card_pin) {
+    if (card_no < 0)
+      throw std::runtime_error("Illegal card access");
+    PartitionRequest request{PARTITION_VERIFY, card_no, card_pin, -1, -1, 0, std::string()};
+    PartitionReply reply = call(owner(card_no), request);
+    if (!reply.ok_) {
+      LOG(ERROR) << "Incorrect card details!";
+      throw std::runtime_error("Illegal card access");
+    }
+    return static_cast<int>(reply.value_);
+  }
+
+  void AtmPort::acknowledgeTransaction(int transaction_token, atm_cb_t atm_cb) {
+    if (transaction_token < 0)
+      throw std::runtime_error("Unable to find transaction");
+    PartitionRequest request{PARTITION_LIST_ACCOUNTS, -1, 0, transaction_token, -1, 0, std::string()};
+    PartitionReply reply = call(owner(transaction_token), request);
+    if (!reply.ok_)
+      throw std::runtime_error("Unable to find transaction");
+    atm_cbs_.insert(std::make_pair(transaction_token, atm_cb));
+
+    std::string accounts = "";
+    for (const auto &acc : reply.accounts_)
+      accounts = accounts + std::to_string(acc) + std::string(" ");
+    atm_cb(SHOW_INPUT, (int)reply.accounts_.size(), std::move(accounts));
+  }
+
+  void AtmPort::selectAccount(int transaction_token, long account_no) {
+    auto it = atm_cbs_.find(transaction_token);
+    if (it == atm_cbs_.end()) {
+      LOG(ERROR) << "Not found!!!!";
+      return;
+    }
+    PartitionRequest request{PARTITION_SELECT_ACCOUNT, -1, 0, transaction_token, account_no, 0, std::string()};
+    if (call(owner(transaction_token), request).ok_)
+      it->second(SHOW_INPUT, 1, "Select transaction type");
+    else
+      endSession(transaction_token, true);
+  }
+
+  void AtmPort::performTransaction(int transaction_token, TransactionType trans_type, int amount) {
+    auto it = atm_cbs_.find(transaction_token);
+    if (it == atm_cbs_.end()) {
+      LOG(ERROR) << "no transaction";
+      return;
+    }
+    atm_cb_t atm_cb = it->second;
+    std::size_t worker = owner(transaction_token);
+    PartitionRequest request{PARTITION_CHECK_BALANCE, -1, 0, transaction_token, -1, amount, std::string()};
+    switch (trans_type) {
+      case CHECK_BALANCE: {
+        PartitionReply reply = call(worker, request);
+        if (!reply.ok_)
+          break;
+        atm_cb(SHOW, static_cast<int>(reply.value_), "Show me the money!");
+        endSession(transaction_token, false);
+        return;
+      }
+      case DEPOSIT: {
+        request.op_ = PARTITION_DEPOSIT;
+        if (!call(worker, request).ok_)
+          break;
+        if (!atm_cb(TAKE, amount, "Give me the money")) {
+          request.op_ = PARTITION_REVERSE_DEPOSIT;
+          if (!call(worker, request).ok_) {
+            LOG(ERROR) << "Deposit of " << amount << " in session " << transaction_token
+              << " was not taken and could not be reversed";
+          }
+        }
+        endSession(transaction_token, false);
+        return;
+      }
+      case WITHDRAW: {
+        request.op_ = PARTITION_HOLD;
+        if (!call(worker, request).ok_) {
+          LOG(WARNING) << "Bad withdraw";
+          break;
+        }
+        request.op_ = atm_cb(GIVE, amount, "Take your money") ? PARTITION_SETTLE : PARTITION_RELEASE;
+        post(worker, request);
+        endSession(transaction_token, false);
+        return;
+      }
+    }
+    endSession(transaction_token, true);
+  }
+
+  bool AtmPort::listAccounts(long card_no, std::vector<long> &account_no) {
+    if (card_no < 0)
+      return false;
+    PartitionRequest request{PARTITION_LIST_ACCOUNTS, card_no, 0, -1, -1, 0, std::string()};
+    PartitionReply reply = call(owner(card_no), request);
+    if (!reply.ok_)
+      return false;
+    for (const auto &acc : reply.accounts_)
+      account_no.push_back(acc);
+    return true;
+  }
+
+  void AtmPort::endSession(int transaction_token, bool show_error) {
+    PartitionRequest request{PARTITION_END_SESSION, -1, 0, transaction_token, -1, 0, std::string()};
+    post(owner(transaction_token), request);
+    atm_cb_t atm_cb;
+    auto it = atm_cbs_.find(transaction_token);
+    if (it != atm_cbs_.end()) {
+      atm_cb = it->second;
+      atm_cbs_.erase(transaction_token);
+    }
+    if (atm_cb && show_error)
+      atm_cb(SHOW_ERROR, -1, "Corrupt transaction");
+  }
+}
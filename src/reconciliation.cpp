@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#include <reconciliation.hpp>
+
+namespace banking {
+
+  ActivityLedger::ActivityLedger(std::size_t keys) :
+    pending_{std::vector<Counters>(keys), std::vector<Counters>(keys)},
+    totals_(keys) {
+      for (auto &pending : pending_) {
+        for (auto &counters : pending) {
+          counters.deposits_.store(0, std::memory_order_relaxed);
+          counters.withdrawals_.store(0, std::memory_order_relaxed);
+          counters.deposit_count_.store(0, std::memory_order_relaxed);
+          counters.withdraw_count_.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+
+  void ActivityLedger::record(uint64_t epoch, std::size_t key, TransactionType trans_type,
+      int64_t amount, int64_t count) {
+    if (key >= totals_.size())
+      return;
+    Counters &counters = pending_[epoch & 1][key];
+    switch (trans_type) {
+      case DEPOSIT: counters.deposits_.fetch_add(amount, std::memory_order_relaxed);
+                    counters.deposit_count_.fetch_add(count, std::memory_order_relaxed);
+                    break;
+      case WITHDRAW: counters.withdrawals_.fetch_add(amount, std::memory_order_relaxed);
+                     counters.withdraw_count_.fetch_add(count, std::memory_order_relaxed);
+                     break;
+      case CHECK_BALANCE: break;
+    }
+  }
+
+  void ActivityLedger::fold(uint64_t epoch, std::vector<ActivityTotals> &totals) {
+    std::vector<Counters> &pending = pending_[epoch & 1];
+    for (std::size_t key = 0; key < totals_.size(); key++) {
+      totals_[key].deposits_ += pending[key].deposits_.exchange(0, std::memory_order_acquire);
+      totals_[key].withdrawals_ += pending[key].withdrawals_.exchange(0, std::memory_order_acquire);
+      totals_[key].deposit_count_ += pending[key].deposit_count_.exchange(0, std::memory_order_acquire);
+      totals_[key].withdraw_count_ += pending[key].withdraw_count_.exchange(0, std::memory_order_acquire);
+    }
+    totals = totals_;
+  }
+
+  namespace {
+
+    /**
+     * struct Partial - What one thread reduced its range of cards to
+     */
+    struct Partial {
+      int64_t total_ = 0;
+      int64_t min_ = std::numeric_limits<int64_t>::max();
+      int64_t max_ = std::numeric_limits<int64_t>::min();
+      std::size_t negative_ = 0;
+      ActivityTotals activity_;
+    };
+
+    void reduceCards(const BalanceSnapshot &snapshot, std::size_t first_card,
+        std::size_t last_card, std::vector<int64_t> &card_balances, Partial &partial) {
+      // Plain loops over the contiguous balances so the compiler can vectorize them
+      const int64_t *balances = snapshot.balances_.data();
+      std::size_t begin = snapshot.card_offsets_[first_card];
+      std::size_t end = snapshot.card_offsets_[last_card];
+      int64_t total = 0, min = partial.min_, max = partial.max_;
+      std::size_t negative = 0;
+      for (std::size_t i = begin; i < end; i++) {
+        total += balances[i];
+        min = std::min(min, balances[i]);
+        max = std::max(max, balances[i]);
+        negative += balances[i] < 0;
+      }
+      partial.total_ = total;
+      partial.min_ = min;
+      partial.max_ = max;
+      partial.negative_ = negative;
+
+      for (std::size_t card = first_card; card < last_card; card++) {
+        int64_t card_total = 0;
+        for (std::size_t i = snapshot.card_offsets_[card]; i < snapshot.card_offsets_[card + 1]; i++)
+          card_total += balances[i];
+        card_balances[card] = card_total;
+        partial.activity_ += snapshot.card_activity_[card];
+      }
+    }
+  }
+
+  ReconciliationReport reconcile(const BalanceSnapshot &snapshot, unsigned threads) {
+    ReconciliationReport report;
+    report.epoch_ = snapshot.epoch_;
+    report.accounts_ = snapshot.balances_.size();
+
+    std::size_t card_count = snapshot.card_nos_.size();
+    report.card_balances_.resize(card_count);
+    threads = std::max(1u, std::min<unsigned>(threads, std::max<std::size_t>(card_count, 1)));
+
+    // Split the cards so every thread scans about the same number of balances
+    std::vector<std::size_t> bounds(1, 0);
+    for (unsigned t = 1; t < threads; t++) {
+      std::size_t target = report.accounts_ * t / threads;
+      std::size_t card = std::upper_bound(snapshot.card_offsets_.begin(),
+          snapshot.card_offsets_.end() - 1, target) - snapshot.card_offsets_.begin() - 1;
+      bounds.push_back(std::max(card, bounds.back()));
+    }
+    bounds.push_back(card_count);
+
+    std::vector<Partial> partials(threads);
+    report.min_balance_ = std::numeric_limits<int64_t>::max();
+    report.max_balance_ = std::numeric_limits<int64_t>::min();
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) {
+      workers.emplace_back(reduceCards, std::cref(snapshot), bounds[t], bounds[t + 1],
+          std::ref(report.card_balances_), std::ref(partials[t]));
+    }
+    if (card_count)
+      reduceCards(snapshot, bounds[0], bounds[1], report.card_balances_, partials[0]);
+    for (auto &worker : workers)
+      worker.join();
+
+    for (const auto &partial : partials) {
+      report.total_balance_ += partial.total_;
+      report.min_balance_ = std::min(report.min_balance_, partial.min_);
+      report.max_balance_ = std::max(report.max_balance_, partial.max_);
+      report.negative_balances_ += partial.negative_;
+      report.activity_ += partial.activity_;
+    }
+    if (!report.accounts_)
+      report.min_balance_ = report.max_balance_ = 0;
+
+    for (std::size_t atm_id = 0; atm_id < snapshot.atm_activity_.size(); atm_id++) {
+      if (!snapshot.atm_activity_[atm_id].empty())
+        report.atms_.push_back(AtmReport{static_cast<int>(atm_id), snapshot.atm_activity_[atm_id]});
+    }
+    return report;
+  }
+}
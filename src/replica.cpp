@@ -0,0 +1,224 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include <replica.hpp>
+
+namespace banking {
+
+  namespace {
+    const std::size_t REPLICA_BATCH = 1024;
+  }
+
+  BankReplica::BankReplica(ChangeJournal &journal) :
+    journal_(journal),
+    cards_(ACCOUNTS_CARDS_UL),
+    running_(false),
+    promoted_(false),
+    applied_(0),
+    applied_seq_(0),
+    last_lag_ns_(0),
+    max_lag_ns_(0),
+    stale_(0) {}
+
+  BankReplica::~BankReplica() {
+    stop();
+  }
+
+  void BankReplica::start() {
+    if (running_.exchange(true))
+      return;
+    applier_ = std::thread([this]() {
+      while (running_.load(std::memory_order_relaxed))
+        poll(std::chrono::milliseconds(10));
+    });
+  }
+
+  void BankReplica::stop() {
+    if (!running_.exchange(false))
+      return;
+    applier_.join();
+  }
+
+  std::size_t BankReplica::poll(ChangeJournal::clock_t::duration timeout) {
+    std::lock_guard<std::mutex> lck(apply_mutex_);
+    std::vector<JournalRecord> records;
+    journal_.consume(records, REPLICA_BATCH, timeout);
+    for (const auto &record : records)
+      apply(record);
+    return records.size();
+  }
+
+  bool BankReplica::catchUp(uint64_t seq, ChangeJournal::clock_t::duration timeout) {
+    ChangeJournal::clock_t::time_point deadline = ChangeJournal::clock_t::now() + timeout;
+    while (applied_seq_.load(std::memory_order_acquire) < seq) {
+      if (ChangeJournal::clock_t::now() >= deadline)
+        return false;
+      if (running_.load(std::memory_order_relaxed))
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      else
+        poll(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  void BankReplica::apply(const JournalRecord &record) {
+    auto it = indexes_.find(record.account_index_);
+    switch (record.op_) {
+      case JOURNAL_LINK_ACCOUNT: {
+        if (it != indexes_.end()) {
+          // Seeded again after records were dropped
+          applyBalance(it->second, record.version_, record.balance_);
+          break;
+        }
+        if (record.card_no_ < 0 || record.card_no_ >= ACCOUNTS_CARDS_UL) {
+          LOG(WARNING) << "Ignoring link of account " << record.account_id_ << " to card " << record.card_no_;
+          break;
+        }
+        account_index_t index = accounts_.create(record.account_id_, record.holder_name_, record.balance_);
+        indexes_.insert(std::make_pair(record.account_index_, index));
+        versions_.resize(index + 1);
+        versions_[index] = record.version_;
+        auto pending = pending_.find(record.account_index_);
+        if (pending != pending_.end()) {
+          applyBalance(index, pending->second.first, pending->second.second);
+          pending_.erase(record.account_index_);
+        }
+
+        ReplicaCard *card = new ReplicaCard;
+        {
+          RcuTable<ReplicaCard>::ReadGuard guard(cards_);
+          const ReplicaCard *linked = guard.get(record.card_no_);
+          if (linked)
+            *card = *linked;
+          else
+            card->card_ = std::make_shared<Card>(record.card_no_);
+        }
+        card->accounts_.push_back(index);
+        cards_.publish(record.card_no_, std::unique_ptr<const ReplicaCard>(card));
+        break;
+      }
+      case JOURNAL_BALANCE: {
+        if (it != indexes_.end()) {
+          applyBalance(it->second, record.version_, record.balance_);
+          break;
+        }
+        // The balance changed before the link of the account was published
+        auto pending = pending_.find(record.account_index_);
+        if (pending == pending_.end())
+          pending_.insert(std::make_pair(record.account_index_, std::make_pair(record.version_, record.balance_)));
+        else if (pending->second.first < record.version_)
+          pending->second = std::make_pair(record.version_, record.balance_);
+        break;
+      }
+    }
+
+    uint64_t lag = ChangeJournal::now() - record.time_ns_;
+    last_lag_ns_.store(lag, std::memory_order_relaxed);
+    if (lag > max_lag_ns_.load(std::memory_order_relaxed))
+      max_lag_ns_.store(lag, std::memory_order_relaxed);
+    applied_.fetch_add(1, std::memory_order_relaxed);
+    applied_seq_.store(record.seq_, std::memory_order_release);
+  }
+
+  void BankReplica::applyBalance(account_index_t index, uint64_t version, int balance) {
+    if (version <= versions_[index]) {
+      stale_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    versions_[index] = version;
+    accounts_.set(index, balance);
+  }
+
+  bool BankReplica::checkBalance(long card_no, int card_pin, long account_no, int &amount) {
+    if (promoted_.load(std::memory_order_relaxed))
+      return false;
+    RcuTable<ReplicaCard>::ReadGuard guard(cards_);
+    const ReplicaCard *card = guard.get(card_no);
+    if (!card || !card->card_->verifyCard(card_pin))
+      return false;
+    for (const auto &index : card->accounts_) {
+      if (accounts_.id(index) == account_no) {
+        amount = accounts_.balance(index);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool BankReplica::listAccounts(long card_no, std::vector<long> &account_no) {
+    if (promoted_.load(std::memory_order_relaxed))
+      return false;
+    RcuTable<ReplicaCard>::ReadGuard guard(cards_);
+    const ReplicaCard *card = guard.get(card_no);
+    if (!card)
+      return false;
+    for (const auto &index : card->accounts_)
+      account_no.push_back(accounts_.id(index));
+    return true;
+  }
+
+  bool BankReplica::privilegedOperation(const int &passcode, const std::string &holder_name,
+      std::vector<long> &account_no, long &card_no) {
+    if (promoted_.load(std::memory_order_relaxed))
+      return false;
+    if (passcode != HIDDEN_PASSCODE) {
+      LOG(ERROR) << "Unauthorized access";
+      return false;
+    }
+
+    uint32_t name_id;
+    if (!accounts_.findName(holder_name, name_id))
+      return false;
+    RcuTable<ReplicaCard>::ReadGuard guard(cards_);
+    for (long card = 0; card < ACCOUNTS_CARDS_UL; card++) {
+      const ReplicaCard *linked = guard.get(card);
+      if (!linked)
+        continue;
+      for (const auto &index : linked->accounts_) {
+        if (accounts_.nameId(index) != name_id)
+          continue;
+        card_no = card;
+        for (const auto &linked_index : linked->accounts_)
+          account_no.push_back(accounts_.id(linked_index));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  ReplicaMetrics BankReplica::metrics() const {
+    ReplicaMetrics metrics;
+    metrics.applied_ = applied_.load(std::memory_order_relaxed);
+    metrics.applied_seq_ = applied_seq_.load(std::memory_order_acquire);
+    metrics.head_seq_ = std::max(journal_.head(), metrics.applied_seq_);
+    metrics.lag_records_ = metrics.head_seq_ - metrics.applied_seq_;
+    metrics.last_lag_ns_ = last_lag_ns_.load(std::memory_order_relaxed);
+    metrics.max_lag_ns_ = max_lag_ns_.load(std::memory_order_relaxed);
+    metrics.stale_ = stale_.load(std::memory_order_relaxed);
+    metrics.dropped_ = journal_.dropped();
+    return metrics;
+  }
+
+  Bank* BankReplica::promote() {
+    if (Bank::getBank()->admissionMetrics().active_)
+      throw std::runtime_error("Promoting over a bank with open sessions");
+    stop();
+    journal_.close();
+    while (poll())
+      ;
+    promoted_.store(true);
+    LOG(INFO) << "Promoting replica at record " << applied_seq_.load();
+
+    Bank *bank = Bank::replaceBank();
+    RcuTable<ReplicaCard>::ReadGuard guard(cards_);
+    for (long card_no = 0; card_no < ACCOUNTS_CARDS_UL; card_no++) {
+      const ReplicaCard *card = guard.get(card_no);
+      if (!card)
+        continue;
+      for (const auto &index : card->accounts_)
+        bank->restoreAccount(card_no, accounts_.id(index), accounts_.name(index), accounts_.balance(index));
+    }
+    return bank;
+  }
+}
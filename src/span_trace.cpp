@@ -0,0 +1,165 @@
+#include <fstream>
+
+#include <glog/logging.h>
+
+#include <span_trace.hpp>
+
+namespace banking {
+
+  namespace {
+    /**
+     * @{name} session and token of the stage running on this thread
+     */
+    thread_local uint64_t current_session = 0;
+    thread_local long current_token = -1;
+
+    /**
+     * @brief Write a string as a JSON string literal
+     */
+    void putJsonString(const char *text, std::ostream &out) {
+      out << '"';
+      for (; *text; text++) {
+        if (*text == '"' || *text == '\\')
+          out << '\\';
+        out << *text;
+      }
+      out << '"';
+    }
+  }
+
+  std::atomic<bool> SpanTracer::enabled_(false);
+
+  SpanTracer::SpanTracer() :
+    next_session_(0),
+    dropped_(0),
+    sample_every_(1),
+    next_thread_(0),
+    sessions_(new std::atomic<uint64_t>[SESSION_SLOTS]) {
+      for (std::size_t i = 0; i < SESSION_SLOTS; i++)
+        sessions_[i].store(0, std::memory_order_relaxed);
+    }
+
+  bool SpanTracer::start(const std::string &path, uint32_t sample_every) {
+    std::lock_guard<std::mutex> lck(state_mutex_);
+    if (enabled())
+      return false;
+    path_ = path;
+    sample_every_.store(sample_every ? sample_every : 1, std::memory_order_relaxed);
+    next_session_.store(0, std::memory_order_relaxed);
+    dropped_.store(0, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < SESSION_SLOTS; i++)
+      sessions_[i].store(0, std::memory_order_relaxed);
+    buffers_.rotate();
+    start_ = std::chrono::steady_clock::now();
+    enabled_.store(true, std::memory_order_release);
+    LOG(INFO) << "Tracing one session in " << sample_every_.load() << " to " << path;
+    return true;
+  }
+
+  void SpanTracer::stop() {
+    std::lock_guard<std::mutex> lck(state_mutex_);
+    if (!enabled_.exchange(false))
+      return;
+    if (path_.empty())
+      return;
+
+    std::ofstream file(path_, std::ios::trunc);
+    if (!file) {
+      LOG(ERROR) << "Unable to open span trace " << path_;
+      return;
+    }
+    std::size_t spans = exportChrome(file);
+    LOG(INFO) << "Wrote " << spans << " spans to " << path_ << ", dropped " << dropped();
+  }
+
+  std::size_t SpanTracer::exportChrome(std::ostream &out) {
+    std::vector<std::shared_ptr<Buffer>> buffers = buffers_.buffers();
+
+    std::size_t spans = 0;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (auto &buffer : buffers) {
+      std::lock_guard<std::mutex> lck(buffer->mutex_);
+      for (const auto &span : buffer->spans_) {
+        out << (spans++ ? ",\n" : "\n") << "{\"name\":";
+        putJsonString(span.name_, out);
+        out << ",\"cat\":\"session\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.session_
+          << ",\"ts\":" << span.start_ns_ / 1000 << '.' << span.start_ns_ % 1000 / 100
+          << ",\"dur\":" << span.duration_ns_ / 1000 << '.' << span.duration_ns_ % 1000 / 100
+          << ",\"args\":{\"token\":" << span.token_ << ",\"thread\":" << span.thread_ << "}}";
+      }
+    }
+    out << "\n]}\n";
+    return spans;
+  }
+
+  uint64_t SpanTracer::newSession() {
+    uint64_t session = next_session_.fetch_add(1, std::memory_order_relaxed);
+    if (session % sample_every_.load(std::memory_order_relaxed))
+      return 0;
+    return session + 1;
+  }
+
+  uint64_t SpanTracer::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+  }
+
+  void SpanTracer::record(const SpanEvent &event) {
+    std::shared_ptr<Buffer> buffer = buffers_.local([this](Buffer &fresh) {
+      fresh.thread_ = next_thread_.fetch_add(1, std::memory_order_relaxed);
+    });
+    std::lock_guard<std::mutex> lck(buffer->mutex_);
+    if (buffer->spans_.size() >= BUFFER_SPANS) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    buffer->spans_.push_back(event);
+    buffer->spans_.back().thread_ = buffer->thread_;
+  }
+
+  void SpanScope::begin(const char *name, long token) {
+    SpanTracer *tracer = SpanTracer::getTracer();
+    session_ = token >= 0 ? tracer->session(token) : current_session;
+    if (!session_)
+      return;
+    parent_session_ = current_session;
+    parent_token_ = current_token;
+    current_session = session_;
+    current_token = token >= 0 ? token : current_token;
+    event_.name_ = name;
+    event_.session_ = session_;
+    event_.token_ = current_token;
+    event_.start_ns_ = tracer->now();
+  }
+
+  void SpanScope::beginSession(const char *name) {
+    SpanTracer *tracer = SpanTracer::getTracer();
+    session_ = tracer->newSession();
+    if (!session_)
+      return;
+    parent_session_ = current_session;
+    parent_token_ = current_token;
+    current_session = session_;
+    current_token = -1;
+    event_.name_ = name;
+    event_.session_ = session_;
+    event_.token_ = -1;
+    event_.start_ns_ = tracer->now();
+  }
+
+  void SpanScope::bind(long token) {
+    if (!session_)
+      return;
+    event_.token_ = token;
+    current_token = token;
+    SpanTracer::getTracer()->bindSession(token, session_);
+  }
+
+  void SpanScope::end() {
+    SpanTracer *tracer = SpanTracer::getTracer();
+    current_session = parent_session_;
+    current_token = parent_token_;
+    event_.duration_ns_ = tracer->now() - event_.start_ns_;
+    tracer->record(event_);
+  }
+}
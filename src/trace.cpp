@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <iterator>
+
+#include <glog/logging.h>
+
+#include <trace.hpp>
+#include <varint.hpp>
+
+namespace banking {
+
+  namespace {
+    const char TRACE_MAGIC[] = {'A', 'T', 'M', 'T', 1};
+
+    const std::size_t TRACE_FLUSH_BYTES = 1 << 16;
+
+    bool getList(const std::string &in, std::size_t &pos, std::vector<long> &values) {
+      uint64_t size;
+      // Every value takes at least a byte, a longer list is corrupt
+      if (!getVarint(in, pos, size) || size > in.size() - pos)
+        return false;
+      values.resize(size);
+      for (auto &value : values) {
+        if (!getSigned(in, pos, value))
+          return false;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Whether an event carries the args and results its op is
+     *        recorded with, and so replayed from
+     *
+     */
+    bool validArity(const TraceEvent &event) {
+      std::size_t args = event.args_.size(), results = event.results_.size();
+      bool found = results > 0 && event.results_[0] == 1;
+      switch (event.op_) {
+        case TRACE_CREATE_AND_LINK_ACCOUNT: return args >= 2 && results >= (found ? 3u : 1u);
+        case TRACE_VERIFY_AND_CREATE_TRANSACTION: return args >= 2 && results >= 1;
+        case TRACE_ACKNOWLEDGE_TRANSACTION: return results >= 1;
+        case TRACE_SELECT_ACCOUNT: return args >= 1;
+        case TRACE_PERFORM_TRANSACTION: return args >= 2;
+        case TRACE_CHECK_BALANCE: return results >= (found ? 2u : 1u);
+        case TRACE_LIST_ACCOUNTS: return args >= 1 && results >= 1;
+        case TRACE_GET_ATM_ID: return true;
+        case TRACE_PRIVILEGED_OPERATION: return args >= 1 && results >= (found ? 2u : 1u);
+        case TRACE_ATM_CALLBACK: return args >= 2 && results >= 1;
+        case TRACE_PERFORM_SESSION: return args % 4 == 0 && results >= 1;
+        case TRACE_RETURN_ATM_ID: return args >= 1;
+      }
+      return false;
+    }
+  }
+
+  void encodeTraceEvent(const TraceEvent &event, std::string &out) {
+    putVarint(event.seq_, out);
+    putVarint(event.time_ns_, out);
+    putVarint(event.op_, out);
+    putSigned(event.token_, out);
+    putVarint(event.text_.size(), out);
+    out.append(event.text_);
+    putVarint(event.args_.size(), out);
+    for (const auto &arg : event.args_)
+      putSigned(arg, out);
+    putVarint(event.results_.size(), out);
+    for (const auto &result : event.results_)
+      putSigned(result, out);
+  }
+
+  bool decodeTraceEvent(const std::string &in, std::size_t &pos, TraceEvent &event) {
+    uint64_t op, text_size;
+    if (!getVarint(in, pos, event.seq_) || !getVarint(in, pos, event.time_ns_) ||
+        !getVarint(in, pos, op) || op > TRACE_RETURN_ATM_ID || !getSigned(in, pos, event.token_) ||
+        !getVarint(in, pos, text_size) || in.size() - pos < text_size)
+      return false;
+    event.op_ = static_cast<TraceOp>(op);
+    event.text_ = in.substr(pos, text_size);
+    pos += text_size;
+    return getList(in, pos, event.args_) && getList(in, pos, event.results_) && validArity(event);
+  }
+
+  bool readTrace(const std::string &path, std::vector<TraceEvent> &events) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      LOG(ERROR) << "Unable to open trace " << path;
+      return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.compare(0, sizeof(TRACE_MAGIC), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+      LOG(ERROR) << "Not a trace file " << path;
+      return false;
+    }
+
+    std::size_t pos = sizeof(TRACE_MAGIC);
+    while (pos < bytes.size()) {
+      std::size_t start = pos;
+      TraceEvent event;
+      if (!decodeTraceEvent(bytes, pos, event)) {
+        LOG(ERROR) << "Corrupt or truncated trace " << path << " at byte " << start
+          << ", after " << events.size() << " events";
+        return false;
+      }
+      events.push_back(event);
+    }
+
+    std::sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b) {
+        return a.seq_ < b.seq_;
+        });
+    return true;
+  }
+
+  bool TraceRecorder::start(const std::string &path) {
+    std::lock_guard<std::mutex> lck(file_mutex_);
+    if (enabled())
+      return false;
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    if (!file_) {
+      LOG(ERROR) << "Unable to open trace " << path;
+      return false;
+    }
+    file_.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    start_ = std::chrono::steady_clock::now();
+    seq_.store(0, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_release);
+    LOG(INFO) << "Recording bank trace to " << path;
+    return true;
+  }
+
+  void TraceRecorder::stop() {
+    if (!enabled_.exchange(false))
+      return;
+
+    for (auto &buffer : buffers_.rotate()) {
+      std::lock_guard<std::mutex> lck(buffer->mutex_);
+      flush(*buffer);
+    }
+
+    std::lock_guard<std::mutex> lck(file_mutex_);
+    file_.close();
+  }
+
+  uint64_t TraceRecorder::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+  }
+
+  void TraceRecorder::record(const TraceEvent &event) {
+    std::shared_ptr<Buffer> buffer = buffers_.local([](Buffer &fresh) {
+      fresh.bytes_.reserve(TRACE_FLUSH_BYTES);
+    });
+    std::lock_guard<std::mutex> lck(buffer->mutex_);
+    encodeTraceEvent(event, buffer->bytes_);
+    if (buffer->bytes_.size() >= TRACE_FLUSH_BYTES)
+      flush(*buffer);
+  }
+
+  void TraceRecorder::flush(Buffer &buffer) {
+    std::lock_guard<std::mutex> lck(file_mutex_);
+    if (file_.is_open())
+      file_.write(buffer.bytes_.data(), buffer.bytes_.size());
+    buffer.bytes_.clear();
+  }
+}
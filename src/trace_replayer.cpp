@@ -0,0 +1,312 @@
+#include <condition_variable>
+#include <cstdlib>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <trace_replayer.hpp>
+
+namespace banking {
+
+  TraceReplayer::TraceReplayer(const std::vector<TraceEvent> &events,
+      const ReplayOptions &options) :
+    options_(options),
+    events_(events),
+    first_time_ns_(0),
+    calls_(0),
+    mismatches_(0) {
+    }
+
+  ReplayReport TraceReplayer::run() {
+    Bank::getBank()->deleteBank();
+    buildSessions();
+
+    start_ = std::chrono::steady_clock::now();
+    if (!events_.empty())
+      first_time_ns_ = events_.front().time_ns_;
+
+    if (options_.parallelism_ <= 1) {
+      for (std::size_t i = 0; i < events_.size(); i++) {
+        if (events_[i].op_ == TRACE_ATM_CALLBACK)
+          continue;
+        long session = event_sessions_[i];
+        replayCall(events_[i], session >= 0 ? &sessions_[session] : nullptr);
+      }
+    } else {
+      /**
+       * struct WorkQueue - Sessions waiting for one replay thread
+       */
+      struct WorkQueue {
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<Session*> sessions_;
+        bool closed_ = false;
+      };
+
+      std::vector<WorkQueue> queues(options_.parallelism_);
+      std::atomic<long> pending(0);
+      std::mutex idle_mutex;
+      std::condition_variable idle_cv;
+
+      std::vector<std::thread> workers;
+      for (auto &queue : queues) {
+        workers.emplace_back([this, &queue, &pending, &idle_mutex, &idle_cv]() {
+            for (;;) {
+              Session *session;
+              {
+                std::unique_lock<std::mutex> lck(queue.mutex_);
+                queue.cv_.wait(lck, [&queue]() { return queue.closed_ || !queue.sessions_.empty(); });
+                if (queue.sessions_.empty())
+                  return;
+                session = queue.sessions_.front();
+                queue.sessions_.pop_front();
+              }
+              replaySession(*session);
+              if (pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lck(idle_mutex);
+                idle_cv.notify_all();
+              }
+            }
+          });
+      }
+
+      for (std::size_t i = 0; i < events_.size(); i++) {
+        long session = event_sessions_[i];
+        if (session < 0 && events_[i].op_ != TRACE_ATM_CALLBACK) {
+          std::unique_lock<std::mutex> lck(idle_mutex);
+          idle_cv.wait(lck, [&pending]() { return pending.load() == 0; });
+          lck.unlock();
+          replayCall(events_[i], nullptr);
+        } else if (session >= 0 && events_[i].op_ == TRACE_VERIFY_AND_CREATE_TRANSACTION) {
+          WorkQueue &queue = queues[std::labs(sessions_[session].card_no_) % queues.size()];
+          pending++;
+          std::lock_guard<std::mutex> lck(queue.mutex_);
+          queue.sessions_.push_back(&sessions_[session]);
+          queue.cv_.notify_one();
+        }
+      }
+
+      for (auto &queue : queues) {
+        std::lock_guard<std::mutex> lck(queue.mutex_);
+        queue.closed_ = true;
+        queue.cv_.notify_one();
+      }
+      for (auto &worker : workers)
+        worker.join();
+    }
+
+    for (const auto &session : sessions_) {
+      for (const auto &callback : session.callbacks_)
+        mismatch(*callback, "callback never made");
+    }
+
+    ReplayReport report;
+    report.calls_ = calls_.load();
+    report.sessions_ = sessions_.size();
+    report.mismatches_ = mismatches_.load();
+    report.elapsed_ms_ = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start_).count();
+    LOG(INFO) << "Replayed " << report.calls_ << " calls in " << report.sessions_
+      << " sessions, " << report.mismatches_ << " mismatches";
+    return report;
+  }
+
+  void TraceReplayer::buildSessions() {
+    std::map<long, long> open_sessions;
+    sessions_.clear();
+    event_sessions_.assign(events_.size(), -1);
+
+    for (std::size_t i = 0; i < events_.size(); i++) {
+      const TraceEvent &event = events_[i];
+      switch (event.op_) {
+        case TRACE_VERIFY_AND_CREATE_TRANSACTION:
+          if (event.results_[0] >= 0) {
+            Session session;
+            session.card_no_ = event.args_[0];
+            session.token_ = -1;
+            session.calls_.push_back(&event);
+            open_sessions[event.results_[0]] = sessions_.size();
+            event_sessions_[i] = sessions_.size();
+            sessions_.push_back(session);
+          }
+          break;
+        case TRACE_ACKNOWLEDGE_TRANSACTION:
+        case TRACE_SELECT_ACCOUNT:
+        case TRACE_PERFORM_TRANSACTION:
+        case TRACE_CHECK_BALANCE:
+        case TRACE_PERFORM_SESSION:
+        case TRACE_ATM_CALLBACK: {
+          std::map<long, long>::const_iterator it = open_sessions.find(event.token_);
+          if (it == open_sessions.end())
+            break;
+          event_sessions_[i] = it->second;
+          if (event.op_ == TRACE_ATM_CALLBACK)
+            sessions_[it->second].callbacks_.push_back(&event);
+          else
+            sessions_[it->second].calls_.push_back(&event);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+
+  void TraceReplayer::replaySession(Session &session) {
+    for (const auto &call : session.calls_)
+      replayCall(*call, &session);
+  }
+
+  void TraceReplayer::replayCall(const TraceEvent &event, Session *session) {
+    waitForEvent(event);
+    calls_++;
+
+    Bank *bank = Bank::getBank();
+    int token = session ? session->token_ : -1;
+    switch (event.op_) {
+      case TRACE_CREATE_AND_LINK_ACCOUNT: {
+        long card_no = event.args_[1] >= 0 ? mapId(card_ids_, event.args_[1]) : -1;
+        long linked_card_no = -1;
+        try {
+          linked_card_no = bank->createAndLinkAccount(event.text_, event.args_[0], card_no);
+        } catch (std::exception &ex) {
+          LOG(WARNING) << "Replayed account creation failed: " << ex.what();
+        }
+        if ((linked_card_no >= 0) != (event.results_[0] == 1)) {
+          mismatch(event, "account creation");
+        } else if (linked_card_no >= 0) {
+          std::vector<long> account_no;
+          bank->listAccounts(linked_card_no, account_no);
+          card_ids_[event.results_[2]] = linked_card_no;
+          account_ids_[event.results_[1]] = account_no.back();
+        }
+        break;
+      }
+      case TRACE_VERIFY_AND_CREATE_TRANSACTION: {
+        int new_token = -1;
+        try {
+          new_token = bank->verifyAndCreateTransaction(mapId(card_ids_, event.args_[0]),
+              event.args_[1], event.args_.size() > 2 ? mapId(atm_ids_, event.args_[2]) : -1);
+        } catch (std::exception&) {
+        }
+        if ((new_token >= 0) != (event.results_[0] >= 0))
+          mismatch(event, "transaction creation");
+        if (session)
+          session->token_ = new_token;
+        break;
+      }
+      case TRACE_ACKNOWLEDGE_TRANSACTION: {
+        bool acknowledged = true;
+        try {
+          bank->acknowledgeTransaction(token, session ? sessionCallback(*session) :
+              [](AtmOperationType, int, std::string&&) { return true; });
+        } catch (std::exception&) {
+          acknowledged = false;
+        }
+        if (acknowledged != (event.results_[0] == 1))
+          mismatch(event, "acknowledge");
+        break;
+      }
+      case TRACE_SELECT_ACCOUNT:
+        bank->selectAccount(token, mapId(account_ids_, event.args_[0]));
+        break;
+      case TRACE_PERFORM_TRANSACTION: {
+        TransactionType trans_type = static_cast<TransactionType>(event.args_[0]);
+        uint64_t request_id = event.args_.size() > 2 ? event.args_[2] : 0;
+        bank->performTransaction(token, trans_type, event.args_[1], request_id);
+        break;
+      }
+      case TRACE_PERFORM_SESSION: {
+        std::vector<SessionOperation> operations;
+        for (std::size_t i = 0; i + 3 < event.args_.size(); i += 4) {
+          operations.push_back(SessionOperation{static_cast<SessionOperationType>(event.args_[i]),
+              mapId(account_ids_, event.args_[i + 1]), static_cast<int>(event.args_[i + 2]),
+              mapId(account_ids_, event.args_[i + 3])});
+        }
+        if (bank->performSession(token, operations) != (event.results_[0] == 1))
+          mismatch(event, "session");
+        break;
+      }
+      case TRACE_CHECK_BALANCE: {
+        int amount = 0;
+        bool found = bank->checkBalance(token, amount);
+        if (found != (event.results_[0] == 1) || (found && amount != event.results_[1]))
+          mismatch(event, "balance");
+        break;
+      }
+      case TRACE_LIST_ACCOUNTS: {
+        std::vector<long> account_no, expected;
+        bool found = bank->listAccounts(mapId(card_ids_, event.args_[0]), account_no);
+        for (std::size_t i = 1; i < event.results_.size(); i++)
+          expected.push_back(mapId(account_ids_, event.results_[i]));
+        if (found != (event.results_[0] == 1) || account_no != expected)
+          mismatch(event, "account listing");
+        break;
+      }
+      case TRACE_GET_ATM_ID: {
+        int atm_id = -1;
+        try {
+          atm_id = bank->get_atm_id();
+        } catch (std::exception &ex) {
+          LOG(WARNING) << "Replayed atm id failed: " << ex.what();
+        }
+        if ((atm_id >= 0) != !event.results_.empty())
+          mismatch(event, "atm id");
+        else if (atm_id >= 0)
+          atm_ids_[event.results_[0]] = atm_id;
+        break;
+      }
+      case TRACE_RETURN_ATM_ID:
+        bank->returnAtmId(mapId(atm_ids_, event.args_[0]));
+        atm_ids_.erase(event.args_[0]);
+        break;
+      case TRACE_PRIVILEGED_OPERATION: {
+        std::vector<long> account_no, expected;
+        long card_no = -1;
+        bool found = bank->privilegedOperation(event.args_[0], event.text_, account_no, card_no);
+        for (std::size_t i = 2; i < event.results_.size(); i++)
+          expected.push_back(mapId(account_ids_, event.results_[i]));
+        if (found != (event.results_[0] == 1) ||
+            (found && (card_no != mapId(card_ids_, event.results_[1]) || account_no != expected)))
+          mismatch(event, "privileged operation");
+        break;
+      }
+      case TRACE_ATM_CALLBACK:
+        break;
+    }
+  }
+
+  void TraceReplayer::waitForEvent(const TraceEvent &event) {
+    if (!options_.original_timing_)
+      return;
+    std::this_thread::sleep_until(start_ + std::chrono::nanoseconds(event.time_ns_ - first_time_ns_));
+  }
+
+  atm_cb_t TraceReplayer::sessionCallback(Session &session) {
+    return [this, &session](AtmOperationType atm_op, int info, std::string&&) {
+      if (session.callbacks_.empty()) {
+        LOG(WARNING) << "Unexpected callback " << atm_op << " " << info;
+        mismatches_++;
+        return true;
+      }
+      const TraceEvent *expected = session.callbacks_.front();
+      session.callbacks_.pop_front();
+      if (expected->args_[0] != atm_op || expected->args_[1] != info)
+        mismatch(*expected, "callback");
+      return expected->results_[0] != 0;
+    };
+  }
+
+  long TraceReplayer::mapId(const std::map<long, long> &ids, long id) const {
+    std::map<long, long>::const_iterator it = ids.find(id);
+    if (it != ids.end())
+      return it->second;
+    return id >= 0 ? -1 - id : id;
+  }
+
+  void TraceReplayer::mismatch(const TraceEvent &event, const std::string &what) {
+    LOG(WARNING) << "Mismatch in " << what << " at event " << event.seq_
+      << " op " << event.op_ << " token " << event.token_;
+    mismatches_++;
+  }
+}
@@ -0,0 +1,213 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <account_table.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(ChunkedArrayTest, GrowsAcrossChunks) {
+  ChunkedArray<long> array;
+  const std::size_t size = ChunkedArray<long>::CHUNK_SIZE * 2 + 5;
+  for (std::size_t i = 0; i < size; i++) {
+    ASSERT_TRUE(array.reserve(i));
+    array[i] = i * 3;
+  }
+  const long *first = &array[0];
+  for (std::size_t i = 0; i < size; i++)
+    EXPECT_EQ(array[i], static_cast<long>(i * 3));
+  EXPECT_EQ(&array[0], first);
+  EXPECT_EQ(array.memoryBytes(), 3 * ChunkedArray<long>::CHUNK_SIZE * sizeof(long));
+  EXPECT_FALSE(array.reserve(ChunkedArray<long>::CHUNK_SIZE * ChunkedArray<long>::MAX_CHUNKS));
+}
+
+TEST(InlineListTest, SpillsPastInlineCapacity) {
+  InlineList<uint32_t, 3> list;
+  EXPECT_TRUE(list.empty());
+  for (uint32_t i = 0; i < 5; i++)
+    list.push_back(i * 10);
+  EXPECT_EQ(list.size(), 5u);
+  EXPECT_EQ(list.back(), 40u);
+
+  InlineList<uint32_t, 3> copy = list;
+  std::vector<uint32_t> values;
+  for (auto value : copy)
+    values.push_back(value);
+  EXPECT_THAT(values, ElementsAre(0, 10, 20, 30, 40));
+}
+
+TEST(NameInternerTest, SameNameSameId) {
+  NameInterner names;
+  uint32_t someone = names.intern("someone");
+  uint32_t other = names.intern("a holder name too long for the small string buffer");
+  EXPECT_NE(someone, other);
+  EXPECT_EQ(names.intern("someone"), someone);
+  EXPECT_EQ(names.name(other), "a holder name too long for the small string buffer");
+
+  uint32_t id;
+  EXPECT_TRUE(names.find("someone", id));
+  EXPECT_EQ(id, someone);
+  EXPECT_FALSE(names.find("nobody", id));
+}
+
+TEST(AccountTableTest, TransactionsAndVersions) {
+  AccountTable table;
+  account_index_t first = table.create(11, "someone", 100);
+  account_index_t second = table.create(12, "someone", 50);
+  EXPECT_EQ(table.size(), 2u);
+  EXPECT_EQ(table.id(second), 12);
+  EXPECT_EQ(table.nameId(first), table.nameId(second));
+  EXPECT_EQ(table.name(first), "someone");
+
+  uint64_t before, after;
+  EXPECT_EQ(table.balance(first, &before), 100);
+  int amount = 40;
+  EXPECT_TRUE(table.performTransaction(first, DEPOSIT, amount));
+  EXPECT_EQ(table.balance(first, &after), 140);
+  EXPECT_GT(after, before);
+
+  amount = 60;
+  EXPECT_FALSE(table.performTransaction(second, WITHDRAW, amount));
+  EXPECT_EQ(table.balance(second, &before), 50);
+  amount = 20;
+  EXPECT_TRUE(table.performTransaction(second, WITHDRAW, amount));
+  EXPECT_EQ(table.balance(second, &after), 30);
+  EXPECT_EQ(after, before + 2);
+
+  amount = 0;
+  EXPECT_TRUE(table.performTransaction(first, CHECK_BALANCE, amount));
+  EXPECT_EQ(amount, 140);
+}
+
+TEST(AccountTableTest, ConcurrentWritersDoNotLoseUpdates) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 0);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; t++) {
+    writers.emplace_back([&table, index]() {
+      for (int i = 0; i < 2000; i++) {
+        int amount = 1;
+        table.performTransaction(index, DEPOSIT, amount);
+      }
+    });
+  }
+  for (auto &writer : writers)
+    writer.join();
+  EXPECT_EQ(table.balance(index), 8000);
+}
+
+TEST(AccountTransactionTest, CommitsAllOrNothing) {
+  AccountTable table;
+  account_index_t from = table.create(1, "someone", 100);
+  account_index_t to = table.create(2, "someone", 0);
+
+  AccountTransaction txn(table);
+  EXPECT_EQ(txn.read(from), 100);
+  txn.add(from, -30);
+  txn.add(to, 30);
+  EXPECT_EQ(txn.read(from), 70);
+  EXPECT_EQ(table.balance(from), 100);
+  EXPECT_TRUE(txn.commit());
+  EXPECT_EQ(table.balance(from), 70);
+  EXPECT_EQ(table.balance(to), 30);
+
+  // A write landing between the read and the commit throws the whole run away
+  txn.clear();
+  txn.add(from, -70);
+  txn.add(to, 70);
+  int amount = 5;
+  table.performTransaction(to, DEPOSIT, amount);
+  EXPECT_FALSE(txn.commit());
+  EXPECT_EQ(table.balance(from), 70);
+  EXPECT_EQ(table.balance(to), 35);
+
+  txn.clear();
+  txn.add(from, -70);
+  txn.add(to, 70);
+  EXPECT_TRUE(txn.commit());
+  EXPECT_EQ(table.balance(from), 0);
+  EXPECT_EQ(table.balance(to), 105);
+}
+
+TEST(AccountTransactionTest, ValidatesReadOnlyAccounts) {
+  AccountTable table;
+  account_index_t read = table.create(1, "someone", 100);
+  account_index_t written = table.create(2, "someone", 0);
+
+  AccountTransaction txn(table);
+  EXPECT_EQ(txn.read(read), 100);
+  txn.add(written, 1);
+  int amount = 1;
+  table.performTransaction(read, WITHDRAW, amount);
+  EXPECT_FALSE(txn.commit());
+  EXPECT_EQ(table.balance(written), 0);
+
+  uint64_t version;
+  table.balance(written, &version);
+  EXPECT_EQ(version % 2, 0u);
+}
+
+TEST(AccountTransactionTest, ConcurrentTransfersKeepTheTotal) {
+  AccountTable table;
+  std::vector<account_index_t> accounts;
+  for (int i = 0; i < 4; i++)
+    accounts.push_back(table.create(i, "someone", 1000));
+
+  std::atomic<int> conflicts(0);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; t++) {
+    writers.emplace_back([&table, &accounts, &conflicts, t]() {
+      AccountTransaction txn(table);
+      for (int i = 0; i < 2000; i++) {
+        account_index_t from = accounts[(t + i) % 4], to = accounts[(t + i + 1) % 4];
+        do {
+          txn.clear();
+          if (txn.read(from) < 3)
+            break;
+          txn.add(from, -3);
+          txn.add(to, 3);
+        } while (!txn.commit() && ++conflicts);
+      }
+    });
+  }
+  for (auto &writer : writers)
+    writer.join();
+
+  int total = 0;
+  for (auto index : accounts) {
+    EXPECT_GE(table.balance(index), 0);
+    total += table.balance(index);
+  }
+  EXPECT_EQ(total, 4000);
+  LOG(INFO) << conflicts.load() << " conflicts";
+}
+
+TEST(AccountTableTest, HandleForwardsToTable) {
+  AccountTable table;
+  Account account(table, table.create(7, "someone", 10));
+  EXPECT_EQ(account.get_id(), 7);
+  EXPECT_EQ(account.get_name(), "someone");
+  int amount = 5;
+  EXPECT_TRUE(account.performTransaction(WITHDRAW, amount));
+  EXPECT_EQ(account.get_balance(), 5);
+
+  // Handles of two tables never see each other's rows
+  AccountTable other_table;
+  Account other(other_table, other_table.create(8, "other", 20));
+  EXPECT_EQ(other.get_index(), account.get_index());
+  EXPECT_EQ(other.get_id(), 8);
+  EXPECT_EQ(other.get_balance(), 20);
+  EXPECT_EQ(account.get_balance(), 5);
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,308 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <set>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <admission.hpp>
+#include <bank.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  const auto LONG_WAIT = std::chrono::seconds(10);
+
+#ifndef ATM_SINGLE_THREADED
+  /**
+   * @brief Poll until the controller has a given number of waiters, failing
+   *        the test if it does not get there within LONG_WAIT
+   */
+  void waitForQueue(AdmissionController &admission, std::size_t depth) {
+    auto deadline = std::chrono::steady_clock::now() + LONG_WAIT;
+    while (admission.metrics().queue_depth_ != depth) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        ADD_FAILURE() << "Queue never reached depth " << depth;
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+#endif
+}
+
+TEST(AdmissionControllerTest, AdmitsUpToBudget) {
+  AdmissionController admission(2, 4, std::chrono::milliseconds(0));
+  EXPECT_TRUE(admission.admit(1));
+  EXPECT_TRUE(admission.admit(2));
+  EXPECT_FALSE(admission.admit(1));
+
+  admission.release();
+  EXPECT_TRUE(admission.admit(1));
+
+  AdmissionMetrics metrics = admission.metrics();
+  EXPECT_EQ(metrics.budget_, 2u);
+  EXPECT_EQ(metrics.active_, 2u);
+  EXPECT_EQ(metrics.admitted_, 3u);
+  EXPECT_EQ(metrics.timed_out_, 1u);
+  EXPECT_EQ(metrics.queue_depth_, 0u);
+  EXPECT_DOUBLE_EQ(metrics.shedRate(), 0.25);
+}
+
+TEST(AdmissionControllerTest, TimesOutAtDeadline) {
+  AdmissionController admission(0, 4, LONG_WAIT);
+  auto start = AdmissionController::clock_t::now();
+  EXPECT_FALSE(admission.admit(1, start + std::chrono::milliseconds(20)));
+  EXPECT_GE(AdmissionController::clock_t::now() - start, std::chrono::milliseconds(20));
+
+  AdmissionMetrics metrics = admission.metrics();
+  EXPECT_EQ(metrics.timed_out_, 1u);
+  EXPECT_EQ(metrics.waited_, 1u);
+  EXPECT_EQ(metrics.queue_depth_, 0u);
+  EXPECT_EQ(metrics.max_queue_depth_, 1u);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST(AdmissionControllerTest, ShedsWhenAtmQueueIsFull) {
+  AdmissionController admission(1, 1, LONG_WAIT);
+  ASSERT_TRUE(admission.admit(1));
+  std::thread waiter([&admission]() { EXPECT_TRUE(admission.admit(1)); });
+  waitForQueue(admission, 1);
+
+  // Atm 1 has used its queue, atm 2 still gets a place
+  EXPECT_FALSE(admission.admit(1));
+  std::thread other([&admission]() { EXPECT_TRUE(admission.admit(2)); });
+  waitForQueue(admission, 2);
+
+  admission.release();
+  admission.release();
+  waiter.join();
+  other.join();
+
+  AdmissionMetrics metrics = admission.metrics();
+  EXPECT_EQ(metrics.shed_, 1u);
+  EXPECT_EQ(metrics.waited_, 2u);
+  EXPECT_EQ(metrics.admitted_, 3u);
+  EXPECT_EQ(metrics.max_queue_depth_, 2u);
+}
+
+TEST(AdmissionControllerTest, BusyAtmDoesNotStarveOthers) {
+  AdmissionController admission(1, 8, LONG_WAIT);
+  ASSERT_TRUE(admission.admit(0));
+
+  std::mutex order_mutex;
+  std::vector<int> order;
+  std::vector<std::thread> waiters;
+  // Three waiters of atm 1 queue up before the only one of atm 2
+  for (int atm_id : {1, 1, 1, 2}) {
+    waiters.emplace_back([&, atm_id]() {
+      ASSERT_TRUE(admission.admit(atm_id));
+      std::lock_guard<std::mutex> lck(order_mutex);
+      order.push_back(atm_id);
+    });
+    waitForQueue(admission, waiters.size());
+  }
+
+  for (std::size_t granted = 1; granted <= waiters.size(); granted++) {
+    admission.release();
+    while (true) {
+      std::lock_guard<std::mutex> lck(order_mutex);
+      if (order.size() == granted)
+        break;
+    }
+  }
+  for (auto &waiter : waiters)
+    waiter.join();
+  EXPECT_THAT(order, ElementsAre(1, 2, 1, 1));
+}
+
+TEST(AdmissionControllerTest, GrowingBudgetGrantsWaiters) {
+  AdmissionController admission(0, 4, LONG_WAIT);
+  std::thread waiter([&admission]() { EXPECT_TRUE(admission.admit(1)); });
+  waitForQueue(admission, 1);
+  admission.configure(1, 4, LONG_WAIT);
+  waiter.join();
+  EXPECT_EQ(admission.metrics().active_, 1u);
+}
+#endif
+
+class BankAdmissionTest : public Test {
+  public:
+  void TearDown() override {
+    Bank::getBank()->deleteBank();
+  }
+
+  /**
+   * @brief Finish a session by showing the balance of its account
+   */
+  void endSession(int token, long account_no) {
+    Bank *bank = Bank::getBank();
+    bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+    bank->selectAccount(token, account_no);
+    TransactionType trans_type = CHECK_BALANCE;
+    bank->performTransaction(token, trans_type, 0);
+  }
+};
+
+TEST_F(BankAdmissionTest, BusyBankTurnsSessionsAway) {
+  Bank *bank = Bank::getBank();
+  long card_no = bank->createAndLinkAccount("someone", 100);
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->listAccounts(card_no, account_no));
+  bank->configureAdmission(1, 1, std::chrono::milliseconds(0));
+
+  int token = bank->verifyAndCreateTransaction(card_no, 8888, 3);
+  EXPECT_THROW(bank->verifyAndCreateTransaction(card_no, 8888, 3), std::runtime_error);
+  AdmissionMetrics metrics = bank->admissionMetrics();
+  EXPECT_EQ(metrics.active_, 1u);
+  EXPECT_EQ(metrics.timed_out_, 1u);
+
+  // Bad card details are refused before taking a slot
+  EXPECT_THROW(bank->verifyAndCreateTransaction(card_no, 1234, 3), std::runtime_error);
+  EXPECT_EQ(bank->admissionMetrics().timed_out_, 1u);
+
+  endSession(token, account_no[0]);
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+  token = bank->verifyAndCreateTransaction(card_no, 8888, 3);
+  endSession(token, account_no[0]);
+  EXPECT_EQ(bank->admissionMetrics().admitted_, 2u);
+}
+
+TEST_F(BankAdmissionTest, FailedAcknowledgeGivesTheSlotBack) {
+  Bank *bank = Bank::getBank();
+  long card_no = bank->createAndLinkAccount("someone", 100);
+  bank->configureAdmission(1, 1, std::chrono::milliseconds(0));
+
+  int token = bank->verifyAndCreateTransaction(card_no, 8888, 3);
+  EXPECT_THROW(bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) -> bool {
+    throw std::runtime_error("Display broken");
+  }), std::runtime_error);
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+  EXPECT_NO_THROW(bank->verifyAndCreateTransaction(card_no, 8888, 3));
+}
+
+TEST_F(BankAdmissionTest, AbandonedSessionsAreReclaimed) {
+  Bank *bank = Bank::getBank();
+  long card_no = bank->createAndLinkAccount("someone", 100);
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->listAccounts(card_no, account_no));
+  bank->configureAdmission(1, 1, std::chrono::milliseconds(0), std::chrono::milliseconds(20));
+
+  // The atm goes away after verifying, and is told once its session ends
+  int timed_out = 0;
+  int token = bank->verifyAndCreateTransaction(card_no, 8888, 3);
+  bank->acknowledgeTransaction(token, [&timed_out](AtmOperationType atm_op, int, std::string&&) {
+    timed_out += atm_op == SHOW_ERROR;
+    return true;
+  });
+  EXPECT_THROW(bank->verifyAndCreateTransaction(card_no, 8888, 4), std::runtime_error);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  token = bank->verifyAndCreateTransaction(card_no, 8888, 4);
+  EXPECT_EQ(timed_out, 1);
+  endSession(token, account_no[0]);
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+}
+
+TEST_F(BankAdmissionTest, AtmIdsAreUniqueUntilReturned) {
+  Bank *bank = Bank::getBank();
+  std::set<int> atm_ids;
+  for (int i = 0; i < ACCOUNTS_CARDS_UL; i++)
+    EXPECT_TRUE(atm_ids.insert(bank->get_atm_id()).second);
+  EXPECT_THROW(bank->get_atm_id(), std::runtime_error);
+
+  bank->returnAtmId(*atm_ids.begin());
+  bank->returnAtmId(*atm_ids.begin());
+  EXPECT_EQ(bank->get_atm_id(), *atm_ids.begin());
+  EXPECT_THROW(bank->get_atm_id(), std::runtime_error);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST_F(BankAdmissionTest, DegradesGracefullyAtTwiceCapacity) {
+  const std::size_t BUDGET = 4;
+  const int SESSIONS = 25;
+  // One busy site with most of the clients next to two quiet ones
+  const std::vector<int> atm_clients = {6, 1, 1};
+
+  Bank *bank = Bank::getBank();
+  // A card runs one session at a time, every client gets its own
+  std::vector<long> cards, accounts;
+  while (cards.size() < 8) {
+    cards.push_back(bank->createAndLinkAccount("client", 0));
+    std::vector<long> account_no;
+    ASSERT_TRUE(bank->listAccounts(cards.back(), account_no));
+    accounts.push_back(account_no[0]);
+  }
+  bank->configureAdmission(BUDGET, 2, std::chrono::seconds(5));
+
+  std::atomic<int> in_session(0), peak(0), completed(0), errors(0);
+  std::vector<std::atomic<int>> busy(atm_clients.size());
+  std::vector<std::thread> clients;
+  for (std::size_t atm_id = 0; atm_id < atm_clients.size(); atm_id++) {
+    for (int client = 0; client < atm_clients[atm_id]; client++) {
+      std::size_t i = clients.size();
+      clients.emplace_back([&, atm_id, i]() {
+        for (int n = 0; n < SESSIONS; n++) {
+          int token;
+          try {
+            token = bank->verifyAndCreateTransaction(cards[i], 8888, atm_id);
+          } catch (std::runtime_error &ex) {
+            if (std::string(ex.what()) == "Bank busy, please try again")
+              busy[atm_id]++;
+            else
+              errors++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+          }
+          int now = ++in_session;
+          int seen = peak.load();
+          while (now > seen && !peak.compare_exchange_weak(seen, now));
+
+          bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+          bank->selectAccount(token, accounts[i]);
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          in_session--;
+          TransactionType trans_type = DEPOSIT;
+          bank->performTransaction(token, trans_type, 1);
+          completed++;
+        }
+      });
+    }
+  }
+  for (auto &client : clients)
+    client.join();
+
+  AdmissionMetrics metrics = bank->admissionMetrics();
+  LOG(INFO) << "admitted " << metrics.admitted_ << " waited " << metrics.waited_
+    << " shed " << metrics.shed_ << " timed out " << metrics.timed_out_
+    << " max queue depth " << metrics.max_queue_depth_;
+
+  EXPECT_EQ(errors.load(), 0);
+  EXPECT_LE(peak.load(), static_cast<int>(BUDGET));
+  EXPECT_EQ(metrics.active_, 0u);
+  EXPECT_EQ(metrics.queue_depth_, 0u);
+  EXPECT_LE(metrics.max_queue_depth_, 2u * atm_clients.size());
+  EXPECT_EQ(metrics.timed_out_, 0u);
+  EXPECT_EQ(static_cast<uint64_t>(completed.load()), metrics.admitted_);
+  int64_t total = 0;
+  for (auto balance : bank->snapshotBalances().balances_)
+    total += balance;
+  EXPECT_EQ(total, completed.load());
+
+  // Only the busy site is ever turned away, the quiet ones are served in full
+  EXPECT_EQ(busy[1].load(), 0);
+  EXPECT_EQ(busy[2].load(), 0);
+  EXPECT_EQ(metrics.shed_, static_cast<uint64_t>(busy[0].load()));
+  EXPECT_GT(completed.load(), 2 * SESSIONS);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
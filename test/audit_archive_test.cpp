@@ -0,0 +1,296 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <glog/logging.h>
+
+#include <audit_archive.hpp>
+#include <bank.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  const std::string ARCHIVE_PATH = "/tmp/atm_audit_archive_test.archive";
+  const uint64_t START_NS = 1700000000000000000ull;
+
+  /**
+   * @brief Record n of a day of traffic, a second apart over 8 atms and 100 accounts
+   *
+   */
+  AuditRecord record(int n) {
+    AuditRecord record;
+    record.time_ns_ = START_NS + n * 1000000000ull;
+    record.atm_id_ = n % 8;
+    record.account_id_ = 1000 + n / 1000 * 10 + n % 10;
+    record.card_no_ = record.account_id_ * 7;
+    record.type_ = static_cast<TransactionType>(n % 3);
+    record.amount_ = record.type_ == CHECK_BALANCE ? 500 + n : n % 50 + 1;
+    record.ok_ = n % 11;
+    return record;
+  }
+
+  void writeArchive(int records, std::size_t block_records) {
+    std::remove(ARCHIVE_PATH.c_str());
+    AuditArchiveWriter writer(block_records);
+    ASSERT_TRUE(writer.open(ARCHIVE_PATH));
+    for (int n = 0; n < records; n++)
+      writer.append(record(n));
+    EXPECT_EQ(writer.records(), static_cast<uint64_t>(records));
+    ASSERT_TRUE(writer.close());
+  }
+}
+
+TEST(AuditArchiveTest, RecordsRoundTrip) {
+  writeArchive(2500, 1000);
+  AuditArchiveReader reader;
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  EXPECT_EQ(reader.blocks(), 3u);
+  EXPECT_EQ(reader.records(), 2500u);
+
+  int n = 0;
+  AuditScanStats stats = reader.scan(AuditQuery(), [&n](const AuditRecord &read) {
+    AuditRecord written = record(n++);
+    EXPECT_EQ(read.time_ns_, written.time_ns_);
+    EXPECT_EQ(read.atm_id_, written.atm_id_);
+    EXPECT_EQ(read.card_no_, written.card_no_);
+    EXPECT_EQ(read.account_id_, written.account_id_);
+    EXPECT_EQ(read.type_, written.type_);
+    EXPECT_EQ(read.amount_, written.amount_);
+    EXPECT_EQ(read.ok_, written.ok_);
+  });
+  EXPECT_EQ(n, 2500);
+  EXPECT_EQ(stats.records_matched_, 2500u);
+  std::remove(ARCHIVE_PATH.c_str());
+}
+
+TEST(AuditArchiveTest, BlocksAreSortedByTime) {
+  std::remove(ARCHIVE_PATH.c_str());
+  AuditArchiveWriter writer(4);
+  ASSERT_TRUE(writer.open(ARCHIVE_PATH));
+  for (int n : {3, 1, 2, 0, 5, 4})
+    writer.append(record(n));
+  ASSERT_TRUE(writer.close());
+
+  AuditArchiveReader reader;
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  std::vector<uint64_t> times;
+  reader.scan(AuditQuery(), [&times](const AuditRecord &read) { times.push_back(read.time_ns_); });
+  EXPECT_THAT(times, ElementsAre(record(0).time_ns_, record(1).time_ns_, record(2).time_ns_,
+        record(3).time_ns_, record(4).time_ns_, record(5).time_ns_));
+  std::remove(ARCHIVE_PATH.c_str());
+}
+
+TEST(AuditArchiveTest, QueriesSkipBlocksOutsideTheirRange) {
+  writeArchive(10000, 1000);
+  AuditArchiveReader reader;
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+
+  // Withdrawals of one account, only used in the fifth thousand records
+  AuditQuery query;
+  query.account_id_ = 1043;
+  query.type_ = WITHDRAW;
+  int matched = 0;
+  AuditScanStats stats = reader.scan(query, [&](const AuditRecord &read) {
+    EXPECT_EQ(read.account_id_, 1043);
+    EXPECT_EQ(read.type_, WITHDRAW);
+    matched++;
+  });
+  int expected = 0;
+  for (int n = 0; n < 10000; n++)
+    expected += record(n).account_id_ == 1043 && record(n).type_ == WITHDRAW;
+  EXPECT_GT(expected, 0);
+  EXPECT_EQ(matched, expected);
+  EXPECT_EQ(stats.blocks_, 10u);
+  EXPECT_EQ(stats.blocks_read_, 1u);
+  EXPECT_EQ(stats.records_scanned_, 1000u);
+
+  // The last hour of the traffic
+  AuditQuery recent;
+  recent.from_ns_ = record(10000 - 3600).time_ns_;
+  matched = 0;
+  stats = reader.scan(recent, [&matched](const AuditRecord&) { matched++; });
+  EXPECT_EQ(matched, 3600);
+  EXPECT_EQ(stats.blocks_read_, 4u);
+
+  // Failures only happen every 11th record, every block has some
+  AuditQuery failed;
+  failed.result_ = 0;
+  failed.to_ns_ = record(2000).time_ns_;
+  matched = 0;
+  stats = reader.scan(failed, [&matched](const AuditRecord &read) {
+    EXPECT_FALSE(read.ok_);
+    matched++;
+  });
+  EXPECT_EQ(matched, 182);
+  EXPECT_EQ(stats.blocks_read_, 2u);
+  std::remove(ARCHIVE_PATH.c_str());
+}
+
+TEST(AuditArchiveTest, TotalsByAtmCountOnlyMoneyThatMoved) {
+  writeArchive(5000, 512);
+  std::map<int, ActivityTotals> expected;
+  for (int n = 0; n < 5000; n++) {
+    AuditRecord written = record(n);
+    if (!written.ok_)
+      continue;
+    ActivityTotals &atm = expected[written.atm_id_];
+    if (written.type_ == DEPOSIT) {
+      atm.deposits_ += written.amount_;
+      atm.deposit_count_++;
+    } else if (written.type_ == WITHDRAW) {
+      atm.withdrawals_ += written.amount_;
+      atm.withdraw_count_++;
+    }
+  }
+
+  AuditArchiveReader reader;
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  std::map<int, ActivityTotals> totals;
+  AuditScanStats stats = reader.totalsByAtm(AuditQuery(), totals);
+  ASSERT_EQ(totals.size(), expected.size());
+  for (const auto &atm : expected) {
+    EXPECT_EQ(totals[atm.first].deposits_, atm.second.deposits_);
+    EXPECT_EQ(totals[atm.first].withdrawals_, atm.second.withdrawals_);
+    EXPECT_EQ(totals[atm.first].deposit_count_, atm.second.deposit_count_);
+    EXPECT_EQ(totals[atm.first].withdraw_count_, atm.second.withdraw_count_);
+  }
+
+  // Neither times, cards nor accounts are read
+  uint64_t all_bytes = reader.scan(AuditQuery(), [](const AuditRecord&) {}).bytes_read_;
+  EXPECT_LT(stats.bytes_read_, all_bytes / 2);
+  std::remove(ARCHIVE_PATH.c_str());
+}
+
+TEST(AuditArchiveTest, ArchivesAreReadableBeforeClose) {
+  std::remove(ARCHIVE_PATH.c_str());
+  AuditArchiveReader reader;
+  EXPECT_FALSE(reader.open("/tmp/atm_audit_archive_test.missing"));
+
+  AuditArchiveWriter writer(100);
+  ASSERT_TRUE(writer.open(ARCHIVE_PATH));
+  EXPECT_FALSE(writer.open(ARCHIVE_PATH));
+  for (int n = 0; n < 250; n++)
+    writer.append(record(n));
+  // Two blocks written, the last one still filling
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  EXPECT_EQ(reader.blocks(), 2u);
+  EXPECT_EQ(reader.records(), 200u);
+  ASSERT_TRUE(writer.close());
+  EXPECT_FALSE(writer.close());
+  writer.append(record(250));
+  EXPECT_EQ(writer.records(), 250u);
+
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  EXPECT_EQ(reader.records(), 250u);
+  std::remove(ARCHIVE_PATH.c_str());
+}
+
+TEST(AuditArchiveTest, ReopenedArchivesAreCarriedOn) {
+  writeArchive(250, 100);
+  // The last block cut short, as by a crash while writing it
+  std::ifstream in(ARCHIVE_PATH, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  {
+    std::ofstream out(ARCHIVE_PATH, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size() - 1);
+  }
+  AuditArchiveReader reader;
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  EXPECT_EQ(reader.records(), 200u);
+
+  AuditArchiveWriter writer(100);
+  ASSERT_TRUE(writer.open(ARCHIVE_PATH));
+  for (int n = 250; n < 400; n++)
+    writer.append(record(n));
+  ASSERT_TRUE(writer.close());
+
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  EXPECT_EQ(reader.blocks(), 4u);
+  std::vector<uint64_t> times;
+  reader.scan(AuditQuery(), [&times](const AuditRecord &read) { times.push_back(read.time_ns_); });
+  ASSERT_EQ(times.size(), 350u);
+  EXPECT_EQ(times[199], record(199).time_ns_);
+  EXPECT_EQ(times[200], record(250).time_ns_);
+  EXPECT_EQ(times.back(), record(399).time_ns_);
+
+  // Any other file is left alone
+  {
+    std::ofstream out(ARCHIVE_PATH, std::ios::binary | std::ios::trunc);
+    out << "not an archive";
+  }
+  AuditArchiveWriter other;
+  EXPECT_FALSE(other.open(ARCHIVE_PATH));
+  EXPECT_FALSE(reader.open(ARCHIVE_PATH));
+  std::remove(ARCHIVE_PATH.c_str());
+}
+
+class BankAuditArchiveTest : public Test {
+  public:
+  void TearDown() override {
+    Bank::getBank()->deleteBank();
+    unsetenv("ATM_AUDIT_ARCHIVE");
+    std::remove(ARCHIVE_PATH.c_str());
+  }
+};
+
+TEST_F(BankAuditArchiveTest, BankArchivesCompletedTransactions) {
+  setenv("ATM_AUDIT_ARCHIVE", ARCHIVE_PATH.c_str(), 1);
+  Bank *bank = Bank::getBank();
+  long card_no = bank->createAndLinkAccount("client", 100);
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->listAccounts(card_no, account_no));
+
+  auto transaction = [&](TransactionType trans_type, int amount, bool taken) {
+    int token = bank->verifyAndCreateTransaction(card_no, 8888, 42);
+    bank->acknowledgeTransaction(token, [taken](AtmOperationType, int, std::string&&) { return taken; });
+    bank->selectAccount(token, account_no[0]);
+    try {
+      bank->performTransaction(token, trans_type, amount);
+    } catch (std::exception&) {
+    }
+  };
+  transaction(DEPOSIT, 50, true);
+  transaction(WITHDRAW, 30, true);
+  transaction(WITHDRAW, 500, true);
+  transaction(DEPOSIT, 10, false);
+  transaction(CHECK_BALANCE, 0, true);
+  bank->deleteBank();
+
+  AuditArchiveReader reader;
+  ASSERT_TRUE(reader.open(ARCHIVE_PATH));
+  std::vector<AuditRecord> records;
+  reader.scan(AuditQuery(), [&records](const AuditRecord &read) { records.push_back(read); });
+  ASSERT_EQ(records.size(), 5u);
+  for (const auto &read : records) {
+    EXPECT_EQ(read.atm_id_, 42);
+    EXPECT_EQ(read.card_no_, card_no);
+    EXPECT_EQ(read.account_id_, account_no[0]);
+  }
+  EXPECT_EQ(records[0].type_, DEPOSIT);
+  EXPECT_TRUE(records[0].ok_);
+  EXPECT_EQ(records[1].type_, WITHDRAW);
+  EXPECT_EQ(records[1].amount_, 30);
+  EXPECT_TRUE(records[1].ok_);
+  EXPECT_EQ(records[2].amount_, 500);
+  EXPECT_FALSE(records[2].ok_);
+  EXPECT_EQ(records[3].type_, DEPOSIT);
+  EXPECT_FALSE(records[3].ok_);
+  EXPECT_EQ(records[4].type_, CHECK_BALANCE);
+  EXPECT_EQ(records[4].amount_, 120);
+
+  std::map<int, ActivityTotals> totals;
+  reader.totalsByAtm(AuditQuery(), totals);
+  EXPECT_EQ(totals[42].deposits_, 50);
+  EXPECT_EQ(totals[42].withdrawals_, 30);
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <bank_policies.hpp>
+#include <flat_hash_map.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(FlatHashMapTest, InsertFindErase) {
+  FlatHashMap<int, int> map;
+  for (int i = 0; i < 1000; i++)
+    EXPECT_TRUE(map.insert(std::make_pair(i, i * 2)).second);
+  EXPECT_FALSE(map.insert(std::make_pair(7, 0)).second);
+  EXPECT_EQ(map.size(), 1000u);
+
+  for (int i = 0; i < 1000; i += 2)
+    EXPECT_EQ(map.erase(i), 1u);
+  EXPECT_EQ(map.erase(0), 0u);
+  EXPECT_EQ(map.size(), 500u);
+
+  for (int i = 0; i < 1000; i++) {
+    FlatHashMap<int, int>::iterator it = map.find(i);
+    if (i % 2) {
+      ASSERT_NE(it, map.end());
+      EXPECT_EQ(it->second, i * 2);
+    } else {
+      EXPECT_EQ(it, map.end());
+    }
+  }
+
+  std::size_t count = 0;
+  for (const auto &element : map) {
+    EXPECT_EQ(element.first % 2, 1);
+    count++;
+  }
+  EXPECT_EQ(count, 500u);
+}
+
+template <typename Table>
+class TableTest : public Test {
+  public:
+  Table table;
+};
+
+using TableTypes = Types<
+  LockedTable<std::map<int, long>, NullMutex>,
+  LockedTable<FlatHashMap<int, long>, std::mutex>,
+  ShardedTable<std::map<int, long>, std::mutex, 4>,
+  ShardedTable<FlatHashMap<int, long>, std::mutex, 4>>;
+TYPED_TEST_SUITE(TableTest, TableTypes);
+
+TYPED_TEST(TableTest, Operations) {
+  long value;
+  this->table.add(1, 10);
+  this->table.add(2, 20);
+  EXPECT_THROW(this->table.add(1, 11), std::runtime_error);
+  EXPECT_TRUE(this->table.find(1, value));
+  EXPECT_EQ(value, 10);
+  EXPECT_TRUE(this->table.change(2, 21));
+  EXPECT_FALSE(this->table.change(3, 30));
+
+  int key;
+  EXPECT_TRUE(this->table.findIf([](const int&, const long &v) { return v == 21; }, key, value));
+  EXPECT_EQ(key, 2);
+
+  this->table.erase(1);
+  EXPECT_FALSE(this->table.find(1, value));
+  this->table.clear();
+  EXPECT_FALSE(this->table.find(2, value));
+}
+
+template <typename BankT>
+class PolicyBankTest : public Test {
+  public:
+  void TearDown() override {
+    BankT::getBank()->deleteBank();
+  }
+};
+
+using BankTypes = Types<
+  BasicBank<NoLockPolicy, OrderedStorage>,
+  BasicBank<NoLockPolicy, FlatHashStorage>,
+  BasicBank<ShardedLockPolicy<BANK_SHARDS>, FlatHashStorage>>;
+TYPED_TEST_SUITE(PolicyBankTest, BankTypes);
+
+TYPED_TEST(PolicyBankTest, DepositSession) {
+  TypeParam *bank = TypeParam::getBank();
+  long card_no = bank->createAndLinkAccount("someone", 1000);
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->privilegedOperation(HIDDEN_PASSCODE, "someone", account_no, card_no));
+
+  std::vector<AtmOperationType> ops;
+  atm_cb_t atm_cb = [&ops](AtmOperationType atm_op, int, std::string&&) {
+    ops.push_back(atm_op);
+    return true;
+  };
+  int token = bank->verifyAndCreateTransaction(card_no, 8888);
+  bank->acknowledgeTransaction(token, atm_cb);
+  bank->selectAccount(token, account_no[0]);
+  TransactionType trans_type = DEPOSIT;
+  bank->performTransaction(token, trans_type, 500);
+  EXPECT_THAT(ops, ElementsAre(SHOW_INPUT, SHOW_INPUT, TAKE));
+
+  EXPECT_THROW(bank->verifyAndCreateTransaction(card_no, 1111), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
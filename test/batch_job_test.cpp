@@ -0,0 +1,278 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <batch_job.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  const std::string CHECKPOINT_PATH = "/tmp/atm_batch_job_test.checkpoint";
+
+  int interest(long, int balance) { return balance / 100; }
+
+  void fillTable(AccountTable &table, std::size_t accounts, int amount) {
+    for (std::size_t i = 0; i < accounts; i++)
+      table.create(i, "someone", amount);
+  }
+}
+
+TEST(BatchJobTest, AdjustsAnAccountOncePerJob) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 1000);
+  int amount;
+  EXPECT_TRUE(table.adjust(index, 1, interest, amount));
+  EXPECT_EQ(amount, 10);
+  EXPECT_FALSE(table.adjust(index, 1, interest, amount));
+  EXPECT_EQ(amount, 0);
+  EXPECT_EQ(table.balance(index), 1010);
+  EXPECT_EQ(table.lastJob(index), 1u);
+
+  EXPECT_TRUE(table.adjust(index, 3, interest, amount));
+  EXPECT_FALSE(table.adjust(index, 2, interest, amount));
+  EXPECT_EQ(table.balance(index), 1020);
+}
+
+TEST(BatchJobTest, FeesLeaveHeldFundsAlone) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  ASSERT_TRUE(table.reserve(index, 60));
+  int amount;
+  EXPECT_TRUE(table.adjust(index, 1, [](long, int) { return -70; }, amount));
+  EXPECT_EQ(amount, -40);
+  EXPECT_EQ(table.balance(index), 60);
+  table.settle(index, 60);
+  EXPECT_EQ(table.balance(index), 0);
+}
+
+TEST(BatchJobTest, AdjustsEveryAccountInChunks) {
+  AccountTable table;
+  SnapshotEpoch epoch;
+  fillTable(table, 1000, 1000);
+  std::atomic<int> adjusted(0);
+  BatchJobConfig config;
+  config.threads_ = 3;
+  config.chunk_size_ = 64;
+  BatchJob job(table, epoch, nullptr, [&](account_index_t) { adjusted++; }, config, interest);
+  job.start();
+  ASSERT_TRUE(job.wait());
+
+  for (account_index_t i = 0; i < 1000; i++)
+    EXPECT_EQ(table.balance(i), 1010);
+  BatchProgress progress = job.progress();
+  EXPECT_TRUE(progress.done_);
+  EXPECT_EQ(progress.applied_, 1000u);
+  EXPECT_EQ(progress.skipped_, 0u);
+  EXPECT_EQ(progress.amount_, 10000);
+  EXPECT_EQ(progress.next_index_, 1000u);
+  EXPECT_EQ(adjusted.load(), 1000);
+}
+
+TEST(BatchJobTest, ResumesFromTheCheckpoint) {
+  AccountTable table;
+  SnapshotEpoch epoch;
+  fillTable(table, 1000, 1000);
+  {
+    std::ofstream file(CHECKPOINT_PATH, std::ios::trunc);
+    file << "7 512 0\n";
+  }
+  // Accounts past the checkpoint done before the job went down
+  int amount;
+  for (account_index_t i = 512; i < 600; i++)
+    ASSERT_TRUE(table.adjust(i, 7, interest, amount));
+
+  BatchJobConfig config;
+  config.job_id_ = 7;
+  config.chunk_size_ = 128;
+  config.checkpoint_path_ = CHECKPOINT_PATH;
+  BatchJob job(table, epoch, nullptr, nullptr, config, interest);
+  job.start();
+  ASSERT_TRUE(job.wait());
+
+  EXPECT_EQ(table.balance(0), 1000);
+  for (account_index_t i = 512; i < 1000; i++)
+    EXPECT_EQ(table.balance(i), 1010);
+  BatchProgress progress = job.progress();
+  EXPECT_EQ(progress.applied_, 400u);
+  EXPECT_EQ(progress.skipped_, 88u);
+
+  uint64_t job_id;
+  std::size_t next_index;
+  bool done;
+  ASSERT_TRUE(BatchJob::readCheckpoint(CHECKPOINT_PATH, job_id, next_index, done));
+  EXPECT_EQ(job_id, 7u);
+  EXPECT_EQ(next_index, 1000u);
+  EXPECT_TRUE(done);
+
+  BatchJob again(table, epoch, nullptr, nullptr, config, interest);
+  again.start();
+  EXPECT_TRUE(again.wait());
+  EXPECT_EQ(again.progress().applied_, 0u);
+  std::remove(CHECKPOINT_PATH.c_str());
+}
+
+TEST(BatchJobTest, StoppedJobGoesOnWhereItLeftOff) {
+  AccountTable table;
+  SnapshotEpoch epoch;
+  fillTable(table, 1000, 1000);
+  std::atomic<int> adjusted(0);
+  BatchJobConfig config;
+  config.chunk_size_ = 10;
+  config.pause_ = std::chrono::milliseconds(1);
+  BatchJob job(table, epoch, nullptr, [&](account_index_t) { adjusted++; }, config, interest);
+  job.start();
+  while (adjusted.load() < 25)
+    std::this_thread::yield();
+  job.stop();
+  EXPECT_FALSE(job.wait());
+  BatchProgress progress = job.progress();
+  EXPECT_FALSE(progress.done_);
+  EXPECT_LT(progress.next_index_, 1000u);
+
+  job.start();
+  ASSERT_TRUE(job.wait());
+  for (account_index_t i = 0; i < 1000; i++)
+    EXPECT_EQ(table.balance(i), 1010);
+  EXPECT_EQ(job.progress().applied_, 1000u);
+}
+
+TEST(LatencyWindowTest, PercentileOfRecentSamples) {
+  LatencyWindow window(128);
+  EXPECT_FALSE(window.active());
+  for (int i = 1; i <= 100; i++)
+    window.record(std::chrono::microseconds(i));
+  EXPECT_EQ(window.percentile(0.99, std::chrono::seconds(1)), std::chrono::microseconds(100));
+  EXPECT_EQ(window.percentile(0.5, std::chrono::seconds(1)), std::chrono::microseconds(51));
+  EXPECT_EQ(window.percentile(0.99, std::chrono::seconds(1), 101), LatencyWindow::clock_t::duration::zero());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(window.percentile(0.99, std::chrono::milliseconds(5)), LatencyWindow::clock_t::duration::zero());
+}
+
+TEST(LatencyWindowTest, ScopeRecordsOnlyWhileWatched) {
+  LatencyWindow window;
+  { LatencyWindow::Scope scope(window); }
+  EXPECT_EQ(window.percentile(0.5, std::chrono::seconds(1)), LatencyWindow::clock_t::duration::zero());
+
+  window.watch();
+  {
+    LatencyWindow::Scope scope(window);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  window.unwatch();
+  EXPECT_FALSE(window.active());
+  EXPECT_GE(window.percentile(0.5, std::chrono::seconds(1)), std::chrono::milliseconds(2));
+}
+
+TEST(BatchJobTest, BacksOffOverTheLatencyBudget) {
+  AccountTable table;
+  SnapshotEpoch epoch;
+  LatencyWindow latency;
+  fillTable(table, 100, 1000);
+  for (int i = 0; i < 100; i++)
+    latency.record(std::chrono::milliseconds(5));
+
+  BatchJobConfig config;
+  config.chunk_size_ = 10;
+  config.latency_budget_ = std::chrono::milliseconds(1);
+  config.max_pause_ = std::chrono::milliseconds(2);
+  BatchJob job(table, epoch, &latency, nullptr, config, interest);
+  job.start();
+  EXPECT_TRUE(latency.active());
+  ASSERT_TRUE(job.wait());
+  EXPECT_FALSE(latency.active());
+
+  BatchProgress progress = job.progress();
+  EXPECT_GT(progress.throttled_, 0u);
+  EXPECT_GT(progress.pause_.count(), 0);
+  EXPECT_LE(progress.pause_, std::chrono::milliseconds(2));
+}
+
+#ifndef ATM_SINGLE_THREADED
+class BankBatchJobTest : public Test {
+  public:
+  void TearDown() override {
+    Bank::getBank()->deleteBank();
+  }
+
+  int64_t balance() {
+    int64_t total = 0;
+    for (auto balance : Bank::getBank()->snapshotBalances().balances_)
+      total += balance;
+    return total;
+  }
+};
+
+TEST_F(BankBatchJobTest, FeesRunAlongsideTransactions) {
+  Bank *bank = Bank::getBank();
+  // A card per atm, the account selected is kept on the card
+  std::vector<long> cards;
+  while (cards.size() < 4)
+    cards.push_back(bank->createAndLinkAccount("client", 1000));
+  std::vector<std::vector<long>> account_no(cards.size());
+  for (std::size_t c = 0; c < cards.size(); c++) {
+    for (int i = 1; i < 10; i++)
+      bank->createAndLinkAccount("client", 1000, cards[c]);
+    ASSERT_TRUE(bank->listAccounts(cards[c], account_no[c]));
+    ASSERT_EQ(account_no[c].size(), 10u);
+  }
+  int64_t before = balance();
+
+  std::atomic<bool> running(true);
+  std::atomic<int64_t> moved(0);
+  std::vector<std::thread> atms;
+  for (int t = 0; t < 4; t++) {
+    atms.emplace_back([&, t]() {
+      for (int n = 0; running.load(); n++) {
+        int amount = 0;
+        try {
+          int token = bank->verifyAndCreateTransaction(cards[t], 8888, t);
+          bank->acknowledgeTransaction(token, [&amount](AtmOperationType atm_op, int info, std::string&&) {
+            if (atm_op == TAKE)
+              amount = info;
+            if (atm_op == GIVE)
+              amount = -info;
+            return true;
+          });
+          bank->selectAccount(token, account_no[t][n % 10]);
+          TransactionType trans_type = n % 2 ? WITHDRAW : DEPOSIT;
+          bank->performTransaction(token, trans_type, 7);
+        } catch (std::exception&) {
+        }
+        moved += amount;
+      }
+    });
+  }
+
+  BatchJobConfig config;
+  config.threads_ = 2;
+  config.chunk_size_ = 4;
+  config.latency_budget_ = std::chrono::milliseconds(10);
+  std::unique_ptr<BatchJob> job = bank->startBatchJob(config, [](long, int) { return -3; });
+  bool done = job->wait();
+  running = false;
+  for (auto &atm : atms)
+    atm.join();
+  ASSERT_TRUE(done);
+
+  BatchProgress progress = job->progress();
+  EXPECT_EQ(progress.applied_, 40u);
+  EXPECT_EQ(progress.amount_, -120);
+  EXPECT_EQ(balance(), before + moved.load() - 3 * 40);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,410 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <holds.hpp>
+#include <reconciliation.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(AccountHoldTest, HeldFundsAreNotAvailable) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  EXPECT_TRUE(table.reserve(index, 60));
+  EXPECT_FALSE(table.reserve(index, 50));
+  EXPECT_EQ(table.held(index), 60);
+  EXPECT_EQ(table.balance(index), 100);
+
+  int amount = 50;
+  EXPECT_FALSE(table.performTransaction(index, WITHDRAW, amount));
+  amount = 40;
+  EXPECT_TRUE(table.performTransaction(index, WITHDRAW, amount));
+
+  table.settle(index, 60);
+  EXPECT_EQ(table.held(index), 0);
+  EXPECT_EQ(table.balance(index), 0);
+
+  amount = 30;
+  table.performTransaction(index, DEPOSIT, amount);
+  EXPECT_TRUE(table.reserve(index, 30));
+  table.unreserve(index, 30);
+  EXPECT_EQ(table.held(index), 0);
+  EXPECT_EQ(table.balance(index), 30);
+}
+
+TEST(AccountHoldTest, TransactionsRespectHolds) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  AccountTransaction txn(table);
+  EXPECT_EQ(txn.available(index), 100);
+  txn.add(index, -80);
+  ASSERT_TRUE(table.reserve(index, 50));
+  EXPECT_FALSE(txn.commit());
+  EXPECT_EQ(table.balance(index), 100);
+}
+
+TEST(AccountHoldTest, TransactionsPlaceHolds) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  AccountTransaction txn(table);
+  txn.hold(index, 70);
+  EXPECT_EQ(txn.read(index), 30);
+  EXPECT_EQ(txn.available(index), 30);
+  ASSERT_TRUE(txn.commit());
+  EXPECT_EQ(table.held(index), 70);
+  EXPECT_EQ(table.balance(index), 100);
+  EXPECT_FALSE(table.reserve(index, 40));
+
+  AccountTransaction short_txn(table);
+  short_txn.hold(index, 40);
+  EXPECT_FALSE(short_txn.commit());
+  EXPECT_EQ(table.held(index), 70);
+}
+
+TEST(HoldTableTest, SettleReleaseAndExpire) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  HoldTable holds(table, 4, std::chrono::milliseconds(50));
+
+  uint64_t settled, released, expired;
+  ASSERT_TRUE(holds.authorize(index, 30, settled));
+  ASSERT_TRUE(holds.authorize(index, 20, released));
+  ASSERT_TRUE(holds.authorize(index, 50, expired));
+  uint64_t declined;
+  EXPECT_FALSE(holds.authorize(index, 1, declined));
+  EXPECT_EQ(holds.metrics().active_, 3u);
+
+  EXPECT_TRUE(holds.settle(settled));
+  EXPECT_FALSE(holds.settle(settled));
+  EXPECT_TRUE(holds.release(released));
+  EXPECT_FALSE(holds.settle(released));
+  EXPECT_EQ(table.balance(index), 70);
+  EXPECT_EQ(table.held(index), 50);
+
+  EXPECT_EQ(holds.expire(HoldTable::clock_t::now() + std::chrono::milliseconds(100)), 1u);
+  EXPECT_FALSE(holds.settle(expired));
+  EXPECT_EQ(table.held(index), 0);
+  EXPECT_EQ(table.balance(index), 70);
+
+  HoldMetrics metrics = holds.metrics();
+  EXPECT_EQ(metrics.active_, 0u);
+  EXPECT_EQ(metrics.authorized_, 3u);
+  EXPECT_EQ(metrics.declined_, 1u);
+  EXPECT_EQ(metrics.settled_, 1u);
+  EXPECT_EQ(metrics.released_, 1u);
+  EXPECT_EQ(metrics.expired_, 1u);
+}
+
+TEST(HoldTableTest, AuthorizeExpiresLapsedHolds) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  HoldTable holds(table, 1, std::chrono::milliseconds(10));
+
+  uint64_t lapsed, fresh;
+  ASSERT_TRUE(holds.authorize(index, 100, lapsed));
+  EXPECT_FALSE(holds.authorize(index, 100, fresh));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  // Both the funds and the only hold slot come back on their own
+  ASSERT_TRUE(holds.authorize(index, 100, fresh));
+  EXPECT_NE(fresh, lapsed);
+  EXPECT_FALSE(holds.release(lapsed));
+  EXPECT_TRUE(holds.settle(fresh));
+  EXPECT_EQ(table.balance(index), 0);
+}
+
+TEST(HoldTableTest, PinnedHoldsOutliveTheirTtl) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  HoldTable holds(table, 2, std::chrono::milliseconds(10));
+
+  uint64_t pinned, adopted;
+  ASSERT_TRUE(holds.authorize(index, 30, pinned, true));
+  ASSERT_TRUE(holds.authorize(index, 0, adopted, true));
+  ASSERT_TRUE(table.reserve(index, 50));
+  EXPECT_TRUE(holds.adopt(adopted, 50));
+  EXPECT_EQ(holds.expire(HoldTable::clock_t::now() + std::chrono::seconds(1)), 0u);
+
+  EXPECT_TRUE(holds.settle(pinned));
+  EXPECT_TRUE(holds.release(adopted));
+  EXPECT_FALSE(holds.adopt(adopted, 1));
+  EXPECT_EQ(table.balance(index), 70);
+  EXPECT_EQ(table.held(index), 0);
+}
+
+TEST(HoldTableTest, ConcurrentHoldsNeverOvercommit) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 1000);
+  HoldTable holds(table, 4096, std::chrono::seconds(60));
+
+  std::atomic<int> granted(0), settled(0), withdrawn(0);
+  std::vector<std::thread> atms;
+  for (int t = 0; t < 4; t++) {
+    atms.emplace_back([&, t]() {
+      for (int i = 0; i < 500; i++) {
+        uint64_t hold_id;
+        if (holds.authorize(index, 1, hold_id)) {
+          granted++;
+          // Every other hold is settled, the rest stay open
+          if (i % 2 && holds.settle(hold_id))
+            settled++;
+        }
+        int amount = 1;
+        if (t == 0 && i % 10 == 0 && table.performTransaction(index, WITHDRAW, amount))
+          withdrawn++;
+      }
+    });
+  }
+  for (auto &atm : atms)
+    atm.join();
+
+  std::size_t active = holds.metrics().active_;
+  EXPECT_EQ(granted.load(), settled.load() + static_cast<int>(active));
+  EXPECT_EQ(table.held(index), static_cast<int>(active));
+  EXPECT_EQ(table.balance(index), 1000 - settled.load() - withdrawn.load());
+  EXPECT_GE(table.balance(index) - table.held(index), 0);
+}
+
+TEST(HoldTableTest, HoldScopeReleasesWhatIsLeft) {
+  AccountTable table;
+  account_index_t index = table.create(1, "someone", 100);
+  HoldTable holds(table, 4, std::chrono::milliseconds(10));
+
+  try {
+    HoldScope scope(holds, 3);
+    ASSERT_TRUE(holds.authorize(index, 10, scope[0], true));
+    ASSERT_TRUE(holds.authorize(index, 20, scope[1], true));
+    ASSERT_TRUE(holds.authorize(index, 30, scope[2], true));
+    EXPECT_TRUE(scope.settle(0));
+    EXPECT_TRUE(scope.release(1));
+    EXPECT_FALSE(scope.release(1));
+    throw std::runtime_error("atm went away");
+  } catch (const std::runtime_error&) {
+  }
+
+  EXPECT_EQ(table.balance(index), 90);
+  EXPECT_EQ(table.held(index), 0);
+  HoldMetrics metrics = holds.metrics();
+  EXPECT_EQ(metrics.active_, 0u);
+  EXPECT_EQ(metrics.settled_, 1u);
+  EXPECT_EQ(metrics.released_, 2u);
+}
+
+class BankHoldTest : public Test {
+  public:
+  void SetUp() override {
+    Bank *bank = Bank::getBank();
+    card_no_ = bank->createAndLinkAccount("someone", 1000);
+    ASSERT_TRUE(bank->listAccounts(card_no_, account_no_));
+  }
+
+  void TearDown() override {
+    Bank::getBank()->deleteBank();
+  }
+
+  /**
+   * @brief Withdraw in a session, the atm answering dispense with a callable
+   */
+  void withdraw(int amount, std::function<bool()> dispense) {
+    Bank *bank = Bank::getBank();
+    int token = bank->verifyAndCreateTransaction(card_no_, 8888, 2);
+    bank->acknowledgeTransaction(token, [dispense](AtmOperationType atm_op, int, std::string&&) {
+      return atm_op == GIVE ? dispense() : true;
+    });
+    bank->selectAccount(token, account_no_[0]);
+    TransactionType trans_type = WITHDRAW;
+    bank->performTransaction(token, trans_type, amount);
+  }
+
+  int balance() {
+    int64_t total = 0;
+    for (auto balance : Bank::getBank()->snapshotBalances().balances_)
+      total += balance;
+    return total;
+  }
+
+  long card_no_;
+  std::vector<long> account_no_;
+};
+
+TEST_F(BankHoldTest, FundsAreHeldWhileDispensing) {
+  Bank *bank = Bank::getBank();
+  int during = -1;
+  withdraw(300, [&]() {
+    during = balance();
+    EXPECT_EQ(bank->holdMetrics().active_, 1u);
+    return true;
+  });
+  EXPECT_EQ(during, 1000);
+  EXPECT_EQ(balance(), 700);
+
+  HoldMetrics metrics = bank->holdMetrics();
+  EXPECT_EQ(metrics.settled_, 1u);
+  EXPECT_EQ(metrics.active_, 0u);
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.activity_.withdrawals_, 300);
+  EXPECT_EQ(report.activity_.withdraw_count_, 1);
+}
+
+TEST_F(BankHoldTest, SessionWithdrawIsHeldWhileDispensing) {
+  Bank *bank = Bank::getBank();
+  int during = -1;
+  bool dispense = true;
+  auto atm_cb = [&](AtmOperationType atm_op, int, std::string&&) {
+    if (atm_op != GIVE)
+      return true;
+    during = balance();
+    EXPECT_EQ(bank->holdMetrics().active_, 1u);
+    return dispense;
+  };
+
+  int token = bank->verifyAndCreateTransaction(card_no_, 8888, 2);
+  bank->acknowledgeTransaction(token, atm_cb);
+  EXPECT_TRUE(bank->performSession(token, {{SESSION_DEPOSIT, account_no_[0], 100, -1},
+        {SESSION_WITHDRAW, account_no_[0], 300, -1}}));
+  EXPECT_EQ(during, 1100);
+  EXPECT_EQ(balance(), 800);
+
+  dispense = false;
+  token = bank->verifyAndCreateTransaction(card_no_, 8888, 2);
+  bank->acknowledgeTransaction(token, atm_cb);
+  EXPECT_TRUE(bank->performSession(token, {{SESSION_WITHDRAW, account_no_[0], 500, -1}}));
+  EXPECT_EQ(balance(), 800);
+
+  HoldMetrics metrics = bank->holdMetrics();
+  EXPECT_EQ(metrics.settled_, 1u);
+  EXPECT_EQ(metrics.released_, 1u);
+  EXPECT_EQ(metrics.active_, 0u);
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.activity_.withdrawals_, 300);
+  EXPECT_EQ(report.activity_.withdraw_count_, 1);
+}
+
+TEST_F(BankHoldTest, FailedDispenseOnlyReleasesTheHold) {
+  Bank *bank = Bank::getBank();
+  withdraw(300, []() { return false; });
+  EXPECT_EQ(balance(), 1000);
+
+  HoldMetrics metrics = bank->holdMetrics();
+  EXPECT_EQ(metrics.released_, 1u);
+  EXPECT_EQ(metrics.settled_, 0u);
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.activity_.withdraw_count_, 0);
+  EXPECT_EQ(report.activity_.withdrawals_, 0);
+}
+
+TEST_F(BankHoldTest, HeldFundsCanNotBeWithdrawnTwice) {
+  Bank *bank = Bank::getBank();
+  bool nested = true;
+  withdraw(700, [&]() {
+    // A second card session on the account while the first one dispenses
+    int token = bank->verifyAndCreateTransaction(card_no_, 8888, 3);
+    bank->acknowledgeTransaction(token, [&nested](AtmOperationType atm_op, int, std::string&&) {
+      if (atm_op == GIVE)
+        nested = true;
+      if (atm_op == SHOW_ERROR)
+        nested = false;
+      return true;
+    });
+    std::vector<SessionOperation> operations = {{SESSION_WITHDRAW, account_no_[0], 400, -1}};
+    EXPECT_FALSE(bank->performSession(token, operations));
+    return true;
+  });
+  EXPECT_FALSE(nested);
+  EXPECT_EQ(balance(), 300);
+  EXPECT_EQ(bank->holdMetrics().active_, 0u);
+}
+
+TEST_F(BankHoldTest, ThrowingAtmReleasesHoldsAndSession) {
+  Bank *bank = Bank::getBank();
+  bank->configureAdmission(1, 1, std::chrono::milliseconds(0));
+  EXPECT_THROW(withdraw(300, []() -> bool { throw std::runtime_error("jammed"); }),
+      std::runtime_error);
+  EXPECT_EQ(bank->holdMetrics().active_, 0u);
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+  EXPECT_EQ(balance(), 1000);
+
+  auto atm_cb = [](AtmOperationType atm_op, int, std::string&&) -> bool {
+    if (atm_op == GIVE)
+      throw std::runtime_error("jammed");
+    return true;
+  };
+  int token = bank->verifyAndCreateTransaction(card_no_, 8888, 2);
+  bank->acknowledgeTransaction(token, atm_cb);
+  EXPECT_THROW(bank->performSession(token, {{SESSION_DEPOSIT, account_no_[0], 100, -1},
+        {SESSION_WITHDRAW, account_no_[0], 500, -1}}), std::runtime_error);
+  EXPECT_EQ(bank->holdMetrics().active_, 0u);
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+  // The deposit was taken and credited before the dispense failed
+  EXPECT_EQ(balance(), 1100);
+}
+
+TEST_F(BankHoldTest, RefusedTakeCreditsNothing) {
+  Bank *bank = Bank::getBank();
+  auto atm_cb = [](AtmOperationType atm_op, int, std::string&&) { return atm_op != TAKE; };
+  int token = bank->verifyAndCreateTransaction(card_no_, 8888, 2);
+  bank->acknowledgeTransaction(token, atm_cb);
+  bank->selectAccount(token, account_no_[0]);
+  TransactionType trans_type = DEPOSIT;
+  bank->performTransaction(token, trans_type, 300);
+  EXPECT_EQ(balance(), 1000);
+
+  token = bank->verifyAndCreateTransaction(card_no_, 8888, 2);
+  bank->acknowledgeTransaction(token, atm_cb);
+  EXPECT_TRUE(bank->performSession(token, {{SESSION_DEPOSIT, account_no_[0], 300, -1}}));
+  EXPECT_EQ(balance(), 1000);
+
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.activity_.deposits_, 0);
+  EXPECT_EQ(report.activity_.deposit_count_, 0);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST_F(BankHoldTest, SlowDispenseUnderLoadKeepsTheBooks) {
+  Bank *bank = Bank::getBank();
+  std::atomic<int> dispensed(0), refused(0);
+  std::vector<std::thread> atms;
+  for (int t = 0; t < 4; t++) {
+    atms.emplace_back([&, t]() {
+      for (int n = 0; n < 20; n++) {
+        try {
+          withdraw(20, [&, t, n]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            if ((t + n) % 3 == 0) {
+              refused++;
+              return false;
+            }
+            dispensed++;
+            return true;
+          });
+        } catch (std::exception&) {
+        }
+      }
+    });
+  }
+  for (auto &atm : atms)
+    atm.join();
+
+  EXPECT_EQ(balance(), 1000 - 20 * dispensed.load());
+  HoldMetrics metrics = bank->holdMetrics();
+  EXPECT_EQ(metrics.settled_, static_cast<uint64_t>(dispensed.load()));
+  EXPECT_EQ(metrics.released_, static_cast<uint64_t>(refused.load()));
+  EXPECT_EQ(metrics.active_, 0u);
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.total_balance_, 1000 - report.activity_.withdrawals_);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
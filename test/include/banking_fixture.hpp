@@ -23,8 +23,9 @@ class AtmControllerMock : AtmController {
     this->selectAccount(account_no);
   }
 
-  void callPerformTransaction(TransactionType trans_type, int amount = 0) {
-    this->performTransaction(trans_type, amount);
+  void callPerformTransaction(TransactionType trans_type, int amount = 0,
+      uint64_t request_id = 0) {
+    this->performTransaction(trans_type, amount, request_id);
   }
 
   MOCK_METHOD(bool, controllerDisplay, (AtmOperationType, int, std::string&&));
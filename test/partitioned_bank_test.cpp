@@ -0,0 +1,229 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <partitioned_bank.hpp>
+#include <spsc_ring.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(SpscRingTest, FifoAndBounded) {
+  SpscRing<int> ring(3);
+  EXPECT_EQ(ring.capacity(), 4u);
+  for (int i = 0; i < 4; i++)
+    EXPECT_TRUE(ring.tryPush(i));
+  int value = 4;
+  EXPECT_FALSE(ring.tryPush(value));
+
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(ring.tryPop(value));
+  value = 5;
+  EXPECT_TRUE(ring.tryPush(value));
+  ASSERT_TRUE(ring.tryPop(value));
+  EXPECT_EQ(value, 5);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST(SpscRingTest, ProducerAndConsumerThreads) {
+  SpscRing<long> ring(64);
+  const long count = 200000;
+  std::thread producer([&ring, count]() {
+    for (long i = 0; i < count; i++) {
+      long value = i;
+      while (!ring.tryPush(value))
+        std::this_thread::yield();
+    }
+  });
+
+  long expected = 0;
+  while (expected < count) {
+    long value;
+    if (!ring.tryPop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(value, expected);
+    expected++;
+  }
+  producer.join();
+}
+
+namespace {
+  /**
+   * struct Shown - A callback made to the atm during a session
+   */
+  struct Shown {
+    AtmOperationType atm_op_;
+    int info_;
+
+    bool operator==(const Shown &other) const {
+      return atm_op_ == other.atm_op_ && info_ == other.info_;
+    }
+  };
+}
+
+class PartitionedBankTest : public Test {
+  public:
+  PartitionedBankTest() : bank_(3, 8, false), port_(bank_.connect()) {}
+
+  /**
+   * @brief Run a session to completion, recording what the atm is shown
+   *        past the account listing
+   */
+  std::vector<Shown> transact(AtmPort &port, long card_no, long account_no,
+      TransactionType trans_type, int amount, bool carry_out = true) {
+    std::vector<Shown> shown;
+    int token = port.verifyAndCreateTransaction(card_no, 8888);
+    port.acknowledgeTransaction(token, [&shown, carry_out](AtmOperationType atm_op, int info,
+          std::string&&) {
+      if (atm_op != SHOW_INPUT)
+        shown.push_back(Shown{atm_op, info});
+      return atm_op == GIVE || atm_op == TAKE ? carry_out : true;
+    });
+    port.selectAccount(token, account_no);
+    port.performTransaction(token, trans_type, amount);
+    return shown;
+  }
+
+  int balance(long card_no, long account_no) {
+    std::vector<Shown> shown = transact(*port_, card_no, account_no, CHECK_BALANCE, 0);
+    return shown.size() == 1 && shown[0].atm_op_ == SHOW ? shown[0].info_ : -1;
+  }
+
+  PartitionedBank bank_;
+  std::unique_ptr<AtmPort> port_;
+};
+
+TEST_F(PartitionedBankTest, CardsAndSessionsStayWithTheirWorker) {
+  std::vector<long> cards;
+  for (int i = 0; i < 6; i++)
+    cards.push_back(port_->createAndLinkAccount("someone", 100));
+  for (int i = 0; i < 6; i++)
+    EXPECT_EQ(cards[i] % 3, (cards[0] + i) % 3);
+
+  EXPECT_EQ(port_->createAndLinkAccount("someone", 50, cards[1]), cards[1]);
+  EXPECT_THROW(port_->createAndLinkAccount("someone", 50, 1000), std::runtime_error);
+  std::vector<long> account_no;
+  ASSERT_TRUE(port_->listAccounts(cards[1], account_no));
+  ASSERT_EQ(account_no.size(), 2u);
+  EXPECT_EQ(account_no[0] % 3, cards[1] % 3);
+  EXPECT_EQ(account_no[1] % 3, cards[1] % 3);
+  EXPECT_FALSE(port_->listAccounts(1000, account_no));
+
+  EXPECT_THROW(port_->verifyAndCreateTransaction(cards[1], 1234), std::runtime_error);
+  int token = port_->verifyAndCreateTransaction(cards[1], 8888);
+  EXPECT_EQ(token % 3, cards[1] % 3);
+  std::vector<AtmOperationType> shown;
+  port_->acknowledgeTransaction(token, [&shown](AtmOperationType atm_op, int info, std::string&&) {
+    shown.push_back(atm_op);
+    EXPECT_EQ(info, atm_op == SHOW_INPUT ? (shown.size() == 1 ? 2 : 1) : -1);
+    return true;
+  });
+  port_->selectAccount(token, account_no[0] + 1);
+  EXPECT_THAT(shown, ElementsAre(SHOW_INPUT, SHOW_ERROR));
+}
+
+TEST_F(PartitionedBankTest, SessionsBehaveLikeTheBank) {
+  long card_no = port_->createAndLinkAccount("someone", 1000);
+  std::vector<long> account_no;
+  port_->listAccounts(card_no, account_no);
+  long account = account_no[0];
+
+  EXPECT_THAT(transact(*port_, card_no, account, DEPOSIT, 100), ElementsAre(Shown{TAKE, 100}));
+  EXPECT_THAT(transact(*port_, card_no, account, WITHDRAW, 300), ElementsAre(Shown{GIVE, 300}));
+  EXPECT_EQ(balance(card_no, account), 800);
+
+  // Whatever the atm could not carry out is given back
+  transact(*port_, card_no, account, DEPOSIT, 100, false);
+  transact(*port_, card_no, account, WITHDRAW, 300, false);
+  EXPECT_EQ(balance(card_no, account), 800);
+
+  EXPECT_THAT(transact(*port_, card_no, account, WITHDRAW, 900), ElementsAre(Shown{SHOW_ERROR, -1}));
+  EXPECT_EQ(balance(card_no, account), 800);
+}
+
+TEST_F(PartitionedBankTest, HeldSessionCanNotSwitchAccounts) {
+  long card_no = port_->createAndLinkAccount("someone", 1000);
+  port_->createAndLinkAccount("someone", 50, card_no);
+  std::vector<long> account_no;
+  ASSERT_TRUE(port_->listAccounts(card_no, account_no));
+  ASSERT_EQ(account_no.size(), 2u);
+
+  // Switching while the atm dispenses would settle the hold on the other account
+  std::vector<AtmOperationType> shown;
+  int token = port_->verifyAndCreateTransaction(card_no, 8888);
+  port_->acknowledgeTransaction(token, [&](AtmOperationType atm_op, int, std::string&&) {
+    shown.push_back(atm_op);
+    if (atm_op == GIVE)
+      port_->selectAccount(token, account_no[1]);
+    return true;
+  });
+  port_->selectAccount(token, account_no[0]);
+  port_->performTransaction(token, WITHDRAW, 300);
+  EXPECT_THAT(shown, ElementsAre(SHOW_INPUT, SHOW_INPUT, GIVE, SHOW_ERROR));
+  EXPECT_EQ(balance(card_no, account_no[1]), 50);
+}
+
+TEST_F(PartitionedBankTest, PostedRequestsAreCarriedOutBeforeThePortCloses) {
+  long card_no = port_->createAndLinkAccount("someone", 1000);
+  std::vector<long> account_no;
+  port_->listAccounts(card_no, account_no);
+
+  // More settles and session ends than the rings hold, none waited on
+  std::unique_ptr<AtmPort> port = bank_.connect();
+  for (std::size_t i = 0; i < PartitionedBank::RING_CAPACITY; i++)
+    transact(*port, card_no, account_no[0], WITHDRAW, 1);
+  port.reset();
+  EXPECT_EQ(balance(card_no, account_no[0]), 1000 - static_cast<int>(PartitionedBank::RING_CAPACITY));
+}
+
+TEST_F(PartitionedBankTest, ConcurrentAtmsKeepTheBooks) {
+  long shared_card = port_->createAndLinkAccount("shared", 1000);
+  std::vector<long> shared_account;
+  port_->listAccounts(shared_card, shared_account);
+
+  std::atomic<int> withdrawn(0);
+  std::vector<std::pair<long, long>> own(4);
+  std::vector<std::thread> atms;
+  for (int t = 0; t < 4; t++) {
+    atms.emplace_back([&, t]() {
+      std::unique_ptr<AtmPort> port = bank_.connect();
+      own[t].first = port->createAndLinkAccount("atm" + std::to_string(t), 1000);
+      std::vector<long> account_no;
+      port->listAccounts(own[t].first, account_no);
+      own[t].second = account_no[0];
+      for (int i = 0; i < 200; i++) {
+        transact(*port, own[t].first, own[t].second, i % 2 ? DEPOSIT : WITHDRAW, 1 + i % 7);
+        std::vector<Shown> shown = transact(*port, shared_card, shared_account[0], WITHDRAW, 3);
+        if (shown.size() == 1 && shown[0].atm_op_ == GIVE)
+          withdrawn += 3;
+      }
+    });
+  }
+  for (auto &atm : atms)
+    atm.join();
+
+  int expected = 1000;
+  for (int i = 0; i < 200; i++)
+    expected += i % 2 ? 1 + i % 7 : -(1 + i % 7);
+  for (int t = 0; t < 4; t++)
+    EXPECT_EQ(balance(own[t].first, own[t].second), expected);
+  EXPECT_EQ(withdrawn.load(), 999);
+  EXPECT_EQ(balance(shared_card, shared_account[0]), 1);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
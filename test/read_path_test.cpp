@@ -0,0 +1,196 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <banking_fixture.hpp>
+#include <rcu.hpp>
+#include <seqlock.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(SeqLockTest, WriteBumpsVersion) {
+  SeqLock<int> balance(100);
+  uint64_t before, after;
+  EXPECT_EQ(balance.read(&before), 100);
+  EXPECT_TRUE(balance.write([](int &money) { money += 50; return true; }));
+  EXPECT_EQ(balance.read(&after), 150);
+  EXPECT_GT(after, before);
+  EXPECT_EQ(after % 2, 0u);
+}
+
+TEST(SeqLockTest, RejectedWriteKeepsValueAndVersion) {
+  SeqLock<int> balance(100);
+  uint64_t version = balance.version();
+  EXPECT_FALSE(balance.write([](int &money) { money = 0; return false; }));
+  EXPECT_EQ(balance.read(), 100);
+  EXPECT_EQ(balance.version(), version);
+}
+
+TEST(RcuTableTest, PublishAndRemove) {
+  RcuTable<int> table(4);
+  EXPECT_TRUE(table.publish(1, std::unique_ptr<const int>(new int(7))));
+  EXPECT_FALSE(table.publish(4, std::unique_ptr<const int>(new int(7))));
+  {
+    RcuTable<int>::ReadGuard guard(table);
+    ASSERT_NE(guard.get(1), nullptr);
+    EXPECT_EQ(*guard.get(1), 7);
+    table.publish(1, std::unique_ptr<const int>(new int(8)));
+    EXPECT_EQ(*guard.get(1), 8);
+    EXPECT_EQ(guard.get(0), nullptr);
+  }
+  table.remove(1);
+  RcuTable<int>::ReadGuard guard(table);
+  EXPECT_EQ(guard.get(1), nullptr);
+}
+
+#ifndef ATM_SINGLE_THREADED
+namespace {
+  const long STRESS_WRITES = 20000;
+  const int STRESS_READERS = 4;
+
+  /**
+   * struct Stamped - Value whose words are all written with the same stamp,
+   *                  so a torn read shows up as differing words
+   */
+  struct Stamped {
+    long words_[4];
+
+    explicit Stamped(long stamp = 0) {
+      for (auto &word : words_)
+        word = stamp;
+    }
+
+    bool whole() const {
+      for (const auto &word : words_) {
+        if (word != words_[0])
+          return false;
+      }
+      return true;
+    }
+  };
+
+  /**
+   * struct Snapshot - Stamped value poisoned when freed
+   */
+  struct Snapshot {
+    explicit Snapshot(long stamp) : stamp_(stamp), live_(true) {}
+    ~Snapshot() { live_ = false; }
+
+    Stamped stamp_;
+    bool live_;
+  };
+}
+
+TEST(SeqLockTest, ConcurrentReadersSeeWholeAndFreshValues) {
+  SeqLock<Stamped> value((Stamped()));
+  std::atomic<long> written(0);
+  std::atomic<bool> done(false);
+  std::atomic<long> torn(0), stale(0);
+  std::vector<std::thread> readers;
+  for (int r = 0; r < STRESS_READERS; r++) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        long before = written.load(std::memory_order_acquire);
+        Stamped read = value.read();
+        if (!read.whole())
+          torn++;
+        // A write finished before the read started is never missed
+        if (read.words_[0] < before)
+          stale++;
+      }
+    });
+  }
+  for (long stamp = 1; stamp <= STRESS_WRITES; stamp++) {
+    value.write([stamp](Stamped &stamped) {
+      stamped = Stamped(stamp);
+      return true;
+    });
+    written.store(stamp, std::memory_order_release);
+  }
+  done.store(true);
+  for (auto &reader : readers)
+    reader.join();
+  EXPECT_EQ(torn.load(), 0);
+  EXPECT_EQ(stale.load(), 0);
+  EXPECT_EQ(value.read().words_[0], STRESS_WRITES);
+}
+
+TEST(RcuTableTest, ConcurrentReadersNeverSeeFreedOrStaleSnapshots) {
+  const std::size_t slots = 4;
+  RcuTable<Snapshot> table(slots);
+  std::vector<std::atomic<long>> published(slots);
+  for (std::size_t key = 0; key < slots; key++) {
+    table.publish(key, std::unique_ptr<const Snapshot>(new Snapshot(0)));
+    published[key].store(0);
+  }
+  std::atomic<bool> done(false);
+  std::atomic<long> bad(0), stale(0);
+  std::vector<std::thread> readers;
+  for (int r = 0; r < STRESS_READERS; r++) {
+    readers.emplace_back([&, r]() {
+      for (std::size_t key = r % slots; !done.load(); key = (key + 1) % slots) {
+        long before = published[key].load(std::memory_order_acquire);
+        RcuTable<Snapshot>::ReadGuard guard(table);
+        const Snapshot *snapshot = guard.get(key);
+        if (!snapshot) {
+          bad++;
+          continue;
+        }
+        // Still in use, so neither freed nor torn until the guard goes
+        std::this_thread::yield();
+        if (!snapshot->live_ || !snapshot->stamp_.whole())
+          bad++;
+        if (snapshot->stamp_.words_[0] < before)
+          stale++;
+      }
+    });
+  }
+  std::thread writer([&]() {
+    for (long stamp = 1; stamp <= STRESS_WRITES; stamp++) {
+      std::size_t key = stamp % slots;
+      table.publish(key, std::unique_ptr<const Snapshot>(new Snapshot(stamp)));
+      published[key].store(stamp, std::memory_order_release);
+    }
+  });
+  writer.join();
+  done.store(true);
+  for (auto &reader : readers)
+    reader.join();
+  EXPECT_EQ(bad.load(), 0);
+  EXPECT_EQ(stale.load(), 0);
+}
+#endif
+
+TEST_F(BankingFixture, ListAccountsTest) {
+  std::vector<long> accounts;
+  EXPECT_TRUE(Bank::getBank()->listAccounts(card_no, accounts));
+  EXPECT_EQ(accounts, account_no);
+}
+
+TEST_F(BankingFixture, CheckBalanceAfterDepositTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(atm_mock, controllerDisplay(TAKE,500,_)).WillOnce(Return(true));
+  atm_mock.callPerformTransaction(DEPOSIT, 500);
+
+  AtmControllerMock next_atm_mock;
+  EXPECT_CALL(next_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  next_atm_mock.callInsertCard(card_no, 8888);
+  next_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(next_atm_mock, controllerDisplay(SHOW,money + 500,_)).WillOnce(Return(true));
+  next_atm_mock.callPerformTransaction(CHECK_BALANCE);
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
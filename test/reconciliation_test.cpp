@@ -0,0 +1,258 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <reconciliation.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(AccountSnapshotTest, WritesAfterCutAreExcluded) {
+  AccountTable table;
+  Account account(table, table.create(1, "someone", 100, 1));
+  int amount = 50;
+  account.performTransaction(DEPOSIT, amount, 1);
+  EXPECT_EQ(account.get_snapshot_balance(2), 150);
+
+  account.performTransaction(DEPOSIT, amount, 2);
+  EXPECT_EQ(account.get_balance(), 200);
+  EXPECT_EQ(account.get_snapshot_balance(2), 150);
+
+  // A write of the closed epoch landing late still belongs before the cut
+  amount = 30;
+  account.performTransaction(WITHDRAW, amount, 1);
+  EXPECT_EQ(account.get_balance(), 170);
+  EXPECT_EQ(account.get_snapshot_balance(2), 120);
+  EXPECT_EQ(account.get_snapshot_balance(3), 170);
+}
+
+TEST(AccountSnapshotTest, AccountsCreatedAfterCutAreEmpty) {
+  AccountTable table;
+  Account account(table, table.create(1, "someone", 100, 2));
+  EXPECT_EQ(account.get_snapshot_balance(2), 0);
+  EXPECT_EQ(account.get_snapshot_balance(3), 100);
+}
+
+TEST(ActivityLedgerTest, FoldsClosedEpochOnly) {
+  ActivityLedger ledger(4);
+  ledger.record(1, 2, DEPOSIT, 100);
+  ledger.record(1, 2, WITHDRAW, 40);
+  ledger.record(2, 2, DEPOSIT, 7);
+  ledger.record(1, 9, DEPOSIT, 100);
+
+  std::vector<ActivityTotals> totals;
+  ledger.fold(1, totals);
+  ASSERT_EQ(totals.size(), 4u);
+  EXPECT_EQ(totals[2].deposits_, 100);
+  EXPECT_EQ(totals[2].withdrawals_, 40);
+  EXPECT_EQ(totals[2].deposit_count_, 1);
+  EXPECT_TRUE(totals[0].empty());
+
+  ledger.record(2, 2, DEPOSIT, -7, -1);
+  ledger.fold(2, totals);
+  EXPECT_EQ(totals[2].deposits_, 100);
+  EXPECT_EQ(totals[2].deposit_count_, 1);
+}
+
+TEST(ReconcileTest, ThreadCountDoesNotChangeReport) {
+  BalanceSnapshot snapshot;
+  snapshot.card_offsets_.push_back(0);
+  for (long card = 0; card < 1000; card++) {
+    for (long i = 0; i <= card % 4; i++) {
+      snapshot.account_ids_.push_back(snapshot.balances_.size());
+      snapshot.balances_.push_back(card * 10 - i * 100);
+    }
+    snapshot.card_nos_.push_back(card);
+    snapshot.card_offsets_.push_back(snapshot.balances_.size());
+    ActivityTotals activity;
+    activity.deposits_ = card;
+    activity.deposit_count_ = 1;
+    snapshot.card_activity_.push_back(activity);
+  }
+  snapshot.atm_activity_.resize(8);
+  snapshot.atm_activity_[3].withdrawals_ = 20;
+  snapshot.atm_activity_[3].withdraw_count_ = 2;
+
+  ReconciliationReport single = reconcile(snapshot, 1);
+  EXPECT_EQ(single.accounts_, snapshot.balances_.size());
+  EXPECT_EQ(single.min_balance_, -270);
+  EXPECT_EQ(single.max_balance_, 9990);
+  EXPECT_EQ(single.activity_.deposits_, 999 * 1000 / 2);
+  EXPECT_EQ(single.activity_.deposit_count_, 1000);
+  ASSERT_EQ(single.card_balances_.size(), 1000u);
+  EXPECT_EQ(single.card_balances_[3], 30 * 4 - 600);
+  ASSERT_EQ(single.atms_.size(), 1u);
+  EXPECT_EQ(single.atms_[0].atm_id_, 3);
+  EXPECT_EQ(single.atms_[0].activity_.withdrawals_, 20);
+
+  int64_t total = 0;
+  for (auto balance : snapshot.balances_)
+    total += balance;
+  EXPECT_EQ(single.total_balance_, total);
+
+  for (unsigned threads : {2u, 3u, 8u, 2000u}) {
+    ReconciliationReport parallel = reconcile(snapshot, threads);
+    EXPECT_EQ(parallel.total_balance_, single.total_balance_);
+    EXPECT_EQ(parallel.min_balance_, single.min_balance_);
+    EXPECT_EQ(parallel.max_balance_, single.max_balance_);
+    EXPECT_EQ(parallel.negative_balances_, single.negative_balances_);
+    EXPECT_EQ(parallel.activity_.deposits_, single.activity_.deposits_);
+    EXPECT_EQ(parallel.card_balances_, single.card_balances_);
+  }
+
+  ReconciliationReport empty = reconcile(BalanceSnapshot(), 4);
+  EXPECT_EQ(empty.accounts_, 0u);
+  EXPECT_EQ(empty.min_balance_, 0);
+}
+
+class BankReconcileTest : public Test {
+  public:
+  void TearDown() override {
+    Bank::getBank()->deleteBank();
+  }
+
+  /**
+   * @brief Run one session on a card, returns false if the token was taken
+   */
+  bool session(long card_no, long account_no, int atm_id, TransactionType trans_type,
+      int amount, bool dispensed = true) {
+    Bank *bank = Bank::getBank();
+    int token;
+    try {
+      token = bank->verifyAndCreateTransaction(card_no, 8888, atm_id);
+    } catch (std::exception&) {
+      return false;
+    }
+    bank->acknowledgeTransaction(token, [dispensed](AtmOperationType atm_op, int, std::string&&) {
+      return atm_op != GIVE && atm_op != TAKE ? true : dispensed;
+    });
+    bank->selectAccount(token, account_no);
+    bank->performTransaction(token, trans_type, amount);
+    return true;
+  }
+};
+
+TEST_F(BankReconcileTest, PerAtmAndGlobalTotals) {
+  Bank *bank = Bank::getBank();
+  long card_no = bank->createAndLinkAccount("someone", 1000);
+  bank->createAndLinkAccount("someone", 500, card_no);
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->listAccounts(card_no, account_no));
+
+  ASSERT_TRUE(session(card_no, account_no[0], 7, DEPOSIT, 300));
+  ASSERT_TRUE(session(card_no, account_no[1], 9, WITHDRAW, 200));
+  ASSERT_TRUE(session(card_no, account_no[1], 9, WITHDRAW, 100, false));
+
+  BalanceSnapshot snapshot = bank->snapshotBalances();
+  ReconciliationReport report = reconcile(snapshot, 2);
+  EXPECT_EQ(report.accounts_, 2u);
+  EXPECT_EQ(report.total_balance_, 1600);
+  EXPECT_EQ(report.activity_.deposits_, 300);
+  EXPECT_EQ(report.activity_.withdrawals_, 200);
+  EXPECT_EQ(report.activity_.withdraw_count_, 1);
+  ASSERT_EQ(snapshot.card_nos_, std::vector<long>{card_no});
+  EXPECT_EQ(snapshot.card_activity_[0].deposits_, 300);
+  EXPECT_EQ(report.card_balances_[0], 1600);
+
+  ASSERT_EQ(report.atms_.size(), 2u);
+  EXPECT_EQ(report.atms_[0].atm_id_, 7);
+  EXPECT_EQ(report.atms_[0].activity_.deposits_, 300);
+  EXPECT_EQ(report.atms_[1].atm_id_, 9);
+  EXPECT_EQ(report.atms_[1].activity_.withdrawals_, 200);
+}
+
+TEST_F(BankReconcileTest, SnapshotsDoNotWaitOnTheAtm) {
+  Bank *bank = Bank::getBank();
+  long card_no = bank->createAndLinkAccount("someone", 1000);
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->listAccounts(card_no, account_no));
+
+  // A snapshot taken while the atm handles the cash would never finish if
+  // an epoch were held across the callback. The cash is taken before it is
+  // credited, so the snapshot does not see the deposit yet
+  BalanceSnapshot snapshot;
+  auto atm_cb = [&](AtmOperationType atm_op, int, std::string&&) {
+    if (atm_op == TAKE)
+      snapshot = bank->snapshotBalances();
+    return true;
+  };
+  int token = bank->verifyAndCreateTransaction(card_no, 8888, 7);
+  bank->acknowledgeTransaction(token, atm_cb);
+  bank->selectAccount(token, account_no[0]);
+  TransactionType deposit = DEPOSIT;
+  bank->performTransaction(token, deposit, 300);
+  ReconciliationReport report = reconcile(snapshot, 1);
+  EXPECT_EQ(report.total_balance_, 1000);
+  EXPECT_EQ(report.activity_.deposits_, 0);
+
+  token = bank->verifyAndCreateTransaction(card_no, 8888, 7);
+  bank->acknowledgeTransaction(token, atm_cb);
+  ASSERT_TRUE(bank->performSession(token, {{SESSION_DEPOSIT, account_no[0], 200, 0}}));
+  report = reconcile(snapshot, 1);
+  EXPECT_EQ(report.total_balance_, 1300);
+  EXPECT_EQ(report.activity_.deposits_, 300);
+
+  report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.total_balance_, 1500);
+  EXPECT_EQ(report.activity_.deposits_, 500);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST_F(BankReconcileTest, SnapshotsStayBalancedUnderLoad) {
+  const int WRITERS = 4;
+  Bank *bank = Bank::getBank();
+  std::vector<long> cards, accounts;
+  for (int i = 0; i < WRITERS; i++) {
+    cards.push_back(bank->createAndLinkAccount("writer", 10000));
+    std::vector<long> account_no;
+    bank->listAccounts(cards.back(), account_no);
+    accounts.push_back(account_no[0]);
+  }
+  const int64_t opening = 10000 * WRITERS;
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> writers;
+  for (int i = 0; i < WRITERS; i++) {
+    writers.emplace_back([&, i]() {
+      for (int n = 0; n < 200; n++)
+        session(cards[i], accounts[i], i, n % 3 ? DEPOSIT : WITHDRAW, 10 + n % 7, n % 5 != 0);
+    });
+  }
+  std::thread checker([&]() {
+    while (!done.load()) {
+      ReconciliationReport report = reconcile(bank->snapshotBalances(), 2);
+      EXPECT_EQ(report.total_balance_,
+          opening + report.activity_.deposits_ - report.activity_.withdrawals_);
+    }
+  });
+  for (auto &writer : writers)
+    writer.join();
+  done.store(true);
+  checker.join();
+
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 2);
+  int64_t total = 0;
+  for (auto balance : report.card_balances_)
+    total += balance;
+  EXPECT_EQ(report.total_balance_, total);
+  ActivityTotals atm_total;
+  for (const auto &atm : report.atms_)
+    atm_total += atm.activity_;
+  EXPECT_EQ(atm_total.deposits_, report.activity_.deposits_);
+  EXPECT_EQ(atm_total.withdrawals_, report.activity_.withdrawals_);
+  EXPECT_EQ(report.total_balance_,
+      opening + report.activity_.deposits_ - report.activity_.withdrawals_);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
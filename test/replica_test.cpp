@@ -0,0 +1,380 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <journal.hpp>
+#include <replica.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  JournalRecord balanceRecord(long account_id, uint64_t version, int balance) {
+    JournalRecord record;
+    record.op_ = JOURNAL_BALANCE;
+    record.card_no_ = -1;
+    record.account_id_ = account_id;
+    record.account_index_ = static_cast<uint32_t>(account_id);
+    record.version_ = version;
+    record.balance_ = balance;
+    return record;
+  }
+
+  JournalRecord linkRecord(long card_no, long account_id, int balance, const std::string &name) {
+    JournalRecord record = balanceRecord(account_id, 0, balance);
+    record.op_ = JOURNAL_LINK_ACCOUNT;
+    record.card_no_ = card_no;
+    record.holder_name_ = name;
+    return record;
+  }
+}
+
+TEST(ChangeJournalTest, RecordsRoundTrip) {
+  JournalRecord record = linkRecord(12, 345, -6, "some one");
+  record.seq_ = 7;
+  record.time_ns_ = 1ull << 40;
+  record.version_ = 10;
+  std::string bytes;
+  encodeJournalRecord(record, bytes);
+  encodeJournalRecord(balanceRecord(345, 12, 100), bytes);
+
+  std::size_t pos = 0;
+  JournalRecord decoded;
+  ASSERT_TRUE(decodeJournalRecord(bytes, pos, decoded));
+  EXPECT_EQ(decoded.seq_, 7u);
+  EXPECT_EQ(decoded.time_ns_, 1ull << 40);
+  EXPECT_EQ(decoded.op_, JOURNAL_LINK_ACCOUNT);
+  EXPECT_EQ(decoded.card_no_, 12);
+  EXPECT_EQ(decoded.account_id_, 345);
+  EXPECT_EQ(decoded.account_index_, 345u);
+  EXPECT_EQ(decoded.version_, 10u);
+  EXPECT_EQ(decoded.balance_, -6);
+  EXPECT_EQ(decoded.holder_name_, "some one");
+  ASSERT_TRUE(decodeJournalRecord(bytes, pos, decoded));
+  EXPECT_EQ(decoded.op_, JOURNAL_BALANCE);
+  EXPECT_EQ(pos, bytes.size());
+
+  std::string partial = bytes.substr(0, bytes.size() - 1);
+  pos = 0;
+  ASSERT_TRUE(decodeJournalRecord(partial, pos, decoded));
+  EXPECT_FALSE(decodeJournalRecord(partial, pos, decoded));
+}
+
+TEST(ChangeJournalTest, ConsumesInOrderUntilClosed) {
+  ChangeJournal journal(4);
+  for (int i = 0; i < 3; i++) {
+    JournalRecord record = balanceRecord(1, i, i);
+    ASSERT_TRUE(journal.publish(record));
+    EXPECT_EQ(record.seq_, static_cast<uint64_t>(i + 1));
+  }
+  EXPECT_EQ(journal.head(), 3u);
+
+  std::vector<JournalRecord> records;
+  EXPECT_TRUE(journal.consume(records, 2, std::chrono::milliseconds(0)));
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[1].seq_, 2u);
+
+  journal.close();
+  JournalRecord record = balanceRecord(1, 4, 4);
+  EXPECT_FALSE(journal.publish(record));
+  records.clear();
+  EXPECT_TRUE(journal.consume(records, 8, std::chrono::milliseconds(0)));
+  EXPECT_EQ(records.size(), 1u);
+  records.clear();
+  EXPECT_FALSE(journal.consume(records, 8, std::chrono::milliseconds(0)));
+}
+
+TEST(ChangeJournalTest, DropsInsteadOfWaitingWhenFull) {
+  ChangeJournal journal(2);
+  for (int i = 0; i < 2; i++) {
+    JournalRecord record = balanceRecord(1, i, i);
+    ASSERT_TRUE(journal.publish(record));
+  }
+  EXPECT_FALSE(journal.takeResync());
+  JournalRecord record = balanceRecord(1, 2, 2);
+  EXPECT_FALSE(journal.publish(record));
+  EXPECT_EQ(journal.dropped(), 1u);
+  EXPECT_EQ(journal.head(), 2u);
+  EXPECT_TRUE(journal.takeResync());
+  EXPECT_FALSE(journal.takeResync());
+
+  std::vector<JournalRecord> records;
+  EXPECT_TRUE(journal.consume(records, 8, std::chrono::milliseconds(0)));
+  EXPECT_TRUE(journal.publish(record));
+  EXPECT_EQ(record.seq_, 3u);
+}
+
+TEST(BankReplicaJournalTest, KeepsTheNewestVersion) {
+  ChangeJournal journal(16);
+  BankReplica replica(journal);
+
+  // A balance may be published before the link of its account
+  JournalRecord record = balanceRecord(5, 4, 40);
+  journal.publish(record);
+  record = linkRecord(2, 5, 10, "someone");
+  record.version_ = 2;
+  journal.publish(record);
+  record = balanceRecord(5, 8, 80);
+  journal.publish(record);
+  record = balanceRecord(5, 6, 60);
+  journal.publish(record);
+  EXPECT_EQ(replica.poll(), 4u);
+
+  int amount = -1;
+  ASSERT_TRUE(replica.checkBalance(2, 8888, 5, amount));
+  EXPECT_EQ(amount, 80);
+  EXPECT_FALSE(replica.checkBalance(2, 1234, 5, amount));
+  EXPECT_FALSE(replica.checkBalance(2, 8888, 6, amount));
+
+  ReplicaMetrics metrics = replica.metrics();
+  EXPECT_EQ(metrics.applied_, 4u);
+  EXPECT_EQ(metrics.applied_seq_, 4u);
+  EXPECT_EQ(metrics.lag_records_, 0u);
+  EXPECT_EQ(metrics.stale_, 1u);
+}
+
+class BankReplicaTest : public Test {
+  public:
+  BankReplicaTest() : journal_(1 << 12), replica_(journal_) {}
+
+  void SetUp() override {
+    Bank *bank = Bank::getBank();
+    bank->attachJournal(&journal_);
+    card_no_ = bank->createAndLinkAccount("someone", 1000);
+    bank->createAndLinkAccount("someone", 200, card_no_);
+    ASSERT_TRUE(bank->listAccounts(card_no_, account_no_));
+  }
+
+  void TearDown() override {
+    replica_.stop();
+    Bank::getBank()->attachJournal(nullptr);
+    Bank::getBank()->deleteBank();
+  }
+
+  void transact(TransactionType trans_type, int amount) {
+    Bank *bank = Bank::getBank();
+    int token = bank->verifyAndCreateTransaction(card_no_, 8888);
+    bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+    bank->selectAccount(token, account_no_[0]);
+    bank->performTransaction(token, trans_type, amount);
+  }
+
+  int replicaBalance(long account_no) {
+    int amount = -1;
+    replica_.checkBalance(card_no_, 8888, account_no, amount);
+    return amount;
+  }
+
+  ChangeJournal journal_;
+  BankReplica replica_;
+  long card_no_;
+  std::vector<long> account_no_;
+};
+
+TEST_F(BankReplicaTest, ServesReadsOfTheAppliedChanges) {
+  Bank *bank = Bank::getBank();
+  transact(DEPOSIT, 100);
+  transact(WITHDRAW, 300);
+  int token = bank->verifyAndCreateTransaction(card_no_, 8888);
+  bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+  ASSERT_TRUE(bank->performSession(token, {{SESSION_TRANSFER, account_no_[0], 50, account_no_[1]}}));
+
+  ASSERT_TRUE(replica_.catchUp(journal_.head(), std::chrono::seconds(1)));
+  EXPECT_EQ(replicaBalance(account_no_[0]), 750);
+  EXPECT_EQ(replicaBalance(account_no_[1]), 250);
+
+  std::vector<long> account_no;
+  ASSERT_TRUE(replica_.listAccounts(card_no_, account_no));
+  EXPECT_EQ(account_no, account_no_);
+
+  long card_no = -1;
+  account_no.clear();
+  EXPECT_FALSE(replica_.privilegedOperation(1, "someone", account_no, card_no));
+  ASSERT_TRUE(replica_.privilegedOperation(HIDDEN_PASSCODE, "someone", account_no, card_no));
+  EXPECT_EQ(card_no, card_no_);
+  EXPECT_EQ(account_no, account_no_);
+
+  ReplicaMetrics metrics = replica_.metrics();
+  EXPECT_EQ(metrics.applied_seq_, journal_.head());
+  EXPECT_EQ(metrics.lag_records_, 0u);
+  EXPECT_GT(metrics.max_lag_ns_, 0u);
+}
+
+TEST_F(BankReplicaTest, LateReplicaIsSeededWithExistingAccounts) {
+  transact(DEPOSIT, 100);
+  ChangeJournal journal(1 << 12);
+  BankReplica replica(journal);
+  Bank::getBank()->attachJournal(&journal);
+  transact(WITHDRAW, 50);
+  replica.poll();
+
+  int amount = -1;
+  ASSERT_TRUE(replica.checkBalance(card_no_, 8888, account_no_[0], amount));
+  EXPECT_EQ(amount, 1050);
+  ASSERT_TRUE(replica.checkBalance(card_no_, 8888, account_no_[1], amount));
+  EXPECT_EQ(amount, 200);
+}
+
+TEST_F(BankReplicaTest, ResyncsAfterDroppedRecords) {
+  ChangeJournal journal(4);
+  BankReplica replica(journal);
+  Bank *bank = Bank::getBank();
+  bank->attachJournal(&journal);
+  EXPECT_EQ(replica.poll(), 2u);
+
+  // Each withdraw publishes its balance, the primary does not wait on the
+  // replica once the journal is full
+  for (int i = 0; i < 6; i++)
+    transact(WITHDRAW, 10);
+  EXPECT_EQ(replica.metrics().dropped_, 2u);
+  replica.poll();
+  int amount = -1;
+  ASSERT_TRUE(replica.checkBalance(card_no_, 8888, account_no_[0], amount));
+  EXPECT_EQ(amount, 960);
+
+  ASSERT_TRUE(journal.takeResync());
+  bank->attachJournal(&journal);
+  replica.poll();
+  ASSERT_TRUE(replica.checkBalance(card_no_, 8888, account_no_[0], amount));
+  EXPECT_EQ(amount, 940);
+  ASSERT_TRUE(replica.checkBalance(card_no_, 8888, account_no_[1], amount));
+  EXPECT_EQ(amount, 200);
+}
+
+TEST_F(BankReplicaTest, FailedWithdrawLeavesTheReplicaAlone) {
+  Bank *bank = Bank::getBank();
+  int token = bank->verifyAndCreateTransaction(card_no_, 8888);
+  bank->acknowledgeTransaction(token, [](AtmOperationType atm_op, int, std::string&&) {
+    return atm_op != GIVE;
+  });
+  bank->selectAccount(token, account_no_[0]);
+  TransactionType trans_type = WITHDRAW;
+  bank->performTransaction(token, trans_type, 300);
+  ASSERT_TRUE(replica_.catchUp(journal_.head(), std::chrono::seconds(1)));
+  EXPECT_EQ(replicaBalance(account_no_[0]), 1000);
+}
+
+TEST_F(BankReplicaTest, PromotionKeepsCardsAndBalances) {
+  transact(WITHDRAW, 100);
+  long old_card_no = card_no_;
+  std::vector<long> old_account_no = account_no_;
+
+  Bank *bank = replica_.promote();
+  ASSERT_EQ(bank, Bank::getBank());
+  int amount;
+  EXPECT_FALSE(replica_.checkBalance(card_no_, 8888, account_no_[0], amount));
+  JournalRecord record = balanceRecord(account_no_[0], 100, 0);
+  EXPECT_FALSE(journal_.publish(record));
+
+  std::vector<long> account_no;
+  ASSERT_TRUE(bank->listAccounts(old_card_no, account_no));
+  EXPECT_EQ(account_no, old_account_no);
+  BalanceSnapshot snapshot = bank->snapshotBalances();
+  EXPECT_THAT(snapshot.balances_, ElementsAre(900, 200));
+
+  // Sessions carry on against the promoted bank
+  transact(DEPOSIT, 100);
+  snapshot = bank->snapshotBalances();
+  EXPECT_THAT(snapshot.balances_, ElementsAre(1000, 200));
+}
+
+TEST_F(BankReplicaTest, PromotionWaitsForOpenSessions) {
+  Bank *bank = Bank::getBank();
+  int token = bank->verifyAndCreateTransaction(card_no_, 8888);
+  EXPECT_THROW(replica_.promote(), std::runtime_error);
+  EXPECT_EQ(Bank::getBank(), bank);
+  ASSERT_TRUE(replica_.catchUp(journal_.head(), std::chrono::seconds(1)));
+  EXPECT_EQ(replicaBalance(account_no_[0]), 1000);
+
+  bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+  bank->selectAccount(token, account_no_[0]);
+  TransactionType trans_type = CHECK_BALANCE;
+  bank->performTransaction(token, trans_type, 0);
+  bank = replica_.promote();
+  EXPECT_THAT(bank->snapshotBalances().balances_, ElementsAre(1000, 200));
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST_F(BankReplicaTest, StreamsOverALocalSocket) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ChangeJournal received(1 << 12);
+  BankReplica replica(received);
+  replica.start();
+  std::thread sender([this, &fds]() {
+    sendJournal(journal_, fds[0]);
+    close(fds[0]);
+  });
+  std::thread receiver([&received, &fds]() {
+    receiveJournal(fds[1], received);
+    close(fds[1]);
+  });
+
+  for (int i = 0; i < 20; i++)
+    transact(i % 2 ? DEPOSIT : WITHDRAW, 10 + i);
+  uint64_t head = journal_.head();
+  ASSERT_TRUE(replica.catchUp(head, std::chrono::seconds(5)));
+  int amount = -1;
+  ASSERT_TRUE(replica.checkBalance(card_no_, 8888, account_no_[0], amount));
+  EXPECT_EQ(amount, 1010);
+  EXPECT_EQ(replica.metrics().head_seq_, head);
+
+  journal_.close();
+  sender.join();
+  receiver.join();
+  replica.stop();
+}
+
+TEST_F(BankReplicaTest, ConvergesUnderConcurrentSessions) {
+  Bank *bank = Bank::getBank();
+  std::vector<long> cards;
+  for (int t = 0; t < 4; t++) {
+    cards.push_back(bank->createAndLinkAccount("atm" + std::to_string(t), 10000));
+  }
+  replica_.start();
+
+  std::vector<std::thread> atms;
+  for (int t = 0; t < 4; t++) {
+    atms.emplace_back([bank, t, card_no = cards[t]]() {
+      std::vector<long> account_no;
+      bank->listAccounts(card_no, account_no);
+      for (int i = 0; i < 50; i++) {
+        try {
+          int token = bank->verifyAndCreateTransaction(card_no, 8888);
+          bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+          bank->selectAccount(token, account_no[0]);
+          TransactionType trans_type = (i + t) % 3 ? WITHDRAW : DEPOSIT;
+          bank->performTransaction(token, trans_type, 1 + i);
+        } catch (std::exception&) {
+        }
+      }
+    });
+  }
+  for (auto &atm : atms)
+    atm.join();
+
+  ASSERT_TRUE(replica_.catchUp(journal_.head(), std::chrono::seconds(5)));
+  BalanceSnapshot snapshot = bank->snapshotBalances();
+  for (std::size_t c = 0; c < snapshot.card_nos_.size(); c++) {
+    for (std::size_t i = snapshot.card_offsets_[c]; i < snapshot.card_offsets_[c + 1]; i++) {
+      int amount = -1;
+      ASSERT_TRUE(replica_.checkBalance(snapshot.card_nos_[c], 8888, snapshot.account_ids_[i], amount));
+      EXPECT_EQ(amount, snapshot.balances_[i]);
+    }
+  }
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
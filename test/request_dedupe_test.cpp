@@ -0,0 +1,248 @@
+#include <thread>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <banking_fixture.hpp>
+#include <cuckoo_filter.hpp>
+#include <request_dedupe.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(CuckooFilterTest, NoFalseNegatives) {
+  CuckooFilter filter(4096);
+  for (uint64_t key = 1; key <= 4096; key++)
+    EXPECT_TRUE(filter.insert(key * 7919));
+  for (uint64_t key = 1; key <= 4096; key++)
+    EXPECT_TRUE(filter.contains(key * 7919));
+
+  int false_positives = 0;
+  for (uint64_t key = 1; key <= 4096; key++)
+    false_positives += filter.contains(key * 7919 + 1);
+  EXPECT_LT(false_positives, 100);
+
+  for (uint64_t key = 1; key <= 4096; key += 2)
+    EXPECT_TRUE(filter.erase(key * 7919));
+  for (uint64_t key = 2; key <= 4096; key += 2)
+    EXPECT_TRUE(filter.contains(key * 7919));
+}
+
+TEST(RequestDedupeTest, DuplicateAndInFlight) {
+  RequestDedupe<int, std::mutex> dedupe(64, std::chrono::minutes(1));
+  int value = 0;
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_NEW);
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_IN_FLIGHT);
+  dedupe.complete(1, 42, 7);
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_DUPLICATE);
+  EXPECT_EQ(value, 7);
+  EXPECT_EQ(dedupe.begin(1, 43, value), DEDUPE_NEW);
+}
+
+TEST(RequestDedupeTest, ForgetsOutsideWindow) {
+  RequestDedupe<int, std::mutex> dedupe(64, std::chrono::milliseconds(1));
+  int value = 0;
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_NEW);
+  dedupe.complete(1, 42, 7);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_NEW);
+}
+
+TEST(RequestDedupeTest, BoundedByCapacity) {
+  RequestDedupe<int, NullMutex> dedupe(4, std::chrono::minutes(1), 1);
+  std::size_t bytes = dedupe.memoryBytes();
+  int value = 0;
+  for (uint64_t id = 1; id <= 1000; id++) {
+    EXPECT_EQ(dedupe.begin(1, id, value), DEDUPE_NEW);
+    dedupe.complete(1, id, 1);
+  }
+  EXPECT_EQ(dedupe.memoryBytes(), bytes);
+  EXPECT_EQ(dedupe.begin(1, 1000, value), DEDUPE_DUPLICATE);
+  EXPECT_EQ(dedupe.begin(1, 1, value), DEDUPE_NEW);
+}
+
+TEST(RequestDedupeTest, ScopesKeepIdsApart) {
+  RequestDedupe<int, NullMutex> dedupe(64, std::chrono::minutes(1), 1);
+  int value = 5;
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_NEW);
+  dedupe.complete(1, 42, 7);
+  value = 9;
+  EXPECT_EQ(dedupe.begin(2, 42, value), DEDUPE_NEW);
+  EXPECT_EQ(dedupe.begin(2, 42, value), DEDUPE_IN_FLIGHT);
+  EXPECT_EQ(value, 9);
+  EXPECT_EQ(dedupe.begin(1, 42, value), DEDUPE_DUPLICATE);
+  EXPECT_EQ(value, 7);
+}
+
+namespace {
+  /**
+   * @brief Filter that refuses every id, as a full cuckoo filter would
+   *
+   */
+  class RefusingFilter {
+    public:
+      explicit RefusingFilter(std::size_t) {}
+      bool insert(uint64_t) { return false; }
+      bool contains(uint64_t) const { return false; }
+      bool erase(uint64_t) { return false; }
+      std::size_t memoryBytes() const { return 0; }
+  };
+}
+
+TEST(RequestDedupeTest, RefusedIdsFallBackToIndex) {
+  RequestDedupe<int, NullMutex, RefusingFilter> dedupe(8, std::chrono::minutes(1), 1);
+  int value = 0;
+  for (uint64_t id = 1; id <= 20; id++) {
+    EXPECT_EQ(dedupe.begin(1, id, value), DEDUPE_NEW);
+    dedupe.complete(1, id, static_cast<int>(id));
+  }
+  for (uint64_t id = 13; id <= 20; id++) {
+    EXPECT_EQ(dedupe.begin(1, id, value), DEDUPE_DUPLICATE);
+    EXPECT_EQ(value, static_cast<int>(id));
+  }
+  EXPECT_EQ(dedupe.begin(1, 12, value), DEDUPE_NEW);
+}
+
+TEST_F(BankingFixture, RetriedDepositAppliedOnceTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callSelectAccount(selectAccount());
+  // The first deposit ended the session, the retry takes nothing
+  EXPECT_CALL(atm_mock, controllerDisplay(TAKE,500,_)).WillOnce(Return(true));
+  atm_mock.callPerformTransaction(DEPOSIT, 500, 77);
+  atm_mock.callPerformTransaction(DEPOSIT, 500, 77);
+
+  AtmControllerMock balance_atm_mock;
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  balance_atm_mock.callInsertCard(card_no, 8888);
+  balance_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW,money + 500,_)).WillOnce(Return(true));
+  balance_atm_mock.callPerformTransaction(CHECK_BALANCE);
+}
+
+TEST_F(BankingFixture, DepositRetriedFromAnotherSessionTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(atm_mock, controllerDisplay(TAKE,300,_)).WillOnce(Return(true));
+  atm_mock.callPerformTransaction(DEPOSIT, 300, 78);
+
+  // Only the retrying atm hears about the retry, and takes nothing
+  AtmControllerMock retry_atm_mock;
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  retry_atm_mock.callInsertCard(card_no, 8888);
+  retry_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW,300,_)).WillOnce(Return(true));
+  retry_atm_mock.callPerformTransaction(DEPOSIT, 300, 78);
+
+  AtmControllerMock balance_atm_mock;
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  balance_atm_mock.callInsertCard(card_no, 8888);
+  balance_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW,money + 300,_)).WillOnce(Return(true));
+  balance_atm_mock.callPerformTransaction(CHECK_BALANCE);
+}
+
+TEST_F(BankingFixture, RetriedWithdrawGivesOnceTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(atm_mock, controllerDisplay(GIVE,200,_)).WillOnce(Return(true));
+  atm_mock.callPerformTransaction(WITHDRAW, 200, 79);
+
+  AtmControllerMock retry_atm_mock;
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  retry_atm_mock.callInsertCard(card_no, 8888);
+  retry_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(GIVE,_,_)).Times(0);
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW,200,_)).WillOnce(Return(true));
+  retry_atm_mock.callPerformTransaction(WITHDRAW, 200, 79);
+
+  AtmControllerMock balance_atm_mock;
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  balance_atm_mock.callInsertCard(card_no, 8888);
+  balance_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW,money - 200,_)).WillOnce(Return(true));
+  balance_atm_mock.callPerformTransaction(CHECK_BALANCE);
+}
+
+TEST_F(BankingFixture, SameIdFromAnotherCardTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(atm_mock, controllerDisplay(TAKE,500,_)).WillOnce(Return(true));
+  atm_mock.callPerformTransaction(DEPOSIT, 500, 81);
+
+  long other_card_no = Bank::getBank()->createAndLinkAccount("someone else", money);
+  std::vector<long> other_account_no;
+  Bank::getBank()->listAccounts(other_card_no, other_account_no);
+  ASSERT_FALSE(other_account_no.empty());
+
+  AtmControllerMock other_atm_mock;
+  EXPECT_CALL(other_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  other_atm_mock.callInsertCard(other_card_no, 8888);
+  other_atm_mock.callSelectAccount(other_account_no[0]);
+  EXPECT_CALL(other_atm_mock, controllerDisplay(TAKE,700,_)).WillOnce(Return(true));
+  other_atm_mock.callPerformTransaction(DEPOSIT, 700, 81);
+
+  AtmControllerMock balance_atm_mock;
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  balance_atm_mock.callInsertCard(other_card_no, 8888);
+  balance_atm_mock.callSelectAccount(other_account_no[0]);
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW,money + 700,_)).WillOnce(Return(true));
+  balance_atm_mock.callPerformTransaction(CHECK_BALANCE);
+}
+
+TEST_F(BankingFixture, MismatchedRetryRefusedTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(atm_mock, controllerDisplay(TAKE,500,_)).WillOnce(Return(true));
+  atm_mock.callPerformTransaction(DEPOSIT, 500, 82);
+
+  // Same id, other amount: neither applied nor answered with the first result
+  AtmControllerMock retry_atm_mock;
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  retry_atm_mock.callInsertCard(card_no, 8888);
+  retry_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(TAKE,_,_)).Times(0);
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW,_,_)).Times(0);
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW_ERROR,_,_)).WillOnce(Return(true));
+  retry_atm_mock.callPerformTransaction(DEPOSIT, 700, 82);
+
+  AtmControllerMock balance_atm_mock;
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  balance_atm_mock.callInsertCard(card_no, 8888);
+  balance_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(balance_atm_mock, controllerDisplay(SHOW,money + 500,_)).WillOnce(Return(true));
+  balance_atm_mock.callPerformTransaction(CHECK_BALANCE);
+}
+
+TEST_F(BankingFixture, RequestWithoutSelectedAccountNotRememberedTest) {
+  AtmControllerMock atm_mock;
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(1);
+  EXPECT_CALL(atm_mock, controllerDisplay(SHOW_ERROR,_,_)).WillOnce(Return(true));
+  atm_mock.callInsertCard(card_no, 8888);
+  atm_mock.callPerformTransaction(DEPOSIT, 500, 83);
+
+  AtmControllerMock retry_atm_mock;
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+  retry_atm_mock.callInsertCard(card_no, 8888);
+  retry_atm_mock.callSelectAccount(selectAccount());
+  EXPECT_CALL(retry_atm_mock, controllerDisplay(TAKE,500,_)).WillOnce(Return(true));
+  retry_atm_mock.callPerformTransaction(DEPOSIT, 500, 83);
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <reconciliation.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  /**
+   * struct Shown - A callback made to the atm during a session
+   */
+  struct Shown {
+    AtmOperationType atm_op_;
+    int info_;
+
+    bool operator==(const Shown &other) const {
+      return atm_op_ == other.atm_op_ && info_ == other.info_;
+    }
+  };
+}
+
+class SessionTest : public Test {
+  public:
+  void SetUp() override {
+    Bank *bank = Bank::getBank();
+    card_no_ = bank->createAndLinkAccount("someone", 1000);
+    bank->createAndLinkAccount("someone", 200, card_no_);
+    ASSERT_TRUE(bank->listAccounts(card_no_, account_no_));
+  }
+
+  void TearDown() override {
+    Bank::getBank()->deleteBank();
+  }
+
+  /**
+   * @brief Open a session on the card, recording what the atm is shown past
+   *        the account listing
+   */
+  int openSession(std::vector<Shown> &shown, bool dispense = true) {
+    Bank *bank = Bank::getBank();
+    int token = bank->verifyAndCreateTransaction(card_no_, 8888);
+    bank->acknowledgeTransaction(token, [&shown, dispense](AtmOperationType atm_op, int info,
+          std::string&&) {
+      if (atm_op != SHOW_INPUT)
+        shown.push_back(Shown{atm_op, info});
+      return atm_op == GIVE || atm_op == TAKE ? dispense : true;
+    });
+    return token;
+  }
+
+  int balance(long account_no) {
+    Bank *bank = Bank::getBank();
+    std::vector<Shown> shown;
+    bank->performSession(openSession(shown), {{SESSION_CHECK_BALANCE, account_no, 0, -1}});
+    return shown.empty() ? -1 : shown[0].info_;
+  }
+
+  long card_no_;
+  std::vector<long> account_no_;
+};
+
+TEST_F(SessionTest, BalanceThenWithdrawInOneSession) {
+  Bank *bank = Bank::getBank();
+  std::vector<Shown> shown;
+  int token = openSession(shown);
+  EXPECT_TRUE(bank->performSession(token, {{SESSION_CHECK_BALANCE, account_no_[0], 0, -1},
+        {SESSION_WITHDRAW, account_no_[0], 300, -1},
+        {SESSION_CHECK_BALANCE, account_no_[0], 0, -1}}));
+  EXPECT_THAT(shown, ElementsAre(Shown{SHOW, 1000}, Shown{GIVE, 300}, Shown{SHOW, 700}));
+  EXPECT_EQ(balance(account_no_[0]), 700);
+
+  // The session is over once the operations ran
+  int amount;
+  EXPECT_FALSE(bank->checkBalance(token, amount));
+  EXPECT_FALSE(bank->performSession(token, {{SESSION_CHECK_BALANCE, account_no_[0], 0, -1}}));
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+}
+
+TEST_F(SessionTest, TransferBetweenLinkedAccounts) {
+  Bank *bank = Bank::getBank();
+  std::vector<Shown> shown;
+  EXPECT_TRUE(bank->performSession(openSession(shown),
+        {{SESSION_TRANSFER, account_no_[0], 250, account_no_[1]},
+        {SESSION_CHECK_BALANCE, account_no_[1], 0, -1}}));
+  EXPECT_THAT(shown, ElementsAre(Shown{SHOW, 750}, Shown{SHOW, 450}));
+
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.total_balance_, 1200);
+  EXPECT_EQ(report.activity_.deposit_count_ + report.activity_.withdraw_count_, 0);
+}
+
+TEST_F(SessionTest, ShortWithdrawRefusesTheWholeSession) {
+  Bank *bank = Bank::getBank();
+  std::vector<Shown> shown;
+  EXPECT_FALSE(bank->performSession(openSession(shown),
+        {{SESSION_DEPOSIT, account_no_[1], 100, -1},
+        {SESSION_WITHDRAW, account_no_[1], 500, -1}}));
+  EXPECT_THAT(shown, ElementsAre(Shown{SHOW_ERROR, -1}));
+  EXPECT_EQ(balance(account_no_[1]), 200);
+
+  // Money deposited earlier in the session counts towards a later withdraw
+  shown.clear();
+  EXPECT_TRUE(bank->performSession(openSession(shown),
+        {{SESSION_DEPOSIT, account_no_[1], 300, -1},
+        {SESSION_WITHDRAW, account_no_[1], 500, -1}}));
+  EXPECT_THAT(shown, ElementsAre(Shown{TAKE, 300}, Shown{GIVE, 500}));
+  EXPECT_EQ(balance(account_no_[1]), 0);
+}
+
+TEST_F(SessionTest, RefusesAccountsOfOtherCards) {
+  Bank *bank = Bank::getBank();
+  long other_card = bank->createAndLinkAccount("other", 500);
+  std::vector<long> other_accounts;
+  bank->listAccounts(other_card, other_accounts);
+
+  std::vector<Shown> shown;
+  EXPECT_FALSE(bank->performSession(openSession(shown),
+        {{SESSION_TRANSFER, account_no_[0], 100, other_accounts[0]}}));
+  EXPECT_THAT(shown, ElementsAre(Shown{SHOW_ERROR, -1}));
+  EXPECT_EQ(balance(account_no_[0]), 1000);
+}
+
+TEST_F(SessionTest, UndispensedWithdrawIsGivenBack) {
+  Bank *bank = Bank::getBank();
+  std::vector<Shown> shown;
+  EXPECT_TRUE(bank->performSession(openSession(shown, false),
+        {{SESSION_TRANSFER, account_no_[1], 200, account_no_[0]},
+        {SESSION_WITHDRAW, account_no_[0], 400, -1}}));
+  EXPECT_THAT(shown, ElementsAre(Shown{SHOW, 0}, Shown{GIVE, 400}));
+  EXPECT_EQ(balance(account_no_[0]), 1200);
+  EXPECT_EQ(balance(account_no_[1]), 0);
+
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.activity_.withdrawals_, 0);
+  EXPECT_EQ(report.activity_.withdraw_count_, 0);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST_F(SessionTest, ConcurrentSessionsOnOneCardStayConsistent) {
+  const int THREADS = 4;
+  const int SESSIONS = 200;
+  Bank *bank = Bank::getBank();
+  std::atomic<int> committed(0), deposited(0);
+  std::vector<std::thread> atms;
+  for (int t = 0; t < THREADS; t++) {
+    atms.emplace_back([&, t]() {
+      for (int n = 0; n < SESSIONS; n++) {
+        std::vector<Shown> shown;
+        long from = account_no_[(t + n) % 2], to = account_no_[(t + n + 1) % 2];
+        if (bank->performSession(openSession(shown), {{SESSION_CHECK_BALANCE, from, 0, -1},
+              {SESSION_TRANSFER, from, 7, to}, {SESSION_DEPOSIT, to, 1, -1}})) {
+          committed++;
+          deposited++;
+          // The deposit is taken first, the balance shown is the one the
+          // transfer was checked against
+          ASSERT_EQ(shown.size(), 3u);
+          EXPECT_EQ(shown[0], (Shown{TAKE, 1}));
+          EXPECT_EQ(shown[2].info_, shown[1].info_ - 7);
+        }
+      }
+    });
+  }
+  for (auto &atm : atms)
+    atm.join();
+
+  EXPECT_GT(committed.load(), 0);
+  ReconciliationReport report = reconcile(bank->snapshotBalances(), 1);
+  EXPECT_EQ(report.total_balance_, 1200 + deposited.load());
+  EXPECT_EQ(report.activity_.deposits_, deposited.load());
+  EXPECT_GE(report.min_balance_, 0);
+  EXPECT_EQ(bank->admissionMetrics().active_, 0u);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
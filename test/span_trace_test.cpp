@@ -0,0 +1,180 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include <bank.hpp>
+#include <bank_policies.hpp>
+#include <span_trace.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  /**
+   * struct Span - A span read back out of the Chrome export
+   */
+  struct Span {
+    std::string name_;
+    uint64_t session_;
+    long token_;
+  };
+
+  /**
+   * @brief Pull name, session and token of every span out of an export
+   */
+  std::vector<Span> parseSpans(const std::string &json) {
+    std::vector<Span> spans;
+    std::size_t pos = 0;
+    while ((pos = json.find("{\"name\":\"", pos)) != std::string::npos) {
+      Span span;
+      pos += 9;
+      span.name_ = json.substr(pos, json.find('"', pos) - pos);
+      pos = json.find("\"tid\":", pos) + 6;
+      span.session_ = std::stoull(json.substr(pos));
+      pos = json.find("\"token\":", pos) + 8;
+      span.token_ = std::stol(json.substr(pos));
+      spans.push_back(span);
+    }
+    return spans;
+  }
+
+  std::vector<Span> exportSpans() {
+    std::ostringstream out;
+    SpanTracer::getTracer()->exportChrome(out);
+    return parseSpans(out.str());
+  }
+}
+
+class SpanTraceTest : public Test {
+  public:
+  void SetUp() override {
+    Bank *bank = Bank::getBank();
+    card_no_ = bank->createAndLinkAccount("someone", 1000);
+    ASSERT_TRUE(bank->listAccounts(card_no_, account_no_));
+  }
+
+  void TearDown() override {
+    SpanTracer::getTracer()->stop();
+    Bank::getBank()->deleteBank();
+  }
+
+  /**
+   * @brief Withdraw in a full session, stage by stage
+   */
+  int withdraw(int amount) {
+    Bank *bank = Bank::getBank();
+    int token = bank->verifyAndCreateTransaction(card_no_, 8888);
+    bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+    bank->selectAccount(token, account_no_[0]);
+    TransactionType trans_type = WITHDRAW;
+    bank->performTransaction(token, trans_type, amount);
+    return token;
+  }
+
+  long card_no_;
+  std::vector<long> account_no_;
+};
+
+TEST_F(SpanTraceTest, DisabledRecordsNothing) {
+  ASSERT_FALSE(SpanTracer::enabled());
+  withdraw(10);
+  {
+    SpanScope span("outside", SPAN_NEW_SESSION);
+    EXPECT_FALSE(span.active());
+  }
+  EXPECT_THAT(exportSpans(), IsEmpty());
+}
+
+TEST_F(SpanTraceTest, SessionStagesShareOneRow) {
+  ASSERT_TRUE(SpanTracer::getTracer()->start(""));
+  int token = withdraw(10);
+  SpanTracer::getTracer()->stop();
+
+  std::vector<Span> spans = exportSpans();
+  std::vector<std::string> names;
+  std::set<uint64_t> sessions;
+  for (const auto &span : spans) {
+    names.push_back(span.name_);
+    sessions.insert(span.session_);
+    if (span.name_ != "admission") {
+      EXPECT_EQ(span.token_, token) << span.name_;
+    }
+  }
+  EXPECT_THAT(sessions, ElementsAre(Gt(0u)));
+  EXPECT_THAT(names, IsSupersetOf({"verifyAndCreateTransaction", "admission",
+        "acknowledgeTransaction", "selectAccount", "performTransaction", "authorizeHold"}));
+  // The account listing plus the cash given out
+  EXPECT_GE(std::count(names.begin(), names.end(), "controllerDisplay"), 2);
+}
+
+TEST_F(SpanTraceTest, SessionsAreSampled) {
+  ASSERT_TRUE(SpanTracer::getTracer()->start("", 2));
+  for (int i = 0; i < 6; i++)
+    withdraw(1);
+  SpanTracer::getTracer()->stop();
+
+  std::map<uint64_t, int> sessions;
+  for (const auto &span : exportSpans())
+    sessions[span.session_]++;
+  EXPECT_EQ(sessions.size(), 3u);
+}
+
+TEST_F(SpanTraceTest, ExportsChromeTraceEvents) {
+  ASSERT_TRUE(SpanTracer::getTracer()->start(""));
+  EXPECT_FALSE(SpanTracer::getTracer()->start(""));
+  withdraw(1);
+  SpanTracer::getTracer()->stop();
+
+  std::ostringstream out;
+  EXPECT_GT(SpanTracer::getTracer()->exportChrome(out), 0u);
+  std::string json = out.str();
+  EXPECT_THAT(json, StartsWith("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+  EXPECT_THAT(json, HasSubstr("\"ph\":\"X\""));
+  EXPECT_THAT(json, EndsWith("]}\n"));
+  EXPECT_EQ(SpanTracer::getTracer()->dropped(), 0u);
+}
+
+#ifndef ATM_SINGLE_THREADED
+TEST(SpanMutexTest, ContendedLockIsASpan) {
+  ASSERT_TRUE(SpanTracer::getTracer()->start(""));
+  SpanMutex<std::mutex> mtx;
+  mtx.lock();
+  std::thread waiter([&mtx]() {
+    SpanScope span("waiter", SPAN_NEW_SESSION);
+    mtx.lock();
+    mtx.unlock();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  mtx.unlock();
+  waiter.join();
+  {
+    // Uncontended locks are not worth a span
+    SpanScope span("owner", SPAN_NEW_SESSION);
+    mtx.lock();
+    mtx.unlock();
+  }
+  SpanTracer::getTracer()->stop();
+
+  std::vector<Span> spans = exportSpans();
+  ASSERT_EQ(spans.size(), 3u);
+  std::map<std::string, uint64_t> sessions;
+  for (const auto &span : spans)
+    sessions[span.name_] = span.session_;
+  EXPECT_THAT(sessions, ElementsAre(Key("mutex wait"), Key("owner"), Key("waiter")));
+  EXPECT_EQ(sessions["mutex wait"], sessions["waiter"]);
+}
+#endif
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
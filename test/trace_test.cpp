@@ -0,0 +1,164 @@
+#include <cstdio>
+#include <fstream>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <banking_fixture.hpp>
+#include <trace.hpp>
+#include <trace_replayer.hpp>
+
+using namespace banking;
+using namespace testing;
+
+namespace {
+  const char TRACE_PATH[] = "trace_test.atmt";
+
+  void recordSessions() {
+    ASSERT_TRUE(TraceRecorder::getRecorder()->start(TRACE_PATH));
+    std::vector<long> account_no;
+    long card_no = Bank::getBank()->createAndLinkAccount("someone", 1000);
+    Bank::getBank()->privilegedOperation(HIDDEN_PASSCODE, "someone", account_no, card_no);
+
+    AtmControllerMock deposit_atm;
+    EXPECT_CALL(deposit_atm, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+    EXPECT_CALL(deposit_atm, controllerDisplay(TAKE,500,_)).WillOnce(Return(true));
+    deposit_atm.callInsertCard(card_no, 8888);
+    deposit_atm.callSelectAccount(account_no[0]);
+    deposit_atm.callPerformTransaction(DEPOSIT, 500, 77);
+
+    // A deposit retried from another atm after the first went through
+    AtmControllerMock retry_atm;
+    EXPECT_CALL(retry_atm, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+    EXPECT_CALL(retry_atm, controllerDisplay(SHOW,_,_)).WillOnce(Return(true));
+    retry_atm.callInsertCard(card_no, 8888);
+    retry_atm.callSelectAccount(account_no[0]);
+    retry_atm.callPerformTransaction(DEPOSIT, 500, 77);
+
+    AtmControllerMock withdraw_atm;
+    EXPECT_CALL(withdraw_atm, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+    EXPECT_CALL(withdraw_atm, controllerDisplay(GIVE,200,_)).WillOnce(Return(false));
+    withdraw_atm.callInsertCard(card_no, 8888);
+    withdraw_atm.callSelectAccount(account_no[0]);
+    withdraw_atm.callPerformTransaction(WITHDRAW, 200);
+
+    AtmControllerMock balance_atm;
+    EXPECT_CALL(balance_atm, controllerDisplay(SHOW_INPUT,_,_)).Times(2);
+    EXPECT_CALL(balance_atm, controllerDisplay(SHOW,1500,_)).WillOnce(Return(true));
+    balance_atm.callInsertCard(card_no, 8888);
+    balance_atm.callSelectAccount(account_no[0]);
+    balance_atm.callPerformTransaction(CHECK_BALANCE);
+
+    Bank *bank = Bank::getBank();
+    int token = bank->verifyAndCreateTransaction(card_no, 8888);
+    bank->acknowledgeTransaction(token, [](AtmOperationType, int, std::string&&) { return true; });
+    EXPECT_TRUE(bank->performSession(token, {{SESSION_CHECK_BALANCE, account_no[0], 0, -1},
+          {SESSION_WITHDRAW, account_no[0], 100, -1}}));
+
+    AtmControllerMock wrong_pin_atm;
+    EXPECT_CALL(wrong_pin_atm, controllerDisplay(SHOW_ERROR,_,_));
+    wrong_pin_atm.callInsertCard(card_no, 1111);
+    TraceRecorder::getRecorder()->stop();
+  }
+}
+
+TEST(TraceTest, EventRoundTrip) {
+  TraceEvent event{42, 1000, TRACE_PRIVILEGED_OPERATION, -1, "someone", {12345}, {1, 7, -3, 900}};
+  std::string bytes;
+  encodeTraceEvent(event, bytes);
+
+  std::size_t pos = 0;
+  TraceEvent decoded;
+  ASSERT_TRUE(decodeTraceEvent(bytes, pos, decoded));
+  EXPECT_EQ(pos, bytes.size());
+  EXPECT_EQ(decoded.seq_, event.seq_);
+  EXPECT_EQ(decoded.time_ns_, event.time_ns_);
+  EXPECT_EQ(decoded.op_, event.op_);
+  EXPECT_EQ(decoded.token_, event.token_);
+  EXPECT_EQ(decoded.text_, event.text_);
+  EXPECT_EQ(decoded.args_, event.args_);
+  EXPECT_EQ(decoded.results_, event.results_);
+
+  pos = 0;
+  EXPECT_FALSE(decodeTraceEvent(bytes.substr(0, bytes.size() - 1), pos, decoded));
+}
+
+TEST(TraceTest, CorruptEventsAreRejected) {
+  TraceEvent event{1, 1000, TRACE_CHECK_BALANCE, 3, "", {}, {1, 700}};
+  std::string bytes;
+  encodeTraceEvent(event, bytes);
+  std::size_t pos = 0;
+  TraceEvent decoded;
+  ASSERT_TRUE(decodeTraceEvent(bytes, pos, decoded));
+
+  // A found balance without the balance, an op past the known ones
+  std::string short_results;
+  event.results_ = {1};
+  encodeTraceEvent(event, short_results);
+  pos = 0;
+  EXPECT_FALSE(decodeTraceEvent(short_results, pos, decoded));
+  std::string unknown_op;
+  event.op_ = static_cast<TraceOp>(TRACE_RETURN_ATM_ID + 1);
+  encodeTraceEvent(event, unknown_op);
+  pos = 0;
+  EXPECT_FALSE(decodeTraceEvent(unknown_op, pos, decoded));
+
+  // A list claiming more values than bytes left is refused before sizing it
+  std::string huge_list;
+  event.op_ = TRACE_SELECT_ACCOUNT;
+  event.results_.clear();
+  encodeTraceEvent(event, huge_list);
+  huge_list.resize(huge_list.size() - 2);
+  huge_list += std::string("\xff\xff\xff\xff\xff\xff\xff\x7f", 8);
+  pos = 0;
+  EXPECT_FALSE(decodeTraceEvent(huge_list, pos, decoded));
+
+  // A trace with a corrupt event is not replayed
+  ASSERT_TRUE(TraceRecorder::getRecorder()->start(TRACE_PATH));
+  TraceRecorder::getRecorder()->stop();
+  {
+    std::ofstream out(TRACE_PATH, std::ios::binary | std::ios::app);
+    out.write(bytes.data(), bytes.size());
+    out.write(short_results.data(), short_results.size());
+  }
+  std::vector<TraceEvent> events;
+  EXPECT_FALSE(readTrace(TRACE_PATH, events));
+  std::remove(TRACE_PATH);
+}
+
+TEST(TraceTest, SerialReplayMatches) {
+  recordSessions();
+
+  std::vector<TraceEvent> events;
+  ASSERT_TRUE(readTrace(TRACE_PATH, events));
+  EXPECT_EQ(events.front().op_, TRACE_CREATE_AND_LINK_ACCOUNT);
+
+  TraceReplayer replayer(events, ReplayOptions());
+  ReplayReport report = replayer.run();
+  EXPECT_EQ(report.sessions_, 5u);
+  EXPECT_EQ(report.mismatches_, 0u);
+  Bank::getBank()->deleteBank();
+}
+
+TEST(TraceTest, ParallelReplayMatches) {
+  recordSessions();
+
+  std::vector<TraceEvent> events;
+  ASSERT_TRUE(readTrace(TRACE_PATH, events));
+
+  ReplayOptions options;
+  options.parallelism_ = 4;
+  TraceReplayer replayer(events, options);
+  EXPECT_EQ(replayer.run().mismatches_, 0u);
+  Bank::getBank()->deleteBank();
+  std::remove(TRACE_PATH);
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,54 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <limits>
+
+#include <glog/logging.h>
+
+#include <varint.hpp>
+
+using namespace banking;
+using namespace testing;
+
+TEST(VarintTest, ValuesRoundTripInTheFewestBytes) {
+  std::string out;
+  const uint64_t values[] = {0, 1, 0x7f, 0x80, 0x3fff, 0x4000, std::numeric_limits<uint64_t>::max()};
+  for (uint64_t value : values)
+    putVarint(value, out);
+  EXPECT_EQ(out.size(), 1u + 1 + 1 + 2 + 2 + 3 + 10);
+
+  const long signed_values[] = {0, -1, 1, -64, 64, std::numeric_limits<long>::min(),
+    std::numeric_limits<long>::max()};
+  std::size_t unsigned_bytes = out.size();
+  for (long value : signed_values)
+    putSigned(value, out);
+  // Zigzag keeps small magnitudes of either sign in one byte
+  EXPECT_EQ(out.size() - unsigned_bytes, 1u + 1 + 1 + 1 + 2 + 10 + 10);
+
+  std::size_t pos = 0;
+  for (uint64_t value : values) {
+    uint64_t read;
+    ASSERT_TRUE(getVarint(out, pos, read));
+    EXPECT_EQ(read, value);
+  }
+  for (long value : signed_values) {
+    long read;
+    ASSERT_TRUE(getSigned(out, pos, read));
+    EXPECT_EQ(read, value);
+  }
+  EXPECT_EQ(pos, out.size());
+
+  // Cut short or longer than 64 bits
+  uint64_t read;
+  pos = 0;
+  EXPECT_FALSE(getVarint(std::string("\x80\x80", 2), pos, read));
+  pos = 0;
+  EXPECT_FALSE(getVarint(std::string(11, '\xff'), pos, read));
+}
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  google::InitGoogleLogging(argv[0]);
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
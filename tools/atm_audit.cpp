@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <glog/logging.h>
+
+#include <audit_archive.hpp>
+
+using namespace banking;
+
+namespace {
+  const uint64_t NS_PER_DAY = 24ull * 3600 * 1000000000;
+
+  void usage(const char *name) {
+    std::cerr << "Usage: " << name << " <archive> [--account N] [--card N] [--atm N]"
+      << " [--type deposit|withdraw|check] [--ok|--failed] [--since-days D]"
+      << " [--from NS] [--to NS] [--totals-by-atm]" << std::endl;
+  }
+
+  const char *typeName(int type) {
+    switch (type) {
+      case DEPOSIT: return "deposit";
+      case WITHDRAW: return "withdraw";
+      case CHECK_BALANCE: return "check";
+    }
+    return "?";
+  }
+}
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+
+  if (argc < 2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  AuditQuery query;
+  bool totals_by_atm = false;
+  for (int i = 2; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--account") && has_value) {
+      query.account_id_ = std::atol(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--card") && has_value) {
+      query.card_no_ = std::atol(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--atm") && has_value) {
+      query.atm_id_ = std::atol(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--type") && has_value) {
+      std::string type(argv[++i]);
+      if (type == "deposit")
+        query.type_ = DEPOSIT;
+      else if (type == "withdraw")
+        query.type_ = WITHDRAW;
+      else if (type == "check")
+        query.type_ = CHECK_BALANCE;
+      else {
+        usage(argv[0]);
+        return 2;
+      }
+    } else if (!std::strcmp(argv[i], "--ok")) {
+      query.result_ = 1;
+    } else if (!std::strcmp(argv[i], "--failed")) {
+      query.result_ = 0;
+    } else if (!std::strcmp(argv[i], "--since-days") && has_value) {
+      query.from_ns_ = AuditArchiveWriter::now() - std::atof(argv[++i]) * NS_PER_DAY;
+    } else if (!std::strcmp(argv[i], "--from") && has_value) {
+      query.from_ns_ = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--to") && has_value) {
+      query.to_ns_ = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--totals-by-atm")) {
+      totals_by_atm = true;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  AuditArchiveReader reader;
+  if (!reader.open(argv[1])) {
+    std::cerr << "Not an audit archive: " << argv[1] << std::endl;
+    return 2;
+  }
+
+  AuditScanStats stats;
+  if (totals_by_atm) {
+    std::map<int, ActivityTotals> totals;
+    stats = reader.totalsByAtm(query, totals);
+    for (const auto &atm : totals)
+      std::cout << "atm " << atm.first
+        << " deposits " << atm.second.deposit_count_ << " " << atm.second.deposits_
+        << " withdrawals " << atm.second.withdraw_count_ << " " << atm.second.withdrawals_
+        << std::endl;
+  } else {
+    stats = reader.scan(query, [](const AuditRecord &record) {
+      std::cout << record.time_ns_
+        << " atm " << record.atm_id_
+        << " card " << record.card_no_
+        << " account " << record.account_id_
+        << " " << typeName(record.type_)
+        << " " << record.amount_
+        << (record.ok_ ? " ok" : " failed")
+        << "\n";
+    });
+  }
+  std::cerr << "blocks: " << stats.blocks_
+    << " blocks_read: " << stats.blocks_read_
+    << " bytes_read: " << stats.bytes_read_
+    << " scanned: " << stats.records_scanned_
+    << " matched: " << stats.records_matched_
+    << std::endl;
+  return 0;
+}
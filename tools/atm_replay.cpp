@@ -0,0 +1,53 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <glog/logging.h>
+
+#include <trace_replayer.hpp>
+
+using namespace banking;
+
+namespace {
+  void usage(const char *name) {
+    std::cerr << "Usage: " << name << " <trace> [--original-timing] [--parallelism N]" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  unsetenv("ATM_BANK_TRACE");
+
+  if (argc < 2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  ReplayOptions options;
+  for (int i = 2; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--original-timing")) {
+      options.original_timing_ = true;
+    } else if (!std::strcmp(argv[i], "--parallelism") && i + 1 < argc) {
+      options.parallelism_ = std::atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  std::vector<TraceEvent> events;
+  if (!readTrace(argv[1], events))
+    return 2;
+
+  TraceReplayer replayer(events, options);
+  ReplayReport report = replayer.run();
+  std::cout << "events: " << events.size()
+    << " calls: " << report.calls_
+    << " sessions: " << report.sessions_
+    << " mismatches: " << report.mismatches_
+    << " elapsed_ms: " << report.elapsed_ms_
+    << " calls_per_sec: " << (report.elapsed_ms_ > 0 ? report.calls_ * 1000.0 / report.elapsed_ms_ : 0)
+    << std::endl;
+  return report.mismatches_ ? 1 : 0;
+}